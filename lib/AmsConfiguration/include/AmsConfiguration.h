@@ -50,6 +50,27 @@
 #define LED_BEHAVIOUR_ERROR_ONLY 3
 #define LED_BEHAVIOUR_OFF 9
 
+// One bit each in the dirty mask of the resident configuration image
+enum ConfigSection {
+	ConfigSectionVersion = 0,
+	ConfigSectionSystem,
+	ConfigSectionUpgradeInfo,
+	ConfigSectionNetwork,
+	ConfigSectionMeter,
+	ConfigSectionGpio,
+	ConfigSectionPrice,
+	ConfigSectionEnergyAccounting,
+	ConfigSectionWeb,
+	ConfigSectionDebug,
+	ConfigSectionNtp,
+	ConfigSectionMqtt,
+	ConfigSectionDomoticz,
+	ConfigSectionHomeAssistant,
+	ConfigSectionUi,
+	ConfigSectionCloud
+};
+#define CONFIG_SECTIONS_ALL 0xFFFF
+
 struct ResetDataContainer {
 	uint8_t cause;
 	uint8_t last_cause;
@@ -95,7 +116,12 @@ struct MqttConfig {
 	uint8_t magic;
 	bool stateUpdate;
 	uint16_t stateUpdateInterval;
-}; // 680
+	uint16_t deadbandPower; // W
+	uint8_t deadbandVoltage; // 0.1 V
+	uint8_t deadbandCurrent; // 0.01 A
+	uint8_t deadbandPercent;
+	uint16_t heartbeat; // Seconds before an unchanged value is sent again, 0 to never repeat
+}; // 688
 
 struct WebConfig {
 	uint8_t security;
@@ -255,6 +281,13 @@ public:
 	int getConfigVersion();
 
 	bool save();
+	uint32_t getRevision();
+	void beginBatch();
+	bool commit();
+	uint16_t getDirtySections();
+	uint32_t getFlashReadCount();
+	uint32_t getCommitCount();
+	uint32_t getUnchangedCount();
 
 	bool getSystemConfig(SystemConfig&);
 	bool setSystemConfig(SystemConfig&);
@@ -271,6 +304,7 @@ public:
 	bool getMqttConfig(MqttConfig&);
 	bool setMqttConfig(MqttConfig&);
 	void clearMqtt(MqttConfig&);
+	void clearMqttDeadband(MqttConfig&);
 	void setMqttChanged();
 	bool isMqttChanged();
 	void ackMqttChange();
@@ -347,6 +381,18 @@ protected:
 
 private:
 	uint8_t configVersion = 0;
+	uint32_t revision = 0; // Incremented on every change, for cache validation
+
+	// The EEPROM buffer is read from flash once and kept, so it is the configuration image in RAM
+	bool loaded = false;
+	bool batch = false;
+	uint16_t dirty = 0;
+	uint32_t flashReads = 0;
+	uint32_t commits = 0;
+	uint32_t unchanged = 0;
+
+	void load();
+	bool store(int address, const uint8_t* data, size_t length, ConfigSection section);
 
 	bool sysChanged = false, networkChanged, mqttChanged, meterChanged = true, ntpChanged = true, priceChanged = false, energyAccountingChanged = true, cloudChanged = true, uiLanguageChanged = false;
 
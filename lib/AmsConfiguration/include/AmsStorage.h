@@ -12,12 +12,21 @@
 #define FILE_MQTT_CA "/mqtt-ca.pem"
 #define FILE_MQTT_CERT "/mqtt-cert.pem"
 #define FILE_MQTT_KEY "/mqtt-key.pem"
+#define FILE_MQTT_OUTBOX "/mqttoutbox.bin"
+#define FILE_MQTT_TEMPLATE "/mqtt-template.txt"
 
 #define FILE_DAYPLOT "/dayplot.bin"
 #define FILE_MONTHPLOT "/monthplot.bin"
 #define FILE_ENERGYACCOUNTING "/energyaccounting.bin"
 
+#define FILE_DAYPLOT_JOURNAL "/dayplot.jnl"
+#define FILE_MONTHPLOT_JOURNAL "/monthplot.jnl"
+#define FILE_ENERGYACCOUNTING_JOURNAL "/energyaccounting.jnl"
+
+#define FILE_ARCHIVE "/archive%04d.bin"
+
 #define FILE_CFG "/configfile.cfg"
 #define FILE_PRICE_CONF "/priceconf.bin"
+#define FILE_PRICE_CACHE "/pricecache.bin"
 
 #endif
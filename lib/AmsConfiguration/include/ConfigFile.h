@@ -0,0 +1,73 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _CONFIGFILE_H
+#define _CONFIGFILE_H
+
+#include "Arduino.h"
+#include "AmsConfiguration.h"
+
+enum ConfigFileTarget {
+	ConfigFileNone = 0,
+	ConfigFileSystem,
+	ConfigFileNetwork,
+	ConfigFileMqtt,
+	ConfigFileWeb,
+	ConfigFileMeter,
+	ConfigFileGpio,
+	ConfigFileDomoticz,
+	ConfigFileHomeAssistant,
+	ConfigFileNtp,
+	ConfigFilePrice,
+	ConfigFileEnergyAccounting
+};
+
+enum ConfigFileType {
+	ConfigFileInt = 0,
+	ConfigFileBool,
+	ConfigFileString,
+	ConfigFileFixed,
+	ConfigFileSignedFixed,
+	ConfigFileHex,
+	ConfigFileParity,
+	ConfigFileThresholds,
+	ConfigFileDayPlot,
+	ConfigFileMonthPlot,
+	ConfigFileEnergyAccountingData
+};
+
+#define CONFIG_FILE_KEY_SIZE 32
+#define CONFIG_FILE_LINE_SIZE 320 // Longest is mqttPassword, 255 characters
+#define CONFIG_FILE_FIELD(target, s, f) target, offsetof(s, f), sizeof(((s*) 0)->f)
+
+struct ConfigFileKeyword {
+	char key[CONFIG_FILE_KEY_SIZE];
+	uint8_t target;
+	uint16_t offset;
+	uint16_t size;
+	uint8_t type;
+	uint16_t scale; // Fixed point values are stored as value * scale
+};
+
+/*
+ * configfile.cfg has one "key value" per line. Every key is an entry in a table that gives the
+ * config struct it belongs to, the offset and size of the field and how the value is written, so
+ * /configfile.cfg and the parser at boot cannot disagree on a name or a scale. Plots and
+ * accounting data are not config fields and are left to the caller.
+ */
+bool configFileKeyword(const char* key, ConfigFileKeyword& keyword);
+
+// Stores value in the field of target, the struct keyword.target names. False for the types the caller handles.
+bool configFileSetValue(const ConfigFileKeyword& keyword, uint8_t* target, char* value);
+
+// Writes "key value\n" from the field of source and returns the length, 0 if there is nothing to write
+size_t configFileFormat(char* buf, size_t size, PGM_P key, const uint8_t* source);
+
+// Same results as String::toInt() and String::toDouble(), which read a missing value as 0
+long configFileLong(const char* str);
+double configFileDouble(const char* str);
+
+#endif
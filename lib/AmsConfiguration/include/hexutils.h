@@ -13,6 +13,7 @@
 String toHex(uint8_t* in);
 String toHex(uint8_t* in, uint16_t size);
 void fromHex(uint8_t *out, String in, uint16_t size);
+void fromHex(uint8_t *out, const char* in, uint16_t size);
 bool stripNonAscii(uint8_t* in, uint16_t size, bool extended = false);
 
 #endif
\ No newline at end of file
@@ -11,11 +11,10 @@
 #endif
 
 bool AmsConfiguration::getSystemConfig(SystemConfig& config) {
-	EEPROM.begin(EEPROM_SIZE);
+	load();
 	uint8_t configVersion = EEPROM.read(EEPROM_CONFIG_ADDRESS);
 	if(configVersion == EEPROM_CHECK_SUM || configVersion == EEPROM_CLEARED_INDICATOR) {
 		EEPROM.get(CONFIG_SYSTEM_START, config);
-		EEPROM.end();
 		return true;
 	} else {
 		config.boardType = 0xFF;
@@ -38,12 +37,8 @@ bool AmsConfiguration::setSystemConfig(SystemConfig& config) {
 		sysChanged |= strcmp(config.country, existing.country) != 0;
 		sysChanged |= config.energyspeedometer != existing.energyspeedometer;
 	}
-	EEPROM.begin(EEPROM_SIZE);
 	stripNonAscii((uint8_t*) config.country, 2);
-	EEPROM.put(CONFIG_SYSTEM_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_SYSTEM_START, (uint8_t*) &config, sizeof(config), ConfigSectionSystem);
 }
 
 bool AmsConfiguration::isSystemConfigChanged() {
@@ -56,9 +51,8 @@ void AmsConfiguration::ackSystemConfigChanged() {
 
 bool AmsConfiguration::getNetworkConfig(NetworkConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_NETWORK_START, config);
-		EEPROM.end();
 		if(config.sleep > 2) config.sleep = 1;
 		return true;
 	} else {
@@ -99,11 +93,7 @@ bool AmsConfiguration::setNetworkConfig(NetworkConfig& config) {
 	stripNonAscii((uint8_t*) config.dns2, 16);
 	stripNonAscii((uint8_t*) config.hostname, 32);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_NETWORK_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_NETWORK_START, (uint8_t*) &config, sizeof(config), ConfigSectionNetwork);
 }
 
 void AmsConfiguration::clearNetworkConfig(NetworkConfig& config) {
@@ -144,13 +134,15 @@ void AmsConfiguration::ackNetworkConfigChange() {
 
 bool AmsConfiguration::getMqttConfig(MqttConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_MQTT_START, config);
-		EEPROM.end();
-		if(config.magic != 0x7B) {
+		if(config.magic != 0x7B && config.magic != 0x7C) {
 			config.stateUpdate = false;
 			config.stateUpdateInterval = 10;
-			config.magic = 0x7B;
+		}
+		if(config.magic != 0x7C) {
+			clearMqttDeadband(config);
+			config.magic = 0x7C;
 		}
 		return true;
 	} else {
@@ -173,6 +165,11 @@ bool AmsConfiguration::setMqttConfig(MqttConfig& config) {
 		mqttChanged |= config.ssl != existing.ssl;
 		mqttChanged |= config.stateUpdate != existing.stateUpdate;
 		mqttChanged |= config.stateUpdateInterval != existing.stateUpdateInterval;
+		mqttChanged |= config.deadbandPower != existing.deadbandPower;
+		mqttChanged |= config.deadbandVoltage != existing.deadbandVoltage;
+		mqttChanged |= config.deadbandCurrent != existing.deadbandCurrent;
+		mqttChanged |= config.deadbandPercent != existing.deadbandPercent;
+		mqttChanged |= config.heartbeat != existing.heartbeat;
 	} else {
 		mqttChanged = true;
 	}
@@ -184,11 +181,7 @@ bool AmsConfiguration::setMqttConfig(MqttConfig& config) {
 	stripNonAscii((uint8_t*) config.username, 128);
 	stripNonAscii((uint8_t*) config.password, 256);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_MQTT_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_MQTT_START, (uint8_t*) &config, sizeof(config), ConfigSectionMqtt);
 }
 
 void AmsConfiguration::clearMqtt(MqttConfig& config) {
@@ -202,9 +195,18 @@ void AmsConfiguration::clearMqtt(MqttConfig& config) {
 	memset(config.password, 0, 256);
 	config.payloadFormat = 0;
 	config.ssl = false;
-	config.magic = 0x7B;
+	config.magic = 0x7C;
 	config.stateUpdate = false;
 	config.stateUpdateInterval = 10;
+	clearMqttDeadband(config);
+}
+
+void AmsConfiguration::clearMqttDeadband(MqttConfig& config) {
+	config.deadbandPower = 0;
+	config.deadbandVoltage = 0;
+	config.deadbandCurrent = 0;
+	config.deadbandPercent = 0;
+	config.heartbeat = 300;
 }
 
 void AmsConfiguration::setMqttChanged() {
@@ -221,9 +223,8 @@ void AmsConfiguration::ackMqttChange() {
 
 bool AmsConfiguration::getWebConfig(WebConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_WEB_START, config);
-		EEPROM.end();
 		return true;
 	} else {
 		clearWebConfig(config);
@@ -237,11 +238,7 @@ bool AmsConfiguration::setWebConfig(WebConfig& config) {
 	stripNonAscii((uint8_t*) config.password, 37);
 	stripNonAscii((uint8_t*) config.context, 37);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_WEB_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_WEB_START, (uint8_t*) &config, sizeof(config), ConfigSectionWeb);
 }
 
 void AmsConfiguration::clearWebConfig(WebConfig& config) {
@@ -253,9 +250,8 @@ void AmsConfiguration::clearWebConfig(WebConfig& config) {
 
 bool AmsConfiguration::getMeterConfig(MeterConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_METER_START, config);
-		EEPROM.end();
 		if(config.bufferSize < 1 || config.bufferSize > 64) {
 			#if defined(ESP32)
 				config.bufferSize = 2;
@@ -297,11 +293,7 @@ bool AmsConfiguration::setMeterConfig(MeterConfig& config) {
 	} else {
 		meterChanged = true;
 	}
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_METER_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_METER_START, (uint8_t*) &config, sizeof(config), ConfigSectionMeter);
 }
 
 void AmsConfiguration::clearMeter(MeterConfig& config) {
@@ -339,9 +331,8 @@ void AmsConfiguration::setMeterChanged() {
 
 bool AmsConfiguration::getDebugConfig(DebugConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_DEBUG_START, config);
-		EEPROM.end();
 		return true;
 	} else {
 		clearDebug(config);
@@ -352,11 +343,7 @@ bool AmsConfiguration::getDebugConfig(DebugConfig& config) {
 bool AmsConfiguration::setDebugConfig(DebugConfig& config) {
 	if(!config.serial && !config.telnet)
 		config.level = 4; // Force warning level when debug is disabled
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_DEBUG_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_DEBUG_START, (uint8_t*) &config, sizeof(config), ConfigSectionDebug);
 }
 
 void AmsConfiguration::clearDebug(DebugConfig& config) {
@@ -367,9 +354,8 @@ void AmsConfiguration::clearDebug(DebugConfig& config) {
 
 bool AmsConfiguration::getDomoticzConfig(DomoticzConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_DOMOTICZ_START, config);
-		EEPROM.end();
 		return true;
 	} else {
 		clearDomo(config);
@@ -388,11 +374,7 @@ bool AmsConfiguration::setDomoticzConfig(DomoticzConfig& config) {
 	} else {
 		mqttChanged = true;
 	}
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_DOMOTICZ_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_DOMOTICZ_START, (uint8_t*) &config, sizeof(config), ConfigSectionDomoticz);
 }
 
 void AmsConfiguration::clearDomo(DomoticzConfig& config) {
@@ -405,9 +387,8 @@ void AmsConfiguration::clearDomo(DomoticzConfig& config) {
 
 bool AmsConfiguration::getHomeAssistantConfig(HomeAssistantConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_HA_START, config);
-		EEPROM.end();
 		if(stripNonAscii((uint8_t*) config.discoveryPrefix, 64) || stripNonAscii((uint8_t*) config.discoveryHostname, 64) || stripNonAscii((uint8_t*) config.discoveryNameTag, 16)) {
 			clearHomeAssistantConfig(config);
 		}
@@ -432,11 +413,7 @@ bool AmsConfiguration::setHomeAssistantConfig(HomeAssistantConfig& config) {
 	stripNonAscii((uint8_t*) config.discoveryHostname, 64);
 	stripNonAscii((uint8_t*) config.discoveryNameTag, 16);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_HA_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_HA_START, (uint8_t*) &config, sizeof(config), ConfigSectionHomeAssistant);
 }
 
 void AmsConfiguration::clearHomeAssistantConfig(HomeAssistantConfig& config) {
@@ -462,11 +439,10 @@ bool AmsConfiguration::pinUsed(uint8_t pin, GpioConfig& config) {
 }
 
 bool AmsConfiguration::getGpioConfig(GpioConfig& config) {
-	EEPROM.begin(EEPROM_SIZE);
+	load();
 	uint8_t configVersion = EEPROM.read(EEPROM_CONFIG_ADDRESS);
 	if(configVersion == EEPROM_CHECK_SUM || configVersion == EEPROM_CLEARED_INDICATOR) {
 		EEPROM.get(CONFIG_GPIO_START, config);
-		EEPROM.end();
 		return true;
 	} else {
 		clearGpio(config);
@@ -521,11 +497,7 @@ bool AmsConfiguration::setGpioConfig(GpioConfig& config) {
 	if(config.apPin >= 0)
 		pinMode(config.apPin, INPUT_PULLUP);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_GPIO_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_GPIO_START, (uint8_t*) &config, sizeof(config), ConfigSectionGpio);
 }
 
 void AmsConfiguration::clearGpio(GpioConfig& config, bool all) {
@@ -553,9 +525,8 @@ void AmsConfiguration::clearGpio(GpioConfig& config, bool all) {
 
 bool AmsConfiguration::getNtpConfig(NtpConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_NTP_START, config);
-		EEPROM.end();
 		return true;
 	} else {
 		clearNtp(config);
@@ -583,11 +554,7 @@ bool AmsConfiguration::setNtpConfig(NtpConfig& config) {
 	stripNonAscii((uint8_t*) config.server, 64);
 	stripNonAscii((uint8_t*) config.timezone, 32);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_NTP_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_NTP_START, (uint8_t*) &config, sizeof(config), ConfigSectionNtp);
 }
 
 bool AmsConfiguration::isNtpChanged() {
@@ -607,9 +574,8 @@ void AmsConfiguration::clearNtp(NtpConfig& config) {
 
 bool AmsConfiguration::getPriceServiceConfig(PriceServiceConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_PRICE_START, config);
-		EEPROM.end();
 		if(strlen(config.entsoeToken) != 0 && strlen(config.entsoeToken) != 36) {
 			clearPriceServiceConfig(config);
 		}
@@ -635,11 +601,7 @@ bool AmsConfiguration::setPriceServiceConfig(PriceServiceConfig& config) {
 	stripNonAscii((uint8_t*) config.area, 17);
 	stripNonAscii((uint8_t*) config.currency, 4);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_PRICE_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_PRICE_START, (uint8_t*) &config, sizeof(config), ConfigSectionPrice);
 }
 
 void AmsConfiguration::clearPriceServiceConfig(PriceServiceConfig& config) {
@@ -662,9 +624,8 @@ void AmsConfiguration::ackPriceServiceChange() {
 
 bool AmsConfiguration::getEnergyAccountingConfig(EnergyAccountingConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_ENERGYACCOUNTING_START, config);
-		EEPROM.end();
 		if(config.thresholds[9] != 0xFFFF) {
 			clearEnergyAccountingConfig(config);
 		}
@@ -690,11 +651,7 @@ bool AmsConfiguration::setEnergyAccountingConfig(EnergyAccountingConfig& config)
 	} else {
 		energyAccountingChanged = true;
 	}
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_ENERGYACCOUNTING_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_ENERGYACCOUNTING_START, (uint8_t*) &config, sizeof(config), ConfigSectionEnergyAccounting);
 }
 
 void AmsConfiguration::clearEnergyAccountingConfig(EnergyAccountingConfig& config) {
@@ -721,10 +678,9 @@ void AmsConfiguration::ackEnergyAccountingChange() {
 
 bool AmsConfiguration::getUiConfig(UiConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_UI_START, config);
 		if(config.showImport > 2) clearUiConfig(config); // Must be wrong
-		EEPROM.end();
 		return true;
 	} else {
 		clearUiConfig(config);
@@ -739,11 +695,7 @@ bool AmsConfiguration::setUiConfig(UiConfig& config) {
 	} else {
 		uiLanguageChanged = true;
 	}
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_UI_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_UI_START, (uint8_t*) &config, sizeof(config), ConfigSectionUi);
 }
 
 void AmsConfiguration::clearUiConfig(UiConfig& config) {
@@ -784,18 +736,13 @@ bool AmsConfiguration::setUpgradeInformation(int16_t exitCode, int16_t errorCode
 	stripNonAscii((uint8_t*) upinfo.fromVersion, 8);
 	stripNonAscii((uint8_t*) upinfo.toVersion, 8);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_UPGRADE_INFO_START, upinfo);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_UPGRADE_INFO_START, (uint8_t*) &upinfo, sizeof(upinfo), ConfigSectionUpgradeInfo);
 }
 
 bool AmsConfiguration::getUpgradeInformation(UpgradeInformation& upinfo) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_UPGRADE_INFO_START, upinfo);
-		EEPROM.end();
 		if(stripNonAscii((uint8_t*) upinfo.fromVersion, 8) || stripNonAscii((uint8_t*) upinfo.toVersion, 8)) {
 			clearUpgradeInformation(upinfo);
 		}
@@ -815,9 +762,8 @@ void AmsConfiguration::clearUpgradeInformation(UpgradeInformation& upinfo) {
 
 bool AmsConfiguration::getCloudConfig(CloudConfig& config) {
 	if(hasConfig()) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		EEPROM.get(CONFIG_CLOUD_START, config);
-		EEPROM.end();
 		if(config.proto > 2) config.proto = 0;
 		return true;
 	} else {
@@ -841,11 +787,7 @@ bool AmsConfiguration::setCloudConfig(CloudConfig& config) {
 
 	stripNonAscii((uint8_t*) config.hostname, 64);
 
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(CONFIG_CLOUD_START, config);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	return store(CONFIG_CLOUD_START, (uint8_t*) &config, sizeof(config), ConfigSectionCloud);
 }
 
 void AmsConfiguration::clearCloudConfig(CloudConfig& config) {
@@ -870,7 +812,7 @@ void AmsConfiguration::setUiLanguageChanged() {
 }
 
 void AmsConfiguration::clear() {
-	EEPROM.begin(EEPROM_SIZE);
+	load();
 
 	SystemConfig sys;
 	EEPROM.get(CONFIG_SYSTEM_START, sys);
@@ -933,15 +875,15 @@ void AmsConfiguration::clear() {
 	EEPROM.put(CONFIG_CLOUD_START, cloud);
 
 	EEPROM.put(EEPROM_CONFIG_ADDRESS, EEPROM_CLEARED_INDICATOR);
-	EEPROM.commit();
-	EEPROM.end();
+	revision++;
+	dirty = CONFIG_SECTIONS_ALL;
+	commit();
 }
 
 bool AmsConfiguration::hasConfig() {
 	if(configVersion == 0) {
-		EEPROM.begin(EEPROM_SIZE);
+		load();
 		configVersion = EEPROM.read(EEPROM_CONFIG_ADDRESS);
-		EEPROM.end();
 	}
 	if(configVersion > EEPROM_CHECK_SUM) {
 		if(loadFromFs(EEPROM_CHECK_SUM)) {
@@ -974,7 +916,7 @@ int AmsConfiguration::getConfigVersion() {
 }
 
 bool AmsConfiguration::relocateConfig103() {
-	EEPROM.begin(EEPROM_SIZE);
+	load();
 
 	MeterConfig meter;
 	UpgradeInformation upinfo;
@@ -1067,21 +1009,79 @@ bool AmsConfiguration::relocateConfig103() {
 	EEPROM.put(CONFIG_CLOUD_START, cloud);
 
 	EEPROM.put(EEPROM_CONFIG_ADDRESS, 104);
-	bool ret = EEPROM.commit();
-	EEPROM.end();
-	return ret;
+	revision++;
+	dirty = CONFIG_SECTIONS_ALL;
+	return commit();
 }
 
 bool AmsConfiguration::save() {
-	EEPROM.begin(EEPROM_SIZE);
-	EEPROM.put(EEPROM_CONFIG_ADDRESS, EEPROM_CHECK_SUM);
-	bool success = EEPROM.commit();
-	EEPROM.end();
+	uint8_t version = EEPROM_CHECK_SUM;
+	batch = false;
+	bool success = store(EEPROM_CONFIG_ADDRESS, &version, 1, ConfigSectionVersion);
 
 	configVersion = EEPROM_CHECK_SUM;
 	return success;
 }
 
+uint32_t AmsConfiguration::getRevision() {
+	return revision;
+}
+
+void AmsConfiguration::load() {
+	if(loaded) return;
+	// Never ended, the buffer allocated here is where all getters read from and setters write to
+	EEPROM.begin(EEPROM_SIZE);
+	flashReads++;
+	loaded = true;
+}
+
+bool AmsConfiguration::store(int address, const uint8_t* data, size_t length, ConfigSection section) {
+	load();
+	bool changed = false;
+	for(size_t i = 0; i < length; i++) {
+		if(EEPROM.read(address + i) != data[i]) {
+			EEPROM.write(address + i, data[i]);
+			changed = true;
+		}
+	}
+	if(changed) {
+		dirty |= 1 << section;
+		revision++;
+	} else {
+		unchanged++;
+	}
+	return batch ? true : commit();
+}
+
+void AmsConfiguration::beginBatch() {
+	batch = true;
+}
+
+bool AmsConfiguration::commit() {
+	if(batch) return true;
+	if(dirty == 0) return true;
+	bool ret = EEPROM.commit();
+	commits++;
+	if(ret) dirty = 0;
+	return ret;
+}
+
+uint16_t AmsConfiguration::getDirtySections() {
+	return dirty;
+}
+
+uint32_t AmsConfiguration::getFlashReadCount() {
+	return flashReads;
+}
+
+uint32_t AmsConfiguration::getCommitCount() {
+	return commits;
+}
+
+uint32_t AmsConfiguration::getUnchangedCount() {
+	return unchanged;
+}
+
 void AmsConfiguration::saveToFs() {
 	
 }
@@ -0,0 +1,278 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "ConfigFile.h"
+#include "hexutils.h"
+
+// Sorted by key in strcmp() order, it is looked up with a binary search
+static const ConfigFileKeyword ConfigFileKeywords[] PROGMEM = {
+	{ "boardType", CONFIG_FILE_FIELD(ConfigFileSystem, SystemConfig, boardType), ConfigFileInt, 0 },
+	{ "dayplot", ConfigFileNone, 0, 0, ConfigFileDayPlot, 0 },
+	{ "dns1", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, dns1), ConfigFileString, 0 },
+	{ "dns2", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, dns2), ConfigFileString, 0 },
+	{ "domoticzCl1idx", CONFIG_FILE_FIELD(ConfigFileDomoticz, DomoticzConfig, cl1idx), ConfigFileInt, 0 },
+	{ "domoticzElidx", CONFIG_FILE_FIELD(ConfigFileDomoticz, DomoticzConfig, elidx), ConfigFileInt, 0 },
+	{ "domoticzVl1idx", CONFIG_FILE_FIELD(ConfigFileDomoticz, DomoticzConfig, vl1idx), ConfigFileInt, 0 },
+	{ "domoticzVl2idx", CONFIG_FILE_FIELD(ConfigFileDomoticz, DomoticzConfig, vl2idx), ConfigFileInt, 0 },
+	{ "domoticzVl3idx", CONFIG_FILE_FIELD(ConfigFileDomoticz, DomoticzConfig, vl3idx), ConfigFileInt, 0 },
+	{ "energyaccounting", ConfigFileNone, 0, 0, ConfigFileEnergyAccountingData, 0 },
+	{ "entsoeArea", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, area), ConfigFileString, 0 },
+	{ "entsoeCurrency", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, currency), ConfigFileString, 0 },
+	{ "entsoeFixedPrice", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, unused2), ConfigFileFixed, 1000 },
+	{ "entsoeMultiplier", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, unused1), ConfigFileFixed, 1000 },
+	{ "entsoeToken", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, entsoeToken), ConfigFileString, 0 },
+	{ "gateway", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, gateway), ConfigFileString, 0 },
+	{ "gpioApPin", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, apPin), ConfigFileInt, 0 },
+	{ "gpioHanPin", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, rxPin), ConfigFileInt, 0 },
+	{ "gpioHanPinPullup", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, rxPinPullup), ConfigFileBool, 0 },
+	{ "gpioLedInverted", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, ledInverted), ConfigFileBool, 0 },
+	{ "gpioLedPin", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, ledPin), ConfigFileInt, 0 },
+	{ "gpioLedPinBlue", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, ledPinBlue), ConfigFileInt, 0 },
+	{ "gpioLedPinGreen", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, ledPinGreen), ConfigFileInt, 0 },
+	{ "gpioLedPinRed", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, ledPinRed), ConfigFileInt, 0 },
+	{ "gpioLedRgbInverted", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, ledRgbInverted), ConfigFileBool, 0 },
+	{ "gpioTempAnalogSensorPin", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, tempAnalogSensorPin), ConfigFileInt, 0 },
+	{ "gpioTempSensorPin", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, tempSensorPin), ConfigFileInt, 0 },
+	{ "gpioVccBootLimit", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, vccBootLimit), ConfigFileFixed, 10 },
+	{ "gpioVccMultiplier", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, vccMultiplier), ConfigFileFixed, 1000 },
+	{ "gpioVccOffset", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, vccOffset), ConfigFileSignedFixed, 100 },
+	{ "gpioVccPin", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, vccPin), ConfigFileInt, 0 },
+	{ "gpioVccResistorGnd", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, vccResistorGnd), ConfigFileInt, 0 },
+	{ "gpioVccResistorVcc", CONFIG_FILE_FIELD(ConfigFileGpio, GpioConfig, vccResistorVcc), ConfigFileInt, 0 },
+	{ "homeAssistantDiscoveryHostname", CONFIG_FILE_FIELD(ConfigFileHomeAssistant, HomeAssistantConfig, discoveryHostname), ConfigFileString, 0 },
+	{ "homeAssistantDiscoveryNameTag", CONFIG_FILE_FIELD(ConfigFileHomeAssistant, HomeAssistantConfig, discoveryNameTag), ConfigFileString, 0 },
+	{ "homeAssistantDiscoveryPrefix", CONFIG_FILE_FIELD(ConfigFileHomeAssistant, HomeAssistantConfig, discoveryPrefix), ConfigFileString, 0 },
+	{ "hostname", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, hostname), ConfigFileString, 0 },
+	{ "ip", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, ip), ConfigFileString, 0 },
+	{ "mdns", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, mdns), ConfigFileBool, 0 },
+	{ "meterAuthenticationKey", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, authenticationKey), ConfigFileHex, 0 },
+	{ "meterBaud", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, baud), ConfigFileInt, 0 },
+	{ "meterDistributionSystem", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, distributionSystem), ConfigFileInt, 0 },
+	{ "meterEncryptionKey", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, encryptionKey), ConfigFileHex, 0 },
+	{ "meterInvert", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, invert), ConfigFileBool, 0 },
+	{ "meterMainFuse", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, mainFuse), ConfigFileInt, 0 },
+	{ "meterParity", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, parity), ConfigFileParity, 0 },
+	{ "meterProductionCapacity", CONFIG_FILE_FIELD(ConfigFileMeter, MeterConfig, productionCapacity), ConfigFileInt, 0 },
+	{ "monthplot", ConfigFileNone, 0, 0, ConfigFileMonthPlot, 0 },
+	{ "mqttClientId", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, clientId), ConfigFileString, 0 },
+	{ "mqttDeadbandCurrent", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, deadbandCurrent), ConfigFileFixed, 100 },
+	{ "mqttDeadbandPercent", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, deadbandPercent), ConfigFileInt, 0 },
+	{ "mqttDeadbandPower", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, deadbandPower), ConfigFileInt, 0 },
+	{ "mqttDeadbandVoltage", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, deadbandVoltage), ConfigFileFixed, 10 },
+	{ "mqttHeartbeat", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, heartbeat), ConfigFileInt, 0 },
+	{ "mqttHost", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, host), ConfigFileString, 0 },
+	{ "mqttPassword", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, password), ConfigFileString, 0 },
+	{ "mqttPayloadFormat", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, payloadFormat), ConfigFileInt, 0 },
+	{ "mqttPort", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, port), ConfigFileInt, 0 },
+	{ "mqttPublishTopic", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, publishTopic), ConfigFileString, 0 },
+	{ "mqttSsl", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, ssl), ConfigFileBool, 0 },
+	{ "mqttUsername", CONFIG_FILE_FIELD(ConfigFileMqtt, MqttConfig, username), ConfigFileString, 0 },
+	{ "netmode", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, mode), ConfigFileInt, 0 },
+	{ "ntpDhcp", CONFIG_FILE_FIELD(ConfigFileNtp, NtpConfig, dhcp), ConfigFileBool, 0 },
+	{ "ntpEnable", CONFIG_FILE_FIELD(ConfigFileNtp, NtpConfig, enable), ConfigFileBool, 0 },
+	{ "ntpServer", CONFIG_FILE_FIELD(ConfigFileNtp, NtpConfig, server), ConfigFileString, 0 },
+	{ "ntpTimezone", CONFIG_FILE_FIELD(ConfigFileNtp, NtpConfig, timezone), ConfigFileString, 0 },
+	{ "priceArea", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, area), ConfigFileString, 0 },
+	{ "priceCurrency", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, currency), ConfigFileString, 0 },
+	{ "priceEnabled", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, enabled), ConfigFileBool, 0 },
+	{ "priceEntsoeToken", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, entsoeToken), ConfigFileString, 0 },
+	{ "priceFixedPrice", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, unused2), ConfigFileFixed, 1000 },
+	{ "priceMultiplier", CONFIG_FILE_FIELD(ConfigFilePrice, PriceServiceConfig, unused1), ConfigFileFixed, 1000 },
+	{ "psk", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, psk), ConfigFileString, 0 },
+	{ "ssid", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, ssid), ConfigFileString, 0 },
+	{ "subnet", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, subnet), ConfigFileString, 0 },
+	{ "thresholds", ConfigFileEnergyAccounting, 0, 0, ConfigFileThresholds, 0 },
+	{ "use11b", CONFIG_FILE_FIELD(ConfigFileNetwork, NetworkConfig, use11b), ConfigFileBool, 0 },
+	{ "webPassword", CONFIG_FILE_FIELD(ConfigFileWeb, WebConfig, password), ConfigFileString, 0 },
+	{ "webSecurity", CONFIG_FILE_FIELD(ConfigFileWeb, WebConfig, security), ConfigFileInt, 0 },
+	{ "webUsername", CONFIG_FILE_FIELD(ConfigFileWeb, WebConfig, username), ConfigFileString, 0 },
+};
+
+bool configFileKeyword(const char* key, ConfigFileKeyword& keyword) {
+	int16_t low = 0;
+	int16_t high = sizeof(ConfigFileKeywords) / sizeof(ConfigFileKeywords[0]) - 1;
+	while(low <= high) {
+		int16_t mid = (low + high) / 2;
+		memcpy_P(&keyword, &ConfigFileKeywords[mid], sizeof(keyword));
+		int cmp = strcmp(key, keyword.key);
+		if(cmp == 0) return true;
+		if(cmp < 0) {
+			high = mid - 1;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return false;
+}
+
+long configFileLong(const char* str) {
+	return str == NULL ? 0 : atol(str);
+}
+
+double configFileDouble(const char* str) {
+	return str == NULL ? 0 : atof(str);
+}
+
+static void configFileSetInt(uint8_t* field, uint16_t size, long value) {
+	switch(size) {
+		case 1: {
+			uint8_t v = value;
+			memcpy(field, &v, 1);
+			break;
+		}
+		case 2: {
+			uint16_t v = value;
+			memcpy(field, &v, 2);
+			break;
+		}
+		case 4: {
+			uint32_t v = value;
+			memcpy(field, &v, 4);
+			break;
+		}
+	}
+}
+
+static long configFileGetInt(const uint8_t* field, uint16_t size, bool isSigned) {
+	switch(size) {
+		case 1: {
+			uint8_t v;
+			memcpy(&v, field, 1);
+			return isSigned ? (long) (int8_t) v : (long) v;
+		}
+		case 2: {
+			uint16_t v;
+			memcpy(&v, field, 2);
+			return isSigned ? (long) (int16_t) v : (long) v;
+		}
+		case 4: {
+			uint32_t v;
+			memcpy(&v, field, 4);
+			return isSigned ? (long) (int32_t) v : (long) v;
+		}
+	}
+	return 0;
+}
+
+bool configFileSetValue(const ConfigFileKeyword& keyword, uint8_t* target, char* value) {
+	if(target == NULL) return false;
+	uint8_t* field = target + keyword.offset;
+	switch(keyword.type) {
+		case ConfigFileInt:
+			configFileSetInt(field, keyword.size, configFileLong(value));
+			return true;
+		case ConfigFileBool:
+			*field = configFileLong(value) == 1;
+			return true;
+		case ConfigFileString:
+			strncpy((char*) field, value, keyword.size - 1);
+			field[keyword.size - 1] = '\0';
+			return true;
+		case ConfigFileFixed:
+		case ConfigFileSignedFixed:
+			// Rounded, 2.55 times 100 is not quite 255 in binary
+			configFileSetInt(field, keyword.size, lround(configFileDouble(value) * keyword.scale));
+			return true;
+		case ConfigFileHex:
+			fromHex(field, value, keyword.size);
+			return true;
+		case ConfigFileParity:
+			if(strncmp_P(value, PSTR("7N1"), 3) == 0) *field = 2;
+			if(strncmp_P(value, PSTR("8N1"), 3) == 0) *field = 3;
+			if(strncmp_P(value, PSTR("8N2"), 3) == 0) *field = 7;
+			if(strncmp_P(value, PSTR("7E1"), 3) == 0) *field = 10;
+			if(strncmp_P(value, PSTR("8E1"), 3) == 0) *field = 11;
+			return true;
+		case ConfigFileThresholds: {
+			EnergyAccountingConfig* eac = (EnergyAccountingConfig*) target;
+			int i = 0;
+			char * pch = strtok (value," ");
+			while (pch != NULL && i < 10) {
+				eac->thresholds[i++] = configFileLong(pch);
+				pch = strtok (NULL, " ");
+			}
+			eac->hours = configFileLong(pch);
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t configFileFormat(char* buf, size_t size, PGM_P key, const uint8_t* source) {
+	ConfigFileKeyword keyword;
+	char name[CONFIG_FILE_KEY_SIZE];
+	strncpy_P(name, key, CONFIG_FILE_KEY_SIZE - 1);
+	name[CONFIG_FILE_KEY_SIZE - 1] = '\0';
+	if(source == NULL || !configFileKeyword(name, keyword)) return 0;
+
+	const uint8_t* field = source + keyword.offset;
+	int len = 0;
+	switch(keyword.type) {
+		case ConfigFileInt:
+			len = snprintf_P(buf, size, PSTR("%s %ld\n"), name, configFileGetInt(field, keyword.size, false));
+			break;
+		case ConfigFileBool:
+			len = snprintf_P(buf, size, PSTR("%s %d\n"), name, *field ? 1 : 0);
+			break;
+		case ConfigFileString:
+			len = snprintf_P(buf, size, PSTR("%s %.*s\n"), name, keyword.size - 1, (const char*) field);
+			break;
+		case ConfigFileFixed:
+		case ConfigFileSignedFixed: {
+			uint8_t decimals = 0;
+			for(uint16_t s = keyword.scale; s > 1; s /= 10) decimals++;
+			long value = configFileGetInt(field, keyword.size, keyword.type == ConfigFileSignedFixed);
+			len = snprintf_P(buf, size, PSTR("%s %.*f\n"), name, decimals, value / (double) keyword.scale);
+			break;
+		}
+		case ConfigFileHex:
+			len = snprintf_P(buf, size, PSTR("%s "), name);
+			for(uint16_t i = 0; i < keyword.size && len > 0 && (size_t) len < size; i++) {
+				len += snprintf_P(buf + len, size - len, PSTR("%02X"), field[i]);
+			}
+			if(len > 0 && (size_t) len < size) {
+				len += snprintf_P(buf + len, size - len, PSTR("\n"));
+			}
+			break;
+		case ConfigFileParity: {
+			char parity[4] = "";
+			switch(*field) {
+				case 2:
+					strcpy_P(parity, PSTR("7N1"));
+					break;
+				case 3:
+					strcpy_P(parity, PSTR("8N1"));
+					break;
+				case 7:
+					strcpy_P(parity, PSTR("8N2"));
+					break;
+				case 10:
+					strcpy_P(parity, PSTR("7E1"));
+					break;
+				case 11:
+					strcpy_P(parity, PSTR("8E1"));
+					break;
+			}
+			if(strlen(parity) == 0) return 0;
+			len = snprintf_P(buf, size, PSTR("%s %s\n"), name, parity);
+			break;
+		}
+		case ConfigFileThresholds: {
+			const EnergyAccountingConfig* eac = (const EnergyAccountingConfig*) source;
+			len = snprintf_P(buf, size, PSTR("%s"), name);
+			for(uint8_t i = 0; i < 10 && len > 0 && (size_t) len < size; i++) {
+				len += snprintf_P(buf + len, size - len, PSTR(" %d"), eac->thresholds[i]);
+			}
+			if(len > 0 && (size_t) len < size) {
+				len += snprintf_P(buf + len, size - len, PSTR(" %d\n"), eac->hours);
+			}
+			break;
+		}
+	}
+	// A truncated line would be read back as a different value
+	if(len <= 0 || (size_t) len >= size) return 0;
+	return len;
+}
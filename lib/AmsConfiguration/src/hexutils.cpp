@@ -28,6 +28,16 @@ void fromHex(uint8_t *out, String in, uint16_t size) {
 	}
 }
 
+void fromHex(uint8_t *out, const char* in, uint16_t size) {
+	size_t length = strlen(in);
+	char hex[3] = { 0 };
+	for(uint16_t i = 0; i < size; i++) {
+		hex[0] = i*2 < length ? in[i*2] : '\0';
+		hex[1] = i*2+1 < length ? in[i*2+1] : '\0';
+		out[i] = strtol(hex, 0, 16);
+	}
+}
+
 bool stripNonAscii(uint8_t* in, uint16_t size, bool extended) {
 	bool ret = false;
 	for(uint16_t i = 0; i < size; i++) {
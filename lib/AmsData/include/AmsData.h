@@ -23,6 +23,17 @@ enum AmsType {
     AmsTypeUnknown = 0xFF
 };
 
+// Fields that are shown together, each group gets a new revision when apply() changes any of its values
+enum AmsDataGroup {
+    AmsDataGroupPower = 0,
+    AmsDataGroupCounters = 1,
+    AmsDataGroupL1 = 2,
+    AmsDataGroupL2 = 3,
+    AmsDataGroupL3 = 4,
+    AmsDataGroupMeter = 5
+};
+#define AMS_DATA_GROUPS 6
+
 class AmsData {
 public:
     AmsData();
@@ -31,6 +42,7 @@ public:
     void apply(const OBIS_code_t obis, double value);
 
     uint64_t getLastUpdateMillis();
+    uint32_t getRevision(AmsDataGroup group);
 
     time_t getPackageTimestamp();
 
@@ -110,6 +122,13 @@ protected:
 
     int8_t lastError = 0x00;
     uint8_t lastErrorCount = 0;
+
+    uint32_t revision = 0;
+    uint32_t groupRevision[AMS_DATA_GROUPS] = {0};
+    uint32_t groupChecksum[AMS_DATA_GROUPS] = {0};
+
+    void updateRevisions();
+    uint32_t checksum(AmsDataGroup group);
 };
 
 #endif
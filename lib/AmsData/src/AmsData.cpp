@@ -110,6 +110,78 @@ void AmsData::apply(AmsData& other) {
         this->activeImportPower = other.getActiveImportPower();
     if(other.getListType() == 2 || (other.getActiveImportPower() > 0 || other.getActiveExportPower() > 0))
         this->activeExportPower = other.getActiveExportPower();
+
+    updateRevisions();
+}
+
+void AmsData::updateRevisions() {
+    for(uint8_t i = 0; i < AMS_DATA_GROUPS; i++) {
+        uint32_t sum = checksum((AmsDataGroup) i);
+        if(sum != groupChecksum[i]) {
+            groupChecksum[i] = sum;
+            groupRevision[i] = ++revision;
+        }
+    }
+}
+
+static uint32_t fnv(uint32_t hash, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*) data;
+    for(size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 16777619;
+    }
+    return hash;
+}
+
+uint32_t AmsData::checksum(AmsDataGroup group) {
+    uint32_t hash = 2166136261;
+    switch(group) {
+        case AmsDataGroupPower:
+            hash = fnv(hash, &activeImportPower, sizeof(activeImportPower));
+            hash = fnv(hash, &activeExportPower, sizeof(activeExportPower));
+            hash = fnv(hash, &reactiveImportPower, sizeof(reactiveImportPower));
+            hash = fnv(hash, &reactiveExportPower, sizeof(reactiveExportPower));
+            hash = fnv(hash, &powerFactor, sizeof(powerFactor));
+            break;
+        case AmsDataGroupCounters:
+            hash = fnv(hash, &activeImportCounter, sizeof(activeImportCounter));
+            hash = fnv(hash, &activeExportCounter, sizeof(activeExportCounter));
+            hash = fnv(hash, &reactiveImportCounter, sizeof(reactiveImportCounter));
+            hash = fnv(hash, &reactiveExportCounter, sizeof(reactiveExportCounter));
+            break;
+        case AmsDataGroupL1:
+            hash = fnv(hash, &l1voltage, sizeof(l1voltage));
+            hash = fnv(hash, &l1current, sizeof(l1current));
+            hash = fnv(hash, &l1activeImportPower, sizeof(l1activeImportPower));
+            hash = fnv(hash, &l1activeExportPower, sizeof(l1activeExportPower));
+            hash = fnv(hash, &l1PowerFactor, sizeof(l1PowerFactor));
+            break;
+        case AmsDataGroupL2:
+            hash = fnv(hash, &l2voltage, sizeof(l2voltage));
+            hash = fnv(hash, &l2current, sizeof(l2current));
+            hash = fnv(hash, &l2activeImportPower, sizeof(l2activeImportPower));
+            hash = fnv(hash, &l2activeExportPower, sizeof(l2activeExportPower));
+            hash = fnv(hash, &l2PowerFactor, sizeof(l2PowerFactor));
+            hash = fnv(hash, &l2currentMissing, sizeof(l2currentMissing));
+            break;
+        case AmsDataGroupL3:
+            hash = fnv(hash, &l3voltage, sizeof(l3voltage));
+            hash = fnv(hash, &l3current, sizeof(l3current));
+            hash = fnv(hash, &l3activeImportPower, sizeof(l3activeImportPower));
+            hash = fnv(hash, &l3activeExportPower, sizeof(l3activeExportPower));
+            hash = fnv(hash, &l3PowerFactor, sizeof(l3PowerFactor));
+            break;
+        case AmsDataGroupMeter:
+            hash = fnv(hash, &listType, sizeof(listType));
+            hash = fnv(hash, &meterType, sizeof(meterType));
+            hash = fnv(hash, &threePhase, sizeof(threePhase));
+            hash = fnv(hash, &twoPhase, sizeof(twoPhase));
+            break;
+    }
+    return hash;
+}
+
+uint32_t AmsData::getRevision(AmsDataGroup group) {
+    return groupRevision[group];
 }
 
 void AmsData::apply(OBIS_code_t obis, double value) {
@@ -0,0 +1,92 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _AMSDATABINARY_H
+#define _AMSDATABINARY_H
+
+#include "Arduino.h"
+#include "AmsData.h"
+#include "EnergyAccounting.h"
+#include "DataSnapshot.h"
+
+#define AMS_BINARY_VERSION 1
+#define AMS_BINARY_HEADER_SIZE 12
+#define AMS_BINARY_MAX_SIZE 256
+
+/**
+ * Compact little-endian snapshot of the current meter and accounting state, served as /data.bin.
+ *
+ * Header, 12 bytes:
+ *   u8  version (1)
+ *   u8  header size (12), the first group starts here
+ *   u16 total length in bytes including the header
+ *   u32 presence mask, bit N set means group N follows
+ *   u32 device time, UTC epoch seconds, 0 if not set
+ *
+ * Groups follow in ascending bit order with fixed sizes. Counters are unsigned unless marked i,
+ * scaled integers are rounded to nearest.
+ *   0  POWER      16  u32 active import W, u32 active export W, u32 reactive import var, u32 reactive export var
+ *   1  COUNTERS   16  u32 active import Wh, u32 active export Wh, u32 reactive import varh, u32 reactive export varh
+ *   2  PF          2  i16 power factor x1000
+ *   3  L1         14  u16 voltage x10, i16 current x100, u32 active import W, u32 active export W, i16 power factor x1000
+ *   4  L2         14  as L1
+ *   5  L3         14  as L1
+ *   6  METER       8  u32 meter time UTC epoch seconds, u8 list type, u8 meter type, u8 flags, i8 last error
+ *                     flags: 0x01 three phase, 0x02 two phase, 0x04 counter estimated, 0x08 L2 current missing
+ *   7  PRICE_IN    4  i32 import price x10000 per kWh
+ *   8  PRICE_OUT   4  i32 export price x10000 per kWh
+ *   9  HOUR       16  u32 import Wh, i32 cost x1000, u32 export Wh, i32 income x1000
+ *   10 DAY        16  as HOUR
+ *   11 MONTH      16  as HOUR
+ *   12 TARIFF      5  u32 month max W, u8 current threshold kW
+ *   13 DEVICE      7  u32 uptime s, u16 supply mV, i8 WiFi RSSI dBm
+ *   14 TEMP        2  i16 temperature x100 degrees C
+ *
+ * New groups are only ever added at higher bits and existing groups never change size within a
+ * version, so a decoder can stop at the first bit it does not know and still use the rest.
+ * test/test_data_binary decodes with nothing but the sizes above, keep the two in step.
+ */
+enum AmsBinaryGroup {
+    AmsBinaryPower = 0,
+    AmsBinaryCounters = 1,
+    AmsBinaryPowerFactor = 2,
+    AmsBinaryL1 = 3,
+    AmsBinaryL2 = 4,
+    AmsBinaryL3 = 5,
+    AmsBinaryMeter = 6,
+    AmsBinaryPriceImport = 7,
+    AmsBinaryPriceExport = 8,
+    AmsBinaryHour = 9,
+    AmsBinaryDay = 10,
+    AmsBinaryMonth = 11,
+    AmsBinaryTariff = 12,
+    AmsBinaryDevice = 13,
+    AmsBinaryTemperature = 14
+};
+
+class AmsDataBinary {
+public:
+    AmsDataBinary(uint8_t* buf, uint16_t size);
+
+    // Prices and device values come from the snapshot, so data.bin shows what data.json and MQTT show for the frame
+    uint16_t encode(AmsData* data, EnergyAccounting* ea, DataSnapshot* snapshot, time_t now);
+
+private:
+    uint8_t* buf;
+    uint16_t size;
+    uint16_t pos = 0;
+
+    void begin(AmsBinaryGroup group, uint32_t& presence);
+    void putU8(uint8_t v);
+    void putU16(uint16_t v);
+    void putU32(uint32_t v);
+    void putScaled16(float v, float scale);
+    void putScaled32(double v, double scale);
+    void putPhase(float voltage, float current, uint32_t importPower, uint32_t exportPower, float powerFactor);
+    void putAccounting(float use, float cost, float produced, float income);
+};
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "AmsDataBinary.h"
+#include "Uptime.h"
+
+AmsDataBinary::AmsDataBinary(uint8_t* buf, uint16_t size) {
+    this->buf = buf;
+    this->size = size;
+}
+
+uint16_t AmsDataBinary::encode(AmsData* data, EnergyAccounting* ea, DataSnapshot* snapshot, time_t now) {
+    if(size < AMS_BINARY_MAX_SIZE) return 0;
+
+    uint32_t presence = 0;
+    pos = AMS_BINARY_HEADER_SIZE;
+
+    uint8_t listType = data->getListType();
+    if(listType > 0) {
+        begin(AmsBinaryPower, presence);
+        putU32(data->getActiveImportPower());
+        putU32(data->getActiveExportPower());
+        putU32(data->getReactiveImportPower());
+        putU32(data->getReactiveExportPower());
+    }
+    if(data->getActiveImportCounter() > 0) {
+        begin(AmsBinaryCounters, presence);
+        putScaled32(data->getActiveImportCounter(), 1000);
+        putScaled32(data->getActiveExportCounter(), 1000);
+        putScaled32(data->getReactiveImportCounter(), 1000);
+        putScaled32(data->getReactiveExportCounter(), 1000);
+    }
+    if(data->getPowerFactor() != 0) {
+        begin(AmsBinaryPowerFactor, presence);
+        putScaled16(data->getPowerFactor(), 1000);
+    }
+    if(data->getL1Voltage() > 0) {
+        begin(AmsBinaryL1, presence);
+        putPhase(data->getL1Voltage(), data->getL1Current(), data->getL1ActiveImportPower(), data->getL1ActiveExportPower(), data->getL1PowerFactor());
+    }
+    if(data->getL2Voltage() > 0) {
+        begin(AmsBinaryL2, presence);
+        putPhase(data->getL2Voltage(), data->getL2Current(), data->getL2ActiveImportPower(), data->getL2ActiveExportPower(), data->getL2PowerFactor());
+    }
+    if(data->getL3Voltage() > 0) {
+        begin(AmsBinaryL3, presence);
+        putPhase(data->getL3Voltage(), data->getL3Current(), data->getL3ActiveImportPower(), data->getL3ActiveExportPower(), data->getL3PowerFactor());
+    }
+    if(listType > 0) {
+        begin(AmsBinaryMeter, presence);
+        putU32(data->getMeterTimestamp());
+        putU8(listType);
+        putU8(data->getMeterType());
+        uint8_t flags = 0;
+        if(data->isThreePhase()) flags |= 0x01;
+        if(data->isTwoPhase()) flags |= 0x02;
+        if(data->isCounterEstimated()) flags |= 0x04;
+        if(data->isL2currentMissing()) flags |= 0x08;
+        putU8(flags);
+        putU8((uint8_t) data->getLastError());
+    }
+
+    if(snapshot != NULL) {
+        float importPrice = snapshot->getPrice(PRICE_DIRECTION_IMPORT);
+        if(importPrice != PRICE_NO_VALUE) {
+            begin(AmsBinaryPriceImport, presence);
+            putScaled32(importPrice, 10000);
+        }
+        float exportPrice = snapshot->getPrice(PRICE_DIRECTION_EXPORT);
+        if(exportPrice != PRICE_NO_VALUE) {
+            begin(AmsBinaryPriceExport, presence);
+            putScaled32(exportPrice, 10000);
+        }
+    }
+
+    if(ea != NULL && ea->isInitialized()) {
+        begin(AmsBinaryHour, presence);
+        putAccounting(ea->getUseThisHour(), ea->getCostThisHour(), ea->getProducedThisHour(), ea->getIncomeThisHour());
+        begin(AmsBinaryDay, presence);
+        putAccounting(ea->getUseToday(), ea->getCostToday(), ea->getProducedToday(), ea->getIncomeToday());
+        begin(AmsBinaryMonth, presence);
+        putAccounting(ea->getUseThisMonth(), ea->getCostThisMonth(), ea->getProducedThisMonth(), ea->getIncomeThisMonth());
+        begin(AmsBinaryTariff, presence);
+        putScaled32(ea->getMonthMax(), 1000);
+        putU8(ea->getCurrentThreshold());
+    }
+
+    if(snapshot != NULL) {
+        begin(AmsBinaryDevice, presence);
+        putU32(millis64() / 1000);
+        putScaled16(snapshot->getVcc(), 1000);
+        putU8((uint8_t) (int8_t) snapshot->getWifiRssi());
+
+        float temperature = snapshot->getTemperature();
+        if(temperature != DEVICE_DISCONNECTED_C) {
+            begin(AmsBinaryTemperature, presence);
+            putScaled16(temperature, 100);
+        }
+    }
+
+    uint16_t length = pos;
+    pos = 0;
+    putU8(AMS_BINARY_VERSION);
+    putU8(AMS_BINARY_HEADER_SIZE);
+    putU16(length);
+    putU32(presence);
+    putU32(now);
+    return length;
+}
+
+void AmsDataBinary::begin(AmsBinaryGroup group, uint32_t& presence) {
+    presence |= ((uint32_t) 1) << group;
+}
+
+void AmsDataBinary::putU8(uint8_t v) {
+    buf[pos++] = v;
+}
+
+void AmsDataBinary::putU16(uint16_t v) {
+    buf[pos++] = v & 0xFF;
+    buf[pos++] = v >> 8;
+}
+
+void AmsDataBinary::putU32(uint32_t v) {
+    buf[pos++] = v & 0xFF;
+    buf[pos++] = (v >> 8) & 0xFF;
+    buf[pos++] = (v >> 16) & 0xFF;
+    buf[pos++] = v >> 24;
+}
+
+void AmsDataBinary::putScaled16(float v, float scale) {
+    int32_t i = lroundf(v * scale);
+    if(i > INT16_MAX) i = INT16_MAX;
+    if(i < INT16_MIN) i = INT16_MIN;
+    putU16((uint16_t) (int16_t) i);
+}
+
+void AmsDataBinary::putScaled32(double v, double scale) {
+    // Counters are unsigned, money is signed, both fit the same 32 bits as long as they stay in range
+    int64_t i = llround(v * scale);
+    if(i > UINT32_MAX) i = UINT32_MAX;
+    if(i < INT32_MIN) i = INT32_MIN;
+    putU32((uint32_t) i);
+}
+
+void AmsDataBinary::putPhase(float voltage, float current, uint32_t importPower, uint32_t exportPower, float powerFactor) {
+    putU16(lroundf(voltage * 10));
+    putScaled16(current, 100);
+    putU32(importPower);
+    putU32(exportPower);
+    putScaled16(powerFactor, 1000);
+}
+
+void AmsDataBinary::putAccounting(float use, float cost, float produced, float income) {
+    putScaled32(use, 1000);
+    putScaled32(cost, 1000);
+    putScaled32(produced, 1000);
+    putScaled32(income, 1000);
+}
@@ -12,6 +12,8 @@
 #include "RemoteDebug.h"
 #endif
 #include "Timezone.h"
+#include "Calendar.h"
+#include "StateJournal.h"
 
 struct DayDataPoints5 {
     uint8_t version;
@@ -61,6 +63,7 @@ public:
     AmsDataStorage(Stream*);
     #endif
     void setTimezone(Timezone*);
+    void setCalendar(Calendar*);
     bool update(AmsData* data, time_t now);
     uint32_t getHourImport(uint8_t);
     uint32_t getHourExport(uint8_t);
@@ -85,6 +88,9 @@ public:
 
     double getEstimatedImportCounter();
 
+    // Incremented whenever a plot value changes, for cache validation
+    uint32_t getRevision();
+
     void setHourImport(uint8_t, uint32_t);
     void setHourExport(uint8_t, uint32_t);
     void setDayImport(uint8_t, uint32_t);
@@ -92,6 +98,8 @@ public:
 
 private:
     Timezone* tz;
+    Calendar* calendar = NULL;
+    uint32_t revision = 0;
     DayDataPoints day = {
         0,
         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
@@ -106,6 +114,8 @@ private:
         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
         10
     };
+    StateJournal* dayJournal;
+    StateJournal* monthJournal;
     #if defined(AMS_REMOTE_DEBUG)
     RemoteDebug* debugger;
     #else
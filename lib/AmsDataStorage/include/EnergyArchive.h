@@ -0,0 +1,73 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _ENERGYARCHIVE_H
+#define _ENERGYARCHIVE_H
+
+#include "Arduino.h"
+#include "LittleFS.h"
+#if defined(AMS_REMOTE_DEBUG)
+#include "RemoteDebug.h"
+#endif
+#include "AmsDataStorage.h"
+
+#define ENERGY_ARCHIVE_MAGIC 0xEA
+#define ENERGY_ARCHIVE_VERSION 1
+#define ENERGY_ARCHIVE_DAYS 366
+
+#define ENERGY_ARCHIVE_HAS_IMPORT 0x01
+#define ENERGY_ARCHIVE_HAS_EXPORT 0x02
+
+/**
+ * One file per UTC year: header, a fixed index of one uint32 offset per day of year (0 means
+ * no data) and day blocks appended as the days complete. A day block is flags, payload length,
+ * 24 import and 24 export values in Wh encoded as a varint followed by zigzag varint deltas,
+ * and a CRC16. Households without production skip the export half entirely.
+ */
+struct EnergyArchiveHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t year;
+};
+
+struct EnergyArchiveDay {
+    uint32_t hImport[24];
+    uint32_t hExport[24];
+};
+
+class EnergyArchive {
+public:
+    #if defined(AMS_REMOTE_DEBUG)
+    EnergyArchive(RemoteDebug*);
+    #else
+    EnergyArchive(Stream*);
+    #endif
+
+    bool update(AmsDataStorage* ds);
+    bool setDay(time_t day, EnergyArchiveDay& data);
+    bool getDay(time_t day, EnergyArchiveDay& data);
+    void close();
+
+private:
+    #if defined(AMS_REMOTE_DEBUG)
+    RemoteDebug* debugger;
+    #else
+    Stream* debugger;
+    #endif
+
+    File file;
+    uint16_t openYear = 0;
+    bool writable = false;
+
+    bool open(uint16_t year, bool write);
+    uint32_t getOffset(uint16_t yday);
+    void dayPosition(time_t day, uint16_t& year, uint16_t& yday);
+
+    uint8_t encode(uint32_t* values, uint8_t* out);
+    bool decode(uint8_t* in, uint8_t length, uint8_t& pos, uint32_t* values);
+};
+
+#endif
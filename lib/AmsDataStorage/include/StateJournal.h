@@ -0,0 +1,65 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _STATEJOURNAL_H
+#define _STATEJOURNAL_H
+
+#include "Arduino.h"
+
+#define STATE_JOURNAL_MAGIC 0x4A
+#define STATE_JOURNAL_VERSION 1
+#define STATE_JOURNAL_RECORD 0xA5
+#define STATE_JOURNAL_MAX_SIZE 1024
+#define STATE_JOURNAL_GAP 4
+
+struct StateJournalHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint16_t base; // CRC of the snapshot this journal applies to
+};
+
+// Followed by length bytes of data and a CRC16 of header and data
+struct StateJournalRecord {
+    uint8_t marker;
+    uint8_t length;
+    uint16_t offset;
+};
+
+/**
+ * Keeps a RAM struct persisted as a snapshot file plus an append-only journal of changed byte ranges.
+ * save() appends only what changed since last time, and rewrites the snapshot once the journal grows
+ * past STATE_JOURNAL_MAX_SIZE. A torn write at the end of the journal is detected by CRC and ignored.
+ */
+class StateJournal {
+public:
+    StateJournal(const char* snapshotPath, const char* journalPath, void* image, uint16_t size);
+    ~StateJournal();
+
+    void setBase(const uint8_t* snapshot, size_t length);
+    uint16_t replay();
+    bool save();
+    bool compact();
+
+    static bool mount();
+
+private:
+    const char* snapshotPath;
+    const char* journalPath;
+    uint8_t* image;
+    uint8_t* shadow;
+    uint16_t size;
+
+    uint16_t base = 0;
+    bool hasBase = false;
+    bool brokenTail = false;
+    size_t journalSize = 0;
+
+    static bool mounted;
+
+    bool nextRange(uint16_t& start, uint16_t& length);
+};
+
+#endif
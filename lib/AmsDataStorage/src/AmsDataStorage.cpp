@@ -20,12 +20,18 @@ AmsDataStorage::AmsDataStorage(Stream* debugger) {
     month.version = 7;
     month.accuracy = 1;
     this->debugger = debugger;
+    dayJournal = new StateJournal(FILE_DAYPLOT, FILE_DAYPLOT_JOURNAL, &day, sizeof(day));
+    monthJournal = new StateJournal(FILE_MONTHPLOT, FILE_MONTHPLOT_JOURNAL, &month, sizeof(month));
 }
 
 void AmsDataStorage::setTimezone(Timezone* tz) {
     this->tz = tz;
 }
 
+void AmsDataStorage::setCalendar(Calendar* calendar) {
+    this->calendar = calendar;
+}
+
 bool AmsDataStorage::update(AmsData* data, time_t now) {
     if(isHappy(now)) {
         #if defined(AMS_REMOTE_DEBUG)
@@ -35,7 +41,7 @@ bool AmsDataStorage::update(AmsData* data, time_t now) {
         return false;
     }
 
-    if(tz == NULL) {
+    if(tz == NULL || calendar == NULL) {
         #if defined(AMS_REMOTE_DEBUG)
         if (debugger->isActive(RemoteDebug::DEBUG))
         #endif
@@ -57,11 +63,10 @@ bool AmsDataStorage::update(AmsData* data, time_t now) {
         return false;
     }
 
-    tmElements_t utc, ltz, utcYesterday, ltzYesterDay;
-    breakTime(now, utc);
-    breakTime(tz->toLocal(now), ltz);
-    breakTime(now-3600, utcYesterday);
-    breakTime(tz->toLocal(now-3600), ltzYesterDay);
+    calendar->update(now);
+    tmElements_t utc = calendar->getUtc();
+    tmElements_t ltz = calendar->getLocal();
+    uint8_t utcYesterdayHour = (utc.Hour + 23) % 24;
 
     uint64_t importCounter = data->getActiveImportCounter() * 1000;
     uint64_t exportCounter = data->getActiveExportCounter() * 1000;
@@ -150,8 +155,8 @@ bool AmsDataStorage::update(AmsData* data, time_t now) {
             day.activeImport = importCounter;
             day.activeExport = exportCounter;
             day.lastMeterReadTime = now;
-            setHourImport(utcYesterday.Hour, 0);
-            setHourExport(utcYesterday.Hour, 0);
+            setHourImport(utcYesterdayHour, 0);
+            setHourExport(utcYesterdayHour, 0);
         } else if(now - day.lastMeterReadTime < 4000) {
             #if defined(AMS_REMOTE_DEBUG)
             if (debugger->isActive(RemoteDebug::DEBUG))
@@ -159,8 +164,8 @@ bool AmsDataStorage::update(AmsData* data, time_t now) {
                 debugger->printf_P(PSTR(" - normal\n"));
             uint32_t imp = importCounter - day.activeImport;
             uint32_t exp = exportCounter - day.activeExport;
-            setHourImport(utcYesterday.Hour, imp);
-            setHourExport(utcYesterday.Hour, exp);
+            setHourImport(utcYesterdayHour, imp);
+            setHourExport(utcYesterdayHour, exp);
 
             day.activeImport = importCounter;
             day.activeExport = exportCounter;
@@ -201,6 +206,8 @@ bool AmsDataStorage::update(AmsData* data, time_t now) {
 
     // Update month plot
     if(ltz.Hour == 0 && !isMonthHappy(now)) {
+        tmElements_t ltzYesterDay;
+        calendar->breakLocal(now-3600, ltzYesterDay);
         #if defined(AMS_REMOTE_DEBUG)
         if (debugger->isActive(RemoteDebug::DEBUG))
         #endif
@@ -267,6 +274,7 @@ bool AmsDataStorage::update(AmsData* data, time_t now) {
 
 void AmsDataStorage::setHourImport(uint8_t hour, uint32_t val) {
     if(hour < 0 || hour > 24) return;
+    revision++;
     
     uint8_t accuracy = day.accuracy;
     uint32_t update = val / pow(10, accuracy);
@@ -306,6 +314,7 @@ uint32_t AmsDataStorage::getHourImport(uint8_t hour) {
 
 void AmsDataStorage::setHourExport(uint8_t hour, uint32_t val) {
     if(hour < 0 || hour > 24) return;
+    revision++;
     
     uint8_t accuracy = day.accuracy;
     uint32_t update = val / pow(10, accuracy);
@@ -345,6 +354,7 @@ uint32_t AmsDataStorage::getHourExport(uint8_t hour) {
 
 void AmsDataStorage::setDayImport(uint8_t day, uint32_t val) {
     if(day < 1 || day > 31) return;
+    revision++;
     
     uint8_t accuracy = month.accuracy;
     uint32_t update = val / pow(10, accuracy);
@@ -384,6 +394,7 @@ uint32_t AmsDataStorage::getDayImport(uint8_t day) {
 
 void AmsDataStorage::setDayExport(uint8_t day, uint32_t val) {
     if(day < 1 || day > 31) return;
+    revision++;
     
     uint8_t accuracy = month.accuracy;
     uint32_t update = val / pow(10, accuracy);
@@ -422,7 +433,7 @@ uint32_t AmsDataStorage::getDayExport(uint8_t day) {
 }
 
 bool AmsDataStorage::load() {
-    if(!LittleFS.begin()) {
+    if(!StateJournal::mount()) {
         return false;
     }
 
@@ -449,15 +460,22 @@ bool AmsDataStorage::load() {
             ret = setDayData(day);
         }
         file.close();
+
+        // Changes made after the snapshot was written
+        if(ret) {
+            dayJournal->setBase((uint8_t*) buf, sizeof(buf));
+            dayJournal->replay();
+        }
     }
 
     if(LittleFS.exists(FILE_MONTHPLOT)) {
         File file = LittleFS.open(FILE_MONTHPLOT, "r");
         char buf[file.size()];
         file.readBytes(buf, file.size());
+        bool monthRet;
         if(buf[0] > 6) {
             MonthDataPoints* month = (MonthDataPoints*) buf;
-            ret &= setMonthData(*month);
+            monthRet = setMonthData(*month);
         } else {
             MonthDataPoints6* old = (MonthDataPoints6*) buf;
             MonthDataPoints month = { old->version };
@@ -470,37 +488,24 @@ bool AmsDataStorage::load() {
                 month.dExport[i] = old->dExport[i];
             }
 
-            ret &= setMonthData(month);
+            monthRet = setMonthData(month);
         }
         file.close();
+        ret &= monthRet;
+
+        if(monthRet) {
+            monthJournal->setBase((uint8_t*) buf, sizeof(buf));
+            monthJournal->replay();
+        }
     }
 
     return ret;
 }
 
 bool AmsDataStorage::save() {
-    if(!LittleFS.begin()) {
-        return false;
-    }
-    {
-        File file = LittleFS.open(FILE_DAYPLOT, "w");
-        char buf[sizeof(day)];
-        memcpy(buf, &day, sizeof(day));
-        for(unsigned long i = 0; i < sizeof(day); i++) {
-            file.write(buf[i]);
-        }
-        file.close();
-    }
-    {
-        File file = LittleFS.open(FILE_MONTHPLOT, "w");
-        char buf[sizeof(month)];
-        memcpy(buf, &month, sizeof(month));
-        for(unsigned long i = 0; i < sizeof(month); i++) {
-            file.write(buf[i]);
-        }
-        file.close();
-    }
-    return true;
+    bool ret = dayJournal->save();
+    ret &= monthJournal->save();
+    return ret;
 }
 
 DayDataPoints AmsDataStorage::getDayData() {
@@ -515,17 +520,20 @@ bool AmsDataStorage::setDayData(DayDataPoints& day) {
     if(day.version == 5 || day.version == 6) {
         this->day = day;
         this->day.version = 6;
+        revision++;
         return true;
     } else if(day.version == 4) {
         this->day = day;
         this->day.accuracy = 1;
         this->day.version = 6;
+        revision++;
         return true;
     } else if(day.version == 3) {
         this->day = day;
         for(uint8_t i = 0; i < 24; i++) this->day.hExport[i] = 0;
         this->day.accuracy = 1;
         this->day.version = 6;
+        revision++;
         return true;
     }
     return false;
@@ -535,22 +543,29 @@ bool AmsDataStorage::setMonthData(MonthDataPoints& month) {
     if(month.version == 6 || month.version == 7) {
         this->month = month;
         this->month.version = 7;
+        revision++;
         return true;
     } else if(month.version == 5) {
         this->month = month;
         this->month.accuracy = 1;
         this->month.version = 7;
+        revision++;
         return true;
     } else if(month.version == 4) {
         this->month = month;
         for(uint8_t i = 0; i < 31; i++) this->month.dExport[i] = 0;
         this->month.accuracy = 1;
         this->month.version = 7;
+        revision++;
         return true;
     }
     return false;
 }
 
+uint32_t AmsDataStorage::getRevision() {
+    return revision;
+}
+
 uint8_t AmsDataStorage::getDayAccuracy() {
     return day.accuracy;
 }
@@ -587,7 +602,7 @@ bool AmsDataStorage::isHappy(time_t now) {
 }
 
 bool AmsDataStorage::isDayHappy(time_t now) {
-    if(tz == NULL) {
+    if(tz == NULL || calendar == NULL) {
         return false;
     }
 
@@ -602,10 +617,8 @@ bool AmsDataStorage::isDayHappy(time_t now) {
         return false;
     }
 
-    tmElements_t tm, last;
-    breakTime(tz->toLocal(now), tm);
-    breakTime(tz->toLocal(day.lastMeterReadTime), last);
-    if(tm.Hour != last.Hour) {
+    calendar->update(now);
+    if(!calendar->isSameHour(day.lastMeterReadTime)) {
         return false;
     }
 
@@ -613,7 +626,7 @@ bool AmsDataStorage::isDayHappy(time_t now) {
 }
 
 bool AmsDataStorage::isMonthHappy(time_t now) {
-    if(tz == NULL) {
+    if(tz == NULL || calendar == NULL) {
         return false;
     }
 
@@ -628,10 +641,8 @@ bool AmsDataStorage::isMonthHappy(time_t now) {
         return false;
     }
 
-    tmElements_t tm, last;
-    breakTime(tz->toLocal(now), tm);
-    breakTime(tz->toLocal(month.lastMeterReadTime), last);
-    if(tm.Day != last.Day) {
+    calendar->update(now);
+    if(!calendar->isSameDay(month.lastMeterReadTime)) {
         return false;
     }
 
@@ -0,0 +1,224 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "EnergyArchive.h"
+#include "AmsStorage.h"
+#include "FirmwareVersion.h"
+#include "crc.h"
+
+#if defined(AMS_REMOTE_DEBUG)
+EnergyArchive::EnergyArchive(RemoteDebug* debugger) {
+#else
+EnergyArchive::EnergyArchive(Stream* debugger) {
+#endif
+    this->debugger = debugger;
+}
+
+bool EnergyArchive::update(AmsDataStorage* ds) {
+    // Day plot is indexed by UTC hour, so once the 00:00 reading is in, it holds the complete previous day
+    DayDataPoints day = ds->getDayData();
+    if(day.lastMeterReadTime < FirmwareVersion::BuildEpoch) return false;
+    tmElements_t tm;
+    breakTime(day.lastMeterReadTime, tm);
+    if(tm.Hour != 0) return false;
+
+    time_t yesterday = day.lastMeterReadTime - SECS_PER_HOUR;
+    uint16_t year, yday;
+    dayPosition(yesterday, year, yday);
+    if(open(year, false) && getOffset(yday) != 0) {
+        return false;
+    }
+
+    EnergyArchiveDay data;
+    for(uint8_t i = 0; i < 24; i++) {
+        data.hImport[i] = ds->getHourImport(i);
+        data.hExport[i] = ds->getHourExport(i);
+    }
+    return setDay(yesterday, data);
+}
+
+bool EnergyArchive::setDay(time_t day, EnergyArchiveDay& data) {
+    uint16_t year, yday;
+    dayPosition(day, year, yday);
+
+    uint8_t block[2 + 240 + 2];
+    uint8_t flags = 0;
+    for(uint8_t i = 0; i < 24; i++) {
+        if(data.hImport[i] > 0) flags |= ENERGY_ARCHIVE_HAS_IMPORT;
+        if(data.hExport[i] > 0) flags |= ENERGY_ARCHIVE_HAS_EXPORT;
+    }
+    uint8_t pos = 2;
+    if(flags & ENERGY_ARCHIVE_HAS_IMPORT) pos += encode(data.hImport, block+pos);
+    if(flags & ENERGY_ARCHIVE_HAS_EXPORT) pos += encode(data.hExport, block+pos);
+    block[0] = flags;
+    block[1] = pos - 2;
+    uint16_t crc = crc16(block, pos);
+    memcpy(block+pos, &crc, 2);
+    pos += 2;
+
+    if(!open(year, true)) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::ERROR))
+        #endif
+        debugger->printf_P(PSTR("(EnergyArchive) Unable to open archive for %d\n"), year);
+        return false;
+    }
+
+    // Block first, then the index entry pointing to it. A power cut in between leaves only an unreferenced block.
+    file.seek(0, SeekEnd);
+    uint32_t offset = file.position();
+    bool ret = file.write(block, pos) == pos;
+    if(ret) {
+        file.seek(sizeof(EnergyArchiveHeader) + (yday * sizeof(offset)), SeekSet);
+        ret = file.write((uint8_t*) &offset, sizeof(offset)) == sizeof(offset);
+    }
+    close();
+
+    if(ret) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::INFO))
+        #endif
+        debugger->printf_P(PSTR("(EnergyArchive) Archived day %d of %d (%d bytes)\n"), yday+1, year, pos);
+    }
+    return ret;
+}
+
+bool EnergyArchive::getDay(time_t day, EnergyArchiveDay& data) {
+    memset(&data, 0, sizeof(data));
+
+    uint16_t year, yday;
+    dayPosition(day, year, yday);
+    if(!open(year, false)) return false;
+
+    uint32_t offset = getOffset(yday);
+    if(offset == 0 || !file.seek(offset, SeekSet)) return false;
+
+    uint8_t block[2 + 255 + 2];
+    if(file.read(block, 2) != 2) return false;
+    uint8_t length = block[1];
+    if(file.read(block+2, length + 2) != length + 2) return false;
+
+    uint16_t crc;
+    memcpy(&crc, block + 2 + length, 2);
+    if(crc != crc16(block, length + 2)) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::WARNING))
+        #endif
+        debugger->printf_P(PSTR("(EnergyArchive) CRC error for day %d of %d\n"), yday+1, year);
+        return false;
+    }
+
+    uint8_t pos = 0;
+    if((block[0] & ENERGY_ARCHIVE_HAS_IMPORT) && !decode(block+2, length, pos, data.hImport)) return false;
+    if((block[0] & ENERGY_ARCHIVE_HAS_EXPORT) && !decode(block+2, length, pos, data.hExport)) return false;
+    return true;
+}
+
+void EnergyArchive::close() {
+    if(file) {
+        file.close();
+    }
+    openYear = 0;
+    writable = false;
+}
+
+bool EnergyArchive::open(uint16_t year, bool write) {
+    if(openYear == year && file && (writable || !write)) {
+        return true;
+    }
+    close();
+    if(!StateJournal::mount()) {
+        return false;
+    }
+
+    char path[24];
+    snprintf_P(path, sizeof(path), PSTR(FILE_ARCHIVE), year);
+    if(!LittleFS.exists(path)) {
+        if(!write) return false;
+
+        File f = LittleFS.open(path, "w");
+        if(!f) return false;
+        EnergyArchiveHeader header = { ENERGY_ARCHIVE_MAGIC, ENERGY_ARCHIVE_VERSION, year };
+        f.write((uint8_t*) &header, sizeof(header));
+        uint8_t zero[64];
+        memset(zero, 0, sizeof(zero));
+        // The index is not a multiple of the zero block, the last write only covers what is left
+        size_t remaining = ENERGY_ARCHIVE_DAYS * sizeof(uint32_t);
+        while(remaining > 0) {
+            size_t length = min(remaining, sizeof(zero));
+            f.write(zero, length);
+            remaining -= length;
+        }
+        f.close();
+    }
+
+    file = LittleFS.open(path, write ? "r+" : "r");
+    if(!file) return false;
+
+    EnergyArchiveHeader header;
+    if(file.read((uint8_t*) &header, sizeof(header)) != sizeof(header) || header.magic != ENERGY_ARCHIVE_MAGIC || header.version != ENERGY_ARCHIVE_VERSION || header.year != year) {
+        file.close();
+        return false;
+    }
+    openYear = year;
+    writable = write;
+    return true;
+}
+
+uint32_t EnergyArchive::getOffset(uint16_t yday) {
+    uint32_t offset = 0;
+    if(yday >= ENERGY_ARCHIVE_DAYS) return 0;
+    if(!file.seek(sizeof(EnergyArchiveHeader) + (yday * sizeof(offset)), SeekSet)) return 0;
+    if(file.read((uint8_t*) &offset, sizeof(offset)) != sizeof(offset)) return 0;
+    return offset;
+}
+
+void EnergyArchive::dayPosition(time_t day, uint16_t& year, uint16_t& yday) {
+    tmElements_t tm;
+    breakTime(day, tm);
+    tmElements_t jan = { 0, 0, 0, 0, 1, 1, tm.Year };
+    year = tm.Year + 1970;
+    yday = (day / SECS_PER_DAY) - (makeTime(jan) / SECS_PER_DAY);
+}
+
+uint8_t EnergyArchive::encode(uint32_t* values, uint8_t* out) {
+    uint8_t pos = 0;
+    uint32_t prev = 0;
+    for(uint8_t i = 0; i < 24; i++) {
+        int32_t delta = (int32_t) (values[i] - prev);
+        uint32_t v = i == 0 ? values[i] : (uint32_t) ((delta << 1) ^ (delta >> 31));
+        prev = values[i];
+        while(v >= 0x80) {
+            out[pos++] = (v & 0x7F) | 0x80;
+            v >>= 7;
+        }
+        out[pos++] = v;
+    }
+    return pos;
+}
+
+bool EnergyArchive::decode(uint8_t* in, uint8_t length, uint8_t& pos, uint32_t* values) {
+    uint32_t prev = 0;
+    for(uint8_t i = 0; i < 24; i++) {
+        uint32_t v = 0;
+        uint8_t shift = 0;
+        while(true) {
+            if(pos >= length || shift > 28) return false;
+            uint8_t b = in[pos++];
+            v |= ((uint32_t) (b & 0x7F)) << shift;
+            if((b & 0x80) == 0) break;
+            shift += 7;
+        }
+        if(i == 0) {
+            values[i] = v;
+        } else {
+            int32_t delta = (int32_t) ((v >> 1) ^ (~(v & 1) + 1));
+            values[i] = prev + delta;
+        }
+        prev = values[i];
+    }
+    return true;
+}
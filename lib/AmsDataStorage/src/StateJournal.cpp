@@ -0,0 +1,193 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "StateJournal.h"
+#include "LittleFS.h"
+#include "crc.h"
+
+bool StateJournal::mounted = false;
+
+StateJournal::StateJournal(const char* snapshotPath, const char* journalPath, void* image, uint16_t size) {
+    this->snapshotPath = snapshotPath;
+    this->journalPath = journalPath;
+    this->image = (uint8_t*) image;
+    this->size = size;
+    // Without a shadow copy there is nothing to diff against, every save becomes a snapshot
+    this->shadow = (uint8_t*) malloc(size);
+    if(this->shadow != NULL) {
+        memcpy(this->shadow, this->image, size);
+    }
+}
+
+StateJournal::~StateJournal() {
+    free(shadow);
+}
+
+bool StateJournal::mount() {
+    if(!mounted) {
+        mounted = LittleFS.begin();
+    }
+    return mounted;
+}
+
+void StateJournal::setBase(const uint8_t* snapshot, size_t length) {
+    base = crc16(snapshot, length);
+    hasBase = true;
+}
+
+uint16_t StateJournal::replay() {
+    uint16_t applied = 0;
+    journalSize = 0;
+    brokenTail = false;
+
+    if(hasBase && LittleFS.exists(journalPath)) {
+        File file = LittleFS.open(journalPath, "r");
+        StateJournalHeader header;
+        if(file.readBytes((char*) &header, sizeof(header)) == sizeof(header) && header.magic == STATE_JOURNAL_MAGIC && header.version == STATE_JOURNAL_VERSION && header.base == base) {
+            journalSize = sizeof(header);
+
+            uint8_t buf[sizeof(StateJournalRecord) + UINT8_MAX + 2];
+            StateJournalRecord* record = (StateJournalRecord*) buf;
+            while(file.available()) {
+                if(file.readBytes((char*) buf, sizeof(StateJournalRecord)) != sizeof(StateJournalRecord) || record->marker != STATE_JOURNAL_RECORD) {
+                    brokenTail = true;
+                    break;
+                }
+                size_t len = record->length + 2;
+                if(file.readBytes((char*) buf + sizeof(StateJournalRecord), len) != len) {
+                    brokenTail = true;
+                    break;
+                }
+                uint16_t crc;
+                memcpy(&crc, buf + sizeof(StateJournalRecord) + record->length, 2);
+                if(crc != crc16(buf, sizeof(StateJournalRecord) + record->length) || record->offset + record->length > size) {
+                    brokenTail = true;
+                    break;
+                }
+                memcpy(image + record->offset, buf + sizeof(StateJournalRecord), record->length);
+                journalSize += sizeof(StateJournalRecord) + len;
+                applied++;
+            }
+            file.close();
+        } else {
+            // Belongs to an older snapshot, everything in it is already part of the current one
+            file.close();
+            LittleFS.remove(journalPath);
+        }
+    }
+
+    if(shadow != NULL) {
+        memcpy(shadow, image, size);
+    }
+    return applied;
+}
+
+bool StateJournal::save() {
+    if(!mount()) {
+        return false;
+    }
+
+    // Without a known snapshot, or with garbage at the end of the journal, appending is not safe
+    if(!hasBase || brokenTail || shadow == NULL) {
+        return compact();
+    }
+
+    size_t needed = 0;
+    uint16_t start = 0, length = 0;
+    while(nextRange(start, length)) {
+        needed += sizeof(StateJournalRecord) + length + 2;
+        start += length;
+    }
+    if(needed == 0) {
+        return true;
+    }
+    if(journalSize + needed > STATE_JOURNAL_MAX_SIZE) {
+        return compact();
+    }
+
+    File file = LittleFS.open(journalPath, "a");
+    if(!file) {
+        return false;
+    }
+    size_t written = 0;
+    if(journalSize == 0) {
+        StateJournalHeader header = { STATE_JOURNAL_MAGIC, STATE_JOURNAL_VERSION, base };
+        written += file.write((uint8_t*) &header, sizeof(header));
+        needed += sizeof(header);
+    }
+
+    uint8_t buf[sizeof(StateJournalRecord) + UINT8_MAX + 2];
+    StateJournalRecord* record = (StateJournalRecord*) buf;
+    start = 0;
+    while(nextRange(start, length)) {
+        record->marker = STATE_JOURNAL_RECORD;
+        record->length = length;
+        record->offset = start;
+        memcpy(buf + sizeof(StateJournalRecord), image + start, length);
+        uint16_t crc = crc16(buf, sizeof(StateJournalRecord) + length);
+        memcpy(buf + sizeof(StateJournalRecord) + length, &crc, 2);
+        written += file.write(buf, sizeof(StateJournalRecord) + length + 2);
+        start += length;
+    }
+    file.close();
+
+    if(written != needed) {
+        // Partial record at the end, next save will write a fresh snapshot
+        brokenTail = true;
+        return false;
+    }
+
+    journalSize += written;
+    memcpy(shadow, image, size);
+    return true;
+}
+
+bool StateJournal::compact() {
+    if(!mount()) {
+        return false;
+    }
+
+    // Write to a temporary file first, rename is atomic so the snapshot is either the old or the new one
+    char tmp[32];
+    snprintf_P(tmp, sizeof(tmp), PSTR("%s.tmp"), snapshotPath);
+    File file = LittleFS.open(tmp, "w");
+    if(!file) {
+        return false;
+    }
+    size_t written = file.write(image, size);
+    file.close();
+    if(written != size || !LittleFS.rename(tmp, snapshotPath)) {
+        LittleFS.remove(tmp);
+        return false;
+    }
+    LittleFS.remove(journalPath);
+
+    base = crc16(image, size);
+    hasBase = true;
+    brokenTail = false;
+    journalSize = 0;
+    if(shadow != NULL) {
+        memcpy(shadow, image, size);
+    }
+    return true;
+}
+
+bool StateJournal::nextRange(uint16_t& start, uint16_t& length) {
+    while(start < size && image[start] == shadow[start]) start++;
+    if(start >= size) {
+        return false;
+    }
+
+    // Small gaps of equal bytes are cheaper to include than to start a new record for
+    uint16_t end = start + 1;
+    uint16_t last = start;
+    while(end < size && end - start < UINT8_MAX && end - last <= STATE_JOURNAL_GAP) {
+        if(image[end] != shadow[end]) last = end;
+        end++;
+    }
+    length = last - start + 1;
+    return true;
+}
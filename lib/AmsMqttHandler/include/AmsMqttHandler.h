@@ -14,11 +14,18 @@
 #include "EnergyAccounting.h"
 #include "HwTools.h"
 #include "PriceService.h"
+#include "PublishCache.h"
+#include "TopicTable.h"
+#include "MqttOutbox.h"
+#include "DecimalFormat.h"
+#include "DataSnapshot.h"
 
 #if defined(ESP32)
 #include <esp_task_wdt.h>
 #endif
 
+#define MQTT_MAX_TOPIC_LENGTH 128
+
 class AmsMqttHandler {
 public:
     #if defined(AMS_REMOTE_DEBUG)
@@ -40,7 +47,8 @@ public:
     #endif
 
     void setCaVerification(bool);
-    void setConfig(MqttConfig& mqttConfig);
+    void setSnapshot(DataSnapshot* snapshot);
+    virtual void setConfig(MqttConfig& mqttConfig);
 
     bool connect();
     void disconnect();
@@ -57,11 +65,26 @@ public:
     virtual bool publishRaw(String data) { return false; };
     virtual void onMessage(String &topic, String &payload) {};
 
+    uint32_t getSentCount();
+    uint32_t getSuppressedCount();
+    uint16_t getOutboxDepth();
+    uint32_t getOutboxSpillBytes();
+    uint32_t getOutboxDropCount();
+    virtual uint16_t getDiscoveryPublished() { return 0; };
+    virtual uint16_t getDiscoveryUnchanged() { return 0; };
+    virtual uint32_t getDiscoveryTime() { return 0; };
+
     virtual ~AmsMqttHandler() {
         if(mqttClient != NULL) {
             mqttClient->stop();
             delete mqttClient;
         }
+        if(publishCache != NULL) {
+            delete publishCache;
+        }
+        if(outbox != NULL) {
+            delete outbox;
+        }
     };
 
 protected:
@@ -80,6 +103,15 @@ protected:
     char* json;
     uint16_t BufferSize = 2048;
     uint64_t lastStateUpdate = 0;
+    PublishCache* publishCache = NULL; // Only for the formats that send one value per message
+    MqttOutbox* outbox = NULL; // Only for the formats where a message stands on its own
+    unsigned long lastOutboxDrain = 0;
+    DataSnapshot* snapshot = NULL;
+
+    bool send(const char* topic, const char* payload, bool keep);
+    void drainOutbox();
+    virtual void onConnected() {};
+    virtual void onLoop() {};
 };
 
 #endif
@@ -0,0 +1,79 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _DATASNAPSHOT_H
+#define _DATASNAPSHOT_H
+
+#include "Arduino.h"
+#include "HwTools.h"
+#include "EnergyAccounting.h"
+
+#define DATA_SNAPSHOT_MAX_AGE 10000
+
+enum DataSnapshotEncoding {
+    DataSnapshotWebData = 0 // data.json without the access flag
+};
+#define DATA_SNAPSHOT_ENCODINGS 1
+
+struct DataSnapshotBuffer {
+    char* data;
+    uint16_t length;
+    uint16_t capacity;
+    uint32_t revision; // Snapshot revision it was rendered from
+    uint32_t key; // Whatever else the encoding depends on, given by the caller
+    uint32_t second; // Uptime second it was rendered in, for encodings that carry uptime or clock
+};
+
+/**
+ * Values that every output of a meter frame needs besides the frame itself, read from the
+ * hardware and the price lookup once per frame instead of once per output. The revision moves on
+ * with every frame, or after DATA_SNAPSHOT_MAX_AGE when the meter is quiet. Encodings rendered
+ * from a revision are kept and handed out read-only to everyone asking for the same revision, key
+ * and second, counting how often one was reused and how often it had to be rendered.
+ *
+ * Only the web data.json is cached as an encoding, the MQTT handlers and the cloud connector share
+ * the sampled values but render their own payloads.
+ */
+class DataSnapshot {
+public:
+    DataSnapshot(HwTools* hw, EnergyAccounting* ea);
+    ~DataSnapshot();
+
+    void update();
+    uint32_t getRevision();
+
+    float getVcc();
+    int getWifiRssi();
+    float getTemperature();
+    float getPrice(uint8_t direction);
+
+    const char* get(uint8_t encoding, uint32_t key, uint32_t second, size_t& length);
+    void put(uint8_t encoding, uint32_t key, uint32_t second, const char* data, size_t length);
+
+    uint32_t getHitCount();
+    uint32_t getRenderCount();
+
+private:
+    HwTools* hw;
+    EnergyAccounting* ea;
+
+    bool stale = true;
+    unsigned long sampled = 0;
+    uint32_t revision = 0;
+    float vcc = 0.0;
+    int rssi = 0;
+    float temperature = -127;
+    float importPrice = PRICE_NO_VALUE;
+    float exportPrice = PRICE_NO_VALUE;
+
+    DataSnapshotBuffer buffers[DATA_SNAPSHOT_ENCODINGS];
+    uint32_t hits = 0;
+    uint32_t renders = 0;
+
+    void sample();
+};
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _DECIMALFORMAT_H
+#define _DECIMALFORMAT_H
+
+#include "Arduino.h"
+
+#define DECIMAL_FORMAT_SIZE 32
+
+/**
+ * Writes value with a fixed number of decimals, the same text as String(value, decimals), into buf
+ * which must hold DECIMAL_FORMAT_SIZE bytes. Uses integer arithmetic only, so it neither touches the
+ * heap nor goes through printf for the common case. Returns the length written.
+ *
+ * String goes through dtostrf, which peels off one digit at a time in floating point. For a value
+ * stored within rounding error of a half the two can end up one apart in the last decimal. Without
+ * decimals there is no leading blank, the text is that of String() of the whole number.
+ */
+uint8_t formatDecimal(char* buf, double value, uint8_t decimals);
+
+#endif
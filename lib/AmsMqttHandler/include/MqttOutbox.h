@@ -0,0 +1,73 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MQTTOUTBOX_H
+#define _MQTTOUTBOX_H
+
+#include "Arduino.h"
+
+#if defined(ESP8266)
+    #define MQTT_OUTBOX_SIZE 2048
+    #define MQTT_OUTBOX_SPILL 32768
+#elif defined(ESP32)
+    #define MQTT_OUTBOX_SIZE 8192
+    #define MQTT_OUTBOX_SPILL 131072
+#endif
+
+#define MQTT_OUTBOX_DRAIN_INTERVAL 100
+
+#define MQTT_OUTBOX_KEEP 0x01 // Never replaced by a newer message, may go to flash and is resent with QoS 1
+#define MQTT_OUTBOX_DEAD 0x02 // Replaced by a newer message on the same topic
+
+struct MqttOutboxRecord {
+    uint16_t length; // Header, topic and payload
+    uint8_t flags;
+    uint8_t topicLength;
+};
+
+/**
+ * Messages that could not be published while the broker was away, oldest first. Live values are
+ * coalesced so only the newest per topic waits in RAM, while messages marked keep (the hourly
+ * counters) are all kept and moved to a file in LittleFS when RAM runs out. The file is read back
+ * before RAM, so the order is preserved, and it also survives a restart. The RAM buffer is only
+ * allocated while something is queued.
+ */
+class MqttOutbox {
+public:
+    MqttOutbox(uint16_t size, uint32_t spillLimit);
+    ~MqttOutbox();
+
+    bool push(const char* topic, const char* payload, uint8_t flags);
+    bool isEmpty();
+    bool peek(char* topic, size_t topicSize, char* payload, size_t payloadSize, uint8_t& flags);
+    void pop();
+
+    uint16_t getDepth();
+    uint32_t getSpillBytes();
+    uint32_t getDropCount();
+
+private:
+    uint8_t* buf = NULL;
+    uint16_t size;
+    uint16_t used = 0;
+    uint16_t count = 0;
+
+    uint32_t spillLimit;
+    uint32_t spillSize = 0;
+    uint32_t spillRead = 0;
+    uint16_t spillCount = 0;
+
+    uint32_t dropped = 0;
+
+    void coalesce(const char* topic, uint8_t topicLength);
+    bool makeRoom(uint16_t length);
+    void removeFirst();
+    bool spill(MqttOutboxRecord* record);
+    void openSpill();
+    bool peekSpill(char* topic, size_t topicSize, char* payload, size_t payloadSize, uint8_t& flags);
+};
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _PAYLOADTEMPLATE_H
+#define _PAYLOADTEMPLATE_H
+
+#include "Arduino.h"
+#include "AmsData.h"
+#include "EnergyAccounting.h"
+
+#define PAYLOAD_TEMPLATE_MAX_SIZE 2048
+#define PAYLOAD_TEMPLATE_MAX_OPS 128
+#define PAYLOAD_TEMPLATE_NAME_SIZE 12
+
+enum PayloadField {
+    PayloadFieldLiteral = 0,
+
+    PayloadFieldId,
+    PayloadFieldName,
+    PayloadFieldUptime,
+    PayloadFieldVcc,
+    PayloadFieldRssi,
+    PayloadFieldTemperature,
+
+    PayloadFieldPackageTimestamp,
+    PayloadFieldListId,
+    PayloadFieldMeterId,
+    PayloadFieldMeterModel,
+    PayloadFieldMeterTimestamp,
+    PayloadFieldActiveImportPower,
+    PayloadFieldReactiveImportPower,
+    PayloadFieldActiveExportPower,
+    PayloadFieldReactiveExportPower,
+    PayloadFieldL1ActiveImportPower,
+    PayloadFieldL2ActiveImportPower,
+    PayloadFieldL3ActiveImportPower,
+    PayloadFieldL1ActiveExportPower,
+    PayloadFieldL2ActiveExportPower,
+    PayloadFieldL3ActiveExportPower,
+    PayloadFieldL1Current,
+    PayloadFieldL2Current,
+    PayloadFieldL3Current,
+    PayloadFieldL1Voltage,
+    PayloadFieldL2Voltage,
+    PayloadFieldL3Voltage,
+    PayloadFieldPowerFactor,
+    PayloadFieldL1PowerFactor,
+    PayloadFieldL2PowerFactor,
+    PayloadFieldL3PowerFactor,
+    PayloadFieldActiveImportCounter,
+    PayloadFieldActiveExportCounter,
+    PayloadFieldReactiveImportCounter,
+    PayloadFieldReactiveExportCounter,
+    PayloadFieldL1ActiveImportCounter,
+    PayloadFieldL2ActiveImportCounter,
+    PayloadFieldL3ActiveImportCounter,
+    PayloadFieldL1ActiveExportCounter,
+    PayloadFieldL2ActiveExportCounter,
+    PayloadFieldL3ActiveExportCounter,
+
+    PayloadFieldUseThisHour,
+    PayloadFieldUseToday,
+    PayloadFieldUseThisMonth,
+    PayloadFieldCostThisHour,
+    PayloadFieldCostToday,
+    PayloadFieldCostThisMonth,
+    PayloadFieldProducedThisHour,
+    PayloadFieldProducedToday,
+    PayloadFieldProducedThisMonth,
+    PayloadFieldIncomeThisHour,
+    PayloadFieldIncomeToday,
+    PayloadFieldIncomeThisMonth,
+    PayloadFieldThreshold,
+    PayloadFieldMonthMax,
+    PayloadFieldPrice,
+    PayloadFieldExportPrice
+};
+
+struct PayloadTemplateOp {
+    uint8_t field; // PayloadFieldLiteral for text copied as is
+    uint8_t decimals;
+    uint16_t offset; // Literal text, offset into the literal block
+    uint16_t length;
+};
+
+// Everything a payload can be made from besides the meter data itself
+struct PayloadTemplateSource {
+    AmsData* data;
+    EnergyAccounting* ea;
+    const char* id;
+    const char* name;
+    uint32_t uptime;
+    float vcc;
+    int rssi;
+    float temperature;
+    float price;
+    float exportPrice;
+};
+
+/**
+ * A user defined payload. The text is plain output with placeholders like {{P}} or {{U1:1}}, the
+ * number after the colon overriding the default decimals of the field. Compiling resolves every
+ * placeholder once into a list of operations, literal text spans and field references, so rendering
+ * only walks that list and writes straight into the output buffer. Text fields are written JSON
+ * escaped and a missing price is written as null.
+ */
+class PayloadTemplate {
+public:
+    ~PayloadTemplate();
+
+    bool compile(const char* text, size_t length);
+    void clear();
+    bool isEmpty();
+    size_t render(char* out, size_t size, PayloadTemplateSource& src);
+
+private:
+    char* literals = NULL;
+    PayloadTemplateOp* ops = NULL;
+    uint8_t count = 0;
+
+    bool lookup(const char* name, size_t length, uint8_t& field, uint8_t& decimals);
+    size_t writeString(char* out, size_t size, const char* str);
+};
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _PUBLISHCACHE_H
+#define _PUBLISHCACHE_H
+
+#include "Arduino.h"
+#include "AmsConfiguration.h"
+
+enum PublishDeadband {
+    PublishDeadbandNone = 0, // Any change
+    PublishDeadbandPower = 1,
+    PublishDeadbandVoltage = 2,
+    PublishDeadbandCurrent = 3
+};
+
+struct PublishCacheEntry {
+    double value; // Counters need more than float precision to notice a small step
+    uint32_t lastPublish; // millis(), 0 until first sent
+};
+
+/**
+ * Last published value per topic slot. A value is sent again only when it moved more than both the
+ * absolute deadband for its kind and the relative deadband, or when the heartbeat says it has been
+ * quiet for too long. Counts what was sent and what was held back.
+ */
+class PublishCache {
+public:
+    PublishCache(MqttConfig* config, uint8_t size);
+    ~PublishCache();
+
+    bool shouldPublish(uint8_t slot, double value, PublishDeadband deadband);
+    void clear();
+
+    uint32_t getSentCount();
+    uint32_t getSuppressedCount();
+
+private:
+    MqttConfig* config;
+    PublishCacheEntry* entries;
+    uint8_t size;
+    uint32_t sent = 0;
+    uint32_t suppressed = 0;
+
+    double getAbsolute(PublishDeadband deadband);
+};
+
+#endif
@@ -0,0 +1,33 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _TOPICTABLE_H
+#define _TOPICTABLE_H
+
+#include "Arduino.h"
+
+/**
+ * Every topic a handler publishes to, resolved once from the configured prefix and kept in a single
+ * block. The suffixes are one PROGMEM string with each entry terminated by '\0', in the order of the
+ * handler's index enum.
+ */
+class TopicTable {
+public:
+    ~TopicTable();
+
+    bool build(const char* prefix, PGM_P suffixes, uint8_t count);
+    const char* get(uint8_t index);
+    bool isEmpty();
+
+private:
+    char* topics = NULL;
+    uint16_t* offsets = NULL;
+    uint8_t count = 0;
+
+    void clear();
+};
+
+#endif
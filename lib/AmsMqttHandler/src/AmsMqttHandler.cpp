@@ -13,6 +13,10 @@ void AmsMqttHandler::setCaVerification(bool caVerification) {
 	this->caVerification = caVerification;
 }
 
+void AmsMqttHandler::setSnapshot(DataSnapshot* snapshot) {
+	this->snapshot = snapshot;
+}
+
 void AmsMqttHandler::setConfig(MqttConfig& mqttConfig) {
 	this->mqttConfig = mqttConfig;
 	this->mqttConfigChanged = true;
@@ -133,6 +137,11 @@ debugger->printf_P(PSTR("  Unable to subscribe to to [%s]\n"), mqttConfig.subscr
 		}
 		mqtt.publish(statusTopic, "online", true, 0);
         mqtt.loop();
+		if(publishCache != NULL) {
+			// The broker may have lost what was sent before, so every value goes out once again
+			publishCache->clear();
+		}
+		onConnected();
         return true;
 	} else {
 		#if defined(AMS_REMOTE_DEBUG)
@@ -158,6 +167,52 @@ void AmsMqttHandler::disconnect() {
     yield();
 }
 
+uint32_t AmsMqttHandler::getSentCount() {
+	return publishCache == NULL ? 0 : publishCache->getSentCount();
+}
+
+uint32_t AmsMqttHandler::getSuppressedCount() {
+	return publishCache == NULL ? 0 : publishCache->getSuppressedCount();
+}
+
+uint16_t AmsMqttHandler::getOutboxDepth() {
+	return outbox == NULL ? 0 : outbox->getDepth();
+}
+
+uint32_t AmsMqttHandler::getOutboxSpillBytes() {
+	return outbox == NULL ? 0 : outbox->getSpillBytes();
+}
+
+uint32_t AmsMqttHandler::getOutboxDropCount() {
+	return outbox == NULL ? 0 : outbox->getDropCount();
+}
+
+bool AmsMqttHandler::send(const char* topic, const char* payload, bool keep) {
+	// Anything already waiting has to go out first to keep the order
+	if(outbox == NULL || (mqtt.connected() && outbox->isEmpty())) {
+		if(mqtt.publish(topic, payload)) {
+			return true;
+		}
+		if(outbox == NULL) {
+			return false;
+		}
+	}
+	return outbox->push(topic, payload, keep ? MQTT_OUTBOX_KEEP : 0);
+}
+
+void AmsMqttHandler::drainOutbox() {
+	lastOutboxDrain = millis();
+
+	char topic[MQTT_MAX_TOPIC_LENGTH];
+	uint8_t flags;
+	if(!outbox->peek(topic, MQTT_MAX_TOPIC_LENGTH, json, BufferSize, flags)) {
+		return;
+	}
+	if(mqtt.publish(topic, json, false, (flags & MQTT_OUTBOX_KEEP) ? 1 : 0)) {
+		outbox->pop();
+	}
+}
+
 lwmqtt_err_t AmsMqttHandler::lastError() {
     return mqtt.lastError();
 }
@@ -168,6 +223,13 @@ bool AmsMqttHandler::connected() {
 
 bool AmsMqttHandler::loop() {
     bool ret = mqtt.loop();
+    // One queued message per interval, so a long outage does not flood the broker or stall the meter
+    if(outbox != NULL && mqtt.connected() && !outbox->isEmpty() && millis() - lastOutboxDrain >= MQTT_OUTBOX_DRAIN_INTERVAL) {
+        drainOutbox();
+    }
+    if(mqtt.connected()) {
+        onLoop();
+    }
     delay(10);
     yield();
 	#if defined(ESP32)
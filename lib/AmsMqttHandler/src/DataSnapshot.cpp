@@ -0,0 +1,100 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "DataSnapshot.h"
+
+DataSnapshot::DataSnapshot(HwTools* hw, EnergyAccounting* ea) {
+    this->hw = hw;
+    this->ea = ea;
+    memset(buffers, 0, sizeof(buffers));
+}
+
+DataSnapshot::~DataSnapshot() {
+    for(uint8_t i = 0; i < DATA_SNAPSHOT_ENCODINGS; i++) {
+        if(buffers[i].data != NULL) free(buffers[i].data);
+    }
+}
+
+void DataSnapshot::update() {
+    // Sampled on first use, so a frame nobody looks at costs nothing
+    stale = true;
+}
+
+void DataSnapshot::sample() {
+    if(!stale && millis() - sampled < DATA_SNAPSHOT_MAX_AGE) return;
+
+    vcc = hw->getVcc();
+    rssi = hw->getWifiRssi();
+    temperature = hw->getTemperature();
+    importPrice = ea->getPriceForHour(PRICE_DIRECTION_IMPORT, 0);
+    exportPrice = ea->getPriceForHour(PRICE_DIRECTION_EXPORT, 0);
+
+    sampled = millis();
+    stale = false;
+    revision++;
+}
+
+uint32_t DataSnapshot::getRevision() {
+    sample();
+    return revision;
+}
+
+float DataSnapshot::getVcc() {
+    sample();
+    return vcc;
+}
+
+int DataSnapshot::getWifiRssi() {
+    sample();
+    return rssi;
+}
+
+float DataSnapshot::getTemperature() {
+    sample();
+    return temperature;
+}
+
+float DataSnapshot::getPrice(uint8_t direction) {
+    sample();
+    return direction == PRICE_DIRECTION_EXPORT ? exportPrice : importPrice;
+}
+
+const char* DataSnapshot::get(uint8_t encoding, uint32_t key, uint32_t second, size_t& length) {
+    if(encoding >= DATA_SNAPSHOT_ENCODINGS) return NULL;
+    sample();
+    DataSnapshotBuffer& b = buffers[encoding];
+    if(b.data == NULL || b.revision != revision || b.key != key || b.second != second) return NULL;
+    hits++;
+    length = b.length;
+    return b.data;
+}
+
+void DataSnapshot::put(uint8_t encoding, uint32_t key, uint32_t second, const char* data, size_t length) {
+    if(encoding >= DATA_SNAPSHOT_ENCODINGS) return;
+    renders++;
+    DataSnapshotBuffer& b = buffers[encoding];
+    if(b.data == NULL || b.capacity < length + 1) {
+        // Only ever grows, the size of an encoding hardly changes between frames
+        char* p = (char*) realloc(b.data, length + 1);
+        if(p == NULL) return;
+        b.data = p;
+        b.capacity = length + 1;
+    }
+    memcpy(b.data, data, length);
+    b.data[length] = '\0';
+    b.length = length;
+    b.revision = revision;
+    b.key = key;
+    b.second = second;
+}
+
+uint32_t DataSnapshot::getHitCount() {
+    return hits;
+}
+
+uint32_t DataSnapshot::getRenderCount() {
+    return renders;
+}
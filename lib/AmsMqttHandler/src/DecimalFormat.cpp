@@ -0,0 +1,53 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "DecimalFormat.h"
+
+uint8_t formatDecimal(char* buf, double value, uint8_t decimals) {
+    if(isnan(value)) {
+        strcpy_P(buf, PSTR("nan"));
+        return 3;
+    }
+    if(isinf(value)) {
+        strcpy_P(buf, value < 0 ? PSTR("-inf") : PSTR("inf"));
+        return value < 0 ? 4 : 3;
+    }
+    if(decimals > 10) decimals = 10;
+
+    bool negative = value < 0;
+    if(negative) value = -value;
+
+    double scale = 1;
+    for(uint8_t i = 0; i < decimals; i++) scale *= 10;
+    double scaled = value * scale + 0.5;
+    if(scaled >= 1e18) {
+        // Does not fit in 64 bits, rare enough to leave to printf. Its return value is the length the
+        // text would have had, which can be more than what fit
+        int ret = snprintf_P(buf, DECIMAL_FORMAT_SIZE, PSTR("%.*f"), decimals, negative ? -value : value);
+        if(ret < 0) {
+            buf[0] = '\0';
+            return 0;
+        }
+        return ret < DECIMAL_FORMAT_SIZE ? ret : DECIMAL_FORMAT_SIZE - 1;
+    }
+
+    // Digits come out backwards, the point goes in after the decimals
+    uint64_t n = (uint64_t) scaled;
+    char tmp[DECIMAL_FORMAT_SIZE];
+    uint8_t len = 0;
+    uint8_t min = decimals > 0 ? decimals + 2 : 1;
+    do {
+        tmp[len++] = '0' + (n % 10);
+        n /= 10;
+        if(decimals > 0 && len == decimals) tmp[len++] = '.';
+    } while(n > 0 || len < min);
+
+    uint8_t pos = 0;
+    if(negative) buf[pos++] = '-';
+    while(len > 0) buf[pos++] = tmp[--len];
+    buf[pos] = '\0';
+    return pos;
+}
@@ -0,0 +1,231 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "MqttOutbox.h"
+#include "AmsStorage.h"
+#include "LittleFS.h"
+
+MqttOutbox::MqttOutbox(uint16_t size, uint32_t spillLimit) {
+    this->size = size;
+    this->spillLimit = spillLimit;
+    openSpill();
+}
+
+MqttOutbox::~MqttOutbox() {
+    if(buf != NULL) free(buf);
+}
+
+bool MqttOutbox::push(const char* topic, const char* payload, uint8_t flags) {
+    size_t topicLength = strlen(topic);
+    size_t length = sizeof(MqttOutboxRecord) + topicLength + strlen(payload);
+    if(topicLength > UINT8_MAX || length > size) {
+        dropped++;
+        return false;
+    }
+    if(buf == NULL) {
+        buf = (uint8_t*) malloc(size);
+        if(buf == NULL) {
+            dropped++;
+            return false;
+        }
+    }
+
+    if((flags & MQTT_OUTBOX_KEEP) == 0) {
+        coalesce(topic, topicLength);
+    }
+    if(!makeRoom(length)) {
+        dropped++;
+        return false;
+    }
+
+    MqttOutboxRecord* record = (MqttOutboxRecord*) (buf + used);
+    record->length = length;
+    record->flags = flags & MQTT_OUTBOX_KEEP;
+    record->topicLength = topicLength;
+    memcpy(buf + used + sizeof(MqttOutboxRecord), topic, topicLength);
+    memcpy(buf + used + sizeof(MqttOutboxRecord) + topicLength, payload, length - sizeof(MqttOutboxRecord) - topicLength);
+    used += length;
+    count++;
+    return true;
+}
+
+bool MqttOutbox::isEmpty() {
+    return count == 0 && spillCount == 0;
+}
+
+bool MqttOutbox::peek(char* topic, size_t topicSize, char* payload, size_t payloadSize, uint8_t& flags) {
+    // Whatever went to flash is older than anything still in RAM
+    if(spillCount > 0 && peekSpill(topic, topicSize, payload, payloadSize, flags)) {
+        return true;
+    }
+
+    while(used > 0 && (((MqttOutboxRecord*) buf)->flags & MQTT_OUTBOX_DEAD)) {
+        removeFirst();
+    }
+    if(count == 0) return false;
+
+    MqttOutboxRecord* record = (MqttOutboxRecord*) buf;
+    size_t payloadLength = record->length - sizeof(MqttOutboxRecord) - record->topicLength;
+    size_t t = min((size_t) record->topicLength, topicSize - 1);
+    size_t p = min(payloadLength, payloadSize - 1);
+    memcpy(topic, buf + sizeof(MqttOutboxRecord), t);
+    topic[t] = '\0';
+    memcpy(payload, buf + sizeof(MqttOutboxRecord) + record->topicLength, p);
+    payload[p] = '\0';
+    flags = record->flags;
+    return true;
+}
+
+void MqttOutbox::pop() {
+    if(spillCount > 0) {
+        MqttOutboxRecord record;
+        File file = LittleFS.open(FILE_MQTT_OUTBOX, "r");
+        if(file && file.seek(spillRead) && file.readBytes((char*) &record, sizeof(record)) == sizeof(record)) {
+            spillRead += record.length;
+            spillCount--;
+        } else {
+            spillCount = 0;
+        }
+        file.close();
+        if(spillCount == 0) {
+            LittleFS.remove(FILE_MQTT_OUTBOX);
+            spillSize = spillRead = 0;
+        }
+        return;
+    }
+
+    if(used > 0) {
+        removeFirst();
+    }
+    if(used == 0 && buf != NULL) {
+        free(buf);
+        buf = NULL;
+    }
+}
+
+uint16_t MqttOutbox::getDepth() {
+    return count + spillCount;
+}
+
+uint32_t MqttOutbox::getSpillBytes() {
+    return spillSize - spillRead;
+}
+
+uint32_t MqttOutbox::getDropCount() {
+    return dropped;
+}
+
+void MqttOutbox::coalesce(const char* topic, uint8_t topicLength) {
+    uint16_t pos = 0;
+    while(pos < used) {
+        MqttOutboxRecord* record = (MqttOutboxRecord*) (buf + pos);
+        if(record->flags == 0 && record->topicLength == topicLength && memcmp(buf + pos + sizeof(MqttOutboxRecord), topic, topicLength) == 0) {
+            record->flags |= MQTT_OUTBOX_DEAD;
+            count--;
+        }
+        pos += record->length;
+    }
+}
+
+bool MqttOutbox::makeRoom(uint16_t length) {
+    if(size - used >= length) return true;
+
+    // Replaced messages go first
+    uint16_t read = 0, write = 0;
+    while(read < used) {
+        MqttOutboxRecord* record = (MqttOutboxRecord*) (buf + read);
+        uint16_t len = record->length;
+        if((record->flags & MQTT_OUTBOX_DEAD) == 0) {
+            if(write != read) memmove(buf + write, buf + read, len);
+            write += len;
+        }
+        read += len;
+    }
+    used = write;
+
+    // Then the oldest, counters are moved to flash and live values are given up
+    while(size - used < length && used > 0) {
+        MqttOutboxRecord* record = (MqttOutboxRecord*) buf;
+        if((record->flags & MQTT_OUTBOX_KEEP) == 0 || !spill(record)) {
+            dropped++;
+        }
+        removeFirst();
+    }
+    return size - used >= length;
+}
+
+void MqttOutbox::removeFirst() {
+    MqttOutboxRecord* record = (MqttOutboxRecord*) buf;
+    uint16_t len = record->length;
+    if((record->flags & MQTT_OUTBOX_DEAD) == 0) count--;
+    memmove(buf, buf + len, used - len);
+    used -= len;
+}
+
+bool MqttOutbox::spill(MqttOutboxRecord* record) {
+    if(spillSize + record->length > spillLimit || !LittleFS.begin()) {
+        return false;
+    }
+    File file = LittleFS.open(FILE_MQTT_OUTBOX, "a");
+    if(!file) return false;
+    size_t written = file.write((uint8_t*) record, record->length);
+    file.close();
+    if(written != record->length) {
+        // A partial record would break everything after it
+        spillCount = 0;
+        LittleFS.remove(FILE_MQTT_OUTBOX);
+        spillSize = spillRead = 0;
+        return false;
+    }
+    spillSize += record->length;
+    spillCount++;
+    return true;
+}
+
+void MqttOutbox::openSpill() {
+    if(!LittleFS.begin() || !LittleFS.exists(FILE_MQTT_OUTBOX)) return;
+
+    // Left over from before a restart, count what is readable and send it once connected
+    File file = LittleFS.open(FILE_MQTT_OUTBOX, "r");
+    MqttOutboxRecord record;
+    uint32_t pos = 0;
+    size_t fileSize = file.size();
+    while(pos + sizeof(record) <= fileSize && file.seek(pos) && file.readBytes((char*) &record, sizeof(record)) == sizeof(record)) {
+        if(record.length < sizeof(record) + record.topicLength || pos + record.length > fileSize) break;
+        pos += record.length;
+        spillCount++;
+    }
+    file.close();
+    spillSize = pos;
+    if(spillCount == 0) {
+        LittleFS.remove(FILE_MQTT_OUTBOX);
+        spillSize = 0;
+    }
+}
+
+bool MqttOutbox::peekSpill(char* topic, size_t topicSize, char* payload, size_t payloadSize, uint8_t& flags) {
+    MqttOutboxRecord record;
+    File file = LittleFS.open(FILE_MQTT_OUTBOX, "r");
+    if(!file || !file.seek(spillRead) || file.readBytes((char*) &record, sizeof(record)) != sizeof(record) || record.length < sizeof(record) + record.topicLength) {
+        if(file) file.close();
+        LittleFS.remove(FILE_MQTT_OUTBOX);
+        spillCount = 0;
+        spillSize = spillRead = 0;
+        return false;
+    }
+
+    size_t payloadLength = record.length - sizeof(record) - record.topicLength;
+    size_t t = min((size_t) record.topicLength, topicSize - 1);
+    size_t p = min(payloadLength, payloadSize - 1);
+    file.readBytes(topic, t);
+    topic[t] = '\0';
+    file.seek(spillRead + sizeof(record) + record.topicLength);
+    file.readBytes(payload, p);
+    payload[p] = '\0';
+    file.close();
+    flags = record.flags;
+    return true;
+}
@@ -0,0 +1,290 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "PayloadTemplate.h"
+#include "DecimalFormat.h"
+
+struct PayloadTemplateName {
+    char name[PAYLOAD_TEMPLATE_NAME_SIZE];
+    uint8_t field;
+    uint8_t decimals;
+};
+
+// Same names as the keys of the JSON payload where there is one
+static const PayloadTemplateName PayloadTemplateNames[] PROGMEM = {
+    { "id", PayloadFieldId, 0 },
+    { "name", PayloadFieldName, 0 },
+    { "up", PayloadFieldUptime, 0 },
+    { "vcc", PayloadFieldVcc, 3 },
+    { "rssi", PayloadFieldRssi, 0 },
+    { "temp", PayloadFieldTemperature, 2 },
+    { "t", PayloadFieldPackageTimestamp, 0 },
+    { "lv", PayloadFieldListId, 0 },
+    { "meterId", PayloadFieldMeterId, 0 },
+    { "type", PayloadFieldMeterModel, 0 },
+    { "rtc", PayloadFieldMeterTimestamp, 0 },
+    { "P", PayloadFieldActiveImportPower, 0 },
+    { "Q", PayloadFieldReactiveImportPower, 0 },
+    { "PO", PayloadFieldActiveExportPower, 0 },
+    { "QO", PayloadFieldReactiveExportPower, 0 },
+    { "P1", PayloadFieldL1ActiveImportPower, 0 },
+    { "P2", PayloadFieldL2ActiveImportPower, 0 },
+    { "P3", PayloadFieldL3ActiveImportPower, 0 },
+    { "PO1", PayloadFieldL1ActiveExportPower, 0 },
+    { "PO2", PayloadFieldL2ActiveExportPower, 0 },
+    { "PO3", PayloadFieldL3ActiveExportPower, 0 },
+    { "I1", PayloadFieldL1Current, 2 },
+    { "I2", PayloadFieldL2Current, 2 },
+    { "I3", PayloadFieldL3Current, 2 },
+    { "U1", PayloadFieldL1Voltage, 2 },
+    { "U2", PayloadFieldL2Voltage, 2 },
+    { "U3", PayloadFieldL3Voltage, 2 },
+    { "PF", PayloadFieldPowerFactor, 2 },
+    { "PF1", PayloadFieldL1PowerFactor, 2 },
+    { "PF2", PayloadFieldL2PowerFactor, 2 },
+    { "PF3", PayloadFieldL3PowerFactor, 2 },
+    { "tPI", PayloadFieldActiveImportCounter, 3 },
+    { "tPO", PayloadFieldActiveExportCounter, 3 },
+    { "tQI", PayloadFieldReactiveImportCounter, 3 },
+    { "tQO", PayloadFieldReactiveExportCounter, 3 },
+    { "tPI1", PayloadFieldL1ActiveImportCounter, 3 },
+    { "tPI2", PayloadFieldL2ActiveImportCounter, 3 },
+    { "tPI3", PayloadFieldL3ActiveImportCounter, 3 },
+    { "tPO1", PayloadFieldL1ActiveExportCounter, 3 },
+    { "tPO2", PayloadFieldL2ActiveExportCounter, 3 },
+    { "tPO3", PayloadFieldL3ActiveExportCounter, 3 },
+    { "useHour", PayloadFieldUseThisHour, 2 },
+    { "useDay", PayloadFieldUseToday, 2 },
+    { "useMonth", PayloadFieldUseThisMonth, 2 },
+    { "costHour", PayloadFieldCostThisHour, 2 },
+    { "costDay", PayloadFieldCostToday, 2 },
+    { "costMonth", PayloadFieldCostThisMonth, 2 },
+    { "prodHour", PayloadFieldProducedThisHour, 2 },
+    { "prodDay", PayloadFieldProducedToday, 2 },
+    { "prodMonth", PayloadFieldProducedThisMonth, 2 },
+    { "incomeHour", PayloadFieldIncomeThisHour, 2 },
+    { "incomeDay", PayloadFieldIncomeToday, 2 },
+    { "incomeMonth", PayloadFieldIncomeThisMonth, 2 },
+    { "threshold", PayloadFieldThreshold, 0 },
+    { "monthMax", PayloadFieldMonthMax, 2 },
+    { "price", PayloadFieldPrice, 4 },
+    { "exportPrice", PayloadFieldExportPrice, 4 }
+};
+
+PayloadTemplate::~PayloadTemplate() {
+    clear();
+}
+
+void PayloadTemplate::clear() {
+    if(literals != NULL) {
+        free(literals);
+        literals = NULL;
+    }
+    if(ops != NULL) {
+        free(ops);
+        ops = NULL;
+    }
+    count = 0;
+}
+
+bool PayloadTemplate::isEmpty() {
+    return count == 0;
+}
+
+bool PayloadTemplate::lookup(const char* name, size_t length, uint8_t& field, uint8_t& decimals) {
+    if(length == 0 || length >= PAYLOAD_TEMPLATE_NAME_SIZE) return false;
+    PayloadTemplateName entry;
+    for(uint8_t i = 0; i < sizeof(PayloadTemplateNames) / sizeof(PayloadTemplateNames[0]); i++) {
+        memcpy_P(&entry, &PayloadTemplateNames[i], sizeof(entry));
+        if(strlen(entry.name) == length && strncmp(entry.name, name, length) == 0) {
+            field = entry.field;
+            decimals = entry.decimals;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PayloadTemplate::compile(const char* text, size_t length) {
+    clear();
+    if(length == 0 || length > PAYLOAD_TEMPLATE_MAX_SIZE) return false;
+
+    // Literal text only shrinks when the placeholders are taken out
+    literals = (char*) malloc(length);
+    ops = (PayloadTemplateOp*) malloc(sizeof(PayloadTemplateOp) * PAYLOAD_TEMPLATE_MAX_OPS);
+    if(literals == NULL || ops == NULL) {
+        clear();
+        return false;
+    }
+
+    uint16_t literalLength = 0;
+    size_t i = 0;
+    bool ok = true;
+    while(ok && i < length) {
+        size_t start = i;
+        while(i < length && !(text[i] == '{' && i+1 < length && text[i+1] == '{')) i++;
+        if(i > start) {
+            if(count >= PAYLOAD_TEMPLATE_MAX_OPS) {
+                ok = false;
+                break;
+            }
+            PayloadTemplateOp& op = ops[count++];
+            op.field = PayloadFieldLiteral;
+            op.decimals = 0;
+            op.offset = literalLength;
+            op.length = i - start;
+            memcpy(literals + literalLength, text + start, op.length);
+            literalLength += op.length;
+        }
+        if(i >= length) break;
+
+        size_t nameStart = i + 2;
+        size_t end = nameStart;
+        while(end+1 < length && !(text[end] == '}' && text[end+1] == '}')) end++;
+        if(end+1 >= length || count >= PAYLOAD_TEMPLATE_MAX_OPS) {
+            ok = false;
+            break;
+        }
+
+        size_t nameEnd = nameStart;
+        while(nameEnd < end && text[nameEnd] != ':') nameEnd++;
+
+        PayloadTemplateOp& op = ops[count];
+        if(!lookup(text + nameStart, nameEnd - nameStart, op.field, op.decimals)) {
+            ok = false;
+            break;
+        }
+        if(nameEnd < end) {
+            op.decimals = 0;
+            for(size_t d = nameEnd+1; ok && d < end; d++) {
+                op.decimals = op.decimals * 10 + (text[d] - '0');
+                ok = text[d] >= '0' && text[d] <= '9' && op.decimals <= 8;
+            }
+            if(!ok) break;
+        }
+        op.offset = op.length = 0;
+        count++;
+        i = end + 2;
+    }
+
+    if(!ok) {
+        // Unknown field, a placeholder left open or too many of them
+        clear();
+        return false;
+    }
+
+    PayloadTemplateOp* fitted = (PayloadTemplateOp*) realloc(ops, sizeof(PayloadTemplateOp) * count);
+    if(fitted != NULL) ops = fitted;
+    return count > 0;
+}
+
+size_t PayloadTemplate::writeString(char* out, size_t size, const char* str) {
+    size_t pos = 0;
+    for(const char* p = str; *p != '\0'; p++) {
+        if(*p == '"' || *p == '\\') {
+            if(pos + 2 >= size) break;
+            out[pos++] = '\\';
+        } else if(pos + 1 >= size) {
+            break;
+        }
+        out[pos++] = *p;
+    }
+    return pos;
+}
+
+size_t PayloadTemplate::render(char* out, size_t size, PayloadTemplateSource& src) {
+    if(size == 0) return 0;
+    AmsData* data = src.data;
+    EnergyAccounting* ea = src.ea;
+
+    size_t pos = 0;
+    char num[DECIMAL_FORMAT_SIZE];
+    for(uint8_t i = 0; i < count; i++) {
+        PayloadTemplateOp& op = ops[i];
+        if(op.field == PayloadFieldLiteral) {
+            size_t length = op.length;
+            if(pos + length >= size) length = size - pos - 1;
+            memcpy(out + pos, literals + op.offset, length);
+            pos += length;
+            continue;
+        }
+
+        double value;
+        switch(op.field) {
+            case PayloadFieldId: pos += writeString(out + pos, size - pos, src.id); continue;
+            case PayloadFieldName: pos += writeString(out + pos, size - pos, src.name); continue;
+            case PayloadFieldListId: pos += writeString(out + pos, size - pos, data->getListId().c_str()); continue;
+            case PayloadFieldMeterId: pos += writeString(out + pos, size - pos, data->getMeterId().c_str()); continue;
+            case PayloadFieldMeterModel: pos += writeString(out + pos, size - pos, data->getMeterModel().c_str()); continue;
+            case PayloadFieldUptime: value = src.uptime; break;
+            case PayloadFieldVcc: value = src.vcc; break;
+            case PayloadFieldRssi: value = src.rssi; break;
+            case PayloadFieldTemperature: value = src.temperature; break;
+            case PayloadFieldPackageTimestamp: value = data->getPackageTimestamp(); break;
+            case PayloadFieldMeterTimestamp: value = data->getMeterTimestamp(); break;
+            case PayloadFieldActiveImportPower: value = data->getActiveImportPower(); break;
+            case PayloadFieldReactiveImportPower: value = data->getReactiveImportPower(); break;
+            case PayloadFieldActiveExportPower: value = data->getActiveExportPower(); break;
+            case PayloadFieldReactiveExportPower: value = data->getReactiveExportPower(); break;
+            case PayloadFieldL1ActiveImportPower: value = data->getL1ActiveImportPower(); break;
+            case PayloadFieldL2ActiveImportPower: value = data->getL2ActiveImportPower(); break;
+            case PayloadFieldL3ActiveImportPower: value = data->getL3ActiveImportPower(); break;
+            case PayloadFieldL1ActiveExportPower: value = data->getL1ActiveExportPower(); break;
+            case PayloadFieldL2ActiveExportPower: value = data->getL2ActiveExportPower(); break;
+            case PayloadFieldL3ActiveExportPower: value = data->getL3ActiveExportPower(); break;
+            case PayloadFieldL1Current: value = data->getL1Current(); break;
+            case PayloadFieldL2Current: value = data->getL2Current(); break;
+            case PayloadFieldL3Current: value = data->getL3Current(); break;
+            case PayloadFieldL1Voltage: value = data->getL1Voltage(); break;
+            case PayloadFieldL2Voltage: value = data->getL2Voltage(); break;
+            case PayloadFieldL3Voltage: value = data->getL3Voltage(); break;
+            case PayloadFieldPowerFactor: value = data->getPowerFactor(); break;
+            case PayloadFieldL1PowerFactor: value = data->getL1PowerFactor(); break;
+            case PayloadFieldL2PowerFactor: value = data->getL2PowerFactor(); break;
+            case PayloadFieldL3PowerFactor: value = data->getL3PowerFactor(); break;
+            case PayloadFieldActiveImportCounter: value = data->getActiveImportCounter(); break;
+            case PayloadFieldActiveExportCounter: value = data->getActiveExportCounter(); break;
+            case PayloadFieldReactiveImportCounter: value = data->getReactiveImportCounter(); break;
+            case PayloadFieldReactiveExportCounter: value = data->getReactiveExportCounter(); break;
+            case PayloadFieldL1ActiveImportCounter: value = data->getL1ActiveImportCounter(); break;
+            case PayloadFieldL2ActiveImportCounter: value = data->getL2ActiveImportCounter(); break;
+            case PayloadFieldL3ActiveImportCounter: value = data->getL3ActiveImportCounter(); break;
+            case PayloadFieldL1ActiveExportCounter: value = data->getL1ActiveExportCounter(); break;
+            case PayloadFieldL2ActiveExportCounter: value = data->getL2ActiveExportCounter(); break;
+            case PayloadFieldL3ActiveExportCounter: value = data->getL3ActiveExportCounter(); break;
+            case PayloadFieldUseThisHour: value = ea->getUseThisHour(); break;
+            case PayloadFieldUseToday: value = ea->getUseToday(); break;
+            case PayloadFieldUseThisMonth: value = ea->getUseThisMonth(); break;
+            case PayloadFieldCostThisHour: value = ea->getCostThisHour(); break;
+            case PayloadFieldCostToday: value = ea->getCostToday(); break;
+            case PayloadFieldCostThisMonth: value = ea->getCostThisMonth(); break;
+            case PayloadFieldProducedThisHour: value = ea->getProducedThisHour(); break;
+            case PayloadFieldProducedToday: value = ea->getProducedToday(); break;
+            case PayloadFieldProducedThisMonth: value = ea->getProducedThisMonth(); break;
+            case PayloadFieldIncomeThisHour: value = ea->getIncomeThisHour(); break;
+            case PayloadFieldIncomeToday: value = ea->getIncomeToday(); break;
+            case PayloadFieldIncomeThisMonth: value = ea->getIncomeThisMonth(); break;
+            case PayloadFieldThreshold: value = ea->getCurrentThreshold(); break;
+            case PayloadFieldMonthMax: value = ea->getMonthMax(); break;
+            case PayloadFieldPrice: value = src.price; break;
+            case PayloadFieldExportPrice: value = src.exportPrice; break;
+            default: continue;
+        }
+
+        uint8_t length;
+        if((op.field == PayloadFieldPrice || op.field == PayloadFieldExportPrice) && value == PRICE_NO_VALUE) {
+            strcpy_P(num, PSTR("null"));
+            length = 4;
+        } else {
+            length = formatDecimal(num, value, op.decimals);
+        }
+        if(pos + length >= size) length = size - pos - 1;
+        memcpy(out + pos, num, length);
+        pos += length;
+    }
+    out[pos] = '\0';
+    return pos;
+}
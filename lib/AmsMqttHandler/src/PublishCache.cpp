@@ -0,0 +1,71 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "PublishCache.h"
+
+PublishCache::PublishCache(MqttConfig* config, uint8_t size) {
+    this->config = config;
+    this->size = size;
+    this->entries = new PublishCacheEntry[size];
+    clear();
+}
+
+PublishCache::~PublishCache() {
+    delete[] entries;
+}
+
+bool PublishCache::shouldPublish(uint8_t slot, double value, PublishDeadband deadband) {
+    if(slot >= size) return true;
+    PublishCacheEntry& e = entries[slot];
+
+    uint32_t now = millis();
+    bool publish = e.lastPublish == 0;
+    if(!publish && config->heartbeat > 0 && now - e.lastPublish >= config->heartbeat * 1000UL) {
+        publish = true;
+    }
+    if(!publish) {
+        double diff = fabs(value - e.value);
+        publish = diff > 0 && diff >= getAbsolute(deadband);
+        // Counters and factors have no deadband, every step counts
+        if(publish && deadband != PublishDeadbandNone) {
+            publish = diff >= fabs(e.value) * config->deadbandPercent / 100.0;
+        }
+    }
+
+    if(publish) {
+        e.value = value;
+        e.lastPublish = now == 0 ? 1 : now;
+        sent++;
+    } else {
+        suppressed++;
+    }
+    return publish;
+}
+
+void PublishCache::clear() {
+    memset(entries, 0, sizeof(PublishCacheEntry) * size);
+}
+
+uint32_t PublishCache::getSentCount() {
+    return sent;
+}
+
+uint32_t PublishCache::getSuppressedCount() {
+    return suppressed;
+}
+
+double PublishCache::getAbsolute(PublishDeadband deadband) {
+    switch(deadband) {
+        case PublishDeadbandPower:
+            return config->deadbandPower;
+        case PublishDeadbandVoltage:
+            return config->deadbandVoltage / 10.0;
+        case PublishDeadbandCurrent:
+            return config->deadbandCurrent / 100.0;
+        default:
+            return 0;
+    }
+}
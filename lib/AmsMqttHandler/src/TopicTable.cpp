@@ -0,0 +1,63 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "TopicTable.h"
+
+TopicTable::~TopicTable() {
+    clear();
+}
+
+bool TopicTable::build(const char* prefix, PGM_P suffixes, uint8_t count) {
+    clear();
+    size_t prefixLength = strlen(prefix);
+    if(prefixLength == 0) return false;
+
+    size_t size = 0;
+    PGM_P p = suffixes;
+    for(uint8_t i = 0; i < count; i++) {
+        size_t length = strlen_P(p);
+        size += prefixLength + length + 1;
+        p += length + 1;
+    }
+
+    topics = (char*) malloc(size);
+    offsets = (uint16_t*) malloc(sizeof(uint16_t) * count);
+    if(topics == NULL || offsets == NULL) {
+        clear();
+        return false;
+    }
+
+    uint16_t pos = 0;
+    p = suffixes;
+    for(uint8_t i = 0; i < count; i++) {
+        offsets[i] = pos;
+        memcpy(topics + pos, prefix, prefixLength);
+        pos += prefixLength;
+        strcpy_P(topics + pos, p);
+        size_t length = strlen_P(p);
+        pos += length + 1;
+        p += length + 1;
+    }
+    this->count = count;
+    return true;
+}
+
+const char* TopicTable::get(uint8_t index) {
+    if(index >= count) return "";
+    return topics + offsets[index];
+}
+
+bool TopicTable::isEmpty() {
+    return count == 0;
+}
+
+void TopicTable::clear() {
+    if(topics != NULL) free(topics);
+    if(offsets != NULL) free(offsets);
+    topics = NULL;
+    offsets = NULL;
+    count = 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _CALENDAR_H
+#define _CALENDAR_H
+
+#include "Arduino.h"
+#include "TimeLib.h"
+#include "Timezone.h"
+
+/**
+ * Caches the broken down UTC and local time for the current hour, together with the UTC epoch
+ * of the surrounding local hour, day and month boundaries. update() only runs breakTime() and the
+ * timezone rules again once time leaves the cached hour, which is also where DST changes happen.
+ */
+class Calendar {
+public:
+    void setTimezone(Timezone* tz);
+    Timezone* getTimezone();
+
+    bool update(time_t now);
+    void breakLocal(time_t t, tmElements_t& tm);
+
+    tmElements_t& getUtc();
+    tmElements_t& getLocal();
+    int32_t getOffset();
+
+    time_t getHourStart();
+    time_t getNextHour();
+    time_t getDayStart();
+    time_t getNextDay();
+    time_t getMonthStart();
+    time_t getNextMonth();
+
+    bool isSameHour(time_t t);
+    bool isSameDay(time_t t);
+    bool isSameMonth(time_t t);
+
+    uint32_t getRecomputeCount();
+
+private:
+    Timezone* tz = NULL;
+
+    tmElements_t utc;
+    tmElements_t local;
+    int32_t offset = 0;
+
+    time_t validFrom = 0, validUntil = 0;
+    time_t hourStart = 0, nextHour = 0;
+    time_t dayStart = 0, nextDay = 0;
+    time_t monthStart = 0, nextMonth = 0;
+
+    uint32_t recomputed = 0;
+
+    void recompute(time_t now);
+    time_t toUtc(time_t local);
+};
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "Calendar.h"
+
+void Calendar::setTimezone(Timezone* tz) {
+    this->tz = tz;
+    validFrom = validUntil = 0;
+}
+
+Timezone* Calendar::getTimezone() {
+    return tz;
+}
+
+bool Calendar::update(time_t now) {
+    if(now < validFrom || now >= validUntil) {
+        recompute(now);
+        return true;
+    }
+
+    // Within the cached hour only minutes and seconds move
+    utc.Second = now % 60;
+    utc.Minute = (now % SECS_PER_HOUR) / 60;
+    time_t l = now + offset;
+    local.Second = l % 60;
+    local.Minute = (l % SECS_PER_HOUR) / 60;
+    return false;
+}
+
+void Calendar::breakLocal(time_t t, tmElements_t& tm) {
+    if(t >= validFrom && t < validUntil) {
+        tm = local;
+        time_t l = t + offset;
+        tm.Second = l % 60;
+        tm.Minute = (l % SECS_PER_HOUR) / 60;
+    } else {
+        breakTime(tz == NULL ? t : tz->toLocal(t), tm);
+    }
+}
+
+tmElements_t& Calendar::getUtc() {
+    return utc;
+}
+
+tmElements_t& Calendar::getLocal() {
+    return local;
+}
+
+int32_t Calendar::getOffset() {
+    return offset;
+}
+
+time_t Calendar::getHourStart() {
+    return hourStart;
+}
+
+time_t Calendar::getNextHour() {
+    return nextHour;
+}
+
+time_t Calendar::getDayStart() {
+    return dayStart;
+}
+
+time_t Calendar::getNextDay() {
+    return nextDay;
+}
+
+time_t Calendar::getMonthStart() {
+    return monthStart;
+}
+
+time_t Calendar::getNextMonth() {
+    return nextMonth;
+}
+
+bool Calendar::isSameHour(time_t t) {
+    return t >= hourStart && t < nextHour;
+}
+
+bool Calendar::isSameDay(time_t t) {
+    return t >= dayStart && t < nextDay;
+}
+
+bool Calendar::isSameMonth(time_t t) {
+    return t >= monthStart && t < nextMonth;
+}
+
+uint32_t Calendar::getRecomputeCount() {
+    return recomputed;
+}
+
+void Calendar::recompute(time_t now) {
+    offset = tz == NULL ? 0 : tz->toLocal(now) - now;
+    time_t l = now + offset;
+    breakTime(now, utc);
+    breakTime(l, local);
+
+    // Timezone rules change offset on whole local hours, so the offset is constant within the local hour
+    hourStart = now - (l % SECS_PER_HOUR);
+    nextHour = hourStart + SECS_PER_HOUR;
+
+    time_t midnight = previousMidnight(l);
+    dayStart = toUtc(midnight);
+    nextDay = toUtc(midnight + SECS_PER_DAY);
+
+    tmElements_t tm = local;
+    tm.Day = 1;
+    tm.Hour = tm.Minute = tm.Second = 0;
+    monthStart = toUtc(makeTime(tm));
+    if(++tm.Month > 12) {
+        tm.Month = 1;
+        tm.Year++;
+    }
+    nextMonth = toUtc(makeTime(tm));
+
+    // UTC fields must stay correct too, which for zones with half hour offsets means a shorter window
+    time_t utcHourStart = now - (now % SECS_PER_HOUR);
+    validFrom = max(hourStart, utcHourStart);
+    validUntil = min(nextHour, utcHourStart + (time_t) SECS_PER_HOUR);
+    recomputed++;
+}
+
+time_t Calendar::toUtc(time_t local) {
+    return tz == NULL ? local : tz->toUTC(local);
+}
@@ -19,12 +19,14 @@
 #include "mbedtls/error.h"
 #include "mbedtls/certs.h"
 #include "mbedtls/rsa.h"
+#include "mbedtls/gcm.h"
 #include "AmsConfiguration.h"
 #include "AmsData.h"
 #include "EnergyAccounting.h"
 #include "HwTools.h"
 #include "AmsMqttHandler.h"
 #include "ConnectionHandler.h"
+#include "HttpClientPool.h"
 
 #if defined(ESP8266)
 	#include <ESP8266HTTPClient.h>
@@ -39,6 +41,28 @@
 
 #define CC_BUF_SIZE 4096
 
+/*
+ * Every update is sent as one frame encrypted with AES-GCM under a session key. The session key
+ * is RSA encrypted with the public key of the cloud once per session and sent along in the first
+ * frame and every CC_SESSION_KEY_REPEAT frames after, so a receiver that lost it catches up. A
+ * frame with the key that is not delivered makes the next frame carry it again. The counter moves
+ * on either way, a nonce is never used twice under the same key.
+ *
+ *   magic "AMS" and version (4) | nonce (12) | wrapped key length (2, big endian) |
+ *   wrapped key (0 or RSA length) | ciphertext | tag (16)
+ *
+ * The nonce is a random session id (4) followed by a frame counter (8, big endian), and the first
+ * 18 bytes are authenticated along with the payload.
+ */
+#define CC_SESSION_VERSION 1
+#define CC_SESSION_KEY_SIZE 16
+#define CC_SESSION_NONCE_SIZE 12
+#define CC_SESSION_HEADER_SIZE 18
+#define CC_SESSION_TAG_SIZE 16
+#define CC_SESSION_KEY_REPEAT 10
+#define CC_SESSION_LIFETIME 86400000
+#define CC_WRAPPED_KEY_SIZE 256
+
 static const char CC_JSON_POWER[] PROGMEM = ",\"%s\":{\"P\":%lu,\"Q\":%lu}";
 static const char CC_JSON_POWER_LIST3[] PROGMEM = ",\"%s\":{\"P\":%lu,\"Q\":%lu,\"tP\":%.3f,\"tQ\":%.3f}";
 static const char CC_JSON_PHASE[] PROGMEM = "%s\"%d\":{\"u\":%.2f,\"i\":%s}";
@@ -54,9 +78,9 @@ struct CloudData {
 class CloudConnector {
 public:
     #if defined(AMS_REMOTE_DEBUG)
-    CloudConnector(RemoteDebug*);
+    CloudConnector(RemoteDebug*, HttpClientPool*);
     #else
-    CloudConnector(Stream*);
+    CloudConnector(Stream*, HttpClientPool*);
     #endif
     bool setup(CloudConfig& config, MeterConfig& meter, SystemConfig& system, NtpConfig& ntp, HwTools* hw, ResetDataContainer* rdc, PriceService* ps);
     void setMqttHandler(AmsMqttHandler* mqttHandler);
@@ -66,6 +90,7 @@ public:
     void forceUpdate();
     void forcePriceUpdate();
     void setConnectionHandler(ConnectionHandler* ch);
+    void setSnapshot(DataSnapshot* snapshot);
     String generateSeed();
 
 private:
@@ -76,6 +101,7 @@ private:
     #endif
     HwTools* hw = NULL;
     ConnectionHandler* ch = NULL;
+    DataSnapshot* snapshot = NULL;
     ResetDataContainer* rdc = NULL;
     PriceService* ps = NULL;
     AmsMqttHandler* mqttHandler = NULL;
@@ -84,7 +110,7 @@ private:
     unsigned long lastPriceConfig = 0;
     EnergyAccountingConfig eac;
     unsigned long lastEac = 0;
-    HTTPClient http;
+    HttpClientPool* pool = NULL;
     WiFiUDP udp;
     WiFiClient tcp;
 	int maxPwr = 0;
@@ -103,13 +129,20 @@ private:
 
     char clearBuffer[CC_BUF_SIZE];
     uint8_t* httpBuffer = NULL;
-    unsigned char encryptedBuffer[256];
+    unsigned char wrappedKey[CC_WRAPPED_KEY_SIZE];
     mbedtls_rsa_context* rsa = nullptr;
+    mbedtls_gcm_context gcm;
+    bool session = false;
+    uint32_t sessionId = 0;
+    uint64_t sessionCounter = 0;
+    bool sessionKeyPending = false;
+    unsigned long sessionStart = 0;
     mbedtls_ctr_drbg_context ctr_drbg;
     mbedtls_entropy_context entropy;
     char* pers = "amsreader";
 
     bool init();
+    bool startSession();
     void debugPrint(byte *buffer, int start, int length);
 
     String meterManufacturer(uint8_t type) {
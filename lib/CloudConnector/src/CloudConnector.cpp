@@ -24,17 +24,13 @@
 #endif
 
 #if defined(AMS_REMOTE_DEBUG)
-CloudConnector::CloudConnector(RemoteDebug* debugger) {
+CloudConnector::CloudConnector(RemoteDebug* debugger, HttpClientPool* pool) {
 #else
-CloudConnector::CloudConnector(Stream* debugger) {
+CloudConnector::CloudConnector(Stream* debugger, HttpClientPool* pool) {
 #endif
     this->debugger = debugger;
-
-    http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
-    http.setReuse(false);
-    http.setTimeout(60000);
-    http.setUserAgent("ams2mqtt/" + String(FirmwareVersion::VersionString));
-    http.useHTTP10(true);
+    this->pool = pool;
+    mbedtls_gcm_init(&gcm);
 
     uint8_t mac[6];
     uint8_t apmac[6];
@@ -94,14 +90,10 @@ bool CloudConnector::init() {
         if (debugger->isActive(RemoteDebug::INFO))
         #endif
         debugger->printf_P(PSTR("(CloudConnector) Downloading public key from %s\n"), clearBuffer);
-        #if defined(ESP8266)
-        WiFiClient client;
-        client.setTimeout(5000);
-        if(http.begin(client, clearBuffer)) {
-        #elif defined(ESP32)
-        if(http.begin(clearBuffer)) {
-        #endif
-            int status = http.GET();
+        HTTPClient* http = pool->begin(clearBuffer);
+        if(http != NULL) {
+            http->useHTTP10(true);
+            int status = http->GET();
 
             #if defined(ESP32)
                 esp_task_wdt_reset();
@@ -110,8 +102,8 @@ bool CloudConnector::init() {
             #endif
 
             if(status == HTTP_CODE_OK) {
-                String pub = http.getString();
-                http.end();
+                String pub = http->getString();
+                pool->end(http);
 
                 memset(clearBuffer, 0, CC_BUF_SIZE);
                 snprintf(clearBuffer, CC_BUF_SIZE, pub.c_str());
@@ -122,6 +114,7 @@ bool CloudConnector::init() {
                 int error_code = 0;
                 if((error_code =  mbedtls_pk_parse_public_key(&pk, (unsigned char*) clearBuffer, strlen((const char*) clearBuffer)+1)) == 0){
                     rsa = mbedtls_pk_rsa(pk);
+                    session = false;
                     mbedtls_ctr_drbg_init(&ctr_drbg);
                     mbedtls_entropy_init(&entropy);
 
@@ -154,14 +147,14 @@ bool CloudConnector::init() {
                 #if defined(AMS_REMOTE_DEBUG)
                 if (debugger->isActive(RemoteDebug::ERROR))
                 #endif
-                debugger->printf(http.errorToString(status).c_str());
+                debugger->printf(http->errorToString(status).c_str());
                 debugger->println();
                 #if defined(AMS_REMOTE_DEBUG)
                 if (debugger->isActive(RemoteDebug::DEBUG))
                 #endif
-                debugger->printf(http.getString().c_str());
+                debugger->printf(http->getString().c_str());
 
-                http.end();
+                pool->end(http);
             }
         }
     }
@@ -334,7 +327,11 @@ void CloudConnector::update(AmsData& data, EnergyAccounting& ea) {
         float vcc = 0.0;
         int rssi = 0;
         float temperature = -127;
-        if(hw != NULL) {
+        if(snapshot != NULL) {
+            vcc = snapshot->getVcc();
+            rssi = snapshot->getWifiRssi();
+            temperature = snapshot->getTemperature();
+        } else if(hw != NULL) {
             vcc = hw->getVcc();
             rssi = hw->getWifiRssi();
             temperature = hw->getTemperature();
@@ -460,23 +457,56 @@ void CloudConnector::update(AmsData& data, EnergyAccounting& ea) {
     uint16_t crc = crc16((uint8_t*) clearBuffer, pos);
     pos += snprintf_P(clearBuffer+pos, CC_BUF_SIZE-pos, PSTR(",\"crc\":\"%04X\"}"), crc);
 
-    if(rsa == nullptr) return;
-    int ret = mbedtls_rsa_check_pubkey(rsa);
+    if(rsa == nullptr || pos >= CC_BUF_SIZE) return;
+    unsigned long encryptStart = micros();
+    if(!session || now - sessionStart >= CC_SESSION_LIFETIME) {
+        int ret = mbedtls_rsa_check_pubkey(rsa);
+        if(ret != 0) {
+            #if defined(AMS_REMOTE_DEBUG)
+            if (debugger->isActive(RemoteDebug::ERROR))
+            #endif
+            debugger->printf_P(PSTR("mbedtls_rsa_check_pubkey return code: %d\n"), ret);
+            mbedtls_strerror(ret, clearBuffer, CC_BUF_SIZE);
+            #if defined(AMS_REMOTE_DEBUG)
+            if (debugger->isActive(RemoteDebug::ERROR))
+            #endif
+            debugger->printf_P(PSTR("%s\n"), clearBuffer);
+            return;
+        }
+        if(!startSession()) return;
+    }
+
+    uint16_t keyLength = sessionKeyPending || sessionCounter % CC_SESSION_KEY_REPEAT == 0 ? rsa->len : 0;
+    uint8_t header[CC_SESSION_HEADER_SIZE];
+    header[0] = 'A';
+    header[1] = 'M';
+    header[2] = 'S';
+    header[3] = CC_SESSION_VERSION;
+    uint8_t* nonce = header + 4;
+    memcpy(nonce, &sessionId, sizeof(sessionId));
+    for(uint8_t i = 0; i < 8; i++) {
+        nonce[4 + i] = sessionCounter >> (56 - (i * 8));
+    }
+    header[16] = keyLength >> 8;
+    header[17] = keyLength & 0xFF;
+
+    // Encrypted in place, the frame is written from its parts below without another copy
+    uint8_t tag[CC_SESSION_TAG_SIZE];
+    int ret = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, pos, nonce, CC_SESSION_NONCE_SIZE, header, CC_SESSION_HEADER_SIZE, (unsigned char*) clearBuffer, (unsigned char*) clearBuffer, CC_SESSION_TAG_SIZE, tag);
+    unsigned long encryptTime = micros() - encryptStart;
     if(ret != 0) {
         #if defined(AMS_REMOTE_DEBUG)
         if (debugger->isActive(RemoteDebug::ERROR))
         #endif
-        debugger->printf_P(PSTR("mbedtls_rsa_pkcs1_encrypt return code: %d\n"), ret);
-        mbedtls_strerror(ret, clearBuffer, CC_BUF_SIZE);
-        #if defined(AMS_REMOTE_DEBUG)
-        if (debugger->isActive(RemoteDebug::ERROR))
-        #endif
-        debugger->printf_P(PSTR("%s\n"), clearBuffer);
+        debugger->printf_P(PSTR("mbedtls_gcm_crypt_and_tag return code: %d\n"), ret);
+        session = false;
         return;
     }
-    memset(encryptedBuffer, 0, rsa->len);
-
-    int maxlen = rsa->len - 11; // 11 should be the correct padding size for PKCS1
+    sessionCounter++;
+    if(keyLength > 0) {
+        // Cleared once the frame is delivered
+        sessionKeyPending = true;
+    }
 
     Stream *stream = NULL;
 
@@ -498,55 +528,47 @@ void CloudConnector::update(AmsData& data, EnergyAccounting& ea) {
         while(tcp.available()) tcp.read(); // Empty incoming buffer
         stream = &tcp;
     } else if(config.proto == 2) {
-        if(!http.connected()) {
-            http.setReuse(true);
-            snprintf_P(clearBuffer, CC_BUF_SIZE, PSTR("http://%s/hub/cloud/data"), config.hostname);
-            if(!http.begin(clearBuffer)) {
-                #if defined(AMS_REMOTE_DEBUG)
-                if (debugger->isActive(RemoteDebug::ERROR))
-                #endif
-                debugger->printf_P(PSTR("(CloudConnector) Unable to start HTTP connector\n"));
-                http.end();
-                return;
-            }
-        }
         if(httpBuffer == NULL) {
-            httpBuffer = (uint8_t*) malloc(CC_BUF_SIZE);
+            httpBuffer = (uint8_t*) malloc(CC_SESSION_HEADER_SIZE + CC_WRAPPED_KEY_SIZE + CC_BUF_SIZE + CC_SESSION_TAG_SIZE);
+            if(httpBuffer == NULL) return;
         }
     }
 
-    int sendBytes = 0;
-    for(int i = 0; i < pos; i += maxlen) {
-        int ret = mbedtls_rsa_pkcs1_encrypt(rsa, mbedtls_ctr_drbg_random, &ctr_drbg, MBEDTLS_RSA_PUBLIC, maxlen, (unsigned char*) (clearBuffer+i), encryptedBuffer);
-        if(ret == 0) {
-            if(stream != NULL) {
-                stream->write(encryptedBuffer, rsa->len);
-            } else {
-                memcpy(httpBuffer + sendBytes, encryptedBuffer, rsa->len);
-            }
-            sendBytes += rsa->len;
-            delay(1);
-        } else {
-            #if defined(AMS_REMOTE_DEBUG)
-            if (debugger->isActive(RemoteDebug::ERROR))
-            #endif
-            debugger->printf_P(PSTR("mbedtls_rsa_pkcs1_encrypt return code: %d\n"), ret);
-            mbedtls_strerror(ret, clearBuffer, CC_BUF_SIZE);
-            #if defined(AMS_REMOTE_DEBUG)
-            if (debugger->isActive(RemoteDebug::ERROR))
-            #endif
-            debugger->printf_P(PSTR("%s\n"), clearBuffer);
-        }
+    int sendBytes = CC_SESSION_HEADER_SIZE + keyLength + pos + CC_SESSION_TAG_SIZE;
+    bool delivered = false;
+    if(stream != NULL) {
+        size_t written = stream->write(header, CC_SESSION_HEADER_SIZE);
+        written += stream->write(wrappedKey, keyLength);
+        written += stream->write((uint8_t*) clearBuffer, pos);
+        written += stream->write(tag, CC_SESSION_TAG_SIZE);
+        delivered = written == (size_t) sendBytes;
+    } else {
+        memcpy(httpBuffer, header, CC_SESSION_HEADER_SIZE);
+        memcpy(httpBuffer + CC_SESSION_HEADER_SIZE, wrappedKey, keyLength);
+        memcpy(httpBuffer + CC_SESSION_HEADER_SIZE + keyLength, clearBuffer, pos);
+        memcpy(httpBuffer + CC_SESSION_HEADER_SIZE + keyLength + pos, tag, CC_SESSION_TAG_SIZE);
     }
 
     if(config.proto == 0) {
-        udp.endPacket();
+        delivered &= udp.endPacket() == 1;
     } else if(config.proto == 1) {
         tcp.write("\r\n");
         tcp.flush();
     } else if(config.proto == 2) {
-        http.addHeader("Content-Type", "application/octet-stream");
-        int status = http.POST(httpBuffer, sendBytes);
+        char url[96];
+        snprintf_P(url, sizeof(url), PSTR("http://%s/hub/cloud/data"), config.hostname);
+        HTTPClient* http = pool->begin(url);
+        if(http == NULL) {
+            #if defined(AMS_REMOTE_DEBUG)
+            if (debugger->isActive(RemoteDebug::ERROR))
+            #endif
+            debugger->printf_P(PSTR("(CloudConnector) Unable to start HTTP connector\n"));
+            return;
+        }
+        http->useHTTP10(true);
+        http->addHeader("Content-Type", "application/octet-stream");
+        int status = http->POST(httpBuffer, sendBytes);
+        delivered = status == 200;
         if(status != 200) {
             #if defined(AMS_REMOTE_DEBUG)
             if (debugger->isActive(RemoteDebug::ERROR))
@@ -555,22 +577,61 @@ void CloudConnector::update(AmsData& data, EnergyAccounting& ea) {
             #if defined(AMS_REMOTE_DEBUG)
             if (debugger->isActive(RemoteDebug::ERROR))
             #endif
-            debugger->printf(http.errorToString(status).c_str());
+            debugger->printf(http->errorToString(status).c_str());
             debugger->println();
             #if defined(AMS_REMOTE_DEBUG)
             if (debugger->isActive(RemoteDebug::DEBUG))
             #endif
-            debugger->printf(http.getString().c_str());
-
-            http.end();
+            debugger->printf(http->getString().c_str());
         }
+        pool->end(http);
+    }
+    if(delivered) {
+        sessionKeyPending = false;
     }
     lastUpdate = now;
 
     #if defined(AMS_REMOTE_DEBUG)
     if (debugger->isActive(RemoteDebug::DEBUG))
     #endif
-    debugger->printf_P(PSTR("%d bytes sent to %s:%d from %s\n"), sendBytes, config.hostname, config.proto == 2 ? 80 : config.port, uuid.c_str());
+    debugger->printf_P(PSTR("%d bytes sent to %s:%d from %s, encrypted in %lu us\n"), sendBytes, config.hostname, config.proto == 2 ? 80 : config.port, uuid.c_str(), encryptTime);
+}
+
+bool CloudConnector::startSession() {
+    if(rsa->len > CC_WRAPPED_KEY_SIZE) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::ERROR))
+        #endif
+        debugger->printf_P(PSTR("(CloudConnector) RSA key of %d bytes is too large\n"), rsa->len);
+        return false;
+    }
+
+    // The only RSA operation of a session, every update after this is symmetric
+    uint8_t key[CC_SESSION_KEY_SIZE];
+    int ret = mbedtls_ctr_drbg_random(&ctr_drbg, key, CC_SESSION_KEY_SIZE);
+    if(ret == 0) {
+        ret = mbedtls_ctr_drbg_random(&ctr_drbg, (unsigned char*) &sessionId, sizeof(sessionId));
+    }
+    if(ret == 0) {
+        ret = mbedtls_rsa_pkcs1_encrypt(rsa, mbedtls_ctr_drbg_random, &ctr_drbg, MBEDTLS_RSA_PUBLIC, CC_SESSION_KEY_SIZE, key, wrappedKey);
+    }
+    if(ret == 0) {
+        ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, CC_SESSION_KEY_SIZE * 8);
+    }
+    memset(key, 0, CC_SESSION_KEY_SIZE);
+    if(ret != 0) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::ERROR))
+        #endif
+        debugger->printf_P(PSTR("(CloudConnector) Unable to start session, return code: %d\n"), ret);
+        session = false;
+        return false;
+    }
+
+    sessionCounter = 0;
+    sessionStart = millis();
+    session = true;
+    return true;
 }
 
 void CloudConnector::forceUpdate() {
@@ -587,6 +648,10 @@ void CloudConnector::setConnectionHandler(ConnectionHandler* ch) {
 	this->ch = ch;
 }
 
+void CloudConnector::setSnapshot(DataSnapshot* snapshot) {
+	this->snapshot = snapshot;
+}
+
 void CloudConnector::setPriceConfig(PriceServiceConfig& priceConfig) {
     this->priceConfig = priceConfig;
     this->lastPriceConfig = 0;
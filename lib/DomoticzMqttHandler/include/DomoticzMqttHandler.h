@@ -10,15 +10,29 @@
 #include "AmsMqttHandler.h"
 #include "AmsConfiguration.h"
 
+enum DomoticzMqttSlot {
+    DomoticzSlotPower = 0,
+    DomoticzSlotEnergy = 1,
+    DomoticzSlotL1Voltage = 2,
+    DomoticzSlotL2Voltage = 3,
+    DomoticzSlotL3Voltage = 4,
+    DomoticzSlotL1Current = 5,
+    DomoticzSlotL2Current = 6,
+    DomoticzSlotL3Current = 7
+};
+#define DOMOTICZ_MQTT_SLOTS 8
+
 class DomoticzMqttHandler : public AmsMqttHandler {
 public:
     #if defined(AMS_REMOTE_DEBUG)
     DomoticzMqttHandler(MqttConfig& mqttConfig, RemoteDebug* debugger, char* buf, DomoticzConfig config) : AmsMqttHandler(mqttConfig, debugger, buf) {
         this->config = config;
+        publishCache = new PublishCache(&this->mqttConfig, DOMOTICZ_MQTT_SLOTS);
     };
     #else
     DomoticzMqttHandler(MqttConfig& mqttConfig, Stream* debugger, char* buf, DomoticzConfig config) : AmsMqttHandler(mqttConfig, debugger, buf) {
         this->config = config;
+        publishCache = new PublishCache(&this->mqttConfig, DOMOTICZ_MQTT_SLOTS);
     };
     #endif
     bool publish(AmsData* data, AmsData* previousState, EnergyAccounting* ea, PriceService* ps);
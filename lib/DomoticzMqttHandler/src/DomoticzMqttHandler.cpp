@@ -26,7 +26,10 @@ bool DomoticzMqttHandler::publish(AmsData* update, AmsData* previousState, Energ
         if(data.getActiveImportCounter() > 1.0 && !data.isCounterEstimated()) {
             energy = data.getActiveImportCounter();
         }
-        if(energy > 0.0) {
+        // Both are checked so the cache keeps track of each, the device takes them together
+        bool changed = publishCache->shouldPublish(DomoticzSlotPower, data.getActiveImportPower(), PublishDeadbandPower);
+        changed |= publishCache->shouldPublish(DomoticzSlotEnergy, energy, PublishDeadbandNone);
+        if(energy > 0.0 && changed) {
             char val[16];
             snprintf_P(val, 16, PSTR("%.1f;%.1f"), (data.getActiveImportPower()/1.0), energy*1000.0);
             snprintf_P(json, BufferSize, DOMOTICZ_JSON,
@@ -41,7 +44,7 @@ bool DomoticzMqttHandler::publish(AmsData* update, AmsData* previousState, Energ
     if(data.getListType() == 1)
         return ret;
 
-    if (config.vl1idx > 0){				
+    if (config.vl1idx > 0 && publishCache->shouldPublish(DomoticzSlotL1Voltage, data.getL1Voltage(), PublishDeadbandVoltage)){				
         char val[16];
         snprintf_P(val, 16, PSTR("%.2f"), data.getL1Voltage());
         snprintf_P(json, BufferSize, DOMOTICZ_JSON,
@@ -52,7 +55,7 @@ bool DomoticzMqttHandler::publish(AmsData* update, AmsData* previousState, Energ
         mqtt.loop();
     }
 
-    if (config.vl2idx > 0){				
+    if (config.vl2idx > 0 && publishCache->shouldPublish(DomoticzSlotL2Voltage, data.getL2Voltage(), PublishDeadbandVoltage)){				
         char val[16];
         snprintf_P(val, 16, PSTR("%.2f"), data.getL2Voltage());
         snprintf_P(json, BufferSize, DOMOTICZ_JSON,
@@ -63,7 +66,7 @@ bool DomoticzMqttHandler::publish(AmsData* update, AmsData* previousState, Energ
         mqtt.loop();
     }
 
-    if (config.vl3idx > 0){				
+    if (config.vl3idx > 0 && publishCache->shouldPublish(DomoticzSlotL3Voltage, data.getL3Voltage(), PublishDeadbandVoltage)){				
         char val[16];
         snprintf(val, 16, "%.2f", data.getL3Voltage());
         snprintf_P(json, BufferSize, DOMOTICZ_JSON,
@@ -74,7 +77,11 @@ bool DomoticzMqttHandler::publish(AmsData* update, AmsData* previousState, Energ
         mqtt.loop();
     }
 
-    if (config.cl1idx > 0){				
+    if (config.cl1idx > 0){
+        bool changed = publishCache->shouldPublish(DomoticzSlotL1Current, data.getL1Current(), PublishDeadbandCurrent);
+        changed |= publishCache->shouldPublish(DomoticzSlotL2Current, data.getL2Current(), PublishDeadbandCurrent);
+        changed |= publishCache->shouldPublish(DomoticzSlotL3Current, data.getL3Current(), PublishDeadbandCurrent);
+        if(!changed) return ret;
         char val[16];
         snprintf(val, 16, "%.1f;%.1f;%.1f", data.getL1Current(), data.getL2Current(), data.getL3Current());
         snprintf_P(json, BufferSize, DOMOTICZ_JSON,
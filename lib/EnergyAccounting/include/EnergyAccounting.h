@@ -62,17 +62,24 @@ struct EnergyAccountingData2 {
     uint16_t costLastMonth;
 };
 
+#define EA_REALTIME_MAGIC 0x6B
+
+// Energy in mWh and money in micro-currency, converted to float only when read
 struct EnergyAccountingRealtimeData {
     uint8_t magic;
     uint8_t currentHour;
     uint8_t currentDay;
     uint8_t currentThresholdIdx;
-    float use;
-    float costHour;
-    float costDay;
-    float produce;
-    float incomeHour;
-    float incomeDay;
+    uint32_t use;
+    uint32_t produce;
+    uint16_t useRemainder; // Watt-milliseconds not yet counted as a whole mWh
+    uint16_t produceRemainder;
+    int32_t costRemainder; // Fractions of micro-currency carried to the next update
+    int32_t incomeRemainder;
+    int64_t costHour;
+    int64_t costDay;
+    int64_t incomeHour;
+    int64_t incomeDay;
     unsigned long lastImportUpdateMillis;
     unsigned long lastExportUpdateMillis;
 };
@@ -88,6 +95,7 @@ public:
     void setup(AmsDataStorage *ds, EnergyAccountingConfig *config);
     void setPriceService(PriceService *ps);
     void setTimezone(Timezone*);
+    void setCalendar(Calendar*);
     EnergyAccountingConfig* getConfig();
     bool update(AmsData* amsData);
     bool load();
@@ -119,6 +127,7 @@ public:
     float getMonthMax();
     uint8_t getCurrentThreshold();
     EnergyAccountingPeak getPeak(uint8_t);
+    uint32_t getRevision();
 
     EnergyAccountingData getData();
     void setData(EnergyAccountingData&);
@@ -137,12 +146,16 @@ private:
     PriceService *ps = NULL;
     EnergyAccountingConfig *config = NULL;
     Timezone *tz = NULL;
+    Calendar *calendar = NULL;
+    uint32_t revision = 0;
     EnergyAccountingData data = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
     EnergyAccountingRealtimeData* realtimeData = NULL;
+    StateJournal* journal = NULL;
     String currency = "";
 
     void calcDayCost();
     bool updateMax(uint16_t val, uint8_t day);
+    int32_t toMicro(float price);
 };
 
 #endif
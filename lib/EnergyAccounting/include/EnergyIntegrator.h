@@ -0,0 +1,25 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _ENERGYINTEGRATOR_H
+#define _ENERGYINTEGRATOR_H
+
+#include <stdint.h>
+
+/**
+ * Integer integration of power into energy and of energy into money. Whatever is too small to be
+ * counted is carried in a remainder, so nothing is lost between frames no matter how short they are.
+ */
+class EnergyIntegrator {
+public:
+    // Whole mWh from watt during ms, 3600 Watt-milliseconds is one mWh
+    static uint32_t energy(uint32_t watt, unsigned long ms, uint16_t& remainder);
+
+    // Micro-currency for mwh at a price in micro-currency per kWh
+    static int64_t money(uint32_t mwh, int32_t price, int32_t& remainder);
+};
+
+#endif
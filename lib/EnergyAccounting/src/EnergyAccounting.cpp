@@ -5,6 +5,7 @@
  */
 
 #include "EnergyAccounting.h"
+#include "EnergyIntegrator.h"
 #include "LittleFS.h"
 #include "AmsStorage.h"
 #include "FirmwareVersion.h"
@@ -16,26 +17,32 @@ EnergyAccounting::EnergyAccounting(Stream* Stream, EnergyAccountingRealtimeData*
 #endif
     data.version = 1;
     this->debugger = debugger;
-    if(rtd->magic != 0x6A) {
-        rtd->magic = 0x6A;
+    if(rtd->magic != EA_REALTIME_MAGIC) {
+        rtd->magic = EA_REALTIME_MAGIC;
         rtd->currentHour = 0;
         rtd->currentDay = 0;
         rtd->currentThresholdIdx = 0;
         rtd->use = 0;
+        rtd->produce = 0;
+        rtd->useRemainder = 0;
+        rtd->produceRemainder = 0;
+        rtd->costRemainder = 0;
+        rtd->incomeRemainder = 0;
         rtd->costHour = 0;
         rtd->costDay = 0;
-        rtd->produce = 0;
         rtd->incomeHour = 0;
         rtd->incomeDay = 0;
         rtd->lastImportUpdateMillis = 0;
         rtd->lastExportUpdateMillis = 0;
     }
     this->realtimeData = rtd;
+    this->journal = new StateJournal(FILE_ENERGYACCOUNTING, FILE_ENERGYACCOUNTING_JOURNAL, &data, sizeof(data));
 }
 
 void EnergyAccounting::setup(AmsDataStorage *ds, EnergyAccountingConfig *config) {
     this->ds = ds;
     this->config = config;
+    revision++;
 }
 
 void EnergyAccounting::setPriceService(PriceService *ps) {
@@ -50,6 +57,10 @@ void EnergyAccounting::setTimezone(Timezone* tz) {
     this->tz = tz;
 }
 
+void EnergyAccounting::setCalendar(Calendar* calendar) {
+    this->calendar = calendar;
+}
+
 bool EnergyAccounting::isInitialized() {
     return this->init;
 }
@@ -58,13 +69,14 @@ bool EnergyAccounting::update(AmsData* amsData) {
     if(config == NULL) return false;
     time_t now = time(nullptr);
     if(now < FirmwareVersion::BuildEpoch) return false;
-    if(tz == NULL) {
+    if(tz == NULL || calendar == NULL) {
         return false;
     }
 
     bool ret = false;
-    tmElements_t local;
-    breakTime(tz->toLocal(now), local);
+    calendar->update(now);
+    tmElements_t local = calendar->getLocal();
+    uint8_t thresholdIdx = this->realtimeData->currentThresholdIdx;
 
     if(!init) {
         this->realtimeData->lastImportUpdateMillis = 0;
@@ -84,6 +96,7 @@ bool EnergyAccounting::update(AmsData* amsData) {
             };
         }
         init = true;
+        revision++;
     }
 
     float importPrice = getPriceForHour(PRICE_DIRECTION_IMPORT, 0);
@@ -92,11 +105,10 @@ bool EnergyAccounting::update(AmsData* amsData) {
     }
 
     if(local.Hour != this->realtimeData->currentHour && (amsData->getListType() >= 3 || local.Minute == 1)) {
-        tmElements_t oneHrAgo, oneHrAgoLocal;
-        breakTime(now-3600, oneHrAgo);
-        uint16_t val = round(ds->getHourImport(oneHrAgo.Hour) / 10.0);
+        tmElements_t oneHrAgoLocal;
+        uint16_t val = round(ds->getHourImport((calendar->getUtc().Hour + 23) % 24) / 10.0);
 
-        breakTime(tz->toLocal(now-3600), oneHrAgoLocal);
+        calendar->breakLocal(now-3600, oneHrAgoLocal);
         ret |= updateMax(val, oneHrAgoLocal.Day);
 
         this->realtimeData->currentHour = local.Hour; // Need to be defined here so that day cost is correctly calculated
@@ -111,12 +123,12 @@ bool EnergyAccounting::update(AmsData* amsData) {
 
         uint8_t prevDay = this->realtimeData->currentDay;
         if(local.Day != this->realtimeData->currentDay) {
-            data.costYesterday = this->realtimeData->costDay * 100;
-            data.costThisMonth += this->realtimeData->costDay * 100;
+            data.costYesterday = this->realtimeData->costDay / 10000;
+            data.costThisMonth += this->realtimeData->costDay / 10000;
             this->realtimeData->costDay = 0;
 
-            data.incomeYesterday = this->realtimeData->incomeDay * 100;
-            data.incomeThisMonth += this->realtimeData->incomeDay * 100;
+            data.incomeYesterday = this->realtimeData->incomeDay / 10000;
+            data.incomeThisMonth += this->realtimeData->incomeDay / 10000;
             this->realtimeData->incomeDay = 0;
 
             this->realtimeData->currentDay = local.Day;
@@ -154,13 +166,14 @@ bool EnergyAccounting::update(AmsData* amsData) {
         }
     }
 
+    // Remainders are carried over so that no energy is lost between frames
     if(this->realtimeData->lastImportUpdateMillis < amsData->getLastUpdateMillis()) {
         unsigned long ms = amsData->getLastUpdateMillis() - this->realtimeData->lastImportUpdateMillis;
-        float kwhi = (amsData->getActiveImportPower() * (((float) ms) / 3600000.0)) / 1000.0;
-        if(kwhi > 0) {
-            this->realtimeData->use += kwhi;
+        uint32_t mwhi = EnergyIntegrator::energy(amsData->getActiveImportPower(), ms, this->realtimeData->useRemainder);
+        if(mwhi > 0) {
+            this->realtimeData->use += mwhi;
             if(importPrice != PRICE_NO_VALUE) {
-                float cost = importPrice * kwhi;
+                int64_t cost = EnergyIntegrator::money(mwhi, toMicro(importPrice), this->realtimeData->costRemainder);
                 this->realtimeData->costHour += cost;
                 this->realtimeData->costDay += cost;
             }
@@ -170,12 +183,12 @@ bool EnergyAccounting::update(AmsData* amsData) {
 
     if(amsData->getListType() > 1 && this->realtimeData->lastExportUpdateMillis < amsData->getLastUpdateMillis()) {
         unsigned long ms = amsData->getLastUpdateMillis() - this->realtimeData->lastExportUpdateMillis;
-        float kwhe = (amsData->getActiveExportPower() * (((float) ms) / 3600000.0)) / 1000.0;
-        if(kwhe > 0) {
-            this->realtimeData->produce += kwhe;
+        uint32_t mwhe = EnergyIntegrator::energy(amsData->getActiveExportPower(), ms, this->realtimeData->produceRemainder);
+        if(mwhe > 0) {
+            this->realtimeData->produce += mwhe;
             float exportPrice = getPriceForHour(PRICE_DIRECTION_EXPORT, 0);
             if(exportPrice != PRICE_NO_VALUE) {
-                float income = exportPrice * kwhe;
+                int64_t income = EnergyIntegrator::money(mwhe, toMicro(exportPrice), this->realtimeData->incomeRemainder);
                 this->realtimeData->incomeHour += income;
                 this->realtimeData->incomeDay += income;
             }
@@ -187,14 +200,18 @@ bool EnergyAccounting::update(AmsData* amsData) {
         while(getMonthMax() > config->thresholds[this->realtimeData->currentThresholdIdx] && this->realtimeData->currentThresholdIdx < 10) this->realtimeData->currentThresholdIdx++;
     }
 
+    if(ret || this->realtimeData->currentThresholdIdx != thresholdIdx) {
+        revision++;
+    }
     return ret;
 }
 
 void EnergyAccounting::calcDayCost() {
     time_t now = time(nullptr);
-    tmElements_t local, utc;
-    if(tz == NULL) return;
-    breakTime(tz->toLocal(now), local);
+    if(tz == NULL || calendar == NULL) return;
+    calendar->update(now);
+    uint8_t localHour = calendar->getLocal().Hour;
+    uint8_t utcHour = calendar->getUtc().Hour;
 
     if(getPriceForHour(PRICE_DIRECTION_IMPORT, 0) != PRICE_NO_VALUE) {
         if(initPrice) {
@@ -202,38 +219,42 @@ void EnergyAccounting::calcDayCost() {
             this->realtimeData->incomeDay = 0;
         }
         for(uint8_t i = 0; i < this->realtimeData->currentHour; i++) {
-            breakTime(now - ((local.Hour - i) * 3600), utc);
+            uint8_t hour = (utcHour + 24 - (localHour - i)) % 24;
 
-            float priceIn = getPriceForHour(PRICE_DIRECTION_IMPORT, i - local.Hour);
+            float priceIn = getPriceForHour(PRICE_DIRECTION_IMPORT, i - localHour);
             if(priceIn != PRICE_NO_VALUE) {
-                int16_t wh = ds->getHourImport(utc.Hour);
-                this->realtimeData->costDay += priceIn * (wh / 1000.0);
+                int16_t wh = ds->getHourImport(hour);
+                this->realtimeData->costDay += ((int64_t) toMicro(priceIn) * wh) / 1000;
             }
 
-            float priceOut = getPriceForHour(PRICE_DIRECTION_EXPORT, i - local.Hour);
+            float priceOut = getPriceForHour(PRICE_DIRECTION_EXPORT, i - localHour);
             if(priceOut != PRICE_NO_VALUE) {
-                int16_t wh = ds->getHourExport(utc.Hour);
-                this->realtimeData->incomeDay += priceOut * (wh / 1000.0);
+                int16_t wh = ds->getHourExport(hour);
+                this->realtimeData->incomeDay += ((int64_t) toMicro(priceOut) * wh) / 1000;
             }
         }
         initPrice = true;
     }
 }
 
+int32_t EnergyAccounting::toMicro(float price) {
+    return lround(price * 1000000.0);
+}
+
 float EnergyAccounting::getUseThisHour() {
-    return this->realtimeData->use;
+    return this->realtimeData->use / 1000000.0;
 }
 
 float EnergyAccounting::getUseToday() {
-    if(tz == NULL) return 0.0;
+    if(tz == NULL || calendar == NULL) return 0.0;
     float ret = 0.0;
     time_t now = time(nullptr);
     if(now < FirmwareVersion::BuildEpoch) return 0.0;
-    tmElements_t utc, local;
-    breakTime(tz->toLocal(now), local);
+    calendar->update(now);
+    uint8_t localHour = calendar->getLocal().Hour;
+    uint8_t utcHour = calendar->getUtc().Hour;
     for(uint8_t i = 0; i < this->realtimeData->currentHour; i++) {
-        breakTime(now - ((local.Hour - i) * 3600), utc);
-        ret += ds->getHourImport(utc.Hour) / 1000.0;
+        ret += ds->getHourImport((utcHour + 24 - (localHour - i)) % 24) / 1000.0;
     }
     return ret + getUseThisHour();
 }
@@ -253,19 +274,19 @@ float EnergyAccounting::getUseLastMonth() {
 }
 
 float EnergyAccounting::getProducedThisHour() {
-    return this->realtimeData->produce;
+    return this->realtimeData->produce / 1000000.0;
 }
 
 float EnergyAccounting::getProducedToday() {
-    if(tz == NULL) return 0.0;
+    if(tz == NULL || calendar == NULL) return 0.0;
     float ret = 0.0;
     time_t now = time(nullptr);
     if(now < FirmwareVersion::BuildEpoch) return 0.0;
-    tmElements_t utc, local;
-    breakTime(tz->toLocal(now), local);
+    calendar->update(now);
+    uint8_t localHour = calendar->getLocal().Hour;
+    uint8_t utcHour = calendar->getUtc().Hour;
     for(uint8_t i = 0; i < this->realtimeData->currentHour; i++) {
-        breakTime(now - ((local.Hour - i) * 3600), utc);
-        ret += ds->getHourExport(utc.Hour) / 1000.0;
+        ret += ds->getHourExport((utcHour + 24 - (localHour - i)) % 24) / 1000.0;
     }
     return ret + getProducedThisHour();
 }
@@ -285,11 +306,11 @@ float EnergyAccounting::getProducedLastMonth() {
 }
 
 float EnergyAccounting::getCostThisHour() {
-    return this->realtimeData->costHour;
+    return this->realtimeData->costHour / 1000000.0;
 }
 
 float EnergyAccounting::getCostToday() {
-    return this->realtimeData->costDay;
+    return this->realtimeData->costDay / 1000000.0;
 }
 
 float EnergyAccounting::getCostYesterday() {
@@ -305,11 +326,11 @@ float EnergyAccounting::getCostLastMonth() {
 }
 
 float EnergyAccounting::getIncomeThisHour() {
-    return this->realtimeData->incomeHour;
+    return this->realtimeData->incomeHour / 1000000.0;
 }
 
 float EnergyAccounting::getIncomeToday() {
-    return this->realtimeData->incomeDay;
+    return this->realtimeData->incomeDay / 1000000.0;
 }
 
 float EnergyAccounting::getIncomeYesterday() {
@@ -361,6 +382,10 @@ float EnergyAccounting::getMonthMax() {
     return maxHour > 0 ? maxHour / count / 100.0 : 0.0;
 }
 
+uint32_t EnergyAccounting::getRevision() {
+    return revision;
+}
+
 EnergyAccountingPeak EnergyAccounting::getPeak(uint8_t num) {
     if(config == NULL)
         return EnergyAccountingPeak({0,0});
@@ -397,7 +422,7 @@ EnergyAccountingPeak EnergyAccounting::getPeak(uint8_t num) {
 }
 
 bool EnergyAccounting::load() {
-    if(!LittleFS.begin()) {
+    if(!StateJournal::mount()) {
         return false;
     }
 
@@ -489,25 +514,19 @@ bool EnergyAccounting::load() {
         }
 
         file.close();
+
+        // Changes made after the snapshot was written
+        if(ret) {
+            journal->setBase((uint8_t*) buf, sizeof(buf));
+            journal->replay();
+        }
     }
 
     return ret;
 }
 
 bool EnergyAccounting::save() {
-    if(!LittleFS.begin()) {
-        return false;
-    }
-    {
-        File file = LittleFS.open(FILE_ENERGYACCOUNTING, "w");
-        char buf[sizeof(data)];
-        memcpy(buf, &data, sizeof(data));
-        for(uint8_t i = 0; i < sizeof(buf); i++) {
-            file.write(buf[i]);
-        }
-        file.close();
-    }
-    return true;
+    return journal->save();
 }
 
 EnergyAccountingData EnergyAccounting::getData() {
@@ -516,6 +535,7 @@ EnergyAccountingData EnergyAccounting::getData() {
 
 void EnergyAccounting::setData(EnergyAccountingData& data) {
     this->data = data;
+    revision++;
 }
 
 bool EnergyAccounting::updateMax(uint16_t val, uint8_t day) {
@@ -0,0 +1,20 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "EnergyIntegrator.h"
+
+uint32_t EnergyIntegrator::energy(uint32_t watt, unsigned long ms, uint16_t& remainder) {
+    uint64_t wms = ((uint64_t) watt * ms) + remainder;
+    remainder = wms % 3600;
+    return wms / 3600;
+}
+
+int64_t EnergyIntegrator::money(uint32_t mwh, int32_t price, int32_t& remainder) {
+    // The product is in 1/1000000 micro-currency
+    int64_t value = ((int64_t) price * mwh) + remainder;
+    remainder = value % 1000000;
+    return value / 1000000;
+}
@@ -12,6 +12,45 @@
 #include "AmsConfiguration.h"
 #include "hexutils.h"
 
+enum HomeAssistantTopic {
+    HomeAssistantTopicPower = 0,
+    HomeAssistantTopicEnergy = 1,
+    HomeAssistantTopicRealtime = 2,
+    HomeAssistantTopicTemperatures = 3,
+    HomeAssistantTopicPrices = 4,
+    HomeAssistantTopicState = 5,
+    HomeAssistantTopicDiscovery = 6
+};
+#define HOMEASSISTANT_TOPICS 7
+
+// Sensors are announced in these groups, each has a fixed range of hash slots
+enum HomeAssistantDiscoveryGroup {
+    HaDiscoveryList1 = 0,
+    HaDiscoveryList2 = 1,
+    HaDiscoveryList2Export = 2,
+    HaDiscoveryList3 = 3,
+    HaDiscoveryList3Export = 4,
+    HaDiscoveryList4 = 5,
+    HaDiscoveryList4Export = 6,
+    HaDiscoveryRealtime = 7,
+    HaDiscoveryRealtimeExport = 8,
+    HaDiscoveryPeaks = 9,
+    HaDiscoveryThresholds = 10,
+    HaDiscoveryPrices = 11,
+    HaDiscoveryPriceHours = 12,
+    HaDiscoverySystem = 13,
+    HaDiscoveryTemperatures = 14
+};
+#define HA_DISCOVERY_GROUPS 15
+#define HA_DISCOVERY_SLOTS 138
+#define HA_TEMPERATURE_SENSORS 32
+
+#define HA_DISCOVERY_INTERVAL 50
+#define HA_DISCOVERY_VERIFY_TIMEOUT 3000
+#define HA_DISCOVERY_NAME_SIZE 64
+#define HA_DISCOVERY_PATH_SIZE 32
+#define HA_DISCOVERY_UOM_SIZE 24
+
 class HomeAssistantMqttHandler : public AmsMqttHandler {
 public:
     #if defined(AMS_REMOTE_DEBUG)
@@ -21,9 +60,7 @@ public:
     #endif
         this->hw = hw;
 
-        l1Init = l2Init = l2eInit = l3Init = l3eInit = l4Init = l4eInit = rtInit = rteInit = pInit = sInit = rInit = false;
-
-        topic = String(mqttConfig.publishTopic);
+        buildTopics();
 
         if(strlen(config.discoveryNameTag) > 0) {
             snprintf_P(buf, 128, PSTR("AMS reader (%s)"), config.discoveryNameTag);
@@ -77,12 +114,21 @@ public:
     bool publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea);
     bool publishRaw(String data);
 
+    void setConfig(MqttConfig& mqttConfig);
     void onMessage(String &topic, String &payload);
 
     uint8_t getFormat();
 
+    uint16_t getDiscoveryPublished();
+    uint16_t getDiscoveryUnchanged();
+    uint32_t getDiscoveryTime();
+
+protected:
+    void onConnected();
+    void onLoop();
+
 private:
-    String topic;
+    TopicTable topics;
 
     String deviceName;
     String deviceModel;
@@ -94,22 +140,42 @@ private:
     String discoveryTopic;
     String sensorNamePrefix;
 
-    bool l1Init, l2Init, l2eInit, l3Init, l3eInit, l4Init, l4eInit, rtInit, rteInit, pInit, sInit, rInit;
-    bool tInit[32] = {false};
-    bool prInit[38] = {false};
+    // Discovery goes out one sensor per loop, a sensor whose config has not changed is skipped
+    uint32_t discoveryPending = 0;
+    uint32_t discoveryDone = 0;
+    uint64_t temperaturePending = 0;
+    uint64_t temperatureDone = 0;
+    uint8_t discoveryIndex = 0;
+    uint32_t discoveryHash[HA_DISCOVERY_SLOTS] = {0};
+    bool discoveryVerified = false;
+    bool discoveryChanged = false;
+    unsigned long discoveryVerifyStart = 0;
+    unsigned long lastDiscovery = 0;
+    uint16_t discoveryPublished = 0;
+    uint16_t discoveryUnchanged = 0;
+    uint32_t discoveryTime = 0;
     uint32_t lastThresholdPublish = 0;
 
     HwTools* hw;
+    EnergyAccounting* ea = NULL;
+    PriceService* ps = NULL;
 
+    void buildTopics();
     bool publishList1(AmsData* data, EnergyAccounting* ea);
     bool publishList2(AmsData* data, EnergyAccounting* ea);
     bool publishList3(AmsData* data, EnergyAccounting* ea);
     bool publishList4(AmsData* data, EnergyAccounting* ea);
     String getMeterModel(AmsData* data);
     bool publishRealtime(AmsData* data, EnergyAccounting* ea, PriceService* ps);
-    void publishSensor(const HomeAssistantSensor sensor);
+    bool publishSensor(const HomeAssistantSensor& sensor, uint8_t slot);
+    void requestDiscovery(uint8_t group);
+    int8_t getDiscoverySensor(uint8_t group, uint8_t index, HomeAssistantSensor& sensor, char* name, char* path, char* uom);
+    void publishNextSensor();
+    uint32_t getDiscoveryMarker();
+    void finishDiscovery();
+    void verifyDiscovery(bool retained);
+    void revalidateDiscovery();
     void publishList1Sensors();
-    void publishList1ExportSensors();
     void publishList2Sensors();
     void publishList2ExportSensors();
     void publishList3Sensors();
@@ -118,7 +184,7 @@ private:
     void publishList4ExportSensors();
     void publishRealtimeSensors(EnergyAccounting* ea, PriceService* ps);
     void publishRealtimeExportSensors(EnergyAccounting* ea, PriceService* ps);
-    void publishTemperatureSensor(uint8_t index, String id);
+    void publishTemperatureSensor(uint8_t index);
     void publishPriceSensors(PriceService* ps);
     void publishSystemSensors();
     void publishThresholdSensors();
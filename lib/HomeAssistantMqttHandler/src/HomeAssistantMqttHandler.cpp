@@ -19,8 +19,18 @@
 #include <esp_task_wdt.h>
 #endif
 
+// Suffixes in HomeAssistantTopic order, appended to the publish topic
+static const char HomeAssistantTopics[] PROGMEM =
+    "/power\0"
+    "/energy\0"
+    "/realtime\0"
+    "/temperatures\0"
+    "/prices\0"
+    "/state\0"
+    "/discovery";
+
 bool HomeAssistantMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAccounting* ea, PriceService* ps) {
-	if(topic.isEmpty() || !mqtt.connected())
+	if(topics.isEmpty() || !mqtt.connected())
 		return false;
 
     if(time(nullptr) < FirmwareVersion::BuildEpoch)
@@ -64,7 +74,7 @@ bool HomeAssistantMqttHandler::publish(AmsData* update, AmsData* previousState,
 bool HomeAssistantMqttHandler::publishList1(AmsData* data, EnergyAccounting* ea) {
     publishList1Sensors();
     snprintf_P(json, BufferSize, HA1_JSON, data->getActiveImportPower());
-    return mqtt.publish(topic + "/power", json);
+    return mqtt.publish(topics.get(HomeAssistantTopicPower), json);
 }
 
 bool HomeAssistantMqttHandler::publishList2(AmsData* data, EnergyAccounting* ea) {
@@ -85,7 +95,7 @@ bool HomeAssistantMqttHandler::publishList2(AmsData* data, EnergyAccounting* ea)
         data->getL2Voltage(),
         data->getL3Voltage()
     );
-    return mqtt.publish(topic + "/power", json);
+    return mqtt.publish(topics.get(HomeAssistantTopicPower), json);
 }
 
 bool HomeAssistantMqttHandler::publishList3(AmsData* data, EnergyAccounting* ea) {
@@ -98,7 +108,7 @@ bool HomeAssistantMqttHandler::publishList3(AmsData* data, EnergyAccounting* ea)
         data->getReactiveExportCounter(),
         data->getMeterTimestamp()
     );
-    return mqtt.publish(topic + "/energy", json);
+    return mqtt.publish(topics.get(HomeAssistantTopicEnergy), json);
 }
 
 bool HomeAssistantMqttHandler::publishList4(AmsData* data, EnergyAccounting* ea) {
@@ -135,7 +145,7 @@ bool HomeAssistantMqttHandler::publishList4(AmsData* data, EnergyAccounting* ea)
         data->getL2ActiveExportCounter(),
         data->getL3ActiveExportCounter()
     );
-    return mqtt.publish(topic + "/power", json);
+    return mqtt.publish(topics.get(HomeAssistantTopicPower), json);
 }
 
 String HomeAssistantMqttHandler::getMeterModel(AmsData* data) {
@@ -148,16 +158,19 @@ bool HomeAssistantMqttHandler::publishRealtime(AmsData* data, EnergyAccounting*
     publishRealtimeSensors(ea, ps);
     if(ea->getProducedThisHour() > 0.0 || ea->getProducedToday() > 0.0 || ea->getProducedThisMonth() > 0.0) publishRealtimeExportSensors(ea, ps);
     if(lastThresholdPublish == 0) publishThresholdSensors();
-    String peaks = "";
+    // Each peak gets a whole DECIMAL_FORMAT_SIZE to write into, however many came before it
+    char peaks[5 * (DECIMAL_FORMAT_SIZE + 1)];
+    uint8_t peaksLength = 0;
+    peaks[0] = '\0';
     uint8_t peakCount = ea->getConfig()->hours;
     if(peakCount > 5) peakCount = 5;
     for(uint8_t i = 1; i <= peakCount; i++) {
-        if(!peaks.isEmpty()) peaks += ",";
-        peaks += String(ea->getPeak(i).value / 100.0, 2);
+        if(peaksLength > 0) peaks[peaksLength++] = ',';
+        peaksLength += formatDecimal(peaks + peaksLength, ea->getPeak(i).value / 100.0, 2);
     }
     uint16_t pos = snprintf_P(json, BufferSize, PSTR("{\"max\":%.1f,\"peaks\":[%s],\"threshold\":%d,\"hour\":{\"use\":%.2f,\"cost\":%.2f,\"produced\":%.2f,\"income\":%.2f},\"day\":{\"use\":%.2f,\"cost\":%.2f,\"produced\":%.2f,\"income\":%.2f},\"month\":{\"use\":%.2f,\"cost\":%.2f,\"produced\":%.2f,\"income\":%.2f}"),
         ea->getMonthMax(),
-        peaks.c_str(),
+        peaks,
         ea->getCurrentThreshold(),
         ea->getUseThisHour(),
         ea->getCostThisHour(),
@@ -192,7 +205,7 @@ bool HomeAssistantMqttHandler::publishRealtime(AmsData* data, EnergyAccounting*
     json[pos++] = '}';
     json[pos] = '\0';
 
-    return mqtt.publish(topic + "/realtime", json);
+    return mqtt.publish(topics.get(HomeAssistantTopicRealtime), json);
 }
 
 bool HomeAssistantMqttHandler::publishTemperatures(AmsConfiguration* config, HwTools* hw) {
@@ -214,18 +227,18 @@ bool HomeAssistantMqttHandler::publishTemperatures(AmsConfiguration* config, HwT
                 data->lastRead
             );
             data->changed = false;
-            publishTemperatureSensor(i+1, id);
+            publishTemperatureSensor(i+1);
         }
 	}
 	char* pos = buf+strlen(buf);
 	snprintf_P(count == 0 ? pos : pos-1, 8, PSTR("}}"));
-    bool ret = mqtt.publish(topic + "/temperatures", buf);
+    bool ret = mqtt.publish(topics.get(HomeAssistantTopicTemperatures), buf);
     loop();
     return ret;
 }
 
 bool HomeAssistantMqttHandler::publishPrices(PriceService* ps) {
-	if(topic.isEmpty() || !mqtt.connected())
+	if(topics.isEmpty() || !mqtt.connected())
 		return false;
 	if(ps->getValueForHour(PRICE_DIRECTION_IMPORT, 0) == PRICE_NO_VALUE)
 		return false;
@@ -336,17 +349,17 @@ bool HomeAssistantMqttHandler::publishPrices(PriceService* ps) {
     json[pos++] = '}';
     json[pos] = '\0';
 
-    bool ret = mqtt.publish(topic + "/prices", json, true, 0);
+    bool ret = mqtt.publish(topics.get(HomeAssistantTopicPrices), json, true, 0);
     loop();
     return ret;
 }
 
 bool HomeAssistantMqttHandler::publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea) {
-	if(topic.isEmpty() || !mqtt.connected())
+	if(topics.isEmpty() || !mqtt.connected())
 		return false;
 
     publishSystemSensors();
-    if(hw->getTemperature() > -50) publishTemperatureSensor(0, "");
+    if(hw->getTemperature() > -50) publishTemperatureSensor(0);
 
     snprintf_P(json, BufferSize, PSTR("{\"id\":\"%s\",\"name\":\"%s\",\"up\":%d,\"vcc\":%.3f,\"rssi\":%d,\"temp\":%.2f,\"version\":\"%s\"}"),
         WiFi.macAddress().c_str(),
@@ -357,23 +370,53 @@ bool HomeAssistantMqttHandler::publishSystem(HwTools* hw, PriceService* ps, Ener
         hw->getTemperature(),
         FirmwareVersion::VersionString
     );
-    bool ret = mqtt.publish(topic + "/state", json);
+    bool ret = mqtt.publish(topics.get(HomeAssistantTopicState), json);
     loop();
     return ret;
 }
 
-void HomeAssistantMqttHandler::publishSensor(const HomeAssistantSensor sensor) {
-    String uid = String(sensor.path);
-    uid.replace(".", "");
-    uid.replace("[", "");
-    uid.replace("]", "");
-    uid.replace("'", "");
+static uint32_t fnv(uint32_t hash, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*) data;
+    for(size_t i = 0; i < length; i++) {
+        hash = (hash ^ p[i]) * 16777619;
+    }
+    return hash;
+}
+
+// First hash slot of each discovery group, followed by the total
+static const uint8_t DiscoverySlotOffset[HA_DISCOVERY_GROUPS + 1] PROGMEM = {
+    0,   // List 1
+    1,   // List 2
+    9,   // List 2 export
+    10,  // List 3
+    13,  // List 3 export
+    14,  // List 4
+    24,  // List 4 export
+    30,  // Realtime
+    38,  // Realtime export
+    44,  // Peaks
+    49,  // Thresholds
+    58,  // Prices
+    63,  // Price per hour and export price
+    102, // System
+    105, // Temperatures
+    HA_DISCOVERY_SLOTS
+};
+
+bool HomeAssistantMqttHandler::publishSensor(const HomeAssistantSensor& sensor, uint8_t slot) {
+    char uid[64];
+    uint8_t len = 0;
+    for(const char* p = sensor.path; *p != '\0' && len < sizeof(uid)-1; p++) {
+        if(*p == '.' || *p == '[' || *p == ']' || *p == '\'') continue;
+        uid[len++] = *p;
+    }
+    uid[len] = '\0';
     snprintf_P(json, BufferSize, HADISCOVER_JSON,
         sensorNamePrefix.c_str(),
         sensor.name,
         mqttConfig.publishTopic, sensor.topic,
-        deviceUid.c_str(), uid.c_str(),
-        deviceUid.c_str(), uid.c_str(),
+        deviceUid.c_str(), uid,
+        deviceUid.c_str(), uid,
         sensor.uom,
         sensor.path,
         sensor.ttl,
@@ -390,220 +433,325 @@ void HomeAssistantMqttHandler::publishSensor(const HomeAssistantSensor sensor) {
         strlen_P(sensor.stacl) > 0 ? (char *) FPSTR(sensor.stacl) : "",
         strlen_P(sensor.stacl) > 0 ? "\"" : ""
     );
-    mqtt.publish(discoveryTopic + deviceUid + "_" + uid.c_str() + "/config", json, true, 0);
-    loop();
+    char name[MQTT_MAX_TOPIC_LENGTH];
+    snprintf_P(name, sizeof(name), PSTR("%s%s_%s/config"), discoveryTopic.c_str(), deviceUid.c_str(), uid);
+
+    // The broker still has the retained config from last time if nothing in it changed
+    uint32_t hash = fnv(fnv(2166136261, name, strlen(name)), json, strlen(json));
+    if(hash == discoveryHash[slot]) {
+        discoveryUnchanged++;
+        return false;
+    }
+    if(!mqtt.publish(name, json, true, 0)) {
+        return false;
+    }
+    discoveryHash[slot] = hash;
+    discoveryPublished++;
+    discoveryChanged = true;
+    return true;
+}
+
+void HomeAssistantMqttHandler::requestDiscovery(uint8_t group) {
+    if(discoveryDone & (1UL << group)) return;
+    discoveryPending |= (1UL << group);
 }
 
 void HomeAssistantMqttHandler::publishList1Sensors() {
-    if(l1Init) return;
-    for(uint8_t i = 0; i < List1SensorCount; i++) {
-        publishSensor(List1Sensors[i]);
-    }
-    l1Init = true;
+    requestDiscovery(HaDiscoveryList1);
 }
 
 void HomeAssistantMqttHandler::publishList2Sensors() {
     publishList1Sensors();
-    if(l2Init) return;
-    for(uint8_t i = 0; i < List2SensorCount; i++) {
-        publishSensor(List2Sensors[i]);
-    }
-    l2Init = true;
+    requestDiscovery(HaDiscoveryList2);
 }
 
 void HomeAssistantMqttHandler::publishList2ExportSensors() {
-    if(l2eInit) return;
-    for(uint8_t i = 0; i < List2ExportSensorCount; i++) {
-        publishSensor(List2ExportSensors[i]);
-    }
-    l2eInit = true;
+    requestDiscovery(HaDiscoveryList2Export);
 }
 
 void HomeAssistantMqttHandler::publishList3Sensors() {
     publishList2Sensors();
-    if(l3Init) return;
-    for(uint8_t i = 0; i < List3SensorCount; i++) {
-        publishSensor(List3Sensors[i]);
-    }
-    l3Init = true;
+    requestDiscovery(HaDiscoveryList3);
 }
 
 void HomeAssistantMqttHandler::publishList3ExportSensors() {
     publishList2ExportSensors();
-    if(l3eInit) return;
-    for(uint8_t i = 0; i < List3ExportSensorCount; i++) {
-        publishSensor(List3ExportSensors[i]);
-    }
-    l3eInit = true;
+    requestDiscovery(HaDiscoveryList3Export);
 }
 
 void HomeAssistantMqttHandler::publishList4Sensors() {
     publishList3Sensors();
-    if(l4Init) return;
-    for(uint8_t i = 0; i < List4SensorCount; i++) {
-        publishSensor(List4Sensors[i]);
-    }
-    l4Init = true;
+    requestDiscovery(HaDiscoveryList4);
 }
 
 void HomeAssistantMqttHandler::publishList4ExportSensors() {
     publishList3ExportSensors();
-    if(l4eInit) return;
-    for(uint8_t i = 0; i < List4ExportSensorCount; i++) {
-        publishSensor(List4ExportSensors[i]);
-    }
-    l4eInit = true;
+    requestDiscovery(HaDiscoveryList4Export);
 }
 
 void HomeAssistantMqttHandler::publishRealtimeSensors(EnergyAccounting* ea, PriceService* ps) {
-    if(rtInit) return;
-    for(uint8_t i = 0; i < RealtimeSensorCount; i++) {
-        HomeAssistantSensor sensor = RealtimeSensors[i];
-        if(strncmp_P(sensor.devcl, PSTR("monetary"), 8) == 0) {
-            if(ps == NULL) continue;
-            sensor.uom = ps->getCurrency();
-        }
-        publishSensor(sensor);
-    }
-    uint8_t peakCount = ea->getConfig()->hours;
-    if(peakCount > 5) peakCount = 5;
-    for(uint8_t i = 0; i < peakCount; i++) {
-        char name[strlen(RealtimePeakSensor.name)];
-        snprintf(name, strlen(RealtimePeakSensor.name), RealtimePeakSensor.name, i+1);
-        char path[strlen(RealtimePeakSensor.path)];
-        snprintf(path, strlen(RealtimePeakSensor.path), RealtimePeakSensor.path, i);
-        HomeAssistantSensor sensor = {
-            name,
-            RealtimePeakSensor.topic,
-            path,
-            RealtimePeakSensor.ttl,
-            RealtimePeakSensor.uom,
-            RealtimePeakSensor.devcl,
-            RealtimePeakSensor.stacl
-        };
-        publishSensor(sensor);
-    }
-    rtInit = true;
+    this->ea = ea;
+    this->ps = ps;
+    requestDiscovery(HaDiscoveryRealtime);
+    requestDiscovery(HaDiscoveryPeaks);
 }
 
 void HomeAssistantMqttHandler::publishRealtimeExportSensors(EnergyAccounting* ea, PriceService* ps) {
-    if(rteInit) return;
-    for(uint8_t i = 0; i < RealtimeExportSensorCount; i++) {
-        HomeAssistantSensor sensor = RealtimeExportSensors[i];
-        if(strncmp_P(sensor.devcl, PSTR("monetary"), 8) == 0) {
-            if(ps == NULL) continue;
-            sensor.uom = ps->getCurrency();
-        }
-        publishSensor(sensor);
-    }
-    rteInit = true;
+    this->ea = ea;
+    this->ps = ps;
+    requestDiscovery(HaDiscoveryRealtimeExport);
 }
 
-void HomeAssistantMqttHandler::publishTemperatureSensor(uint8_t index, String id) {
-    if(index > 32) return;
-    if(tInit[index]) return;
-    char name[strlen(TemperatureSensor.name)+id.length()];
-    snprintf(name, strlen(TemperatureSensor.name)+id.length(), TemperatureSensor.name, id.c_str());
-
-    char path[strlen(TemperatureSensor.path)+id.length()];
-    if(index == 0) {
-        memcpy_P(path, PSTR("temp\0"), 5);
-    } else {
-        snprintf(path, strlen(TemperatureSensor.path)+id.length(), TemperatureSensor.path, id.c_str());
-    }
-    HomeAssistantSensor sensor = {
-        name,
-        index == 0 ? SystemSensors[0].topic : TemperatureSensor.topic,
-        path,
-        TemperatureSensor.ttl,
-        TemperatureSensor.uom,
-        TemperatureSensor.devcl,
-        TemperatureSensor.stacl
-    };
-    publishSensor(sensor);
-    tInit[index] = true;
+void HomeAssistantMqttHandler::publishTemperatureSensor(uint8_t index) {
+    if(index > HA_TEMPERATURE_SENSORS) return;
+    uint64_t bit = 1ULL << index;
+    if(temperatureDone & bit) return;
+    temperaturePending |= bit;
+    discoveryPending |= (1UL << HaDiscoveryTemperatures);
 }
 
 void HomeAssistantMqttHandler::publishPriceSensors(PriceService* ps) {
     if(ps == NULL) return;
-    String uom = String(ps->getCurrency()) + "/kWh";
+    this->ps = ps;
+    requestDiscovery(HaDiscoveryPrices);
+    // Hours show up as prices arrive, so these are looked at again every time
+    discoveryPending |= (1UL << HaDiscoveryPriceHours);
+}
+
+void HomeAssistantMqttHandler::publishSystemSensors() {
+    requestDiscovery(HaDiscoverySystem);
+}
+
+void HomeAssistantMqttHandler::publishThresholdSensors() {
+    requestDiscovery(HaDiscoveryThresholds);
+}
 
-    if(!pInit) {
-        for(uint8_t i = 0; i < PriceSensorCount; i++) {
-            HomeAssistantSensor sensor = PriceSensors[i];
+int8_t HomeAssistantMqttHandler::getDiscoverySensor(uint8_t group, uint8_t index, HomeAssistantSensor& sensor, char* name, char* path, char* uom) {
+    switch(group) {
+        case HaDiscoveryList1:
+            if(index >= List1SensorCount) return -1;
+            sensor = List1Sensors[index];
+            return 1;
+        case HaDiscoveryList2:
+            if(index >= List2SensorCount) return -1;
+            sensor = List2Sensors[index];
+            return 1;
+        case HaDiscoveryList2Export:
+            if(index >= List2ExportSensorCount) return -1;
+            sensor = List2ExportSensors[index];
+            return 1;
+        case HaDiscoveryList3:
+            if(index >= List3SensorCount) return -1;
+            sensor = List3Sensors[index];
+            return 1;
+        case HaDiscoveryList3Export:
+            if(index >= List3ExportSensorCount) return -1;
+            sensor = List3ExportSensors[index];
+            return 1;
+        case HaDiscoveryList4:
+            if(index >= List4SensorCount) return -1;
+            sensor = List4Sensors[index];
+            return 1;
+        case HaDiscoveryList4Export:
+            if(index >= List4ExportSensorCount) return -1;
+            sensor = List4ExportSensors[index];
+            return 1;
+        case HaDiscoveryRealtime:
+        case HaDiscoveryRealtimeExport:
+            if(group == HaDiscoveryRealtime) {
+                if(index >= RealtimeSensorCount) return -1;
+                sensor = RealtimeSensors[index];
+            } else {
+                if(index >= RealtimeExportSensorCount) return -1;
+                sensor = RealtimeExportSensors[index];
+            }
             if(strncmp_P(sensor.devcl, PSTR("monetary"), 8) == 0) {
-                sensor.uom = uom.c_str();
+                if(ps == NULL) return 0;
+                sensor.uom = ps->getCurrency();
+            }
+            return 1;
+        case HaDiscoveryPeaks: {
+            uint8_t peakCount = ea == NULL ? 0 : ea->getConfig()->hours;
+            if(peakCount > 5) peakCount = 5;
+            if(index >= peakCount) return -1;
+            sensor = RealtimePeakSensor;
+            snprintf(name, HA_DISCOVERY_NAME_SIZE, RealtimePeakSensor.name, index+1);
+            snprintf(path, HA_DISCOVERY_PATH_SIZE, RealtimePeakSensor.path, index);
+            sensor.name = name;
+            sensor.path = path;
+            return 1;
+        }
+        case HaDiscoveryThresholds:
+            if(index >= 9) return -1;
+            sensor = RealtimeThresholdSensor;
+            snprintf(name, HA_DISCOVERY_NAME_SIZE, RealtimeThresholdSensor.name, index+1);
+            snprintf(path, HA_DISCOVERY_PATH_SIZE, RealtimeThresholdSensor.path, index);
+            sensor.name = name;
+            sensor.path = path;
+            return 1;
+        case HaDiscoveryPrices:
+            if(index >= PriceSensorCount) return -1;
+            if(ps == NULL) return 0;
+            sensor = PriceSensors[index];
+            if(strncmp_P(sensor.devcl, PSTR("monetary"), 8) == 0) {
+                snprintf_P(uom, HA_DISCOVERY_UOM_SIZE, PSTR("%s/kWh"), ps->getCurrency());
+                sensor.uom = uom;
+            }
+            return 1;
+        case HaDiscoveryPriceHours:
+            if(index > 38) return -1;
+            if(ps == NULL) return 0;
+            sensor = PriceSensor;
+            snprintf_P(uom, HA_DISCOVERY_UOM_SIZE, PSTR("%s/kWh"), ps->getCurrency());
+            sensor.uom = uom;
+            if(index == 38) {
+                if(ps->getValueForHour(PRICE_DIRECTION_EXPORT, 0) == PRICE_NO_VALUE) return 0;
+                strcpy_P(path, PSTR("exportprices['0']"));
+                sensor.name = "Export price current hour";
+                sensor.stacl = "total";
+            } else {
+                if(ps->getValueForHour(PRICE_DIRECTION_IMPORT, index) == PRICE_NO_VALUE) return 0;
+                snprintf(name, HA_DISCOVERY_NAME_SIZE, PriceSensor.name, index, index == 1 ? "hour" : "hours");
+                snprintf(path, HA_DISCOVERY_PATH_SIZE, PriceSensor.path, index);
+                sensor.name = index == 0 ? "Price current hour" : name;
+                if(index == 0) sensor.stacl = "total";
             }
-            publishSensor(sensor);
+            sensor.path = path;
+            return 1;
+        case HaDiscoverySystem:
+            if(index >= SystemSensorCount) return -1;
+            sensor = SystemSensors[index];
+            return 1;
+        case HaDiscoveryTemperatures: {
+            if(index > HA_TEMPERATURE_SENSORS) return -1;
+            if((temperaturePending & (1ULL << index)) == 0) return 0;
+            sensor = TemperatureSensor;
+            if(index == 0) {
+                sensor.topic = SystemSensors[0].topic;
+                snprintf(name, HA_DISCOVERY_NAME_SIZE, TemperatureSensor.name, "");
+                strcpy_P(path, PSTR("temp"));
+            } else {
+                TempSensorData* data = hw->getTempSensorData(index-1);
+                if(data == NULL) return 0;
+                String id = toHex(data->address, 8);
+                snprintf(name, HA_DISCOVERY_NAME_SIZE, TemperatureSensor.name, id.c_str());
+                snprintf(path, HA_DISCOVERY_PATH_SIZE, TemperatureSensor.path, id.c_str());
+            }
+            sensor.name = name;
+            sensor.path = path;
+            return 1;
         }
-        pInit = true;
     }
-    for(uint8_t i = 0; i < 38; i++) {
-        if(prInit[i]) continue;
-        float val = ps->getValueForHour(PRICE_DIRECTION_IMPORT, i);
-        if(val == PRICE_NO_VALUE) continue;
-        
-        char name[strlen(PriceSensor.name)+2];
-        snprintf(name, strlen(PriceSensor.name)+2, PriceSensor.name, i, i == 1 ? "hour" : "hours");
-        char path[strlen(PriceSensor.path)+1];
-        snprintf(path, strlen(PriceSensor.path)+1, PriceSensor.path, i);
-        HomeAssistantSensor sensor = {
-            i == 0 ? "Price current hour" : name,
-            PriceSensor.topic,
-            path,
-            PriceSensor.ttl,
-            uom.c_str(),
-            PriceSensor.devcl,
-            i == 0 ? "total" : PriceSensor.stacl
-        };
-        publishSensor(sensor);
-        prInit[i] = true;
+    return -1;
+}
+
+void HomeAssistantMqttHandler::publishNextSensor() {
+    if(discoveryPending == 0 || !mqtt.connected()) return;
+    if(!discoveryVerified) {
+        if(millis() - discoveryVerifyStart < HA_DISCOVERY_VERIFY_TIMEOUT) return;
+        // No marker came back, so the broker has none of the retained configs
+        verifyDiscovery(false);
     }
+    if(millis() - lastDiscovery < HA_DISCOVERY_INTERVAL) return;
+
+    unsigned long start = millis();
+    uint8_t group = 0;
+    while((discoveryPending & (1UL << group)) == 0) group++;
+
+    // Skipped entries cost nothing, so keep going until one sensor has been looked at
+    HomeAssistantSensor sensor;
+    char name[HA_DISCOVERY_NAME_SIZE];
+    char path[HA_DISCOVERY_PATH_SIZE];
+    char uom[HA_DISCOVERY_UOM_SIZE];
+    int8_t res;
+    while((res = getDiscoverySensor(group, discoveryIndex, sensor, name, path, uom)) == 0) {
+        discoveryIndex++;
+    }
+    if(res > 0) {
+        uint8_t slot = pgm_read_byte(&DiscoverySlotOffset[group]) + discoveryIndex;
+        if(slot < pgm_read_byte(&DiscoverySlotOffset[group+1])) {
+            publishSensor(sensor, slot);
+        }
+        if(group == HaDiscoveryTemperatures) {
+            temperaturePending &= ~(1ULL << discoveryIndex);
+            temperatureDone |= (1ULL << discoveryIndex);
+        }
+        discoveryIndex++;
+    } else {
+        discoveryPending &= ~(1UL << group);
+        if(group != HaDiscoveryPriceHours && group != HaDiscoveryTemperatures) {
+            discoveryDone |= (1UL << group);
+        }
+        discoveryIndex = 0;
+        if(discoveryPending == 0) {
+            finishDiscovery();
+        }
+    }
+
+    lastDiscovery = millis();
+    discoveryTime += lastDiscovery - start;
+}
+
+uint32_t HomeAssistantMqttHandler::getDiscoveryMarker() {
+    return fnv(2166136261, discoveryHash, sizeof(discoveryHash));
+}
 
-    float exportPrice = ps->getValueForHour(PRICE_DIRECTION_EXPORT, 0);
-    if(exportPrice != PRICE_NO_VALUE) {
-        char path[20];
-        snprintf(path, 20, "exportprices['%d']", 0);
-        HomeAssistantSensor sensor = {
-            "Export price current hour",
-            PriceSensor.topic,
-            path,
-            PriceSensor.ttl,
-            uom.c_str(),
-            PriceSensor.devcl,
-            "total"
-        };
-        publishSensor(sensor);
+void HomeAssistantMqttHandler::finishDiscovery() {
+    #if defined(AMS_REMOTE_DEBUG)
+if (debugger->isActive(RemoteDebug::INFO))
+#endif
+debugger->printf_P(PSTR("HA discovery done, %d published, %d unchanged, %lums\n"), discoveryPublished, discoveryUnchanged, discoveryTime);
+    if(!discoveryChanged) return;
+    char marker[12];
+    snprintf_P(marker, sizeof(marker), PSTR("%08lX"), (unsigned long) getDiscoveryMarker());
+    if(mqtt.publish(topics.get(HomeAssistantTopicDiscovery), marker, true, 0)) {
+        discoveryChanged = false;
     }
 }
 
-void HomeAssistantMqttHandler::publishSystemSensors() {
-    if(sInit) return;
-    for(uint8_t i = 0; i < SystemSensorCount; i++) {
-        publishSensor(SystemSensors[i]);
+void HomeAssistantMqttHandler::verifyDiscovery(bool retained) {
+    if(!retained) {
+        memset(discoveryHash, 0, sizeof(discoveryHash));
     }
-    sInit = true;
+    discoveryVerified = true;
+    mqtt.unsubscribe(topics.get(HomeAssistantTopicDiscovery));
 }
 
-void HomeAssistantMqttHandler::publishThresholdSensors() {
-    if(rInit) return;
-    for(uint8_t i = 0; i < 9; i++) {
-        char name[strlen(RealtimeThresholdSensor.name)+1];
-        snprintf(name, strlen(RealtimeThresholdSensor.name)+2, RealtimeThresholdSensor.name, i+1);
-        char path[strlen(RealtimeThresholdSensor.path)+1];
-        snprintf(path, strlen(RealtimeThresholdSensor.path)+1, RealtimeThresholdSensor.path, i);
-        HomeAssistantSensor sensor = {
-            name,
-            RealtimeThresholdSensor.topic,
-            path,
-            RealtimeThresholdSensor.ttl,
-            RealtimeThresholdSensor.uom,
-            RealtimeThresholdSensor.devcl,
-            RealtimeThresholdSensor.stacl
-        };
-        publishSensor(sensor);
+void HomeAssistantMqttHandler::revalidateDiscovery() {
+    // Everything announced so far is looked at again, the hashes keep it from being sent twice
+    discoveryPending |= discoveryDone;
+    discoveryDone = 0;
+    temperaturePending |= temperatureDone;
+    temperatureDone = 0;
+    if(temperaturePending != 0) {
+        discoveryPending |= (1UL << HaDiscoveryTemperatures);
     }
-    rInit = true;
+    discoveryIndex = 0;
+}
+
+void HomeAssistantMqttHandler::onConnected() {
+    discoveryPublished = discoveryUnchanged = 0;
+    discoveryTime = 0;
+    discoveryVerified = false;
+    discoveryVerifyStart = millis();
+    mqtt.subscribe(topics.get(HomeAssistantTopicDiscovery));
+    revalidateDiscovery();
+}
+
+void HomeAssistantMqttHandler::onLoop() {
+    publishNextSensor();
+}
+
+uint16_t HomeAssistantMqttHandler::getDiscoveryPublished() {
+    return discoveryPublished;
+}
+
+uint16_t HomeAssistantMqttHandler::getDiscoveryUnchanged() {
+    return discoveryUnchanged;
+}
+
+uint32_t HomeAssistantMqttHandler::getDiscoveryTime() {
+    return discoveryTime;
 }
 
 uint8_t HomeAssistantMqttHandler::getFormat() {
@@ -614,16 +762,29 @@ bool HomeAssistantMqttHandler::publishRaw(String data) {
     return false;
 }
 
+void HomeAssistantMqttHandler::setConfig(MqttConfig& mqttConfig) {
+    AmsMqttHandler::setConfig(mqttConfig);
+    strcpy(this->mqttConfig.subscribeTopic, statusTopic.c_str());
+    buildTopics();
+}
+
+void HomeAssistantMqttHandler::buildTopics() {
+    topics.build(mqttConfig.publishTopic, HomeAssistantTopics, HOMEASSISTANT_TOPICS);
+}
+
 void HomeAssistantMqttHandler::onMessage(String &topic, String &payload) {
     if(topic.equals(statusTopic)) {
         if(payload.equals("online")) {
  			#if defined(AMS_REMOTE_DEBUG)
 if (debugger->isActive(RemoteDebug::INFO))
 #endif
-debugger->printf_P(PSTR("Received online status from HA, resetting sensor status\n"));
-            l1Init = l2Init = l2eInit = l3Init = l3eInit = l4Init = l4eInit = rtInit = rteInit = pInit = sInit = rInit = false;
-            for(uint8_t i = 0; i < 32; i++) tInit[i] = false;
-            for(uint8_t i = 0; i < 38; i++) prInit[i] = false;
+debugger->printf_P(PSTR("Received online status from HA, checking sensor status\n"));
+            revalidateDiscovery();
         }
+    } else if(!discoveryVerified && topic.equals(topics.get(HomeAssistantTopicDiscovery))) {
+        // The marker is the hash of every config we have sent, a match means the broker kept them all
+        char marker[12];
+        snprintf_P(marker, sizeof(marker), PSTR("%08lX"), (unsigned long) getDiscoveryMarker());
+        verifyDiscovery(payload.equals(marker));
     }
 }
@@ -0,0 +1,154 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _HTTPCLIENTPOOL_H
+#define _HTTPCLIENTPOOL_H
+
+#include "Arduino.h"
+#if defined(AMS_REMOTE_DEBUG)
+#include "RemoteDebug.h"
+#endif
+
+#if defined(ESP8266)
+	#include <ESP8266WiFi.h>
+	#include <ESP8266HTTPClient.h>
+	#include <WiFiClientSecureBearSSL.h>
+#elif defined(ESP32) // ARDUINO_ARCH_ESP32
+	#include <WiFi.h>
+	#include <HTTPClient.h>
+	#include <WiFiClientSecure.h>
+#else
+	#warning "Unsupported board type"
+#endif
+
+#define HTTP_POOL_SLOTS 2
+#define HTTP_POOL_HOST_LEN 64
+#define HTTP_POOL_TIMEOUT 60000
+#define HTTP_POOL_IDLE_TIMEOUT 15000
+
+class HttpClientPool;
+
+/**
+ * Client handed to HTTPClient by the pool. HTTPClient decides by itself when it has to
+ * (re)connect, so connects and TLS handshakes are counted here rather than by the pool.
+ */
+template <class T>
+class HttpPoolClient : public T {
+public:
+    HttpPoolClient(HttpClientPool* pool, uint8_t slot, bool secure) : pool(pool), slot(slot), secure(secure) {};
+
+    using T::connect;
+    int connect(const char* host, uint16_t port) override;
+    #if defined(ESP8266)
+    int connect(const String& host, uint16_t port) override {
+        return connect(host.c_str(), port);
+    };
+    // HTTPClient works on a clone, which has to count as well
+    std::unique_ptr<WiFiClient> clone() const override {
+        return std::unique_ptr<WiFiClient>(new HttpPoolClient<T>(*this));
+    };
+    #elif defined(ESP32)
+    int connect(const char* host, uint16_t port, int32_t timeout) override;
+    #endif
+
+private:
+    HttpClientPool* pool;
+    uint8_t slot;
+    bool secure;
+    bool connecting = false; // The core implements some connect() overloads by calling another one
+};
+
+/**
+ * Shared outbound HTTP(S) connections. One slot per host is kept open between requests
+ * so that consecutive calls skip the TCP and TLS handshake. On ESP8266 the BearSSL
+ * session is also kept per host, so a new connection resumes the previous TLS session.
+ */
+class HttpClientPool {
+public:
+    #if defined(AMS_REMOTE_DEBUG)
+    HttpClientPool(RemoteDebug*);
+    #else
+    HttpClientPool(Stream*);
+    #endif
+    ~HttpClientPool();
+
+    // Returns a HTTPClient ready for a request towards url, or NULL if unable to connect. Must be released with end()
+    HTTPClient* begin(const char* url);
+    void end(HTTPClient* http);
+
+    // Returns a client for url, for code that brings its own HTTPClient (like the firmware updater)
+    WiFiClient* getClient(const char* url);
+
+    void loop();
+    void close();
+
+    uint32_t getRequestCount();
+    uint32_t getReuseCount();
+    uint32_t getHandshakeCount();
+    uint32_t getHandshakeTime();
+
+private:
+    template <class T> friend class HttpPoolClient;
+
+    struct HttpPoolSlot {
+        char host[HTTP_POOL_HOST_LEN];
+        uint16_t port;
+        bool secure;
+        WiFiClient* client;
+        HTTPClient* http;
+        #if defined(ESP8266)
+        BearSSL::Session* session;
+        #endif
+        unsigned long lastUsed;
+        uint32_t connects;
+        uint32_t connectsAtBegin;
+    };
+
+    #if defined(AMS_REMOTE_DEBUG)
+    RemoteDebug* debugger;
+    #else
+    Stream* debugger;
+    #endif
+
+    HttpPoolSlot slots[HTTP_POOL_SLOTS];
+
+    uint32_t requests = 0;
+    uint32_t reused = 0;
+    uint32_t handshakes = 0;
+    uint32_t handshakeTime = 0;
+
+    HttpPoolSlot* acquire(const char* url);
+    bool parseUrl(const char* url, char* host, uint16_t& port, bool& secure);
+    void disconnect(HttpPoolSlot& slot);
+    void release(HttpPoolSlot& slot);
+    void connected(uint8_t slot, const char* host, bool secure, unsigned long duration);
+};
+
+template <class T>
+int HttpPoolClient<T>::connect(const char* host, uint16_t port) {
+    if(connecting) return T::connect(host, port);
+    connecting = true;
+    unsigned long start = millis();
+    int ret = T::connect(host, port);
+    connecting = false;
+    if(ret) pool->connected(slot, host, secure, millis() - start);
+    return ret;
+}
+
+#if defined(ESP32)
+template <class T>
+int HttpPoolClient<T>::connect(const char* host, uint16_t port, int32_t timeout) {
+    if(connecting) return T::connect(host, port, timeout);
+    connecting = true;
+    unsigned long start = millis();
+    int ret = T::connect(host, port, timeout);
+    connecting = false;
+    if(ret) pool->connected(slot, host, secure, millis() - start);
+    return ret;
+}
+#endif
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "HttpClientPool.h"
+#include "FirmwareVersion.h"
+
+#if defined(ESP32)
+#include <esp_task_wdt.h>
+#endif
+
+#if defined(AMS_REMOTE_DEBUG)
+HttpClientPool::HttpClientPool(RemoteDebug* debugger) {
+#else
+HttpClientPool::HttpClientPool(Stream* debugger) {
+#endif
+    this->debugger = debugger;
+    for(uint8_t i = 0; i < HTTP_POOL_SLOTS; i++) {
+        HttpPoolSlot& slot = slots[i];
+        memset(slot.host, 0, HTTP_POOL_HOST_LEN);
+        slot.port = 0;
+        slot.secure = false;
+        slot.client = NULL;
+        slot.http = NULL;
+        #if defined(ESP8266)
+        slot.session = NULL;
+        #endif
+        slot.lastUsed = 0;
+        slot.connects = 0;
+        slot.connectsAtBegin = 0;
+    }
+}
+
+HttpClientPool::~HttpClientPool() {
+    close();
+}
+
+HTTPClient* HttpClientPool::begin(const char* url) {
+    HttpPoolSlot* slot = acquire(url);
+    if(slot == NULL)
+        return NULL;
+
+    if(slot->http == NULL) {
+        slot->http = new HTTPClient();
+        slot->http->setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+        slot->http->setReuse(true);
+        slot->http->setTimeout(HTTP_POOL_TIMEOUT);
+        slot->http->setUserAgent("ams2mqtt/" + String(FirmwareVersion::VersionString));
+    }
+    // Per request, HTTP/1.0 closes the connection afterwards
+    slot->http->useHTTP10(false);
+    if(!slot->http->begin(*slot->client, url)) {
+        disconnect(*slot);
+        return NULL;
+    }
+    slot->connectsAtBegin = slot->connects;
+
+    #if defined(ESP32)
+        esp_task_wdt_reset();
+    #elif defined(ESP8266)
+        ESP.wdtFeed();
+    #endif
+    return slot->http;
+}
+
+void HttpClientPool::end(HTTPClient* http) {
+    if(http == NULL)
+        return;
+    for(uint8_t i = 0; i < HTTP_POOL_SLOTS; i++) {
+        HttpPoolSlot& slot = slots[i];
+        if(slot.http != http) continue;
+
+        // A followed redirect may have moved the connection to another host, so it cannot be kept for this one
+        bool redirected = http->getLocation().length() > 0;
+        http->end();
+        if(slot.connects == slot.connectsAtBegin) {
+            reused++;
+        }
+        if(redirected) {
+            disconnect(slot);
+        }
+        slot.lastUsed = millis();
+        return;
+    }
+    http->end();
+}
+
+WiFiClient* HttpClientPool::getClient(const char* url) {
+    HttpPoolSlot* slot = acquire(url);
+    if(slot == NULL)
+        return NULL;
+    return slot->client;
+}
+
+void HttpClientPool::loop() {
+    unsigned long now = millis();
+    for(uint8_t i = 0; i < HTTP_POOL_SLOTS; i++) {
+        HttpPoolSlot& slot = slots[i];
+        if(slot.client != NULL && now - slot.lastUsed > HTTP_POOL_IDLE_TIMEOUT) {
+            disconnect(slot);
+        }
+    }
+}
+
+void HttpClientPool::close() {
+    for(uint8_t i = 0; i < HTTP_POOL_SLOTS; i++) {
+        release(slots[i]);
+    }
+}
+
+uint32_t HttpClientPool::getRequestCount() {
+    return requests;
+}
+
+uint32_t HttpClientPool::getReuseCount() {
+    return reused;
+}
+
+uint32_t HttpClientPool::getHandshakeCount() {
+    return handshakes;
+}
+
+uint32_t HttpClientPool::getHandshakeTime() {
+    return handshakeTime;
+}
+
+HttpClientPool::HttpPoolSlot* HttpClientPool::acquire(const char* url) {
+    char host[HTTP_POOL_HOST_LEN];
+    uint16_t port;
+    bool secure;
+    if(!parseUrl(url, host, port, secure)) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::ERROR))
+        #endif
+        debugger->printf_P(PSTR("(HttpClientPool) Unable to parse URL: %s\n"), url);
+        return NULL;
+    }
+
+    // Prefer the slot already used for this host, then an empty slot, then the least recently used
+    HttpPoolSlot* slot = NULL;
+    HttpPoolSlot* candidate = NULL;
+    for(uint8_t i = 0; i < HTTP_POOL_SLOTS; i++) {
+        HttpPoolSlot& s = slots[i];
+        if(s.client != NULL && s.port == port && s.secure == secure && strcmp(s.host, host) == 0) {
+            slot = &s;
+            break;
+        }
+        if(candidate == NULL || (candidate->client != NULL && (s.client == NULL || s.lastUsed < candidate->lastUsed))) {
+            candidate = &s;
+        }
+    }
+
+    if(slot == NULL) {
+        slot = candidate;
+        uint8_t index = slot - slots;
+        release(*slot);
+        strcpy(slot->host, host);
+        slot->port = port;
+        slot->secure = secure;
+        if(secure) {
+            #if defined(ESP8266)
+            BearSSL::WiFiClientSecure* client = new HttpPoolClient<BearSSL::WiFiClientSecure>(this, index, true);
+            client->setInsecure();
+            slot->session = new BearSSL::Session();
+            client->setSession(slot->session);
+            slot->client = client;
+            #elif defined(ESP32)
+            WiFiClientSecure* client = new HttpPoolClient<WiFiClientSecure>(this, index, true);
+            client->setInsecure();
+            slot->client = client;
+            #endif
+        } else {
+            slot->client = new HttpPoolClient<WiFiClient>(this, index, false);
+        }
+        #if defined(ESP8266)
+        slot->client->setTimeout(5000);
+        #endif
+    } else if(slot->client->connected() && millis() - slot->lastUsed > HTTP_POOL_IDLE_TIMEOUT) {
+        // Server has most likely closed its end by now
+        disconnect(*slot);
+    }
+
+    requests++;
+    slot->lastUsed = millis();
+    return slot;
+}
+
+bool HttpClientPool::parseUrl(const char* url, char* host, uint16_t& port, bool& secure) {
+    const char* p;
+    if(strncmp_P(url, PSTR("https://"), 8) == 0) {
+        secure = true;
+        port = 443;
+        p = url + 8;
+    } else if(strncmp_P(url, PSTR("http://"), 7) == 0) {
+        secure = false;
+        port = 80;
+        p = url + 7;
+    } else {
+        return false;
+    }
+
+    size_t len = strcspn(p, ":/?");
+    if(len == 0 || len >= HTTP_POOL_HOST_LEN)
+        return false;
+    memcpy(host, p, len);
+    host[len] = '\0';
+
+    if(p[len] == ':') {
+        port = atoi(p + len + 1);
+    }
+    return port > 0;
+}
+
+void HttpClientPool::disconnect(HttpPoolSlot& slot) {
+    if(slot.client != NULL && slot.client->connected()) {
+        slot.client->stop();
+    }
+}
+
+void HttpClientPool::connected(uint8_t slot, const char* host, bool secure, unsigned long duration) {
+    slots[slot].connects++;
+    if(secure) {
+        handshakes++;
+        handshakeTime += duration;
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::DEBUG))
+        #endif
+        debugger->printf_P(PSTR("(HttpClientPool) TLS handshake with %s took %lums\n"), host, duration);
+    }
+}
+
+void HttpClientPool::release(HttpPoolSlot& slot) {
+    disconnect(slot);
+    if(slot.http != NULL) {
+        delete slot.http;
+        slot.http = NULL;
+    }
+    if(slot.client != NULL) {
+        delete slot.client;
+        slot.client = NULL;
+    }
+    #if defined(ESP8266)
+    if(slot.session != NULL) {
+        delete slot.session;
+        slot.session = NULL;
+    }
+    #endif
+    memset(slot.host, 0, HTTP_POOL_HOST_LEN);
+    slot.port = 0;
+    slot.secure = false;
+}
@@ -8,16 +8,21 @@
 #define _JSONMQTTHANDLER_H
 
 #include "AmsMqttHandler.h"
+#include "PayloadTemplate.h"
 
 class JsonMqttHandler : public AmsMqttHandler {
 public:
     #if defined(AMS_REMOTE_DEBUG)
     JsonMqttHandler(MqttConfig& mqttConfig, RemoteDebug* debugger, char* buf, HwTools* hw) : AmsMqttHandler(mqttConfig, debugger, buf) {
         this->hw = hw;
+        outbox = new MqttOutbox(MQTT_OUTBOX_SIZE, MQTT_OUTBOX_SPILL);
+        loadTemplate();
     };
     #else
     JsonMqttHandler(MqttConfig& mqttConfig, Stream* debugger, char* buf, HwTools* hw) : AmsMqttHandler(mqttConfig, debugger, buf) {
         this->hw = hw;
+        outbox = new MqttOutbox(MQTT_OUTBOX_SIZE, MQTT_OUTBOX_SPILL);
+        loadTemplate();
     };
     #endif
     bool publish(AmsData* data, AmsData* previousState, EnergyAccounting* ea, PriceService* ps);
@@ -26,12 +31,17 @@ public:
     bool publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea);
     bool publishRaw(String data);
 
+    void setConfig(MqttConfig& mqttConfig);
     void onMessage(String &topic, String &payload);
 
     uint8_t getFormat();
 
 private:
     HwTools* hw;
+    PayloadTemplate payloadTemplate;
+
+    void loadTemplate();
+    bool publishTemplate(AmsData* data, EnergyAccounting* ea);
     uint16_t appendJsonHeader(AmsData* data);
     uint16_t appendJsonFooter(EnergyAccounting* ea, uint16_t pos);
     bool publishList1(AmsData* data, EnergyAccounting* ea);
@@ -8,12 +8,14 @@
 #include "FirmwareVersion.h"
 #include "hexutils.h"
 #include "Uptime.h"
+#include "AmsStorage.h"
+#include "LittleFS.h"
 
 bool JsonMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAccounting* ea, PriceService* ps) {
     if(strlen(mqttConfig.publishTopic) == 0) {
         return false;
     }
-	if(!mqtt.connected()) {
+	if(!mqtt.connected() && outbox == NULL) {
 		return false;
     }
 
@@ -31,7 +33,10 @@ bool JsonMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAcc
         data = *update;
     }
 
-    if(data.getListType() == 1) {
+    if(mqttConfig.payloadFormat == 7) {
+        ret = publishTemplate(&data, ea);
+        mqtt.loop();
+    } else if(data.getListType() == 1) {
         ret = publishList1(&data, ea);
         mqtt.loop();
     } else if(data.getListType() == 2) {
@@ -54,9 +59,9 @@ uint16_t JsonMqttHandler::appendJsonHeader(AmsData* data) {
         mqttConfig.clientId,
         (uint32_t) (millis64()/1000),
         data->getPackageTimestamp(),
-        hw->getVcc(),
-        hw->getWifiRssi(),
-        hw->getTemperature()
+        snapshot == NULL ? hw->getVcc() : snapshot->getVcc(),
+        snapshot == NULL ? hw->getWifiRssi() : snapshot->getWifiRssi(),
+        snapshot == NULL ? hw->getTemperature() : snapshot->getTemperature()
     );
 }
 
@@ -98,9 +103,9 @@ bool JsonMqttHandler::publishList1(AmsData* data, EnergyAccounting* ea) {
     if(mqttConfig.payloadFormat == 5) {
         char topic[192];
         snprintf_P(topic, 192, PSTR("%s/list1"), mqttConfig.publishTopic);
-        return mqtt.publish(topic, json);
+        return send(topic, json, false);
     } else {
-        return mqtt.publish(mqttConfig.publishTopic, json);
+        return send(mqttConfig.publishTopic, json, false);
     }
 }
 
@@ -130,9 +135,9 @@ bool JsonMqttHandler::publishList2(AmsData* data, EnergyAccounting* ea) {
     if(mqttConfig.payloadFormat == 5) {
         char topic[192];
         snprintf_P(topic, 192, PSTR("%s/list2"), mqttConfig.publishTopic);
-        return mqtt.publish(topic, json);
+        return send(topic, json, false);
     } else {
-        return mqtt.publish(mqttConfig.publishTopic, json);
+        return send(mqttConfig.publishTopic, json, false);
     }
 }
 
@@ -167,9 +172,9 @@ bool JsonMqttHandler::publishList3(AmsData* data, EnergyAccounting* ea) {
     if(mqttConfig.payloadFormat == 5) {
         char topic[192];
         snprintf_P(topic, 192, PSTR("%s/list3"), mqttConfig.publishTopic);
-        return mqtt.publish(topic, json);
+        return send(topic, json, true);
     } else {
-        return mqtt.publish(mqttConfig.publishTopic, json);
+        return send(mqttConfig.publishTopic, json, true);
     }
 }
 
@@ -220,9 +225,56 @@ bool JsonMqttHandler::publishList4(AmsData* data, EnergyAccounting* ea) {
     if(mqttConfig.payloadFormat == 5) {
         char topic[192];
         snprintf_P(topic, 192, PSTR("%s/list4"), mqttConfig.publishTopic);
-        return mqtt.publish(topic, json);
+        return send(topic, json, false);
     } else {
-        return mqtt.publish(mqttConfig.publishTopic, json);
+        return send(mqttConfig.publishTopic, json, false);
+    }
+}
+
+bool JsonMqttHandler::publishTemplate(AmsData* data, EnergyAccounting* ea) {
+    if(payloadTemplate.isEmpty()) {
+        return false;
+    }
+    String mac = WiFi.macAddress();
+    PayloadTemplateSource src = {
+        data,
+        ea,
+        mac.c_str(),
+        mqttConfig.clientId,
+        (uint32_t) (millis64()/1000),
+        snapshot == NULL ? hw->getVcc() : snapshot->getVcc(),
+        snapshot == NULL ? hw->getWifiRssi() : snapshot->getWifiRssi(),
+        snapshot == NULL ? hw->getTemperature() : snapshot->getTemperature(),
+        snapshot == NULL ? ea->getPriceForHour(PRICE_DIRECTION_IMPORT, 0) : snapshot->getPrice(PRICE_DIRECTION_IMPORT),
+        snapshot == NULL ? ea->getPriceForHour(PRICE_DIRECTION_EXPORT, 0) : snapshot->getPrice(PRICE_DIRECTION_EXPORT)
+    };
+    payloadTemplate.render(json, BufferSize, src);
+    return send(mqttConfig.publishTopic, json, data->getListType() == 3);
+}
+
+void JsonMqttHandler::setConfig(MqttConfig& mqttConfig) {
+    AmsMqttHandler::setConfig(mqttConfig);
+    loadTemplate();
+}
+
+void JsonMqttHandler::loadTemplate() {
+    payloadTemplate.clear();
+    if(mqttConfig.payloadFormat != 7) {
+        return;
+    }
+
+    // Compiled here once, publishing only runs the result
+    size_t length = 0;
+    if(LittleFS.begin() && LittleFS.exists(FILE_MQTT_TEMPLATE)) {
+        File file = LittleFS.open(FILE_MQTT_TEMPLATE, (char*) "r");
+        length = file.read((uint8_t*) json, BufferSize);
+        file.close();
+    }
+    if(!payloadTemplate.compile(json, length)) {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::WARNING))
+        #endif
+        debugger->printf_P(PSTR("MQTT payload template is missing or invalid\n"));
     }
 }
 
@@ -407,9 +459,9 @@ bool JsonMqttHandler::publishSystem(HwTools* hw, PriceService* ps, EnergyAccount
         WiFi.macAddress().c_str(),
         mqttConfig.clientId,
         (uint32_t) (millis64()/1000),
-        hw->getVcc(),
-        hw->getWifiRssi(),
-        hw->getTemperature(),
+        snapshot == NULL ? hw->getVcc() : snapshot->getVcc(),
+        snapshot == NULL ? hw->getWifiRssi() : snapshot->getWifiRssi(),
+        snapshot == NULL ? hw->getTemperature() : snapshot->getTemperature(),
         FirmwareVersion::VersionString
     );
     bool ret = false;
@@ -9,9 +9,12 @@
 
 #include "Stream.h"
 
+#define DNB_CURR_MAX 4
+
 class DnbCurrParser: public Stream {
 public:
     float getValue();
+    float getValue(const char* currency);
     
     int available();
     int read();
@@ -24,6 +27,12 @@ private:
     uint8_t scale = 0;
     float value = 0;
 
+    // Values per BASE_CUR when several series are requested in one query
+    char currency[4];
+    char currencies[DNB_CURR_MAX][4];
+    float values[DNB_CURR_MAX];
+    uint8_t count = 0;
+
     char buf[128];
     uint8_t pos = 0;
     uint8_t mode = 0;
@@ -11,19 +11,13 @@
 
 #include "TimeLib.h"
 #include "Timezone.h"
+#include "Calendar.h"
 #if defined(AMS_REMOTE_DEBUG)
 #include "RemoteDebug.h"
 #endif
 #include "AmsConfiguration.h"
 #include "EntsoeA44Parser.h"
-
-#if defined(ESP8266)
-	#include <ESP8266HTTPClient.h>
-#elif defined(ESP32) // ARDUINO_ARCH_ESP32
-	#include <HTTPClient.h>
-#else
-	#warning "Unsupported board type"
-#endif
+#include "HttpClientPool.h"
 
 #define SSL_BUF_SIZE 512
 
@@ -57,6 +51,24 @@ struct PriceConfig {
     uint8_t end_dayofmonth;
 };
 
+#define PRICE_CACHE_VERSION 1
+
+// Prices and currency rate as last fetched, kept on LittleFS so they survive a reboot.
+// Dates are local (CET/CEST) midnight, validity is UTC epoch. Zero means not present.
+struct PriceCache {
+    uint8_t version;
+    char area[17];
+    char currency[4];
+    uint32_t todayDate;
+    uint32_t tomorrowDate;
+    PricesContainer today;
+    PricesContainer tomorrow;
+    char currencyFrom[4];
+    float currencyMultiplier;
+    uint32_t currencyValidUntil;
+    uint16_t crc;
+};
+
 struct PricePart {
     char name[32];
     char description[32];
@@ -66,9 +78,9 @@ struct PricePart {
 class PriceService {
 public:
     #if defined(AMS_REMOTE_DEBUG)
-    PriceService(RemoteDebug*);
+    PriceService(RemoteDebug*, HttpClientPool*);
     #else
-    PriceService(Stream*);
+    PriceService(Stream*, HttpClientPool*);
     #endif
     void setup(PriceServiceConfig&);
     bool loop();
@@ -89,6 +101,7 @@ public:
     PricePart getPricePart(uint8_t index);
 
     int16_t getLastError();
+    uint32_t getRevision();
 
     bool load();
     bool save();
@@ -100,9 +113,10 @@ private:
     Stream* debugger;
     #endif
     PriceServiceConfig* config = NULL;
-    HTTPClient* http = NULL;
+    HttpClientPool* pool = NULL;
 
     uint8_t currentDay = 0, currentHour = 0;
+    uint32_t revision = 0; // Incremented when prices or price config change
     uint8_t tomorrowFetchMinute = 15; // How many minutes over 13:00 should it fetch prices
     uint8_t nextFetchDelayMinutes = 15;
     uint64_t lastTodayFetch = 0;
@@ -110,10 +124,13 @@ private:
     uint64_t lastCurrencyFetch = 0;
     PricesContainer* today = NULL;
     PricesContainer* tomorrow = NULL;
+    uint32_t todayDate = 0;
+    uint32_t tomorrowDate = 0;
 
     std::vector<PriceConfig> priceConfig;
 
     Timezone* tz = NULL;
+    Calendar calendar;
 
     static const uint16_t BufferSize = 256;
     char* buf;
@@ -123,6 +140,10 @@ private:
     uint8_t* auth = NULL;
 
     float currencyMultiplier = 0;
+    char currencyFrom[4];
+    uint32_t currencyValidUntil = 0;
+
+    uint16_t cacheCrc = 0;
 
     int16_t lastError = 0;
 
@@ -130,6 +151,10 @@ private:
     bool retrieve(const char* url, Stream* doc);
     float getCurrencyMultiplier(const char* from, const char* to, time_t t);
 
+    void alignDays(uint32_t midnight);
+    bool loadCache();
+    bool saveCache();
+
     void debugPrint(byte *buffer, int start, int length);
 };
 #endif
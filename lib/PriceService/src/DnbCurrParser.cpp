@@ -11,6 +11,15 @@ float DnbCurrParser::getValue() {
     return value;
 }
 
+float DnbCurrParser::getValue(const char* currency) {
+    for(uint8_t i = 0; i < count; i++) {
+        if(strncmp(currencies[i], currency, 3) == 0) {
+            return values[i];
+        }
+    }
+    return 0;
+}
+
 int DnbCurrParser::available() {
     return 0;
 }
@@ -44,6 +53,13 @@ size_t DnbCurrParser::write(uint8_t byte) {
         buf[pos++] = byte;
         buf[pos++] = '\0';
         if(strncmp(buf, "<Series", 7) == 0) {
+            memset(currency, 0, sizeof(currency));
+            for(int i = 0; i < pos; i++) {
+                if(strncmp(buf+i, "BASE_CUR=\"", 10) == 0) {
+                    strncpy(currency, buf+i+10, 3);
+                    break;
+                }
+            }
             for(int i = 0; i < pos; i++) {
                 if(strncmp(buf+i, "UNIT_MULT=\"", 11) == 0) {
                     pos = i + 11;
@@ -73,6 +89,10 @@ size_t DnbCurrParser::write(uint8_t byte) {
                 }
             }
             value = String(buf+pos).toFloat() / pow(10, scale);
+            if(strlen(currency) > 0 && count < DNB_CURR_MAX) {
+                memcpy(currencies[count], currency, sizeof(currency));
+                values[count++] = value;
+            }
         }
         pos = 0;
     } else {
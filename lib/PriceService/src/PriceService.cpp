@@ -15,24 +15,27 @@
 #include "hexutils.h"
 
 #include "GcmParser.h"
+#include "crc.h"
 
 #if defined(ESP32)
 #include <esp_task_wdt.h>
 #endif
 
 #if defined(AMS_REMOTE_DEBUG)
-PriceService::PriceService(RemoteDebug* Debug) : priceConfig(std::vector<PriceConfig>()) {
+PriceService::PriceService(RemoteDebug* Debug, HttpClientPool* pool) : priceConfig(std::vector<PriceConfig>()) {
 #else
-PriceService::PriceService(Stream* Debug) : priceConfig(std::vector<PriceConfig>()) {
+PriceService::PriceService(Stream* Debug, HttpClientPool* pool) : priceConfig(std::vector<PriceConfig>()) {
 #endif
     this->buf = (char*) malloc(BufferSize);
 
     debugger = Debug;
+    this->pool = pool;
 
     // Entso-E uses CET/CEST
     TimeChangeRule CEST = {"CEST", Last, Sun, Mar, 2, 120};
 	TimeChangeRule CET = {"CET ", Last, Sun, Oct, 3, 60};
 	tz = new Timezone(CEST, CET);
+    calendar.setTimezone(tz);
 
     tomorrowFetchMinute = 15 + random(45); // Random between 13:15 and 14:00
 }
@@ -46,15 +49,12 @@ void PriceService::setup(PriceServiceConfig& config) {
     if(today != NULL) delete today;
     if(tomorrow != NULL) delete tomorrow;
     today = tomorrow = NULL;
-
-    if(http != NULL) {
-        delete http;
-    }
-    http = new HTTPClient();
-    http->setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
-    http->setReuse(false);
-    http->setTimeout(60000);
-    http->setUserAgent("ams2mqtt/" + String(FirmwareVersion::VersionString));
+    todayDate = tomorrowDate = 0;
+    currencyMultiplier = 0;
+    memset(currencyFrom, 0, sizeof(currencyFrom));
+    currencyValidUntil = 0;
+    cacheCrc = 0;
+    currentDay = 0;
 
     #if defined(AMS2MQTT_PRICE_KEY)
         key = new uint8_t[16] AMS2MQTT_PRICE_KEY;
@@ -70,6 +70,7 @@ void PriceService::setup(PriceServiceConfig& config) {
     #endif
 
     load();
+    revision++;
 }
 
 char* PriceService::getToken() {
@@ -110,7 +111,8 @@ float PriceService::getValueForHour(uint8_t direction, time_t ts, int8_t hour) {
         return ret;
 
     tmElements_t tm;
-    breakTime(tz->toLocal(ts + (hour * SECS_PER_HOUR)), tm);
+    calendar.update(ts);
+    calendar.breakLocal(ts + (hour * SECS_PER_HOUR), tm);
     uint8_t day = 0x01 << ((tm.Wday+5)%7);
     uint32_t hrs = 0x01 << tm.Hour;
 
@@ -141,7 +143,8 @@ float PriceService::getValueForHour(uint8_t direction, time_t ts, int8_t hour) {
 
 float PriceService::getEnergyPriceForHour(uint8_t direction, time_t ts, int8_t hour) {
     tmElements_t tm;
-    breakTime(tz->toLocal(ts + (hour * SECS_PER_HOUR)), tm);
+    calendar.update(ts);
+    calendar.breakLocal(ts + (hour * SECS_PER_HOUR), tm);
     uint8_t day = 0x01 << ((tm.Wday+5)%7);
     uint32_t hrs = 0x01 << tm.Hour;
 
@@ -164,21 +167,9 @@ float PriceService::getEnergyPriceForHour(uint8_t direction, time_t ts, int8_t h
     }
     if(value != PRICE_NO_VALUE) return value;
 
-    int8_t pos = hour;
-
-    breakTime(tz->toLocal(ts), tm);
-    while(tm.Hour > 0) {
-        ts -= 3600;
-        breakTime(tz->toLocal(ts), tm);
-        pos++;
-    }
-    uint8_t hoursToday = 0;
-    uint8_t todayDate = tm.Day;
-    while(tm.Day == todayDate) {
-        ts += 3600;
-        breakTime(tz->toLocal(ts), tm);
-        hoursToday++;
-    }
+    // Hours are counted from the boundaries rather than the clock, so DST days get 23 or 25 positions
+    int8_t pos = hour + ((calendar.getHourStart() - calendar.getDayStart()) / SECS_PER_HOUR);
+    uint8_t hoursToday = (calendar.getNextDay() - calendar.getDayStart()) / SECS_PER_HOUR;
     if(pos > 49)
         return PRICE_NO_VALUE;
 
@@ -236,20 +227,21 @@ bool PriceService::loop() {
     if(strlen(config->currency) == 0)
         return false;
 
-    tmElements_t tm;
-    breakTime(tz->toLocal(t), tm);
+    calendar.update(t);
+    uint32_t midnight = previousMidnight(t + calendar.getOffset());
+    tmElements_t tm = calendar.getLocal();
 
     if(currentDay == 0) {
         currentDay = tm.Day;
         currentHour = tm.Hour;
+
+        // Discard whatever was loaded from cache that does not belong to today or tomorrow
+        alignDays(midnight);
+        if(today != NULL) return true;
     }
     
     if(currentDay != tm.Day) {
-        if(today != NULL) delete today;
-        if(tomorrow != NULL) {
-            today = tomorrow;
-            tomorrow = NULL;
-        }
+        alignDays(midnight);
         currentDay = tm.Day;
         currentHour = tm.Hour;
         return today != NULL || (!config->enabled && priceConfig.capacity() != 0); // Only trigger MQTT publish if we have todays prices.
@@ -267,6 +259,11 @@ bool PriceService::loop() {
         try {
             lastTodayFetch = now;
             today = fetchPrices(t);
+            if(today != NULL) {
+                todayDate = midnight;
+                saveCache();
+                revision++;
+            }
         } catch(const std::exception& e) {
             if(lastError == 0) {
                 lastError = 900;
@@ -283,6 +280,11 @@ bool PriceService::loop() {
         try {
             lastTomorrowFetch = now;
             tomorrow = fetchPrices(t+SECS_PER_DAY);
+            if(tomorrow != NULL) {
+                tomorrowDate = midnight + SECS_PER_DAY;
+                saveCache();
+                revision++;
+            }
         } catch(const std::exception& e) {
             if(lastError == 0) {
                 lastError = 900;
@@ -298,7 +300,8 @@ bool PriceService::loop() {
 
 bool PriceService::retrieve(const char* url, Stream* doc) {
     #if defined(ESP32)
-        if(http->begin(url)) {
+        HTTPClient* http = pool->begin(url);
+        if(http != NULL) {
             #if defined(ESP32)
                 esp_task_wdt_reset();
             #elif defined(ESP8266)
@@ -315,7 +318,7 @@ bool PriceService::retrieve(const char* url, Stream* doc) {
 
             if(status == HTTP_CODE_OK) {
                 http->writeToStream(doc);
-                http->end();
+                pool->end(http);
                 lastError = 0;
                 nextFetchDelayMinutes = 1;
                 return true;
@@ -341,7 +344,7 @@ if (debugger->isActive(RemoteDebug::DEBUG))
 #endif
 debugger->printf(http->getString().c_str());
 
-                http->end();
+                pool->end(http);
                 return false;
             }
         } else {
@@ -355,6 +358,10 @@ float PriceService::getCurrencyMultiplier(const char* from, const char* to, time
     if(strcmp(from, to) == 0)
         return 1.00;
 
+    // Rate from cache or previous fetch is still valid, no need to go online
+    if(currencyMultiplier != 0 && t < currencyValidUntil && strncmp(from, currencyFrom, 3) == 0)
+        return currencyMultiplier;
+
     uint64_t now = millis64();
     if(now > lastCurrencyFetch && (lastCurrencyFetch == 0 || (now - lastCurrencyFetch) > 60000)) {
         lastCurrencyFetch = now;
@@ -367,21 +374,22 @@ float PriceService::getCurrencyMultiplier(const char* from, const char* to, time
             ESP.wdtFeed();
         #endif
 
+        // Norges Bank only publishes rates against NOK, so a cross rate needs both currencies. Ask for both in one request.
         float currencyMultiplier = 0;
-        snprintf_P(buf, BufferSize, PSTR("https://data.norges-bank.no/api/data/EXR/B.%s.NOK.SP?lastNObservations=1"), from);
+        bool fromNok = strncmp(from, "NOK", 3) == 0;
+        bool toNok = strncmp(to, "NOK", 3) == 0;
+        if(fromNok) {
+            snprintf_P(buf, BufferSize, PSTR("https://data.norges-bank.no/api/data/EXR/B.%s.NOK.SP?lastNObservations=1"), to);
+        } else if(toNok) {
+            snprintf_P(buf, BufferSize, PSTR("https://data.norges-bank.no/api/data/EXR/B.%s.NOK.SP?lastNObservations=1"), from);
+        } else {
+            snprintf_P(buf, BufferSize, PSTR("https://data.norges-bank.no/api/data/EXR/B.%s+%s.NOK.SP?lastNObservations=1"), from, to);
+        }
         if(retrieve(buf, &p)) {
-            currencyMultiplier = p.getValue();
-            if(strncmp(to, "NOK", 3) != 0) {
-                snprintf_P(buf, BufferSize, PSTR("https://data.norges-bank.no/api/data/EXR/B.%s.NOK.SP?lastNObservations=1"), to);
-                if(retrieve(buf, &p)) {
-                    if(p.getValue() > 0.0) {
-                        currencyMultiplier /= p.getValue();
-                    } else {
-                        currencyMultiplier = 0;
-                    }
-                } else {
-                    currencyMultiplier = 0;
-                }
+            float fromValue = fromNok ? 1.0 : p.getValue(from);
+            float toValue = toNok ? 1.0 : p.getValue(to);
+            if(fromValue > 0.0 && toValue > 0.0) {
+                currencyMultiplier = fromValue / toValue;
             }
         }
         if(currencyMultiplier != 0) {
@@ -393,6 +401,10 @@ debugger->printf_P(PSTR("(PriceService) Resulting currency multiplier: %.4f\n"),
             breakTime(t, tm);
             lastCurrencyFetch = now + (SECS_PER_DAY * 1000) - (((((tm.Hour * 60) + tm.Minute) * 60) + tm.Second) * 1000) + (3600000 * 6) + (tomorrowFetchMinute * 60);
             this->currencyMultiplier = currencyMultiplier;
+            strncpy(currencyFrom, from, sizeof(currencyFrom)-1);
+            currencyFrom[sizeof(currencyFrom)-1] = '\0';
+            currencyValidUntil = previousMidnight(t) + SECS_PER_DAY + (SECS_PER_HOUR * 6) + (tomorrowFetchMinute * 60);
+            saveCache();
         } else {
             #if defined(AMS_REMOTE_DEBUG)
 if (debugger->isActive(RemoteDebug::WARNING))
@@ -463,13 +475,8 @@ debugger->printf_P(PSTR("(PriceService) Fetching prices for %02d.%02d.%04d\n"),
 if (debugger->isActive(RemoteDebug::DEBUG))
 #endif
 debugger->printf_P(PSTR("(PriceService)  url: %s\n"), buf);
-        #if defined(ESP8266)
-        WiFiClient client;
-        client.setTimeout(5000);
-        if(http->begin(client, buf)) {
-        #elif defined(ESP32)
-        if(http->begin(buf)) {
-        #endif
+        HTTPClient* http = pool->begin(buf);
+        if(http != NULL) {
             int status = http->GET();
 
             #if defined(ESP32)
@@ -480,7 +487,7 @@ debugger->printf_P(PSTR("(PriceService)  url: %s\n"), buf);
 
             if(status == HTTP_CODE_OK) {
                 data = http->getString();
-                http->end();
+                pool->end(http);
                 
                 uint8_t* content = (uint8_t*) (data.c_str());
 
@@ -533,7 +540,7 @@ if (debugger->isActive(RemoteDebug::DEBUG))
 #endif
 debugger->printf(http->getString().c_str());
 
-                http->end();
+                pool->end(http);
             }
         }
     }
@@ -560,6 +567,10 @@ int16_t PriceService::getLastError() {
     return lastError;
 }
 
+uint32_t PriceService::getRevision() {
+    return revision;
+}
+
 std::vector<PriceConfig>& PriceService::getPriceConfig() {
     return this->priceConfig;
 }
@@ -573,11 +584,13 @@ void PriceService::setPriceConfig(uint8_t index, PriceConfig &priceConfig) {
         this->priceConfig[index] = priceConfig;
     else   
         this->priceConfig.push_back(priceConfig);
+    revision++;
 }
 
 void PriceService::cropPriceConfig(uint8_t size) {
     this->priceConfig.resize(size);
     this->priceConfig.shrink_to_fit();
+    revision++;
 
 }
 
@@ -621,6 +634,10 @@ if (debugger->isActive(RemoteDebug::ERROR))
 debugger->printf_P(PSTR("(PriceService) Unable to load LittleFS\n"));
         return false;
     }
+    if(config != NULL && config->enabled) {
+        loadCache();
+    }
+
     if(!LittleFS.exists(FILE_PRICE_CONF)) {
         return false;
     }
@@ -641,4 +658,124 @@ debugger->printf_P(PSTR("(PriceService) Loading price config\n"));
     file.close();
 
     return true;
-}
\ No newline at end of file
+}
+
+void PriceService::alignDays(uint32_t midnight) {
+    revision++;
+    if(today != NULL && todayDate != midnight) {
+        delete today;
+        today = NULL;
+        todayDate = 0;
+    }
+    if(tomorrow != NULL && tomorrowDate == midnight) {
+        if(today != NULL) delete today;
+        today = tomorrow;
+        todayDate = tomorrowDate;
+        tomorrow = NULL;
+        tomorrowDate = 0;
+    }
+    if(tomorrow != NULL && tomorrowDate != midnight + SECS_PER_DAY) {
+        delete tomorrow;
+        tomorrow = NULL;
+        tomorrowDate = 0;
+    }
+}
+
+bool PriceService::saveCache() {
+    PriceCache cache;
+    memset(&cache, 0, sizeof(cache));
+    cache.version = PRICE_CACHE_VERSION;
+    strncpy(cache.area, config->area, sizeof(cache.area)-1);
+    strncpy(cache.currency, config->currency, sizeof(cache.currency)-1);
+    if(today != NULL) {
+        cache.todayDate = todayDate;
+        memcpy(&cache.today, today, sizeof(cache.today));
+    }
+    if(tomorrow != NULL) {
+        cache.tomorrowDate = tomorrowDate;
+        memcpy(&cache.tomorrow, tomorrow, sizeof(cache.tomorrow));
+    }
+    if(currencyMultiplier != 0) {
+        memcpy(cache.currencyFrom, currencyFrom, sizeof(cache.currencyFrom));
+        cache.currencyMultiplier = currencyMultiplier;
+        cache.currencyValidUntil = currencyValidUntil;
+    }
+    cache.crc = crc16((uint8_t*) &cache, offsetof(PriceCache, crc));
+
+    // Avoid flash wear when nothing has changed since the last write
+    if(cache.crc == cacheCrc)
+        return true;
+
+    if(!LittleFS.begin()) {
+        #if defined(AMS_REMOTE_DEBUG)
+if (debugger->isActive(RemoteDebug::ERROR))
+#endif
+debugger->printf_P(PSTR("(PriceService) Unable to load LittleFS\n"));
+        return false;
+    }
+
+    #if defined(AMS_REMOTE_DEBUG)
+if (debugger->isActive(RemoteDebug::DEBUG))
+#endif
+debugger->printf_P(PSTR("(PriceService) Saving price cache\n"));
+
+    File file = LittleFS.open(FILE_PRICE_CACHE, "w");
+    size_t written = file.write((uint8_t*) &cache, sizeof(cache));
+    file.close();
+    if(written != sizeof(cache)) {
+        LittleFS.remove(FILE_PRICE_CACHE);
+        return false;
+    }
+
+    cacheCrc = cache.crc;
+    return true;
+}
+
+bool PriceService::loadCache() {
+    if(!LittleFS.exists(FILE_PRICE_CACHE)) {
+        return false;
+    }
+
+    PriceCache cache;
+    File file = LittleFS.open(FILE_PRICE_CACHE, "r");
+    size_t read = file.size() == sizeof(cache) ? file.readBytes((char*) &cache, sizeof(cache)) : 0;
+    file.close();
+
+    if(read != sizeof(cache) || cache.version != PRICE_CACHE_VERSION || cache.crc != crc16((uint8_t*) &cache, offsetof(PriceCache, crc))) {
+        #if defined(AMS_REMOTE_DEBUG)
+if (debugger->isActive(RemoteDebug::WARNING))
+#endif
+debugger->printf_P(PSTR("(PriceService) Price cache is invalid, discarding\n"));
+        LittleFS.remove(FILE_PRICE_CACHE);
+        return false;
+    }
+
+    // Cache is only valid for the area and currency it was fetched for
+    if(strncmp(cache.area, config->area, sizeof(cache.area)) != 0 || strncmp(cache.currency, config->currency, sizeof(cache.currency)) != 0) {
+        return false;
+    }
+
+    #if defined(AMS_REMOTE_DEBUG)
+if (debugger->isActive(RemoteDebug::INFO))
+#endif
+debugger->printf_P(PSTR("(PriceService) Loading price cache\n"));
+
+    if(cache.todayDate != 0) {
+        if(today == NULL) today = new PricesContainer();
+        memcpy(today, &cache.today, sizeof(*today));
+        todayDate = cache.todayDate;
+    }
+    if(cache.tomorrowDate != 0) {
+        if(tomorrow == NULL) tomorrow = new PricesContainer();
+        memcpy(tomorrow, &cache.tomorrow, sizeof(*tomorrow));
+        tomorrowDate = cache.tomorrowDate;
+    }
+    if(cache.currencyMultiplier != 0) {
+        memcpy(currencyFrom, cache.currencyFrom, sizeof(currencyFrom));
+        currencyFrom[sizeof(currencyFrom)-1] = '\0';
+        currencyMultiplier = cache.currencyMultiplier;
+        currencyValidUntil = cache.currencyValidUntil;
+    }
+    cacheCrc = cache.crc;
+    return true;
+}
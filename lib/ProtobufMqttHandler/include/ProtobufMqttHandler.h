@@ -0,0 +1,61 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _PROTOBUFMQTTHANDLER_H
+#define _PROTOBUFMQTTHANDLER_H
+
+#include "AmsMqttHandler.h"
+#include "ProtobufWriter.h"
+
+#define PROTOBUF_KEYFRAME_INTERVAL 900000
+
+// Counters sent as the difference from the keyframe, in the order of the fields in amsreader.proto
+#define PROTOBUF_COUNTERS 10
+
+/**
+ * Same content as the JSON format but encoded as described in proto/amsreader.proto. Values are
+ * fixed-point integers. Counters and timestamps are sent relative to the last keyframe. Messages
+ * are binary, so they bypass the outbox and are built in the shared buffer without allocating.
+ */
+class ProtobufMqttHandler : public AmsMqttHandler {
+public:
+    #if defined(AMS_REMOTE_DEBUG)
+    ProtobufMqttHandler(MqttConfig& mqttConfig, RemoteDebug* debugger, char* buf, HwTools* hw) : AmsMqttHandler(mqttConfig, debugger, buf) {
+        this->hw = hw;
+    };
+    #else
+    ProtobufMqttHandler(MqttConfig& mqttConfig, Stream* debugger, char* buf, HwTools* hw) : AmsMqttHandler(mqttConfig, debugger, buf) {
+        this->hw = hw;
+    };
+    #endif
+    bool publish(AmsData* data, AmsData* previousState, EnergyAccounting* ea, PriceService* ps);
+    bool publishTemperatures(AmsConfiguration*, HwTools*);
+    bool publishPrices(PriceService*);
+    bool publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea);
+    bool publishRaw(String data);
+
+    void onMessage(String &topic, String &payload);
+
+    uint8_t getFormat();
+
+protected:
+    void onConnected();
+
+private:
+    HwTools* hw;
+
+    uint32_t seq = 0;
+    uint32_t keySeq = 0;
+    bool keyHasCounters = false;
+    unsigned long keyMillis = 0;
+    int64_t keyTimestamp = 0;
+    int64_t keyCounters[PROTOBUF_COUNTERS];
+
+    void writeMeter(ProtobufWriter& writer, AmsData* data, bool key);
+    void writeRealtime(ProtobufWriter& writer, EnergyAccounting* ea);
+    bool sendBinary(size_t length, bool retain);
+};
+#endif
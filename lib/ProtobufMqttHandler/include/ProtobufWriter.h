@@ -0,0 +1,45 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _PROTOBUFWRITER_H
+#define _PROTOBUFWRITER_H
+
+#include "Arduino.h"
+
+/**
+ * Protocol Buffers encoder writing straight into a caller owned buffer. Zero values are left out
+ * like proto3 does. A nested message reserves two bytes for its length and is moved back one byte
+ * when it turns out shorter than 128 bytes, so nothing is encoded twice. Running out of room sets
+ * the writer as failed instead of writing past the end, check isOk() before using the result.
+ */
+class ProtobufWriter {
+public:
+    ProtobufWriter(uint8_t* buf, size_t size);
+
+    void writeUint(uint8_t field, uint64_t value);
+    void writeSint(uint8_t field, int64_t value);
+    void writeBool(uint8_t field, bool value);
+    void writeFixed64(uint8_t field, uint64_t value);
+    void writeString(uint8_t field, const char* str);
+    void writePackedSint(uint8_t field, int32_t* values, uint8_t count);
+
+    size_t beginMessage(uint8_t field);
+    void endMessage(size_t mark);
+
+    bool isOk();
+    size_t getLength();
+
+private:
+    uint8_t* buf;
+    size_t size;
+    size_t pos = 0;
+    bool ok = true;
+
+    void writeTag(uint8_t field, uint8_t type);
+    void writeVarint(uint64_t value);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "ProtobufMqttHandler.h"
+#include "FirmwareVersion.h"
+#include "Uptime.h"
+
+bool ProtobufMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAccounting* ea, PriceService* ps) {
+    if(strlen(mqttConfig.publishTopic) == 0 || !mqtt.connected()) {
+        return false;
+    }
+
+    AmsData data;
+    if(mqttConfig.stateUpdate) {
+        uint64_t now = millis64();
+        if(now-lastStateUpdate < mqttConfig.stateUpdateInterval * 1000) return false;
+        data.apply(*previousState);
+        data.apply(*update);
+        lastStateUpdate = now;
+    } else {
+        data = *update;
+    }
+
+    uint8_t listType = data.getListType();
+    if(listType < 1 || listType > 4) {
+        return false;
+    }
+
+    // A keyframe also has to be sent when counters turn up and the current one has none to refer to
+    bool counters = listType >= 3;
+    bool key = keySeq == 0 || millis() - keyMillis >= PROTOBUF_KEYFRAME_INTERVAL || (counters && !keyHasCounters);
+
+    seq++;
+    int64_t timestamp = data.getPackageTimestamp();
+    ProtobufWriter writer((uint8_t*) json, BufferSize);
+    writer.writeUint(1, seq);
+    if(key) {
+        keySeq = seq;
+        keyMillis = millis();
+        keyTimestamp = timestamp;
+        keyHasCounters = counters;
+        writer.writeSint(3, timestamp);
+    } else {
+        writer.writeUint(2, keySeq);
+        writer.writeSint(3, timestamp - keyTimestamp);
+    }
+    writer.writeUint(4, listType);
+    writeMeter(writer, &data, key);
+    writeRealtime(writer, ea);
+
+    bool ret = false;
+    if(writer.isOk()) {
+        ret = sendBinary(writer.getLength(), key);
+    } else {
+        #if defined(AMS_REMOTE_DEBUG)
+        if (debugger->isActive(RemoteDebug::WARNING))
+        #endif
+        debugger->printf_P(PSTR("Protobuf payload does not fit the buffer\n"));
+    }
+    if(!ret && key) {
+        // Nobody got it, so the next frame cannot refer to it
+        keySeq = 0;
+    }
+    loop();
+    return ret;
+}
+
+void ProtobufMqttHandler::writeMeter(ProtobufWriter& writer, AmsData* data, bool key) {
+    size_t mark = writer.beginMessage(5);
+    if(key) {
+        writer.writeString(1, data->getListId().c_str());
+        writer.writeString(2, data->getMeterId().c_str());
+        writer.writeString(3, data->getMeterModel().c_str());
+    }
+    if(data->getMeterTimestamp() != 0) {
+        writer.writeSint(4, (int64_t) data->getMeterTimestamp() - (int64_t) data->getPackageTimestamp());
+    }
+
+    // Values the meter does not send are zero and left out by the writer
+    writer.writeUint(5, data->getActiveImportPower());
+    writer.writeUint(6, data->getReactiveImportPower());
+    writer.writeUint(7, data->getActiveExportPower());
+    writer.writeUint(8, data->getReactiveExportPower());
+    writer.writeUint(9, data->getL1ActiveImportPower());
+    writer.writeUint(10, data->getL2ActiveImportPower());
+    writer.writeUint(11, data->getL3ActiveImportPower());
+    writer.writeUint(12, data->getL1ActiveExportPower());
+    writer.writeUint(13, data->getL2ActiveExportPower());
+    writer.writeUint(14, data->getL3ActiveExportPower());
+
+    writer.writeSint(15, lroundf(data->getL1Current() * 100));
+    writer.writeSint(16, lroundf(data->getL2Current() * 100));
+    writer.writeSint(17, lroundf(data->getL3Current() * 100));
+    writer.writeUint(18, lroundf(data->getL1Voltage() * 10));
+    writer.writeUint(19, lroundf(data->getL2Voltage() * 10));
+    writer.writeUint(20, lroundf(data->getL3Voltage() * 10));
+    writer.writeSint(21, lroundf(data->getPowerFactor() * 1000));
+    writer.writeSint(22, lroundf(data->getL1PowerFactor() * 1000));
+    writer.writeSint(23, lroundf(data->getL2PowerFactor() * 1000));
+    writer.writeSint(24, lroundf(data->getL3PowerFactor() * 1000));
+
+    if(data->getListType() >= 3) {
+        int64_t counters[PROTOBUF_COUNTERS] = {
+            llround(data->getActiveImportCounter() * 1000),
+            llround(data->getActiveExportCounter() * 1000),
+            llround(data->getReactiveImportCounter() * 1000),
+            llround(data->getReactiveExportCounter() * 1000),
+            llround(data->getL1ActiveImportCounter() * 1000),
+            llround(data->getL2ActiveImportCounter() * 1000),
+            llround(data->getL3ActiveImportCounter() * 1000),
+            llround(data->getL1ActiveExportCounter() * 1000),
+            llround(data->getL2ActiveExportCounter() * 1000),
+            llround(data->getL3ActiveExportCounter() * 1000)
+        };
+        if(key) {
+            memcpy(keyCounters, counters, sizeof(keyCounters));
+        }
+        for(uint8_t i = 0; i < PROTOBUF_COUNTERS; i++) {
+            writer.writeSint(25 + i, key ? counters[i] : counters[i] - keyCounters[i]);
+        }
+    }
+    writer.endMessage(mark);
+}
+
+void ProtobufMqttHandler::writeRealtime(ProtobufWriter& writer, EnergyAccounting* ea) {
+    size_t mark = writer.beginMessage(6);
+    writer.writeUint(1, lroundf(ea->getUseThisHour() * 1000));
+    writer.writeUint(2, lroundf(ea->getUseToday() * 1000));
+    writer.writeUint(3, ea->getCurrentThreshold());
+    writer.writeUint(4, lroundf(ea->getMonthMax() * 1000));
+    writer.writeUint(5, lroundf(ea->getProducedThisHour() * 1000));
+    writer.writeUint(6, lroundf(ea->getProducedToday() * 1000));
+    writer.endMessage(mark);
+}
+
+bool ProtobufMqttHandler::sendBinary(size_t length, bool retain) {
+    return mqtt.publish(mqttConfig.publishTopic, json, length, retain, 0);
+}
+
+bool ProtobufMqttHandler::publishTemperatures(AmsConfiguration* config, HwTools* hw) {
+    int count = hw->getTempSensorCount();
+    if(count < 2) {
+        return false;
+    }
+
+    ProtobufWriter writer((uint8_t*) json, BufferSize);
+    for(int i = 0; i < count; i++) {
+        TempSensorData* data = hw->getTempSensorData(i);
+        if(data != NULL) {
+            // Same byte order as the hex address in the other formats
+            uint64_t address = 0;
+            for(uint8_t b = 0; b < 8; b++) {
+                address = (address << 8) | data->address[b];
+            }
+            size_t mark = writer.beginMessage(9);
+            writer.writeFixed64(1, address);
+            writer.writeSint(2, lroundf(data->lastRead * 100));
+            writer.endMessage(mark);
+            data->changed = false;
+        }
+    }
+    bool ret = writer.isOk() && sendBinary(writer.getLength(), false);
+    loop();
+    return ret;
+}
+
+bool ProtobufMqttHandler::publishPrices(PriceService* ps) {
+    if(strlen(mqttConfig.publishTopic) == 0 || !mqtt.connected())
+        return false;
+    if(ps->getValueForHour(PRICE_DIRECTION_IMPORT, 0) == PRICE_NO_VALUE)
+        return false;
+
+    time_t now = time(nullptr);
+
+    int32_t values[38];
+    uint8_t count = 0;
+    for(uint8_t i = 0; i < 38; i++) {
+        float val = ps->getValueForHour(PRICE_DIRECTION_IMPORT, now, i);
+        if(val == PRICE_NO_VALUE) break;
+        values[count++] = lroundf(val * 10000);
+    }
+
+    ProtobufWriter writer((uint8_t*) json, BufferSize);
+    size_t mark = writer.beginMessage(8);
+    writer.writeSint(1, now - (now % SECS_PER_HOUR));
+    writer.writePackedSint(2, values, count);
+    writer.endMessage(mark);
+
+    bool ret = writer.isOk() && sendBinary(writer.getLength(), false);
+    loop();
+    return ret;
+}
+
+bool ProtobufMqttHandler::publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea) {
+    if(strlen(mqttConfig.publishTopic) == 0 || !mqtt.connected())
+        return false;
+
+    ProtobufWriter writer((uint8_t*) json, BufferSize);
+    size_t mark = writer.beginMessage(7);
+    writer.writeString(1, WiFi.macAddress().c_str());
+    writer.writeString(2, mqttConfig.clientId);
+    writer.writeUint(3, (uint32_t) (millis64()/1000));
+    writer.writeUint(4, lroundf((snapshot == NULL ? hw->getVcc() : snapshot->getVcc()) * 1000));
+    writer.writeSint(5, snapshot == NULL ? hw->getWifiRssi() : snapshot->getWifiRssi());
+    writer.writeSint(6, lroundf((snapshot == NULL ? hw->getTemperature() : snapshot->getTemperature()) * 100));
+    writer.writeString(7, FirmwareVersion::VersionString);
+    writer.endMessage(mark);
+
+    bool ret = writer.isOk() && sendBinary(writer.getLength(), false);
+    loop();
+    return ret;
+}
+
+void ProtobufMqttHandler::onConnected() {
+    // The broker or the subscribers may have lost the keyframe, start over with a new one
+    seq = 0;
+    keySeq = 0;
+}
+
+uint8_t ProtobufMqttHandler::getFormat() {
+    return 8;
+}
+
+bool ProtobufMqttHandler::publishRaw(String data) {
+    return false;
+}
+
+void ProtobufMqttHandler::onMessage(String &topic, String &payload) {
+}
@@ -0,0 +1,119 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "ProtobufWriter.h"
+
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_LENGTH 2
+
+ProtobufWriter::ProtobufWriter(uint8_t* buf, size_t size) {
+    this->buf = buf;
+    this->size = size;
+}
+
+void ProtobufWriter::writeVarint(uint64_t value) {
+    do {
+        if(pos >= size) {
+            ok = false;
+            return;
+        }
+        uint8_t b = value & 0x7F;
+        value >>= 7;
+        buf[pos++] = value == 0 ? b : b | 0x80;
+    } while(value != 0);
+}
+
+void ProtobufWriter::writeTag(uint8_t field, uint8_t type) {
+    writeVarint((field << 3) | type);
+}
+
+void ProtobufWriter::writeUint(uint8_t field, uint64_t value) {
+    if(value == 0) return;
+    writeTag(field, PB_VARINT);
+    writeVarint(value);
+}
+
+void ProtobufWriter::writeSint(uint8_t field, int64_t value) {
+    if(value == 0) return;
+    writeTag(field, PB_VARINT);
+    writeVarint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+void ProtobufWriter::writeBool(uint8_t field, bool value) {
+    writeUint(field, value ? 1 : 0);
+}
+
+void ProtobufWriter::writeFixed64(uint8_t field, uint64_t value) {
+    if(value == 0) return;
+    writeTag(field, PB_FIXED64);
+    if(pos + 8 > size) {
+        ok = false;
+        return;
+    }
+    for(uint8_t i = 0; i < 8; i++) {
+        buf[pos++] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+void ProtobufWriter::writeString(uint8_t field, const char* str) {
+    size_t length = str == NULL ? 0 : strlen(str);
+    if(length == 0) return;
+    writeTag(field, PB_LENGTH);
+    writeVarint(length);
+    if(pos + length > size) {
+        ok = false;
+        return;
+    }
+    memcpy(buf + pos, str, length);
+    pos += length;
+}
+
+void ProtobufWriter::writePackedSint(uint8_t field, int32_t* values, uint8_t count) {
+    if(count == 0) return;
+    size_t mark = beginMessage(field);
+    for(uint8_t i = 0; i < count; i++) {
+        // Every element is written, a zero in a packed list still holds its place
+        int64_t value = values[i];
+        writeVarint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+    }
+    endMessage(mark);
+}
+
+size_t ProtobufWriter::beginMessage(uint8_t field) {
+    writeTag(field, PB_LENGTH);
+    size_t mark = pos;
+    pos += 2;
+    if(pos > size) {
+        ok = false;
+        pos = size;
+    }
+    return mark;
+}
+
+void ProtobufWriter::endMessage(size_t mark) {
+    if(!ok) return;
+    size_t length = pos - mark - 2;
+    if(length < 0x80) {
+        memmove(buf + mark + 1, buf + mark + 2, length);
+        buf[mark] = length;
+        pos--;
+    } else if(length < 0x4000) {
+        buf[mark] = (length & 0x7F) | 0x80;
+        buf[mark + 1] = length >> 7;
+    } else {
+        ok = false;
+    }
+}
+
+bool ProtobufWriter::isOk() {
+    return ok;
+}
+
+size_t ProtobufWriter::getLength() {
+    return pos;
+}
@@ -9,17 +9,80 @@
 
 #include "AmsMqttHandler.h"
 
+// One cache slot per published value, followed by the topics that are sent without the cache
+enum RawMqttSlot {
+    RawSlotImportActive = 0,
+    RawSlotExportActive = 1,
+    RawSlotImportReactive = 2,
+    RawSlotExportReactive = 3,
+    RawSlotL1Current = 4,
+    RawSlotL1Voltage = 5,
+    RawSlotL2Current = 6,
+    RawSlotL2Voltage = 7,
+    RawSlotL3Current = 8,
+    RawSlotL3Voltage = 9,
+    RawSlotImportL1 = 10,
+    RawSlotImportL2 = 11,
+    RawSlotImportL3 = 12,
+    RawSlotExportL1 = 13,
+    RawSlotExportL2 = 14,
+    RawSlotExportL3 = 15,
+    RawSlotImportL1Accumulated = 16,
+    RawSlotImportL2Accumulated = 17,
+    RawSlotImportL3Accumulated = 18,
+    RawSlotExportL1Accumulated = 19,
+    RawSlotExportL2Accumulated = 20,
+    RawSlotExportL3Accumulated = 21,
+    RawSlotPowerFactor = 22,
+    RawSlotL1PowerFactor = 23,
+    RawSlotL2PowerFactor = 24,
+    RawSlotL3PowerFactor = 25,
+    RawSlotImportReactiveAccumulated = 26,
+    RawSlotImportActiveAccumulated = 27,
+    RawSlotExportReactiveAccumulated = 28,
+    RawSlotExportActiveAccumulated = 29,
+    RawSlotRealtimeImportHour = 30,
+    RawSlotRealtimeImportDay = 31,
+    RawSlotRealtimeImportMonth = 32,
+    RawSlotRealtimePeak = 33, // Five slots, one per peak
+    RawSlotRealtimeThreshold = 38,
+    RawSlotRealtimeMonthMax = 39,
+    RawSlotRealtimeExportHour = 40,
+    RawSlotRealtimeExportDay = 41,
+    RawSlotRealtimeExportMonth = 42,
+    RawTopicTimestamp = 43,
+    RawTopicMeterId = 44,
+    RawTopicMeterType = 45,
+    RawTopicMeterClock = 46,
+    RawTopicId = 47,
+    RawTopicUptime = 48,
+    RawTopicVcc = 49,
+    RawTopicMem = 50,
+    RawTopicRssi = 51,
+    RawTopicTemperature = 52,
+    RawTopicPriceMin = 53,
+    RawTopicPriceMax = 54,
+    RawTopicPriceCheapest1hr = 55,
+    RawTopicPriceCheapest3hr = 56,
+    RawTopicPriceCheapest6hr = 57,
+    RawTopicExportPrice = 58
+};
+#define RAW_MQTT_SLOTS 43
+#define RAW_MQTT_TOPICS 59
+
 class RawMqttHandler : public AmsMqttHandler {
 public:
     #if defined(AMS_REMOTE_DEBUG)
     RawMqttHandler(MqttConfig& mqttConfig, RemoteDebug* debugger, char* buf) : AmsMqttHandler(mqttConfig, debugger, buf) {
         full = mqttConfig.payloadFormat == 2;
-        topic = String(mqttConfig.publishTopic);
+        buildTopics();
+        publishCache = new PublishCache(&this->mqttConfig, RAW_MQTT_SLOTS);
     };
     #else
     RawMqttHandler(MqttConfig& mqttConfig, Stream* debugger, char* buf) : AmsMqttHandler(mqttConfig, debugger, buf) {
         full = mqttConfig.payloadFormat == 2;
-        topic = String(mqttConfig.publishTopic);
+        buildTopics();
+        publishCache = new PublishCache(&this->mqttConfig, RAW_MQTT_SLOTS);
     };
     #endif
     bool publish(AmsData* data, AmsData* previousState, EnergyAccounting* ea, PriceService* ps);
@@ -28,13 +91,14 @@ public:
     bool publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea);
     bool publishRaw(String data);
 
+    void setConfig(MqttConfig& mqttConfig);
     void onMessage(String &topic, String &payload);
 
     uint8_t getFormat();
 
 private:
     bool full;
-    String topic;
+    TopicTable topics;
     uint32_t lastThresholdPublish = 0;
 
     bool publishList1(AmsData* data, AmsData* meterState);
@@ -42,5 +106,8 @@ private:
     bool publishList3(AmsData* data, AmsData* meterState);
     bool publishList4(AmsData* data, AmsData* meterState);
     bool publishRealtime(EnergyAccounting* ea);
+    bool shouldPublish(RawMqttSlot slot, double value, PublishDeadband deadband);
+    void buildTopics();
+    bool publishValue(RawMqttSlot index, double value, uint8_t decimals, bool retain = false);
 };
 #endif
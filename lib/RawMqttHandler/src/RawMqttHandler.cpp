@@ -8,8 +8,70 @@
 #include "hexutils.h"
 #include "Uptime.h"
 
+// Suffixes in RawMqttSlot order, appended to the publish topic
+static const char RawTopics[] PROGMEM =
+    "/meter/import/active\0"
+    "/meter/export/active\0"
+    "/meter/import/reactive\0"
+    "/meter/export/reactive\0"
+    "/meter/l1/current\0"
+    "/meter/l1/voltage\0"
+    "/meter/l2/current\0"
+    "/meter/l2/voltage\0"
+    "/meter/l3/current\0"
+    "/meter/l3/voltage\0"
+    "/meter/import/l1\0"
+    "/meter/import/l2\0"
+    "/meter/import/l3\0"
+    "/meter/export/l1\0"
+    "/meter/export/l2\0"
+    "/meter/export/l3\0"
+    "/meter/import/l1/accumulated\0"
+    "/meter/import/l2/accumulated\0"
+    "/meter/import/l3/accumulated\0"
+    "/meter/export/l1/accumulated\0"
+    "/meter/export/l2/accumulated\0"
+    "/meter/export/l3/accumulated\0"
+    "/meter/powerfactor\0"
+    "/meter/l1/powerfactor\0"
+    "/meter/l2/powerfactor\0"
+    "/meter/l3/powerfactor\0"
+    "/meter/import/reactive/accumulated\0"
+    "/meter/import/active/accumulated\0"
+    "/meter/export/reactive/accumulated\0"
+    "/meter/export/active/accumulated\0"
+    "/realtime/import/hour\0"
+    "/realtime/import/day\0"
+    "/realtime/import/month\0"
+    "/realtime/import/peak/1\0"
+    "/realtime/import/peak/2\0"
+    "/realtime/import/peak/3\0"
+    "/realtime/import/peak/4\0"
+    "/realtime/import/peak/5\0"
+    "/realtime/import/threshold\0"
+    "/realtime/import/monthmax\0"
+    "/realtime/export/hour\0"
+    "/realtime/export/day\0"
+    "/realtime/export/month\0"
+    "/meter/dlms/timestamp\0"
+    "/meter/id\0"
+    "/meter/type\0"
+    "/meter/clock\0"
+    "/id\0"
+    "/uptime\0"
+    "/vcc\0"
+    "/mem\0"
+    "/rssi\0"
+    "/temperature\0"
+    "/price/min\0"
+    "/price/max\0"
+    "/price/cheapest/1hr\0"
+    "/price/cheapest/3hr\0"
+    "/price/cheapest/6hr\0"
+    "/exportprice/0";
+
 bool RawMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAccounting* ea, PriceService* ps) {
-	if(topic.isEmpty() || !mqtt.connected())
+	if(topics.isEmpty() || !mqtt.connected())
 		return false;
 
     AmsData data;
@@ -24,7 +86,7 @@ bool RawMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAcco
     }
         
     if(data.getPackageTimestamp() > 0) {
-        mqtt.publish(topic + "/meter/dlms/timestamp", String(data.getPackageTimestamp()));
+        publishValue(RawTopicTimestamp, data.getPackageTimestamp(), 0);
     }
     switch(data.getListType()) {
         case 4:
@@ -48,8 +110,8 @@ bool RawMqttHandler::publish(AmsData* update, AmsData* previousState, EnergyAcco
 }
 
 bool RawMqttHandler::publishList1(AmsData* data, AmsData* meterState) {
-    if(full || meterState->getActiveImportPower() != data->getActiveImportPower()) {
-        mqtt.publish(topic + "/meter/import/active", String(data->getActiveImportPower()));
+    if(shouldPublish(RawSlotImportActive, data->getActiveImportPower(), PublishDeadbandPower)) {
+        publishValue(RawSlotImportActive, data->getActiveImportPower(), 0);
     }
     return true;
 }
@@ -57,153 +119,183 @@ bool RawMqttHandler::publishList1(AmsData* data, AmsData* meterState) {
 bool RawMqttHandler::publishList2(AmsData* data, AmsData* meterState) {
     // Only send data if changed. ID and Type is sent on the 10s interval only if changed
     if(full || meterState->getMeterId() != data->getMeterId()) {
-        mqtt.publish(topic + "/meter/id", data->getMeterId());
+        mqtt.publish(topics.get(RawTopicMeterId), data->getMeterId());
     }
     if(full || meterState->getMeterModel() != data->getMeterModel()) {
-        mqtt.publish(topic + "/meter/type", data->getMeterModel());
+        mqtt.publish(topics.get(RawTopicMeterType), data->getMeterModel());
     }
     loop();
-    if(full || meterState->getL1Current() != data->getL1Current()) {
-        mqtt.publish(topic + "/meter/l1/current", String(data->getL1Current(), 2));
+    if(shouldPublish(RawSlotL1Current, data->getL1Current(), PublishDeadbandCurrent)) {
+        publishValue(RawSlotL1Current, data->getL1Current(), 2);
     }
-    if(full || meterState->getL1Voltage() != data->getL1Voltage()) {
-        mqtt.publish(topic + "/meter/l1/voltage", String(data->getL1Voltage(), 2));
+    if(shouldPublish(RawSlotL1Voltage, data->getL1Voltage(), PublishDeadbandVoltage)) {
+        publishValue(RawSlotL1Voltage, data->getL1Voltage(), 2);
     }
     loop();
-    if(full || meterState->getL2Current() != data->getL2Current()) {
-        mqtt.publish(topic + "/meter/l2/current", String(data->getL2Current(), 2));
+    if(shouldPublish(RawSlotL2Current, data->getL2Current(), PublishDeadbandCurrent)) {
+        publishValue(RawSlotL2Current, data->getL2Current(), 2);
     }
-    if(full || meterState->getL2Voltage() != data->getL2Voltage()) {
-        mqtt.publish(topic + "/meter/l2/voltage", String(data->getL2Voltage(), 2));
+    if(shouldPublish(RawSlotL2Voltage, data->getL2Voltage(), PublishDeadbandVoltage)) {
+        publishValue(RawSlotL2Voltage, data->getL2Voltage(), 2);
     }
     loop();
-    if(full || meterState->getL3Current() != data->getL3Current()) {
-        mqtt.publish(topic + "/meter/l3/current", String(data->getL3Current(), 2));
+    if(shouldPublish(RawSlotL3Current, data->getL3Current(), PublishDeadbandCurrent)) {
+        publishValue(RawSlotL3Current, data->getL3Current(), 2);
     }
-    if(full || meterState->getL3Voltage() != data->getL3Voltage()) {
-        mqtt.publish(topic + "/meter/l3/voltage", String(data->getL3Voltage(), 2));
+    if(shouldPublish(RawSlotL3Voltage, data->getL3Voltage(), PublishDeadbandVoltage)) {
+        publishValue(RawSlotL3Voltage, data->getL3Voltage(), 2);
     }
     loop();
-    if(full || meterState->getReactiveExportPower() != data->getReactiveExportPower()) {
-        mqtt.publish(topic + "/meter/export/reactive", String(data->getReactiveExportPower()));
+    if(shouldPublish(RawSlotExportReactive, data->getReactiveExportPower(), PublishDeadbandPower)) {
+        publishValue(RawSlotExportReactive, data->getReactiveExportPower(), 0);
     }
-    if(full || meterState->getActiveExportPower() != data->getActiveExportPower()) {
-        mqtt.publish(topic + "/meter/export/active", String(data->getActiveExportPower()));
+    if(shouldPublish(RawSlotExportActive, data->getActiveExportPower(), PublishDeadbandPower)) {
+        publishValue(RawSlotExportActive, data->getActiveExportPower(), 0);
     }
-    if(full || meterState->getReactiveImportPower() != data->getReactiveImportPower()) {
-        mqtt.publish(topic + "/meter/import/reactive", String(data->getReactiveImportPower()));
+    if(shouldPublish(RawSlotImportReactive, data->getReactiveImportPower(), PublishDeadbandPower)) {
+        publishValue(RawSlotImportReactive, data->getReactiveImportPower(), 0);
     }
     return true;
 }
 
 bool RawMqttHandler::publishList3(AmsData* data, AmsData* meterState) {
     // ID and type belongs to List 2, but I see no need to send that every 10s
-    mqtt.publish(topic + "/meter/id", data->getMeterId(), true, 0);
-    mqtt.publish(topic + "/meter/type", data->getMeterModel(), true, 0);
-    mqtt.publish(topic + "/meter/clock", String(data->getMeterTimestamp()));
-    mqtt.publish(topic + "/meter/import/reactive/accumulated", String(data->getReactiveImportCounter(), 3), true, 0);
-    mqtt.publish(topic + "/meter/import/active/accumulated", String(data->getActiveImportCounter(), 3), true, 0);
-    mqtt.publish(topic + "/meter/export/reactive/accumulated", String(data->getReactiveExportCounter(), 3), true, 0);
-    mqtt.publish(topic + "/meter/export/active/accumulated", String(data->getActiveExportCounter(), 3), true, 0);
+    mqtt.publish(topics.get(RawTopicMeterId), data->getMeterId(), true, 0);
+    mqtt.publish(topics.get(RawTopicMeterType), data->getMeterModel(), true, 0);
+    publishValue(RawTopicMeterClock, data->getMeterTimestamp(), 0);
+    if(shouldPublish(RawSlotImportReactiveAccumulated, data->getReactiveImportCounter(), PublishDeadbandNone)) {
+        publishValue(RawSlotImportReactiveAccumulated, data->getReactiveImportCounter(), 3, true);
+    }
+    if(shouldPublish(RawSlotImportActiveAccumulated, data->getActiveImportCounter(), PublishDeadbandNone)) {
+        publishValue(RawSlotImportActiveAccumulated, data->getActiveImportCounter(), 3, true);
+    }
+    if(shouldPublish(RawSlotExportReactiveAccumulated, data->getReactiveExportCounter(), PublishDeadbandNone)) {
+        publishValue(RawSlotExportReactiveAccumulated, data->getReactiveExportCounter(), 3, true);
+    }
+    if(shouldPublish(RawSlotExportActiveAccumulated, data->getActiveExportCounter(), PublishDeadbandNone)) {
+        publishValue(RawSlotExportActiveAccumulated, data->getActiveExportCounter(), 3, true);
+    }
     return true;
 }
 
 bool RawMqttHandler::publishList4(AmsData* data, AmsData* meterState) {
-        if(full || meterState->getL1ActiveImportPower() != data->getL1ActiveImportPower()) {
-            mqtt.publish(topic + "/meter/import/l1", String(data->getL1ActiveImportPower()));
+        if(shouldPublish(RawSlotImportL1, data->getL1ActiveImportPower(), PublishDeadbandPower)) {
+            publishValue(RawSlotImportL1, data->getL1ActiveImportPower(), 0);
             mqtt.loop();
         }
-        if(full || meterState->getL2ActiveImportPower() != data->getL2ActiveImportPower()) {
-            mqtt.publish(topic + "/meter/import/l2", String(data->getL2ActiveImportPower()));
+        if(shouldPublish(RawSlotImportL2, data->getL2ActiveImportPower(), PublishDeadbandPower)) {
+            publishValue(RawSlotImportL2, data->getL2ActiveImportPower(), 0);
             mqtt.loop();
         }
-        if(full || meterState->getL3ActiveImportPower() != data->getL3ActiveImportPower()) {
-            mqtt.publish(topic + "/meter/import/l3", String(data->getL3ActiveImportPower()));
+        if(shouldPublish(RawSlotImportL3, data->getL3ActiveImportPower(), PublishDeadbandPower)) {
+            publishValue(RawSlotImportL3, data->getL3ActiveImportPower(), 0);
             mqtt.loop();
         }
-        if(full || meterState->getL1ActiveExportPower() != data->getL1ActiveExportPower()) {
-            mqtt.publish(topic + "/meter/export/l1", String(data->getL1ActiveExportPower()));
+        if(shouldPublish(RawSlotExportL1, data->getL1ActiveExportPower(), PublishDeadbandPower)) {
+            publishValue(RawSlotExportL1, data->getL1ActiveExportPower(), 0);
             mqtt.loop();
         }
-        if(full || meterState->getL2ActiveExportPower() != data->getL2ActiveExportPower()) {
-            mqtt.publish(topic + "/meter/export/l2", String(data->getL2ActiveExportPower()));
+        if(shouldPublish(RawSlotExportL2, data->getL2ActiveExportPower(), PublishDeadbandPower)) {
+            publishValue(RawSlotExportL2, data->getL2ActiveExportPower(), 0);
             mqtt.loop();
         }
-        if(full || meterState->getL3ActiveExportPower() != data->getL3ActiveExportPower()) {
-            mqtt.publish(topic + "/meter/export/l3", String(data->getL3ActiveExportPower()));
+        if(shouldPublish(RawSlotExportL3, data->getL3ActiveExportPower(), PublishDeadbandPower)) {
+            publishValue(RawSlotExportL3, data->getL3ActiveExportPower(), 0);
             mqtt.loop();
         }
-        if(full || meterState->getL1ActiveImportCounter() != data->getL1ActiveImportCounter()) {
-            mqtt.publish(topic + "/meter/import/l1/accumulated", String(data->getL1ActiveImportCounter(), 2));
+        if(shouldPublish(RawSlotImportL1Accumulated, data->getL1ActiveImportCounter(), PublishDeadbandNone)) {
+            publishValue(RawSlotImportL1Accumulated, data->getL1ActiveImportCounter(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL2ActiveImportCounter() != data->getL2ActiveImportCounter()) {
-            mqtt.publish(topic + "/meter/import/l2/accumulated", String(data->getL2ActiveImportCounter(), 2));
+        if(shouldPublish(RawSlotImportL2Accumulated, data->getL2ActiveImportCounter(), PublishDeadbandNone)) {
+            publishValue(RawSlotImportL2Accumulated, data->getL2ActiveImportCounter(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL3ActiveImportCounter() != data->getL3ActiveImportCounter()) {
-            mqtt.publish(topic + "/meter/import/l3/accumulated", String(data->getL3ActiveImportCounter(), 2));
+        if(shouldPublish(RawSlotImportL3Accumulated, data->getL3ActiveImportCounter(), PublishDeadbandNone)) {
+            publishValue(RawSlotImportL3Accumulated, data->getL3ActiveImportCounter(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL1ActiveExportCounter() != data->getL1ActiveExportCounter()) {
-            mqtt.publish(topic + "/meter/export/l1/accumulated", String(data->getL1ActiveExportCounter(), 2));
+        if(shouldPublish(RawSlotExportL1Accumulated, data->getL1ActiveExportCounter(), PublishDeadbandNone)) {
+            publishValue(RawSlotExportL1Accumulated, data->getL1ActiveExportCounter(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL2ActiveExportCounter() != data->getL2ActiveExportCounter()) {
-            mqtt.publish(topic + "/meter/export/l2/accumulated", String(data->getL2ActiveExportCounter(), 2));
+        if(shouldPublish(RawSlotExportL2Accumulated, data->getL2ActiveExportCounter(), PublishDeadbandNone)) {
+            publishValue(RawSlotExportL2Accumulated, data->getL2ActiveExportCounter(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL3ActiveExportCounter() != data->getL3ActiveExportCounter()) {
-            mqtt.publish(topic + "/meter/export/l3/accumulated", String(data->getL3ActiveExportCounter(), 2));
+        if(shouldPublish(RawSlotExportL3Accumulated, data->getL3ActiveExportCounter(), PublishDeadbandNone)) {
+            publishValue(RawSlotExportL3Accumulated, data->getL3ActiveExportCounter(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getPowerFactor() != data->getPowerFactor()) {
-            mqtt.publish(topic + "/meter/powerfactor", String(data->getPowerFactor(), 2));
+        if(shouldPublish(RawSlotPowerFactor, data->getPowerFactor(), PublishDeadbandNone)) {
+            publishValue(RawSlotPowerFactor, data->getPowerFactor(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL1PowerFactor() != data->getL1PowerFactor()) {
-            mqtt.publish(topic + "/meter/l1/powerfactor", String(data->getL1PowerFactor(), 2));
+        if(shouldPublish(RawSlotL1PowerFactor, data->getL1PowerFactor(), PublishDeadbandNone)) {
+            publishValue(RawSlotL1PowerFactor, data->getL1PowerFactor(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL2PowerFactor() != data->getL2PowerFactor()) {
-            mqtt.publish(topic + "/meter/l2/powerfactor", String(data->getL2PowerFactor(), 2));
+        if(shouldPublish(RawSlotL2PowerFactor, data->getL2PowerFactor(), PublishDeadbandNone)) {
+            publishValue(RawSlotL2PowerFactor, data->getL2PowerFactor(), 2);
             mqtt.loop();
         }
-        if(full || meterState->getL3PowerFactor() != data->getL3PowerFactor()) {
-            mqtt.publish(topic + "/meter/l3/powerfactor", String(data->getL3PowerFactor(), 2));
+        if(shouldPublish(RawSlotL3PowerFactor, data->getL3PowerFactor(), PublishDeadbandNone)) {
+            publishValue(RawSlotL3PowerFactor, data->getL3PowerFactor(), 2);
             mqtt.loop();
         }
         return true;
 }
 
 bool RawMqttHandler::publishRealtime(EnergyAccounting* ea) {
-    mqtt.publish(topic + "/realtime/import/hour", String(ea->getUseThisHour(), 3));
-    mqtt.loop();
-    mqtt.publish(topic + "/realtime/import/day", String(ea->getUseToday(), 2));
-    mqtt.loop();
-    mqtt.publish(topic + "/realtime/import/month", String(ea->getUseThisMonth(), 1));
-    mqtt.loop();
+    if(shouldPublish(RawSlotRealtimeImportHour, ea->getUseThisHour(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeImportHour, ea->getUseThisHour(), 3);
+        mqtt.loop();
+    }
+    if(shouldPublish(RawSlotRealtimeImportDay, ea->getUseToday(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeImportDay, ea->getUseToday(), 2);
+        mqtt.loop();
+    }
+    if(shouldPublish(RawSlotRealtimeImportMonth, ea->getUseThisMonth(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeImportMonth, ea->getUseThisMonth(), 1);
+        mqtt.loop();
+    }
     uint8_t peakCount = ea->getConfig()->hours;
     if(peakCount > 5) peakCount = 5;
     for(uint8_t i = 1; i <= peakCount; i++) {
-        mqtt.publish(topic + "/realtime/import/peak/" + String(i, 10), String(ea->getPeak(i).value / 100.0, 10), true, 0);
+        if(shouldPublish((RawMqttSlot) (RawSlotRealtimePeak + i - 1), ea->getPeak(i).value, PublishDeadbandNone)) {
+            publishValue((RawMqttSlot) (RawSlotRealtimePeak + i - 1), ea->getPeak(i).value / 100.0, 10, true);
+            mqtt.loop();
+        }
+    }
+    if(shouldPublish(RawSlotRealtimeThreshold, ea->getCurrentThreshold(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeThreshold, ea->getCurrentThreshold(), 0, true);
+        mqtt.loop();
+    }
+    if(shouldPublish(RawSlotRealtimeMonthMax, ea->getMonthMax(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeMonthMax, ea->getMonthMax(), 3, true);
+        mqtt.loop();
+    }
+    if(shouldPublish(RawSlotRealtimeExportHour, ea->getProducedThisHour(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeExportHour, ea->getProducedThisHour(), 3);
+        mqtt.loop();
+    }
+    if(shouldPublish(RawSlotRealtimeExportDay, ea->getProducedToday(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeExportDay, ea->getProducedToday(), 2);
+        mqtt.loop();
+    }
+    if(shouldPublish(RawSlotRealtimeExportMonth, ea->getProducedThisMonth(), PublishDeadbandNone)) {
+        publishValue(RawSlotRealtimeExportMonth, ea->getProducedThisMonth(), 1);
         mqtt.loop();
     }
-    mqtt.publish(topic + "/realtime/import/threshold", String(ea->getCurrentThreshold(), 10), true, 0);
-    mqtt.loop();
-    mqtt.publish(topic + "/realtime/import/monthmax", String(ea->getMonthMax(), 3), true, 0);
-    mqtt.loop();
-    mqtt.publish(topic + "/realtime/export/hour", String(ea->getProducedThisHour(), 3));
-    mqtt.loop();
-    mqtt.publish(topic + "/realtime/export/day", String(ea->getProducedToday(), 2));
-    mqtt.loop();
-    mqtt.publish(topic + "/realtime/export/month", String(ea->getProducedThisMonth(), 1));
-    mqtt.loop();
     uint32_t now = millis();
     if(lastThresholdPublish == 0 || now-lastThresholdPublish > 3600000) {
         EnergyAccountingConfig* conf = ea->getConfig();
+        char name[MQTT_MAX_TOPIC_LENGTH];
+        char val[DECIMAL_FORMAT_SIZE];
         for(uint8_t i = 0; i < 9; i++) {
-            mqtt.publish(topic + "/realtime/import/thresholds/" + String(i+1, 10), String(conf->thresholds[i], 10), true, 0);
+            snprintf_P(name, sizeof(name), PSTR("%s/realtime/import/thresholds/%d"), mqttConfig.publishTopic, i+1);
+            formatDecimal(val, conf->thresholds[i], 0);
+            mqtt.publish(name, val, true, 0);
             mqtt.loop();
         }
         lastThresholdPublish = now;
@@ -211,13 +303,29 @@ bool RawMqttHandler::publishRealtime(EnergyAccounting* ea) {
     return true;
 }
 
+bool RawMqttHandler::shouldPublish(RawMqttSlot slot, double value, PublishDeadband deadband) {
+    // The full format sends every value on every frame
+    if(full) return true;
+    return publishCache->shouldPublish(slot, value, deadband);
+}
+
+bool RawMqttHandler::publishValue(RawMqttSlot index, double value, uint8_t decimals, bool retain) {
+    char val[DECIMAL_FORMAT_SIZE];
+    formatDecimal(val, value, decimals);
+    return mqtt.publish(topics.get(index), val, retain, 0);
+}
+
 bool RawMqttHandler::publishTemperatures(AmsConfiguration* config, HwTools* hw) {
     uint8_t c = hw->getTempSensorCount();
     for(int i = 0; i < c; i++) {
         TempSensorData* data = hw->getTempSensorData(i);
         if(data != NULL && data->lastValidRead > -85) {
             if(data->changed || full) {
-                mqtt.publish(topic + "/temperature/" + toHex(data->address), String(data->lastValidRead, 2));
+                char name[MQTT_MAX_TOPIC_LENGTH];
+                char val[DECIMAL_FORMAT_SIZE];
+                snprintf_P(name, sizeof(name), PSTR("%s/temperature/%s"), mqttConfig.publishTopic, toHex(data->address).c_str());
+                formatDecimal(val, data->lastValidRead, 2);
+                mqtt.publish(name, val);
                 mqtt.loop();
                 data->changed = false;
             }
@@ -227,7 +335,7 @@ bool RawMqttHandler::publishTemperatures(AmsConfiguration* config, HwTools* hw)
 }
 
 bool RawMqttHandler::publishPrices(PriceService* ps) {
-	if(topic.isEmpty() || !mqtt.connected())
+	if(topics.isEmpty() || !mqtt.connected())
 		return false;
 	if(ps->getValueForHour(PRICE_DIRECTION_IMPORT, 0) == PRICE_NO_VALUE)
 		return false;
@@ -307,67 +415,70 @@ bool RawMqttHandler::publishPrices(PriceService* ps) {
 		sprintf(ts6hr, "%04d-%02d-%02dT%02d:00:00Z", tm.Year+1970, tm.Month, tm.Day, tm.Hour);
 	}
 
+    char name[MQTT_MAX_TOPIC_LENGTH];
+    char val[DECIMAL_FORMAT_SIZE];
     for(int i = 0; i < 34; i++) {
-        float val = values[i];
-        if(val == PRICE_NO_VALUE) {
-            mqtt.publish(topic + "/price/" + String(i), "", true, 0);
+        snprintf_P(name, sizeof(name), PSTR("%s/price/%d"), mqttConfig.publishTopic, i);
+        if(values[i] == PRICE_NO_VALUE) {
+            mqtt.publish(name, "", true, 0);
             mqtt.loop();
         } else {
-            mqtt.publish(topic + "/price/" + String(i), String(val, 4), true, 0);
+            formatDecimal(val, values[i], 4);
+            mqtt.publish(name, val, true, 0);
             mqtt.loop();
         }
     }
     if(min != INT16_MAX) {
-        mqtt.publish(topic + "/price/min", String(min, 4), true, 0);
+        publishValue(RawTopicPriceMin, min, 4, true);
         mqtt.loop();
     }
     if(max != INT16_MIN) {
-        mqtt.publish(topic + "/price/max", String(max, 4), true, 0);
+        publishValue(RawTopicPriceMax, max, 4, true);
         mqtt.loop();
     }
     if(min1hrIdx != -1) {
-        mqtt.publish(topic + "/price/cheapest/1hr", String(ts1hr), true, 0);
+        mqtt.publish(topics.get(RawTopicPriceCheapest1hr), ts1hr, true, 0);
         mqtt.loop();
     }
     if(min3hrIdx != -1) {
-        mqtt.publish(topic + "/price/cheapest/3hr", String(ts3hr), true, 0);
+        mqtt.publish(topics.get(RawTopicPriceCheapest3hr), ts3hr, true, 0);
         mqtt.loop();
     }
     if(min6hrIdx != -1) {
-        mqtt.publish(topic + "/price/cheapest/6hr", String(ts6hr), true, 0);
+        mqtt.publish(topics.get(RawTopicPriceCheapest6hr), ts6hr, true, 0);
         mqtt.loop();
     }
 
     float exportPrice = ps->getEnergyPriceForHour(PRICE_DIRECTION_EXPORT, now, 0);
     if(exportPrice == PRICE_NO_VALUE) {
-        mqtt.publish(topic + "/exportprice/0", "", true, 0);
+        mqtt.publish(topics.get(RawTopicExportPrice), "", true, 0);
         mqtt.loop();
     } else {
-        mqtt.publish(topic + "/exportprice/0", String(exportPrice, 4), true, 0);
+        publishValue(RawTopicExportPrice, exportPrice, 4, true);
         mqtt.loop();
     }
     return true;
 }
 
 bool RawMqttHandler::publishSystem(HwTools* hw, PriceService* ps, EnergyAccounting* ea) {
-	if(topic.isEmpty() || !mqtt.connected())
+	if(topics.isEmpty() || !mqtt.connected())
 		return false;
 
-	mqtt.publish(topic + "/id", WiFi.macAddress(), true, 0);
+	mqtt.publish(topics.get(RawTopicId), WiFi.macAddress(), true, 0);
     mqtt.loop();
-	mqtt.publish(topic + "/uptime", String((uint32_t) (millis64()/1000)));
+	publishValue(RawTopicUptime, (uint32_t) (millis64()/1000), 0);
     mqtt.loop();
 	float vcc = hw->getVcc();
 	if(vcc > 0) {
-		mqtt.publish(topic + "/vcc", String(vcc, 2));
+		publishValue(RawTopicVcc, vcc, 2);
         mqtt.loop();
 	}
-	mqtt.publish(topic + "/mem", String(ESP.getFreeHeap()));
+	publishValue(RawTopicMem, ESP.getFreeHeap(), 0);
     mqtt.loop();
-	mqtt.publish(topic + "/rssi", String(hw->getWifiRssi()));
+	publishValue(RawTopicRssi, hw->getWifiRssi(), 0);
     mqtt.loop();
     if(hw->getTemperature() > -85) {
-		mqtt.publish(topic + "/temperature", String(hw->getTemperature(), 2));
+		publishValue(RawTopicTemperature, hw->getTemperature(), 2);
         mqtt.loop();
     }
     return true;
@@ -381,5 +492,15 @@ bool RawMqttHandler::publishRaw(String data) {
     return false;
 }
 
+void RawMqttHandler::setConfig(MqttConfig& mqttConfig) {
+    AmsMqttHandler::setConfig(mqttConfig);
+    full = mqttConfig.payloadFormat == 2;
+    buildTopics();
+}
+
+void RawMqttHandler::buildTopics() {
+    topics.build(mqttConfig.publishTopic, RawTopics, RAW_MQTT_TOPICS);
+}
+
 void RawMqttHandler::onMessage(String &topic, String &payload) {
 }
@@ -10,22 +10,79 @@
 #include <stdint.h>
 #include "AmsData.h"
 
+// Level 0 holds raw samples, the others min/max/avg of a fixed number of level 0 samples
+#if defined(ESP32)
+#define REALTIME_SAMPLE 1000
+#define REALTIME_LEVELS 4
+#define REALTIME_LEVEL_TABLE { { 1, 600 }, { 10, 360 }, { 60, 1440 }, { 900, 672 } } // 10 min, 1 h, 24 h, 7 days
+#else
 #define REALTIME_SAMPLE 10000
-#define REALTIME_SIZE 360
+#define REALTIME_LEVELS 3
+#define REALTIME_LEVEL_TABLE { { 1, 360 }, { 90, 96 }, { 360, 168 } } // 1 h, 24 h, 7 days
+#endif
+
+// Net power per phase in addition to the total, raw samples on level 0 only
+#if defined(REALTIME_PHASES)
+#define REALTIME_CHANNELS 4
+#else
+#define REALTIME_CHANNELS 1
+#endif
+
+struct RealtimeLevelConfig {
+    uint16_t ratio; // Level 0 samples per bucket
+    uint16_t size;
+};
+
+struct RealtimeLevel {
+    uint16_t ratio;
+    uint16_t size;
+    uint8_t codes; // 1 for raw samples, 3 for min/max/avg
+    uint8_t* data;
+    uint32_t current; // Bucket being accumulated
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t count;
+};
 
+/**
+ * Samples are stored as 12 bit codes, two per three bytes. Bit 11 is the sign, bits 10-7 the
+ * exponent and bits 6-0 the mantissa. Exponent 0 holds 0-127 W exactly, above that the value is
+ * (128 + mantissa) << (exponent - 1), which keeps the error below 0.4% up to about 4 MW.
+ *
+ * Every level accumulates the bucket in progress and writes it to its ring once a sample for the
+ * next bucket arrives, so an update costs the same regardless of how far back the levels reach.
+ */
 class RealtimePlot {
 public:
     RealtimePlot();
     void update(AmsData& data);
-    int32_t getValue(uint16_t req);
+    int32_t getValue(uint16_t req, uint8_t channel = 0);
     int16_t getSize();
+    uint16_t getSampleInterval();
+    uint8_t getChannels();
+
+    uint8_t getLevels();
+    uint32_t getLevelInterval(uint8_t level);
+    uint16_t getLevelSize(uint8_t level);
+    bool getBucket(uint8_t level, uint16_t req, int32_t& min, int32_t& max, int32_t& avg);
+
+    static uint16_t encode(int32_t value);
+    static int32_t decode(uint16_t code);
 
 private:
-    int8_t* values;
-    uint8_t* scaling;
+    RealtimeLevel levels[REALTIME_LEVELS];
+    #if defined(REALTIME_PHASES)
+    uint8_t* phases;
+    #endif
 
-    unsigned long lastMillis = 0;
+    uint64_t lastMillis = 0;
     double lastReading = 0;
-    uint16_t lastPos = 0;
+    uint32_t lastSample = 0;
+
+    void add(RealtimeLevel& level, uint32_t from, uint32_t to, int32_t value);
+    void finalize(RealtimeLevel& level);
+    static void set(uint8_t* data, uint32_t idx, uint16_t code);
+    static uint16_t get(uint8_t* data, uint32_t idx);
 };
 #endif
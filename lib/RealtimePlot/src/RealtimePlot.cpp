@@ -5,25 +5,44 @@
  */
 
 #include "RealtimePlot.h"
+#include "Uptime.h"
 #include <stdlib.h>
 
+static const RealtimeLevelConfig levelConfig[REALTIME_LEVELS] = REALTIME_LEVEL_TABLE;
+
 RealtimePlot::RealtimePlot() {
-    values = (int8_t*) malloc(REALTIME_SIZE);
-    scaling = (uint8_t*) malloc(REALTIME_SIZE);
-    memset(values, 0, REALTIME_SIZE);
-    memset(scaling, 0, REALTIME_SIZE);
+    for(uint8_t i = 0; i < REALTIME_LEVELS; i++) {
+        RealtimeLevel& level = levels[i];
+        level.ratio = levelConfig[i].ratio;
+        level.size = levelConfig[i].size;
+        level.codes = level.ratio == 1 ? 1 : 3;
+        size_t bytes = ((level.size * level.codes + 1) / 2) * 3;
+        level.data = (uint8_t*) malloc(bytes);
+        memset(level.data, 0, bytes);
+        level.current = 0;
+        level.count = 0;
+    }
+    #if defined(REALTIME_PHASES)
+    size_t bytes = ((levels[0].size + 1) / 2) * 3 * (REALTIME_CHANNELS - 1);
+    phases = (uint8_t*) malloc(bytes);
+    memset(phases, 0, bytes);
+    #endif
 }
 
 void RealtimePlot::update(AmsData& data) {
-    unsigned long now = millis();
-    uint16_t pos = (now / REALTIME_SAMPLE) % REALTIME_SIZE;
+    // Sample numbers must keep counting past the 49.7 day wrap of millis(), or the rings would jump back
+    uint64_t now = millis64();
+    uint32_t sample = now / REALTIME_SAMPLE;
     if(lastMillis == 0) {
         lastMillis = now;
         lastReading = data.getActiveImportCounter() - data.getActiveExportCounter();
-        lastPos = pos;
+        lastSample = sample;
+        for(uint8_t i = 0; i < REALTIME_LEVELS; i++) {
+            levels[i].current = sample / levels[i].ratio;
+        }
         return;
     }
-    if(pos == lastPos && data.isCounterEstimated()) return;
+    if(sample == lastSample && data.isCounterEstimated()) return;
 
     unsigned long ms = now - lastMillis;
     int32_t val; // A bit hacky this one, but just to avoid spikes at end of hour. Will mostly be correct
@@ -32,51 +51,196 @@ void RealtimePlot::update(AmsData& data) {
     } else {
         val = data.getActiveImportPower() - data.getActiveExportPower();
     }
-    uint8_t scale = 0;
-    int32_t update = val / pow(10, scale);
-    while(update > INT8_MAX || update < INT8_MIN) {
-        update = val / pow(10, ++scale);
-    }
-    if(pos < lastPos) {
-        for(uint16_t i = lastPos+1; i < REALTIME_SIZE; i++) {
-            values[i] = update;
-            scaling[i] = scale;
-        }
-        for(uint16_t i = 0; i <= pos; i++) {
-            values[i] = update;
-            scaling[i] = scale;
+
+    // Every sample after the last update up to and including the current one gets the new value
+    if(sample != lastSample) {
+        for(uint8_t i = 0; i < REALTIME_LEVELS; i++) {
+            add(levels[i], lastSample, sample, val);
         }
-    } else {
-        for(uint16_t i = lastPos+1; i <= pos; i++) {
-            values[i] = update;
-            scaling[i] = scale;
+
+        #if defined(REALTIME_PHASES)
+        bool hasPhases = !data.isCounterEstimated();
+        int32_t phase[REALTIME_CHANNELS - 1] = {
+            hasPhases ? (int32_t) data.getL1ActiveImportPower() - (int32_t) data.getL1ActiveExportPower() : 0,
+            hasPhases ? (int32_t) data.getL2ActiveImportPower() - (int32_t) data.getL2ActiveExportPower() : 0,
+            hasPhases ? (int32_t) data.getL3ActiveImportPower() - (int32_t) data.getL3ActiveExportPower() : 0
+        };
+        uint16_t size = levels[0].size;
+        uint32_t from = sample - lastSample > size ? sample - size : lastSample;
+        for(uint32_t s = from + 1; s <= sample; s++) {
+            for(uint8_t c = 0; c < REALTIME_CHANNELS - 1; c++) {
+                set(phases, (c * size) + (s % size), encode(phase[c]));
+            }
         }
+        #endif
     }
 
     lastMillis = now;
     lastReading = data.getActiveImportCounter() - data.getActiveExportCounter();
-    lastPos = pos;
+    lastSample = sample;
+}
+
+int32_t RealtimePlot::getValue(uint16_t req, uint8_t channel) {
+    if(channel >= REALTIME_CHANNELS) return 0;
+    if(channel == 0) {
+        int32_t min, max, avg;
+        return getBucket(0, req, min, max, avg) ? avg : 0;
+    }
+
+    #if defined(REALTIME_PHASES)
+    uint16_t size = levels[0].size;
+    uint32_t sample = millis64() / REALTIME_SAMPLE;
+    if(lastMillis == 0 || req >= size || req > sample) return 0;
+    uint32_t s = min(sample - req, lastSample);
+    if(lastSample - s >= size) return 0;
+    return decode(get(phases, ((channel - 1) * size) + (s % size)));
+    #else
+    return 0;
+    #endif
+}
+
+int16_t RealtimePlot::getSize() {
+    return levels[0].size;
 }
 
-int32_t RealtimePlot::getValue(uint16_t req) {
-    if(req > REALTIME_SIZE) return 0;
+uint16_t RealtimePlot::getSampleInterval() {
+    return REALTIME_SAMPLE;
+}
 
-    unsigned long now = millis();
-    if(req * REALTIME_SAMPLE > now) return 0;
-    unsigned long reqTime = now - (req * REALTIME_SAMPLE);
+uint8_t RealtimePlot::getChannels() {
+    return REALTIME_CHANNELS;
+}
 
-    uint16_t pos = (now / REALTIME_SAMPLE) % REALTIME_SIZE;
-    uint16_t getPos;
-    if(reqTime > lastMillis) {
-        getPos = lastPos;
-    } else if(req > pos) {
-        getPos = REALTIME_SIZE + pos - req;
+uint8_t RealtimePlot::getLevels() {
+    return REALTIME_LEVELS;
+}
+
+uint32_t RealtimePlot::getLevelInterval(uint8_t level) {
+    if(level >= REALTIME_LEVELS) return 0;
+    return (uint32_t) levels[level].ratio * REALTIME_SAMPLE;
+}
+
+uint16_t RealtimePlot::getLevelSize(uint8_t level) {
+    if(level >= REALTIME_LEVELS) return 0;
+    return levels[level].size;
+}
+
+bool RealtimePlot::getBucket(uint8_t level, uint16_t req, int32_t& min, int32_t& max, int32_t& avg) {
+    if(level >= REALTIME_LEVELS || lastMillis == 0) return false;
+    RealtimeLevel& l = levels[level];
+    if(req >= l.size) return false;
+
+    uint32_t bucket = (millis64() / REALTIME_SAMPLE) / l.ratio;
+    if(req > bucket) return false;
+    bucket -= req;
+
+    // Nothing newer than the last update, so anything after it repeats the bucket in progress
+    if(bucket >= l.current && l.count > 0) {
+        min = l.min;
+        max = l.max;
+        avg = l.sum / (int32_t) l.count;
+        return true;
+    }
+    if(bucket >= l.current) bucket = l.current - 1;
+    if(l.current - bucket > l.size) return false;
+
+    uint32_t idx = (bucket % l.size) * l.codes;
+    if(l.codes == 1) {
+        min = max = avg = decode(get(l.data, idx));
     } else {
-        getPos = pos - req;
+        min = decode(get(l.data, idx));
+        max = decode(get(l.data, idx + 1));
+        avg = decode(get(l.data, idx + 2));
     }
-    return values[getPos] * pow(10, scaling[getPos]);
+    return true;
 }
 
-int16_t RealtimePlot::getSize() {
-    return REALTIME_SIZE;
+void RealtimePlot::add(RealtimeLevel& level, uint32_t from, uint32_t to, int32_t value) {
+    // After a gap longer than the ring, only the part that still fits is worth writing
+    uint32_t span = (uint32_t) level.ratio * level.size;
+    if(to - from > span) {
+        from = to - span;
+        level.current = (from + 1) / level.ratio;
+        level.count = 0;
+    }
+
+    uint32_t s = from + 1;
+    while(s <= to) {
+        uint32_t bucket = s / level.ratio;
+        if(bucket != level.current) {
+            finalize(level);
+            level.current = bucket;
+        }
+        uint32_t end = min(((bucket + 1) * level.ratio) - 1, to);
+        uint32_t n = end - s + 1;
+        if(level.count == 0) {
+            level.min = level.max = value;
+            level.sum = 0;
+        } else {
+            if(value < level.min) level.min = value;
+            if(value > level.max) level.max = value;
+        }
+        level.sum += (int64_t) value * n;
+        level.count += n;
+        s = end + 1;
+    }
+
+    // Raw samples are visible as soon as they arrive, buckets once they are complete
+    if(level.ratio == 1) {
+        finalize(level);
+        level.min = level.max = level.sum = value;
+        level.count = 1;
+    }
+}
+
+void RealtimePlot::finalize(RealtimeLevel& level) {
+    if(level.count == 0) return;
+    int32_t avg = level.sum / (int32_t) level.count;
+    uint32_t idx = (level.current % level.size) * level.codes;
+    if(level.codes == 1) {
+        set(level.data, idx, encode(avg));
+    } else {
+        set(level.data, idx, encode(level.min));
+        set(level.data, idx + 1, encode(level.max));
+        set(level.data, idx + 2, encode(avg));
+    }
+    level.count = 0;
+}
+
+uint16_t RealtimePlot::encode(int32_t value) {
+    uint16_t sign = value < 0 ? 0x800 : 0;
+    uint32_t v = value < 0 ? -value : value;
+    if(v < 128) return sign | v;
+
+    // Round to nearest on the precision of the exponent, which may carry into the next one
+    uint8_t exp = 31 - __builtin_clz(v) - 6;
+    v = (v + ((1 << (exp - 1)) >> 1)) >> (exp - 1);
+    if(v > 255) {
+        v >>= 1;
+        exp++;
+    }
+    if(exp > 15) return sign | 0x7FF;
+    return sign | (exp << 7) | (v & 0x7F);
+}
+
+int32_t RealtimePlot::decode(uint16_t code) {
+    uint8_t exp = (code >> 7) & 0x0F;
+    int32_t v = exp == 0 ? (code & 0x7F) : ((code & 0x7F) | 0x80) << (exp - 1);
+    return code & 0x800 ? -v : v;
+}
+
+void RealtimePlot::set(uint8_t* data, uint32_t idx, uint16_t code) {
+    uint8_t* p = data + ((idx >> 1) * 3);
+    if(idx & 1) {
+        p[1] = (p[1] & 0x0F) | ((code & 0x0F) << 4);
+        p[2] = code >> 4;
+    } else {
+        p[0] = code & 0xFF;
+        p[1] = (p[1] & 0xF0) | (code >> 8);
+    }
+}
+
+uint16_t RealtimePlot::get(uint8_t* data, uint32_t idx) {
+    uint8_t* p = data + ((idx >> 1) * 3);
+    return idx & 1 ? (p[1] >> 4) | (p[2] << 4) : p[0] | ((p[1] & 0x0F) << 8);
 }
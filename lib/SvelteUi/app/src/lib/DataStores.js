@@ -50,42 +50,88 @@ let data = {};
 export const dataStore = readable(data, (set) => { 
     let timeout;
     let scanTimeout;
+    let events;
+    let access = false;
+    let lastSubscribe = 0;
+
+    function received(data) {
+        set(data);
+        if(lastTemp != data.t) {
+            lastTemp = data.t;
+            setTimeout(getTemperatures, 2000);
+        }
+        if(lastPrice == null && data.pe && data.p != null) {
+            lastPrice = data.p;
+            getPrices();
+        }
+        if(sysinfo.upgrading) {
+            window.location.reload();
+        } else if(!sysinfo || !sysinfo.chip || sysinfo.booting || (tries > 1 && !isBusPowered(sysinfo.board))) {
+            getSysinfo();
+            if(dayPlotTimeout) clearTimeout(dayPlotTimeout);
+            dayPlotTimeout = setTimeout(getDayPlot, 2000);
+            if(monthPlotTimeout) clearTimeout(monthPlotTimeout);
+            monthPlotTimeout = setTimeout(getMonthPlot, 3000);
+        }
+        if(!dayPlotTimeout) dayPlotTimeout = getDayPlot();
+        if(!monthPlotTimeout) monthPlotTimeout = getMonthPlot();
+        tries = 0;
+    }
+
+    // Bus powered devices are asked less often while the supply is low
+    function pollInterval(data) {
+        let to = 5000;
+        if(isBusPowered(sysinfo.board) && data.v > 2.5) {
+            let diff = (3.3 - Math.min(3.3, data.v));
+            if(diff > 0) {
+                to = Math.max(diff, 0.1) * 10 * 5000;
+            }
+        }
+        return to;
+    }
+
+    // Frames are pushed on /events as they arrive, data.json is only polled while the stream is unavailable
+    function subscribe() {
+        lastSubscribe = Date.now();
+        events = new EventSource("events");
+        events.addEventListener("hello", (e) => {
+            access = JSON.parse(e.data).a;
+        });
+        events.onmessage = (e) => {
+            let data = JSON.parse(e.data);
+            // The access flag of the session is only sent in the hello event
+            data.a = access;
+            received(data);
+            if(pollInterval(data) > 5000) unsubscribe();
+        };
+        events.onerror = () => {
+            // Too many subscribers or the device went away, polling takes over and counts the failures
+            unsubscribe();
+        };
+    }
+
+    function unsubscribe() {
+        if(!events) return;
+        events.close();
+        events = null;
+        if(timeout) clearTimeout(timeout);
+        timeout = setTimeout(getData, 1000);
+    }
+
     async function getData() {
         fetchWithTimeout("data.json")
             .then((res) => res.json())
             .then((data) => {
-                set(data);
-                if(lastTemp != data.t) {
-                    lastTemp = data.t;
-                    setTimeout(getTemperatures, 2000);
-                }
-                if(lastPrice == null && data.pe && data.p != null) {
-                    lastPrice = data.p;
-                    getPrices();
-                }
-                if(sysinfo.upgrading) {
-                    window.location.reload();
-                } else if(!sysinfo || !sysinfo.chip || sysinfo.booting || (tries > 1 && !isBusPowered(sysinfo.board))) {
-                    getSysinfo();
-                    if(dayPlotTimeout) clearTimeout(dayPlotTimeout);
-                    dayPlotTimeout = setTimeout(getDayPlot, 2000);
-                    if(monthPlotTimeout) clearTimeout(monthPlotTimeout);
-                    monthPlotTimeout = setTimeout(getMonthPlot, 3000);
-                }
-                if(!dayPlotTimeout) dayPlotTimeout = getDayPlot();
-                if(!monthPlotTimeout) monthPlotTimeout = getMonthPlot();
-                
-                let to = 5000;
-                if(isBusPowered(sysinfo.board) && data.v > 2.5) {
-                    let diff = (3.3 - Math.min(3.3, data.v));
-                    if(diff > 0) {
-                        to = Math.max(diff, 0.1) * 10 * 5000;
-                    }
-                }
+                received(data);
+
+                let to = pollInterval(data);
                 if(to > 5000) console.log("Next in " + to + "ms");
+                if(to <= 5000 && typeof EventSource !== "undefined" && Date.now() - lastSubscribe > 60000) {
+                    subscribe();
+                    return;
+                }
                 if(timeout) clearTimeout(timeout);
                 timeout = setTimeout(getData, to);
-                tries = 0;
             })
             .catch((err) => {
                 tries++;
@@ -106,6 +152,7 @@ export const dataStore = readable(data, (set) => {
     getData();
     return function stop() {
         clearTimeout(timeout);
+        if(events) events.close();
     }
 });
 
@@ -18,6 +18,7 @@ export default defineConfig({
   server: {
     proxy: {
       "/data.json": "http://192.168.233.49",
+      "/events": "http://192.168.233.49",
       "/energyprice.json": "http://192.168.233.49",
       "/dayplot.json": "http://192.168.233.49",
       "/monthplot.json": "http://192.168.233.49",
@@ -16,8 +16,11 @@ static const char HEADER_ACCESS_CONTROL_REQUEST_PRIVATE_NETWORK[] PROGMEM = "Acc
 static const char HEADER_ACCESS_CONTROL_ALLOW_PRIVATE_NETWORK[] PROGMEM = "Access-Control-Allow-Private-Network";
 static const char HEADER_REFERER[] PROGMEM = "Referer";
 static const char HEADER_ORIGIN[] PROGMEM = "Origin";
+static const char HEADER_ETAG[] PROGMEM = "ETag";
+static const char HEADER_IF_NONE_MATCH[] PROGMEM = "If-None-Match";
 
 static const char CACHE_CONTROL_NO_CACHE[] PROGMEM = "no-cache, no-store, must-revalidate";
+static const char CACHE_CONTROL_REVALIDATE[] PROGMEM = "no-cache";
 static const char CONTENT_ENCODING_GZIP[] PROGMEM = "gzip";
 static const char CACHE_1DA[] PROGMEM = "public, max-age=86400";
 static const char CACHE_1MO[] PROGMEM = "public, max-age=2630000";
@@ -29,6 +32,9 @@ static const char AUTHENTICATE_BASIC[] PROGMEM = "Basic realm=\"Secure Area\"";
 static const char MIME_PLAIN[] PROGMEM = "text/plain";
 static const char MIME_HTML[] PROGMEM = "text/html";
 static const char MIME_JSON[] PROGMEM = "application/json";
+static const char MIME_BINARY[] PROGMEM = "application/octet-stream";
+static const char MIME_CSV[] PROGMEM = "text/csv";
+static const char MIME_NDJSON[] PROGMEM = "application/x-ndjson";
 static const char MIME_CSS[] PROGMEM = "text/css";
 static const char MIME_JS[] PROGMEM = "text/javascript";
 
@@ -8,6 +8,7 @@
 #define _AMSWEBSERVER_h
 
 #include "Arduino.h"
+#include <functional>
 #include "AmsMqttHandler.h"
 #include "AmsConfiguration.h"
 #include "HwTools.h"
@@ -15,23 +16,28 @@
 #include "AmsStorage.h"
 #include "AmsDataStorage.h"
 #include "EnergyAccounting.h"
+#include "EnergyArchive.h"
 #include "Uptime.h"
 #if defined(AMS_REMOTE_DEBUG)
 #include "RemoteDebug.h"
 #endif
 #include "PriceService.h"
 #include "RealtimePlot.h"
+#include "DataSnapshot.h"
 #include "ConnectionHandler.h"
+#include "HttpClientPool.h"
+#include "EventStream.h"
+#include "HistoryImport.h"
+#include "JsonWriter.h"
+#include "WebServerAdapter.h"
 
 #if defined(ESP8266)
 	#include <ESP8266WiFi.h>
-	#include <ESP8266WebServer.h>
 	#include <ESP8266HTTPClient.h>
 	#include <ESP8266httpUpdate.h>
 	#include <ESP8266SSDP.h>
 #elif defined(ESP32) // ARDUINO_ARCH_ESP32
 	#include <WiFi.h>
-	#include <WebServer.h>
 	#include <HTTPClient.h>
 	#include <HTTPUpdate.h>
 	#include <ESP32SSDP.h>
@@ -46,6 +52,18 @@
 
 #include "LittleFS.h"
 
+// Groups of data.json fields that are left out of a since= response when unchanged
+#define DATA_GROUP_SETTINGS 0
+#define DATA_GROUP_POWER 1
+#define DATA_GROUP_COUNTERS 2
+#define DATA_GROUP_L1 3
+#define DATA_GROUP_L2 4
+#define DATA_GROUP_L3 5
+#define DATA_GROUP_PRICE 6
+#define DATA_GROUP_TARIFF 7
+#define DATA_GROUP_ACCOUNTING 8
+#define DATA_GROUPS 9
+
 class AmsWebServer {
 public:
 	#if defined(AMS_REMOTE_DEBUG)
@@ -53,7 +71,7 @@ public:
 	#else
 	AmsWebServer(uint8_t* buf, Stream* Debug, HwTools* hw, ResetDataContainer* rdc);
 	#endif
-    void setup(AmsConfiguration*, GpioConfig*, AmsData*, AmsDataStorage*, EnergyAccounting*, RealtimePlot*);
+    void setup(AmsConfiguration*, GpioConfig*, AmsData*, AmsDataStorage*, EnergyAccounting*, RealtimePlot*, DataSnapshot*);
     void loop();
 	#if defined(_CLOUDCONNECTOR_H)
 	void setCloud(CloudConnector* cloud);
@@ -65,6 +83,9 @@ public:
 	void setMeterConfig(uint8_t distributionSystem, uint16_t mainFuse, uint16_t productionCapacity);
 	void setMqttHandler(AmsMqttHandler* mqttHandler);
 	void setConnectionHandler(ConnectionHandler* ch);
+	void setHttpClientPool(HttpClientPool* pool);
+	void setEnergyArchive(EnergyArchive* archive);
+	void setIdleCallback(std::function<void()> callback);
 
 private:
     #if defined(AMS_REMOTE_DEBUG)
@@ -79,7 +100,7 @@ private:
 	uint16_t mainFuse = 0, productionCapacity = 0;
 
 	HwTools* hw;
-	Timezone* tz;
+	Timezone* tz = NULL;
 	PriceService* ps = NULL;
 	AmsConfiguration* config;
 	GpioConfig* gpioConfig;
@@ -88,13 +109,27 @@ private:
 	AmsDataStorage* ds;
     EnergyAccounting* ea = NULL;
 	RealtimePlot* rtp = NULL;
+	DataSnapshot* snapshot = NULL;
 	AmsMqttHandler* mqttHandler = NULL;
 	ConnectionHandler* ch = NULL;
+	HttpClientPool* pool = NULL;
+	EnergyArchive* archive = NULL;
+	HistoryImport* historyImport = NULL;
 	#if defined(_CLOUDCONNECTOR_H)
 	CloudConnector* cloud = NULL;
 	#endif
 	bool uploading = false;
 	File file;
+	uint16_t fileRevision = 0;
+	EventStream events;
+	uint64_t lastEventUpdate = 0;
+	unsigned long lastEventPublish = 0;
+	uint32_t etagSeed = 0;
+	uint32_t settingsRevision = 0;
+	uint32_t dataRevisionBase = 0;
+	uint32_t dataRevision = 0;
+	uint32_t dataGroupKey[DATA_GROUPS] = {0};
+	uint32_t dataGroupRevision[DATA_GROUPS] = {0};
 	bool performRestart = false;
 	bool performUpgrade = false;
 	bool rebootForUpgrade = false;
@@ -109,13 +144,10 @@ private:
     static const uint16_t BufferSize = 2048;
     char* buf;
 
-#if defined(ESP8266)
-	ESP8266WebServer server;
-#elif defined(ESP32)
-	WebServer server;
-#endif
+	WebServerAdapter server;
 
 	bool checkSecurity(byte level, bool send401 = true);
+	bool checkETag(uint32_t revision, uint32_t extra);
 
 	void indexHtml();
 	void indexJs();
@@ -125,8 +157,21 @@ private:
 
     void sysinfoJson();
     void dataJson();
+    void dataBin();
+	size_t renderData(char* out, size_t size, const char* access);
+	size_t renderDataBody(char* out, size_t size);
+	void renderDataDelta(uint32_t since, bool access);
+	void updateDataRevisions();
+	void dataStatus(float vcc, int rssi, uint8_t& espStatus, uint8_t& hanStatus, uint8_t& wifiStatus, uint8_t& mqttStatus);
+	void eventsSubscribe();
 	void dayplotJson();
 	void monthplotJson();
+	void archiveJson();
+	void archiveBucket(JsonWriter& json, time_t key, uint32_t importWh, uint32_t exportWh);
+	void historyCsv();
+	void historyNdjson();
+	void historyExport(bool ndjson);
+	void historyRow(JsonWriter& out, bool ndjson, bool withImport, bool withExport, PGM_P series, const char* key, double importValue, double exportValue, uint8_t decimals);
 	void energyPriceJson();
 	void temperatureJson();
 	void tariffJson();
@@ -151,16 +196,21 @@ private:
 	void mqttCertDelete();
 	void mqttKeyUpload();
 	void mqttKeyDelete();
+	void mqttTemplateUpload();
+	void mqttTemplateDelete();
 	HTTPUpload& uploadFile(const char* path);
 	void deleteFile(const char* path);
 
 	void configFileDownload();
+	void configFileLine(JsonWriter& writer, PGM_P key, const void* source);
 	void configFileUpload();
 	void configFilePost();
 	void factoryResetPost();
 
 	void modifyDayPlot();
 	void modifyMonthPlot();
+	void historyUpload();
+	void historyPost();
 
 	void notFound();
 	void redirectToMain();
@@ -0,0 +1,62 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _EVENTSTREAM_H
+#define _EVENTSTREAM_H
+
+#include "Arduino.h"
+
+#if defined(ESP8266)
+	#include <ESP8266WiFi.h>
+	#define EVENT_STREAM_CLIENTS 2
+#elif defined(ESP32)
+	#include <WiFi.h>
+	#define EVENT_STREAM_CLIENTS 4
+#endif
+
+#define EVENT_STREAM_BUFFER 2048
+#define EVENT_STREAM_KEEPALIVE 15000
+
+struct EventStreamClient {
+	WiFiClient client;
+	uint16_t pos; // Bytes of the current event written
+	char* tail; // Unsent end of the previous event, only for a client that fell behind
+	uint16_t tailLength;
+	uint16_t tailPos;
+};
+
+/**
+ * Server-Sent Events fan-out. An event is rendered once into the shared buffer between begin() and
+ * commit() and then written to every subscriber without blocking. A client that cannot take the
+ * whole event finishes it from a private copy of the remainder and then continues with the newest
+ * event, skipping whatever came in between, so nothing queues up behind a slow reader.
+ */
+class EventStream {
+public:
+	bool subscribe(WiFiClient& client, const char* hello);
+	bool hasClients();
+
+	char* begin(size_t& capacity);
+	void commit(size_t length);
+	void loop();
+
+	uint8_t getClientCount();
+	uint32_t getEventCount();
+	uint32_t getDroppedCount();
+
+private:
+	EventStreamClient clients[EVENT_STREAM_CLIENTS];
+	uint8_t count = 0;
+	char* buf = NULL;
+	uint16_t length = 0;
+	uint32_t events = 0;
+	uint32_t dropped = 0;
+
+	int send(WiFiClient& client, const char* data, size_t length);
+	void remove(uint8_t index);
+};
+
+#endif
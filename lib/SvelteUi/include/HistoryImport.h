@@ -0,0 +1,82 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _HISTORYIMPORT_H
+#define _HISTORYIMPORT_H
+
+#include "Arduino.h"
+#include "AmsDataStorage.h"
+#include "EnergyAccounting.h"
+#include "EnergyArchive.h"
+
+#define HISTORY_LINE_SIZE 128
+
+#define HISTORY_SERIES_HOUR 'h'
+#define HISTORY_SERIES_DAY 'd'
+#define HISTORY_SERIES_ARCHIVE 'a'
+#define HISTORY_SERIES_PEAK 'p'
+#define HISTORY_SERIES_COST 'c'
+
+#define HISTORY_COLUMN_SERIES 0
+#define HISTORY_COLUMN_KEY 1
+#define HISTORY_COLUMN_IMPORT 2
+#define HISTORY_COLUMN_EXPORT 3
+#define HISTORY_COLUMNS 4
+#define HISTORY_MAX_COLUMNS 8 // A header may name columns this version does not know, those are skipped
+
+/**
+ * Restores what /history.csv and /history.ndjson export, fed straight from the upload chunks one
+ * line at a time. Rows are series, key, import and export:
+ *   hour     key is the UTC hour 0-23, values in Wh
+ *   day      key is the day of month 1-31, values in Wh
+ *   archive  key is the UTC epoch of the hour, values in Wh, rows of one day are written together
+ *   peak     key is the day of month, import is the peak hour in Wh
+ *   cost     key is yesterday, thismonth or lastmonth, import is cost and export is income
+ * A CSV header line sets the column order, so exports with only some of the fields work as well.
+ * A line with more columns than the header, or than HISTORY_COLUMNS without one, is an error.
+ *
+ * Archive days not stored before are started from zero, and a day block has no way to tell a
+ * missing hour from a zero one. Hours a day's rows leave out are therefore stored as 0 Wh and
+ * counted in getMissingHours(), so the caller can report them.
+ */
+class HistoryImport {
+public:
+	HistoryImport(AmsDataStorage* ds, EnergyAccounting* ea, EnergyArchive* archive);
+
+	void write(const uint8_t* data, size_t length);
+	bool end();
+
+	uint16_t getRows();
+	uint16_t getErrors();
+	uint16_t getMissingHours();
+
+private:
+	AmsDataStorage* ds;
+	EnergyAccounting* ea;
+	EnergyArchive* archive;
+
+	char line[HISTORY_LINE_SIZE];
+	uint8_t length = 0;
+	bool overflow = false;
+	int8_t columns[HISTORY_COLUMNS] = { 0, 1, 2, 3 };
+	uint8_t columnCount = HISTORY_COLUMNS;
+
+	EnergyArchiveDay day;
+	time_t currentDay = 0;
+	uint32_t dayHours = 0; // Bit per hour of the current day that holds a value
+	EnergyAccountingData ead;
+	uint8_t peaks = 0;
+	bool dsChanged = false, eaChanged = false;
+	uint16_t rows = 0, errors = 0, missingHours = 0;
+
+	void parseLine();
+	bool parseCsv(char** fields);
+	bool parseJson(char** fields);
+	bool apply(char** fields);
+	void flushDay();
+};
+
+#endif
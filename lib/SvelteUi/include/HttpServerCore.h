@@ -0,0 +1,187 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _HTTPSERVERCORE_H
+#define _HTTPSERVERCORE_H
+
+#include "Arduino.h"
+#include <functional>
+
+// The core's web server header is only included for HTTPMethod, HTTPUpload and CONTENT_LENGTH_UNKNOWN
+#if defined(ESP8266)
+	#include <ESP8266WiFi.h>
+	#include <ESP8266WebServer.h>
+	#define HTTP_SERVER_CONNECTIONS 4
+	#define HTTP_SERVER_INPUT 768
+	#define HTTP_SERVER_OUTPUT 4096
+	#define HTTP_SERVER_FORM 4096
+#elif defined(ESP32)
+	#include <WiFi.h>
+	#include <WebServer.h>
+	#define HTTP_SERVER_CONNECTIONS 8
+	#define HTTP_SERVER_INPUT 1024
+	#define HTTP_SERVER_OUTPUT 8192
+	#define HTTP_SERVER_FORM 8192
+#endif
+
+#define HTTP_SERVER_SEGMENT 1460 // Most that is handed to the socket at a time, one TCP segment
+#define HTTP_SERVER_HEADERS 8
+#define HTTP_SERVER_TIMEOUT 5000 // Request head and body, and keep-alive connections waiting for the next request
+#define HTTP_SERVER_SEND_TIMEOUT 5000 // Response that has not moved
+
+enum HttpConnectionState {
+	HttpConnectionFree = 0,
+	HttpConnectionHead,
+	HttpConnectionBody,
+	HttpConnectionReady,
+	HttpConnectionSending
+};
+
+enum HttpBodyType {
+	HttpBodyNone = 0,
+	HttpBodyForm,
+	HttpBodyPlain,
+	HttpBodyMultipart
+};
+
+enum HttpMultipartState {
+	HttpMultipartPreamble = 0,
+	HttpMultipartDelimiter,
+	HttpMultipartHeaders,
+	HttpMultipartData,
+	HttpMultipartEpilogue
+};
+
+// Part of a queued response. Copies keep their bytes right after the struct, PROGMEM content is only referenced.
+struct HttpSegment {
+	HttpSegment* next;
+	const char* data;
+	size_t length;
+	size_t pos;
+	bool progmem;
+};
+
+struct HttpConnection {
+	WiFiClient client;
+	uint8_t state = HttpConnectionFree;
+	HTTPMethod method;
+	bool http11;
+	bool keepAlive;
+	bool detached;
+	bool responded;
+	bool chunked;
+	bool discard; // Output after the first response, or after the connection failed, goes nowhere
+	unsigned long lastActivity;
+
+	char* in = NULL;
+	uint16_t inLength = 0;
+
+	char* uri = NULL;
+	String headers[HTTP_SERVER_HEADERS]; // Values of the collected headers, in the order they were asked for
+	String contentType;
+	uint32_t contentLength;
+	uint32_t bodyRead;
+	uint8_t bodyType;
+	void* handler; // Whatever the request was matched to when the head was complete
+
+	char* form = NULL; // Query and body arguments as decoded "name\0value\0" pairs
+	uint16_t formLength;
+	uint16_t formCapacity;
+	bool formOverflow;
+	uint8_t argState;
+	uint8_t argEscape;
+	char argHex;
+
+	uint8_t multipartState;
+	bool multipartFile;
+	String delimiter;
+
+	String responseHeaders;
+	HttpSegment* out = NULL;
+	HttpSegment* outTail = NULL;
+	size_t outLength; // Copied bytes waiting, referenced PROGMEM does not count
+};
+
+/**
+ * Event driven HTTP/1.1 server. Every call to loop() accepts waiting connections, moves at most one
+ * segment of each response out without blocking, reads what has arrived and runs at most one request
+ * handler, so a slow or large response no longer holds up the rest of the firmware. Each connection
+ * has its own input buffer, arguments and output queue. Output is queued while the handler runs and
+ * sent afterwards. A handler that writes more than HTTP_SERVER_OUTPUT waits for its own connection to
+ * drain and keeps the others and the idle callback going meanwhile.
+ *
+ * The subclass matches requests in onHead(), gets multipart file parts in onUpload() one buffer at a
+ * time and answers in onRequest(), using the protected helpers on the connection it was given.
+ */
+class HttpServerCore {
+public:
+	HttpServerCore(uint16_t port = 80);
+	virtual ~HttpServerCore() {}
+
+	void begin();
+	void loop();
+	void setIdleCallback(std::function<void()> callback);
+	void collectHeader(const char* name);
+
+	uint8_t getConnectionCount();
+
+protected:
+	HttpConnection* current = NULL;
+	HTTPUpload* currentUpload = NULL;
+	PGM_P headerNames[HTTP_SERVER_HEADERS];
+	uint8_t headerCount = 0;
+
+	virtual void onHead(HttpConnection& c) {}
+	virtual void onUpload(HttpConnection& c, HTTPUpload& upload) {}
+	virtual void onRequest(HttpConnection& c) = 0;
+
+	const char* findArg(HttpConnection& c, const char* name);
+	bool beginResponse(HttpConnection& c, int code, PGM_P contentType, size_t contentLength);
+	void write(HttpConnection& c, const char* data, size_t length);
+	void write_P(HttpConnection& c, PGM_P data, size_t length);
+	void flush(HttpConnection& c);
+
+private:
+	WiFiServer server;
+	HttpConnection connections[HTTP_SERVER_CONNECTIONS];
+	HttpConnection* uploading = NULL;
+	uint8_t next = 0;
+	std::function<void()> idle = NULL;
+
+	void accept();
+	void service(HttpConnection& c);
+	void dispatch(HttpConnection& c);
+	void fail(HttpConnection& c, int code);
+	void release(HttpConnection& c, bool stop);
+	void reset(HttpConnection& c);
+	void consume(HttpConnection& c, size_t length);
+
+	void parseHead(HttpConnection& c);
+	void requestLine(HttpConnection& c, char* line);
+	void headerLine(HttpConnection& c, char* line);
+	void headComplete(HttpConnection& c);
+	void parseBody(HttpConnection& c);
+	size_t parseMultipart(HttpConnection& c, size_t length);
+	void partHeader(HttpConnection& c, char* line);
+	void partBegin(HttpConnection& c);
+	bool partData(HttpConnection& c, const char* data, size_t length);
+	void partEnd(HttpConnection& c);
+	void uploadEvent(HttpConnection& c, HTTPUploadStatus status);
+	void uploadAbort();
+
+	void argPut(HttpConnection& c, char ch);
+	void argEnd(HttpConnection& c);
+	void formPut(HttpConnection& c, char ch);
+
+	void append(HttpConnection& c, const char* data, size_t length, bool progmem);
+	void appendChunkHeader(HttpConnection& c, size_t length);
+	int sendSegment(HttpConnection& c);
+	int sendBytes(WiFiClient& client, const char* data, size_t length);
+	void drain(HttpConnection& c, bool all);
+	void pump(HttpConnection& c);
+};
+
+#endif
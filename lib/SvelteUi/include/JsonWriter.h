@@ -0,0 +1,79 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _JSONWRITER_H
+#define _JSONWRITER_H
+
+#include "Arduino.h"
+
+#include "WebServerAdapter.h"
+
+typedef WebServerAdapter JsonWriterServer;
+
+#if defined(TCP_MSS)
+#define JSON_WRITER_CHUNK (TCP_MSS - 8) // Room for the chunked encoding header and trailer
+#else
+#define JSON_WRITER_CHUNK 1452
+#endif
+#define JSON_WRITER_DEPTH 16
+
+/**
+ * Writes a response straight into a caller supplied buffer and passes it on to the web server in
+ * chunks of one TCP segment, so the size of the response is not limited by the buffer. Structured
+ * values handle separators, escaping and number formatting, printf_P() is there for the PROGMEM
+ * templates and only needs each single template to fit the buffer.
+ */
+class JsonWriter {
+public:
+	JsonWriter(JsonWriterServer* server, char* buf, size_t size);
+
+	void begin(int code, PGM_P contentType);
+	size_t end();
+
+	void setAsciiOnly(bool asciiOnly);
+	bool isTruncated();
+	size_t getBytesWritten();
+
+	void printf_P(PGM_P format, ...);
+	void print_P(PGM_P str);
+	void write(const char* data, size_t length);
+
+	void beginObject();
+	void endObject();
+	void beginArray();
+	void endArray();
+	void key(const char* name);
+	void key_P(PGM_P name);
+
+	void value(int32_t value);
+	void value(uint32_t value);
+	void value(double value, uint8_t decimals);
+	void value(bool value);
+	void value(const char* str);
+	void nullValue();
+
+private:
+	JsonWriterServer* server;
+	char* buf;
+	size_t size;
+	size_t pos = 0;
+	size_t written = 0;
+	bool asciiOnly = false;
+	bool truncated = false;
+
+	uint8_t depth = 0;
+	uint16_t hasValue = 0; // Bit per nesting level, set once the first member is written
+	bool afterKey = false;
+
+	void separator();
+	void string(const char* str);
+	void push(char c);
+	void put(char c);
+	void flush(bool all);
+	void formatUnsigned(uint64_t value, char* out, uint8_t& len);
+};
+
+#endif
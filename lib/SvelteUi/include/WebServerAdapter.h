@@ -0,0 +1,74 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#ifndef _WEBSERVERADAPTER_H
+#define _WEBSERVERADAPTER_H
+
+#include "HttpServerCore.h"
+
+struct WebServerRoute {
+	String uri;
+	HTTPMethod method;
+	std::function<void(void)> fn;
+	std::function<void(void)> ufn;
+	WebServerRoute* next;
+};
+
+/**
+ * The part of ESP8266WebServer/WebServer that AmsWebServer uses, on top of HttpServerCore, so the
+ * handlers stay as they are. Everything refers to the request whose handler is running. The route
+ * is looked up once per request, when the head is complete.
+ */
+class WebServerAdapter : public HttpServerCore {
+public:
+	typedef std::function<void(void)> THandlerFunction;
+
+	WebServerAdapter(uint16_t port = 80);
+	~WebServerAdapter();
+
+	void on(const String& uri, HTTPMethod method, THandlerFunction fn);
+	void on(const String& uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn);
+	void onNotFound(THandlerFunction fn);
+	void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+	#if defined(ESP8266)
+	template<typename... Args>
+	void collectHeaders(const Args&... args) {
+		const char* keys[] = { args... };
+		collectHeaders(keys, sizeof...(args));
+	}
+	#endif
+	void handleClient();
+
+	String uri();
+	String arg(const String& name);
+	bool hasArg(const String& name);
+	String header(const String& name);
+	bool hasHeader(const String& name);
+
+	void sendHeader(const String& name, const String& value, bool first = false);
+	void setContentLength(size_t length);
+	void send(int code, const char* contentType = NULL, const String& content = String(""));
+	void send_P(int code, PGM_P contentType, PGM_P content);
+	void send_P(int code, PGM_P contentType, PGM_P content, size_t length);
+	void sendContent(const char* content, size_t length);
+	void sendContent(const String& content);
+
+	HTTPUpload& upload();
+	WiFiClient& client();
+
+protected:
+	void onHead(HttpConnection& c);
+	void onUpload(HttpConnection& c, HTTPUpload& upload);
+	void onRequest(HttpConnection& c);
+
+private:
+	WebServerRoute* routes = NULL;
+	WebServerRoute* lastRoute = NULL;
+	THandlerFunction notFoundHandler = NULL;
+	size_t contentLength = CONTENT_LENGTH_NOT_SET;
+};
+
+#endif
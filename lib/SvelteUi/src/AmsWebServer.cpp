@@ -9,6 +9,9 @@
 #include "FirmwareVersion.h"
 #include "base64.h"
 #include "hexutils.h"
+#include "JsonWriter.h"
+#include "AmsDataBinary.h"
+#include "ConfigFile.h"
 
 #include "html/index_html.h"
 #include "html/index_css.h"
@@ -70,13 +73,14 @@ AmsWebServer::AmsWebServer(uint8_t* buf, Stream* Debug, HwTools* hw, ResetDataCo
 	}
 }
 
-void AmsWebServer::setup(AmsConfiguration* config, GpioConfig* gpioConfig, AmsData* meterState, AmsDataStorage* ds, EnergyAccounting* ea, RealtimePlot* rtp) {
+void AmsWebServer::setup(AmsConfiguration* config, GpioConfig* gpioConfig, AmsData* meterState, AmsDataStorage* ds, EnergyAccounting* ea, RealtimePlot* rtp, DataSnapshot* snapshot) {
     this->config = config;
 	this->gpioConfig = gpioConfig;
 	this->meterState = meterState;
 	this->ds = ds;
 	this->ea = ea;
 	this->rtp = rtp;
+	this->snapshot = snapshot;
 
 	String context;
 	config->getWebConfig(webConfig);
@@ -122,8 +126,13 @@ debugger->printf_P(PSTR("Using context path: '%s'\n"), context.c_str());
 	server.on(context + F("/logo.svg"), HTTP_GET, std::bind(&AmsWebServer::logoSvg, this)); 
 	server.on(context + F("/sysinfo.json"), HTTP_GET, std::bind(&AmsWebServer::sysinfoJson, this));
 	server.on(context + F("/data.json"), HTTP_GET, std::bind(&AmsWebServer::dataJson, this));
+	server.on(context + F("/data.bin"), HTTP_GET, std::bind(&AmsWebServer::dataBin, this));
+	server.on(context + F("/events"), HTTP_GET, std::bind(&AmsWebServer::eventsSubscribe, this));
 	server.on(context + F("/dayplot.json"), HTTP_GET, std::bind(&AmsWebServer::dayplotJson, this));
 	server.on(context + F("/monthplot.json"), HTTP_GET, std::bind(&AmsWebServer::monthplotJson, this));
+	server.on(context + F("/archive.json"), HTTP_GET, std::bind(&AmsWebServer::archiveJson, this));
+	server.on(context + F("/history.csv"), HTTP_GET, std::bind(&AmsWebServer::historyCsv, this));
+	server.on(context + F("/history.ndjson"), HTTP_GET, std::bind(&AmsWebServer::historyNdjson, this));
 	server.on(context + F("/energyprice.json"), HTTP_GET, std::bind(&AmsWebServer::energyPriceJson, this));
 	server.on(context + F("/temperature.json"), HTTP_GET, std::bind(&AmsWebServer::temperatureJson, this));
 	server.on(context + F("/tariff.json"), HTTP_GET, std::bind(&AmsWebServer::tariffJson, this));
@@ -147,17 +156,23 @@ debugger->printf_P(PSTR("Using context path: '%s'\n"), context.c_str());
 	server.on(context + F("/mqtt-ca"), HTTP_POST, std::bind(&AmsWebServer::mqttCaDelete, this), std::bind(&AmsWebServer::mqttCaUpload, this));
 	server.on(context + F("/mqtt-cert"), HTTP_POST, std::bind(&AmsWebServer::mqttCertDelete, this), std::bind(&AmsWebServer::mqttCertUpload, this));
 	server.on(context + F("/mqtt-key"), HTTP_POST, std::bind(&AmsWebServer::mqttKeyDelete, this), std::bind(&AmsWebServer::mqttKeyUpload, this));
+	server.on(context + F("/mqtt-template"), HTTP_POST, std::bind(&AmsWebServer::mqttTemplateDelete, this), std::bind(&AmsWebServer::mqttTemplateUpload, this));
 
 	server.on(context + F("/configfile"), HTTP_POST, std::bind(&AmsWebServer::configFilePost, this), std::bind(&AmsWebServer::configFileUpload, this));
 	server.on(context + F("/configfile.cfg"), HTTP_GET, std::bind(&AmsWebServer::configFileDownload, this));
 
 	server.on(context + F("/dayplot"), HTTP_POST, std::bind(&AmsWebServer::modifyDayPlot, this));
 	server.on(context + F("/monthplot"), HTTP_POST, std::bind(&AmsWebServer::modifyMonthPlot, this));
+	server.on(context + F("/history"), HTTP_POST, std::bind(&AmsWebServer::historyPost, this), std::bind(&AmsWebServer::historyUpload, this));
 
 	server.on(context + F("/sysinfo.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
 	server.on(context + F("/data.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
+	server.on(context + F("/data.bin"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
 	server.on(context + F("/dayplot.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
 	server.on(context + F("/monthplot.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
+	server.on(context + F("/archive.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
+	server.on(context + F("/history.csv"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
+	server.on(context + F("/history.ndjson"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
 	server.on(context + F("/energyprice.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
 	server.on(context + F("/temperature.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
 	server.on(context + F("/tariff.json"), HTTP_OPTIONS, std::bind(&AmsWebServer::optionsGet, this));
@@ -180,11 +195,14 @@ debugger->printf_P(PSTR("Using context path: '%s'\n"), context.c_str());
 	server.onNotFound(std::bind(&AmsWebServer::notFound, this));
 	
 	#if defined(ESP32)
-	const char * headerkeys[] = {HEADER_AUTHORIZATION, HEADER_ORIGIN, HEADER_REFERER, HEADER_ACCESS_CONTROL_REQUEST_PRIVATE_NETWORK} ;
-    server.collectHeaders(headerkeys, 4);
+	const char * headerkeys[] = {HEADER_AUTHORIZATION, HEADER_ORIGIN, HEADER_REFERER, HEADER_ACCESS_CONTROL_REQUEST_PRIVATE_NETWORK, HEADER_IF_NONE_MATCH} ;
+    server.collectHeaders(headerkeys, 5);
 	#else
-    server.collectHeaders(HEADER_AUTHORIZATION, HEADER_ORIGIN, HEADER_REFERER, HEADER_ACCESS_CONTROL_REQUEST_PRIVATE_NETWORK);
+    server.collectHeaders(HEADER_AUTHORIZATION, HEADER_ORIGIN, HEADER_REFERER, HEADER_ACCESS_CONTROL_REQUEST_PRIVATE_NETWORK, HEADER_IF_NONE_MATCH);
 	#endif
+	etagSeed = random(INT32_MAX);
+	// Random start so a revision remembered by a client from before a restart is most likely out of range
+	dataRevisionBase = dataRevision = random(0x40000000);
 	server.begin(); // Web server start
 
 	MqttConfig mqttConfig;
@@ -213,8 +231,21 @@ void AmsWebServer::setConnectionHandler(ConnectionHandler* ch) {
 	this->ch = ch;
 }
 
+void AmsWebServer::setHttpClientPool(HttpClientPool* pool) {
+	this->pool = pool;
+}
+
+void AmsWebServer::setEnergyArchive(EnergyArchive* archive) {
+	this->archive = archive;
+}
+
+void AmsWebServer::setIdleCallback(std::function<void()> callback) {
+	server.setIdleCallback(callback);
+}
+
 void AmsWebServer::setPriceService(PriceService* ps) {
 	this->ps = ps;
+	settingsRevision++;
 }
 
 void AmsWebServer::setMeterConfig(uint8_t distributionSystem, uint16_t mainFuse, uint16_t productionCapacity) {
@@ -222,11 +253,24 @@ void AmsWebServer::setMeterConfig(uint8_t distributionSystem, uint16_t mainFuse,
 	this->distributionSystem = distributionSystem;
 	this->mainFuse = mainFuse;
 	this->productionCapacity = productionCapacity;
+	settingsRevision++;
 }
 
 void AmsWebServer::loop() {
 	server.handleClient();
 
+	// Each frame is rendered once for all subscribers, repeated now and then so idle connections are noticed
+	if(events.hasClients() && (meterState->getLastUpdateMillis() != lastEventUpdate || millis() - lastEventPublish > EVENT_STREAM_KEEPALIVE)) {
+		size_t capacity;
+		char* out = events.begin(capacity);
+		if(out != NULL) {
+			events.commit(renderData(out, capacity, "null"));
+		}
+		lastEventUpdate = meterState->getLastUpdateMillis();
+		lastEventPublish = millis();
+	}
+	events.loop();
+
 	if(maxPwr == 0 && meterState->getListType() > 1 && mainFuse > 0 && distributionSystem > 0) {
 		int voltage = distributionSystem == 2 ? 400 : 230;
 		if(meterState->isThreePhase()) {
@@ -236,6 +280,7 @@ void AmsWebServer::loop() {
 		} else {
 			maxPwr = mainFuse * 230;
 		}
+		settingsRevision++;
 	}
 }
 
@@ -270,6 +315,20 @@ debugger->printf_P(PSTR("Unsuccessful login: '%s'\n"), providedPwd.c_str());
 	return access;
 }
 
+bool AmsWebServer::checkETag(uint32_t revision, uint32_t extra) {
+	// Revision counters restart at boot, the seed keeps tags from a previous boot from matching
+	char etag[28];
+	snprintf_P(etag, sizeof(etag), PSTR("\"%08lx%08lx%08lx\""), (unsigned long) etagSeed, (unsigned long) revision, (unsigned long) extra);
+	server.sendHeader(HEADER_ETAG, etag);
+	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_REVALIDATE);
+	if(server.hasHeader(HEADER_IF_NONE_MATCH) && server.header(HEADER_IF_NONE_MATCH).indexOf(etag) >= 0) {
+		server.setContentLength(0);
+		server.send(304);
+		return true;
+	}
+	return false;
+}
+
 void AmsWebServer::notFound() {
 	#if defined(AMS_REMOTE_DEBUG)
 if (debugger->isActive(RemoteDebug::WARNING))
@@ -392,7 +451,15 @@ void AmsWebServer::sysinfoJson() {
 	features += "\"kmp\"";
 	#endif
 
-	int size = snprintf_P(buf, BufferSize, SYSINFO_JSON,
+	addConditionalCloudHeaders();
+	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
+	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
+	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
+
+	JsonWriter json(&server, buf, BufferSize);
+	json.setAsciiOnly(true);
+	json.begin(200, MIME_JSON);
+	json.printf_P(SYSINFO_JSON,
 		FirmwareVersion::VersionString,
 		#if defined(CONFIG_IDF_TARGET_ESP32S2)
 		"esp32s2",
@@ -475,18 +542,30 @@ void AmsWebServer::sysinfoJson() {
 		ea->getProducedLastMonth(),
 		ea->getIncomeLastMonth(),
 		(uint16_t) (tz == NULL ? 0 : (tz->toLocal(now)-now)/3600),
+		pool == NULL ? 0 : pool->getRequestCount(),
+		pool == NULL ? 0 : pool->getReuseCount(),
+		pool == NULL ? 0 : pool->getHandshakeCount(),
+		pool == NULL ? 0 : pool->getHandshakeTime(),
+		events.getClientCount(),
+		events.getEventCount(),
+		events.getDroppedCount(),
+		mqttHandler == NULL ? 0 : mqttHandler->getSentCount(),
+		mqttHandler == NULL ? 0 : mqttHandler->getSuppressedCount(),
+		mqttHandler == NULL ? 0 : mqttHandler->getOutboxDepth(),
+		mqttHandler == NULL ? 0 : mqttHandler->getOutboxSpillBytes(),
+		mqttHandler == NULL ? 0 : mqttHandler->getOutboxDropCount(),
+		mqttHandler == NULL ? 0 : mqttHandler->getDiscoveryPublished(),
+		mqttHandler == NULL ? 0 : mqttHandler->getDiscoveryUnchanged(),
+		mqttHandler == NULL ? 0 : mqttHandler->getDiscoveryTime(),
+		snapshot->getHitCount(),
+		snapshot->getRenderCount(),
+		config->getFlashReadCount(),
+		config->getCommitCount(),
+		config->getUnchangedCount(),
+		config->getDirtySections(),
 		features.c_str()
 	);
-
-	stripNonAscii((uint8_t*) buf, size+1);
-
-	addConditionalCloudHeaders();
-	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
-	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
-	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
-
-	server.setContentLength(strlen(buf));
-	server.send(200, MIME_JSON, buf);
+	json.end();
 
 	if(performRestart || rebootForUpgrade) {
 		server.handleClient();
@@ -508,72 +587,64 @@ debugger->printf_P(PSTR("Rebooting\n"));
 }
 
 void AmsWebServer::dataJson() {
-	uint64_t millis = millis64();
-
 	if(!checkSecurity(2, true))
 		return;
 
-	float vcc = hw->getVcc();
-	int rssi = hw->getWifiRssi();
+	addConditionalCloudHeaders();
+	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
+	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
+	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
 
-	uint8_t espStatus;
-	#if defined(ESP8266)
-	if(vcc < 2.0) { // Voltage not correct, ESP would not run on this voltage
-		espStatus = 1;
-	} else if(vcc > 2.8 && vcc < 3.5) {
-		espStatus = 1;
-	} else if(vcc > 2.7 && vcc < 3.6) {
-		espStatus = 2;
-	} else {
-		espStatus = 3;
-	}
-	#elif defined(ESP32)
-	if(vcc < 2.0) { // Voltage not correct, ESP would not run on this voltage
-		espStatus = 1;
-	} else if(vcc > 3.1 && vcc < 3.5) {
-		espStatus = 1;
-	} else if(vcc > 3.0 && vcc < 3.6) {
-		espStatus = 2;
-	} else {
-		espStatus = 3;
+	bool access = checkSecurity(1, false);
+	if(server.hasArg(F("since"))) {
+		uint32_t since = strtoul(server.arg(F("since")).c_str(), NULL, 10);
+		updateDataRevisions();
+		if(since >= dataRevisionBase && since <= dataRevision) {
+			renderDataDelta(since, access);
+			return;
+		}
 	}
-	#endif
 
-	uint8_t hanStatus;
-	if(meterState->getLastError() != 0) {
-		hanStatus = 3;
-	} else if(meterState->getLastUpdateMillis() == 0 && millis < 30000) {
-		hanStatus = 0;
-	} else if(millis - meterState->getLastUpdateMillis() < 15000) {
-		hanStatus = 1;
-	} else if(millis - meterState->getLastUpdateMillis() < 30000) {
-		hanStatus = 2;
-	} else {
-		hanStatus = 3;
-	}
+	size_t length = renderData(buf, BufferSize, access ? "true" : "false");
+	server.setContentLength(length);
+	server.send(200, MIME_JSON, buf);
+}
 
-	uint8_t wifiStatus;
-	if(rssi > -75) {
-		wifiStatus = 1;
-	} else if(rssi > -95) {
-		wifiStatus = 2;
+size_t AmsWebServer::renderData(char* out, size_t size, const char* access) {
+	updateDataRevisions();
+
+	// Polls and the event stream within one revision all get the same document, only the access flag differs.
+	// Uptime, heap, clock and HAN status change without a new revision, so a cached document is only used
+	// within the second it was rendered in and is never more than a second behind on those
+	uint32_t second = millis64() / 1000;
+	size_t length;
+	const char* cached = snapshot->get(DataSnapshotWebData, dataRevision, second, length);
+	if(cached != NULL && length < size) {
+		memcpy(out, cached, length);
 	} else {
-		wifiStatus = 3;
+		length = renderDataBody(out, size);
+		snapshot->put(DataSnapshotWebData, dataRevision, second, out, length);
 	}
 
-	uint8_t mqttStatus;
-	if(!mqttEnabled) {
-		mqttStatus = 0;
-	} else if(mqttHandler != NULL && mqttHandler->connected()) {
-		mqttStatus = 1;
-	} else if(mqttHandler == NULL || mqttHandler->lastError() == 0) {
-		mqttStatus = 2;
-	} else {
-		mqttStatus = 3;
-	}
+	// The flag goes in front of the closing brace
+	while(length > 0 && out[length-1] != '}') length--;
+	if(length == 0) return 0;
+	length--;
+	length += snprintf_P(out+length, size-length, PSTR(",\"a\":%s}"), access);
+	return length < size ? length : size - 1;
+}
+
+size_t AmsWebServer::renderDataBody(char* out, size_t size) {
+	uint64_t millis = millis64();
 
-	float price = ea->getPriceForHour(PRICE_DIRECTION_IMPORT, 0);
-	float exportPrice = ea->getPriceForHour(PRICE_DIRECTION_EXPORT, 0);
+	float vcc = snapshot->getVcc();
+	int rssi = snapshot->getWifiRssi();
+
+	uint8_t espStatus, hanStatus, wifiStatus, mqttStatus;
+	dataStatus(vcc, rssi, espStatus, hanStatus, wifiStatus, mqttStatus);
+
+	float price = snapshot->getPrice(PRICE_DIRECTION_IMPORT);
+	float exportPrice = snapshot->getPrice(PRICE_DIRECTION_EXPORT);
 
 	String peaks = "";
 	for(uint8_t i = 1; i <= ea->getConfig()->hours; i++) {
@@ -583,7 +654,7 @@ void AmsWebServer::dataJson() {
 
 	time_t now = time(nullptr);
 
-	snprintf_P(buf, BufferSize, DATA_JSON,
+	size_t length = snprintf_P(out, size, DATA_JSON,
 		maxPwr == 0 ? meterState->isThreePhase() ? 20000 : 10000 : maxPwr,
 		productionCapacity,
 		mainFuse == 0 ? 40 : mainFuse,
@@ -619,7 +690,7 @@ void AmsWebServer::dataJson() {
 
 		vcc,
 		rssi,
-		hw->getTemperature(),
+		snapshot->getTemperature(),
 		(uint32_t) (millis / 1000),
 		ESP.getFreeHeap(),
 		espStatus,
@@ -652,16 +723,323 @@ void AmsWebServer::dataJson() {
 		meterState->getLastError(),
 		ps == NULL ? 0 : ps->getLastError(),
 		(uint32_t) now,
-		checkSecurity(1, false) ? "true" : "false"
+		dataRevision
 	);
+	return length < size ? length : size - 1;
+}
+
+void AmsWebServer::dataStatus(float vcc, int rssi, uint8_t& espStatus, uint8_t& hanStatus, uint8_t& wifiStatus, uint8_t& mqttStatus) {
+	uint64_t millis = millis64();
+
+	#if defined(ESP8266)
+	if(vcc < 2.0) { // Voltage not correct, ESP would not run on this voltage
+		espStatus = 1;
+	} else if(vcc > 2.8 && vcc < 3.5) {
+		espStatus = 1;
+	} else if(vcc > 2.7 && vcc < 3.6) {
+		espStatus = 2;
+	} else {
+		espStatus = 3;
+	}
+	#elif defined(ESP32)
+	if(vcc < 2.0) { // Voltage not correct, ESP would not run on this voltage
+		espStatus = 1;
+	} else if(vcc > 3.1 && vcc < 3.5) {
+		espStatus = 1;
+	} else if(vcc > 3.0 && vcc < 3.6) {
+		espStatus = 2;
+	} else {
+		espStatus = 3;
+	}
+	#endif
+
+	if(meterState->getLastError() != 0) {
+		hanStatus = 3;
+	} else if(meterState->getLastUpdateMillis() == 0 && millis < 30000) {
+		hanStatus = 0;
+	} else if(millis - meterState->getLastUpdateMillis() < 15000) {
+		hanStatus = 1;
+	} else if(millis - meterState->getLastUpdateMillis() < 30000) {
+		hanStatus = 2;
+	} else {
+		hanStatus = 3;
+	}
+
+	if(rssi > -75) {
+		wifiStatus = 1;
+	} else if(rssi > -95) {
+		wifiStatus = 2;
+	} else {
+		wifiStatus = 3;
+	}
+
+	if(!mqttEnabled) {
+		mqttStatus = 0;
+	} else if(mqttHandler != NULL && mqttHandler->connected()) {
+		mqttStatus = 1;
+	} else if(mqttHandler == NULL || mqttHandler->lastError() == 0) {
+		mqttStatus = 2;
+	} else {
+		mqttStatus = 3;
+	}
+}
+
+void AmsWebServer::updateDataRevisions() {
+	// Each group is keyed by the revisions of what it is made from, the key changing gives the group a new revision here
+	uint32_t psRevision = ps == NULL ? 0 : ps->getRevision();
+	uint32_t keys[DATA_GROUPS] = {
+		settingsRevision + meterState->getRevision(AmsDataGroupMeter),
+		meterState->getRevision(AmsDataGroupPower),
+		meterState->getRevision(AmsDataGroupCounters),
+		meterState->getRevision(AmsDataGroupL1),
+		meterState->getRevision(AmsDataGroupL2),
+		meterState->getRevision(AmsDataGroupL3),
+		settingsRevision + psRevision + (uint32_t) (time(nullptr) / 3600),
+		ea->getRevision(),
+		(uint32_t) meterState->getLastUpdateMillis()
+	};
+	for(uint8_t i = 0; i < DATA_GROUPS; i++) {
+		if(keys[i] != dataGroupKey[i]) {
+			dataGroupKey[i] = keys[i];
+			dataGroupRevision[i] = ++dataRevision;
+		}
+	}
+}
+
+void AmsWebServer::renderDataDelta(uint32_t since, bool access) {
+	// Same fields as data.json, but groups that have not changed after the given revision are left out
+	float vcc = snapshot->getVcc();
+	int rssi = snapshot->getWifiRssi();
+	uint8_t espStatus, hanStatus, wifiStatus, mqttStatus;
+	dataStatus(vcc, rssi, espStatus, hanStatus, wifiStatus, mqttStatus);
+
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.beginObject();
+
+	if(dataGroupRevision[DATA_GROUP_SETTINGS] > since) {
+		json.key_P(PSTR("im"));
+		json.value((int32_t) (maxPwr == 0 ? meterState->isThreePhase() ? 20000 : 10000 : maxPwr));
+		json.key_P(PSTR("om"));
+		json.value((uint32_t) productionCapacity);
+		json.key_P(PSTR("mf"));
+		json.value((uint32_t) (mainFuse == 0 ? 40 : mainFuse));
+		json.key_P(PSTR("mt"));
+		json.value((uint32_t) meterState->getMeterType());
+		json.key_P(PSTR("ds"));
+		json.value((uint32_t) distributionSystem);
+		json.key_P(PSTR("pr"));
+		json.value(priceRegion.c_str());
+		json.key_P(PSTR("pc"));
+		json.value(priceCurrency.c_str());
+	}
+	if(dataGroupRevision[DATA_GROUP_POWER] > since) {
+		json.key_P(PSTR("i"));
+		json.value(meterState->getActiveImportPower());
+		json.key_P(PSTR("e"));
+		json.value(meterState->getActiveExportPower());
+		json.key_P(PSTR("w"));
+		json.value(((int32_t) meterState->getActiveImportPower()) - (int32_t) meterState->getActiveExportPower());
+		json.key_P(PSTR("ri"));
+		json.value(meterState->getReactiveImportPower());
+		json.key_P(PSTR("re"));
+		json.value(meterState->getReactiveExportPower());
+		json.key_P(PSTR("f"));
+		json.value(meterState->getPowerFactor(), 2);
+	}
+	if(dataGroupRevision[DATA_GROUP_COUNTERS] > since) {
+		json.key_P(PSTR("ic"));
+		json.value(meterState->getActiveImportCounter(), 3);
+		json.key_P(PSTR("ec"));
+		json.value(meterState->getActiveExportCounter(), 3);
+		json.key_P(PSTR("ric"));
+		json.value(meterState->getReactiveImportCounter(), 3);
+		json.key_P(PSTR("rec"));
+		json.value(meterState->getReactiveExportCounter(), 3);
+	}
+	if(dataGroupRevision[DATA_GROUP_L1] > since) {
+		json.key_P(PSTR("l1"));
+		json.beginObject();
+		json.key_P(PSTR("u"));
+		json.value(meterState->getL1Voltage(), 2);
+		json.key_P(PSTR("i"));
+		json.value(meterState->getL1Current(), 2);
+		json.key_P(PSTR("p"));
+		json.value(meterState->getL1ActiveImportPower());
+		json.key_P(PSTR("q"));
+		json.value(meterState->getL1ActiveExportPower());
+		json.key_P(PSTR("f"));
+		json.value(meterState->getL1PowerFactor(), 2);
+		json.endObject();
+	}
+	if(dataGroupRevision[DATA_GROUP_L2] > since) {
+		json.key_P(PSTR("l2"));
+		json.beginObject();
+		json.key_P(PSTR("u"));
+		json.value(meterState->getL2Voltage(), 2);
+		json.key_P(PSTR("i"));
+		json.value(meterState->getL2Current(), 2);
+		json.key_P(PSTR("p"));
+		json.value(meterState->getL2ActiveImportPower());
+		json.key_P(PSTR("q"));
+		json.value(meterState->getL2ActiveExportPower());
+		json.key_P(PSTR("f"));
+		json.value(meterState->getL2PowerFactor(), 2);
+		json.key_P(PSTR("e"));
+		json.value(meterState->isL2currentMissing());
+		json.endObject();
+	}
+	if(dataGroupRevision[DATA_GROUP_L3] > since) {
+		json.key_P(PSTR("l3"));
+		json.beginObject();
+		json.key_P(PSTR("u"));
+		json.value(meterState->getL3Voltage(), 2);
+		json.key_P(PSTR("i"));
+		json.value(meterState->getL3Current(), 2);
+		json.key_P(PSTR("p"));
+		json.value(meterState->getL3ActiveImportPower());
+		json.key_P(PSTR("q"));
+		json.value(meterState->getL3ActiveExportPower());
+		json.key_P(PSTR("f"));
+		json.value(meterState->getL3PowerFactor(), 2);
+		json.endObject();
+	}
+	if(dataGroupRevision[DATA_GROUP_PRICE] > since) {
+		float price = snapshot->getPrice(PRICE_DIRECTION_IMPORT);
+		float exportPrice = snapshot->getPrice(PRICE_DIRECTION_EXPORT);
+		json.key_P(PSTR("p"));
+		if(price == PRICE_NO_VALUE) {
+			json.nullValue();
+		} else {
+			json.value(price, 2);
+		}
+		json.key_P(PSTR("px"));
+		if(exportPrice == PRICE_NO_VALUE) {
+			json.nullValue();
+		} else {
+			json.value(exportPrice, 2);
+		}
+		json.key_P(PSTR("pe"));
+		json.value(price != PRICE_NO_VALUE);
+	}
+
+	bool tariff = dataGroupRevision[DATA_GROUP_TARIFF] > since;
+	bool accounting = dataGroupRevision[DATA_GROUP_ACCOUNTING] > since;
+	if(tariff || accounting) {
+		json.key_P(PSTR("ea"));
+		json.beginObject();
+		if(tariff) {
+			json.key_P(PSTR("x"));
+			json.value(ea->getMonthMax(), 1);
+			json.key_P(PSTR("p"));
+			json.beginArray();
+			for(uint8_t i = 1; i <= ea->getConfig()->hours; i++) {
+				json.value(ea->getPeak(i).value / 100.0, 2);
+			}
+			json.endArray();
+			json.key_P(PSTR("t"));
+			json.value((uint32_t) ea->getCurrentThreshold());
+		}
+		if(accounting) {
+			json.key_P(PSTR("h"));
+			json.beginObject();
+			json.key_P(PSTR("u"));
+			json.value(ea->getUseThisHour(), 2);
+			json.key_P(PSTR("c"));
+			json.value(ea->getCostThisHour(), 2);
+			json.key_P(PSTR("p"));
+			json.value(ea->getProducedThisHour(), 2);
+			json.key_P(PSTR("i"));
+			json.value(ea->getIncomeThisHour(), 2);
+			json.endObject();
+			json.key_P(PSTR("d"));
+			json.beginObject();
+			json.key_P(PSTR("u"));
+			json.value(ea->getUseToday(), 2);
+			json.key_P(PSTR("c"));
+			json.value(ea->getCostToday(), 2);
+			json.key_P(PSTR("p"));
+			json.value(ea->getProducedToday(), 2);
+			json.key_P(PSTR("i"));
+			json.value(ea->getIncomeToday(), 2);
+			json.endObject();
+			json.key_P(PSTR("m"));
+			json.beginObject();
+			json.key_P(PSTR("u"));
+			json.value(ea->getUseThisMonth(), 2);
+			json.key_P(PSTR("c"));
+			json.value(ea->getCostThisMonth(), 2);
+			json.key_P(PSTR("p"));
+			json.value(ea->getProducedThisMonth(), 2);
+			json.key_P(PSTR("i"));
+			json.value(ea->getIncomeThisMonth(), 2);
+			json.endObject();
+		}
+		json.endObject();
+	}
+
+	// Device state changes with every poll and is always included
+	json.key_P(PSTR("v"));
+	json.value(vcc, 3);
+	json.key_P(PSTR("r"));
+	json.value((int32_t) rssi);
+	json.key_P(PSTR("t"));
+	json.value(snapshot->getTemperature(), 2);
+	json.key_P(PSTR("u"));
+	json.value((uint32_t) (millis64() / 1000));
+	json.key_P(PSTR("m"));
+	json.value((uint32_t) ESP.getFreeHeap());
+	json.key_P(PSTR("em"));
+	json.value((uint32_t) espStatus);
+	json.key_P(PSTR("hm"));
+	json.value((uint32_t) hanStatus);
+	json.key_P(PSTR("wm"));
+	json.value((uint32_t) wifiStatus);
+	json.key_P(PSTR("mm"));
+	json.value((uint32_t) mqttStatus);
+	json.key_P(PSTR("me"));
+	json.value((int32_t) (mqttHandler == NULL ? 0 : mqttHandler->lastError()));
+	json.key_P(PSTR("he"));
+	json.value((int32_t) meterState->getLastError());
+	json.key_P(PSTR("ee"));
+	json.value((int32_t) (ps == NULL ? 0 : ps->getLastError()));
+	json.key_P(PSTR("c"));
+	json.value((uint32_t) time(nullptr));
+	json.key_P(PSTR("rv"));
+	json.value(dataRevision);
+	json.key_P(PSTR("a"));
+	json.value(access);
+	json.endObject();
+	json.end();
+}
+
+void AmsWebServer::eventsSubscribe() {
+	if(!checkSecurity(2, true))
+		return;
+
+	// Events carry data.json without the per request access flag, that is sent once in the hello event
+	WiFiClient client = server.client();
+	if(!events.subscribe(client, checkSecurity(1, false) ? "{\"a\":true}" : "{\"a\":false}")) {
+		server.send_P(503, MIME_PLAIN, PSTR("503: Too many subscribers"));
+	}
+}
+
+void AmsWebServer::dataBin() {
+	if(!checkSecurity(2, true))
+		return;
+
+	// Same state as data.json for collectors, fixed-point fields and no text formatting. Layout is documented in AmsDataBinary.h
+	AmsDataBinary bin((uint8_t*) buf, BufferSize);
+	uint16_t length = bin.encode(meterState, ea, snapshot, time(nullptr));
 
 	addConditionalCloudHeaders();
 	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
 	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
 	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
 
-	server.setContentLength(strlen(buf));
-	server.send(200, MIME_JSON, buf);
+	server.setContentLength(length);
+	server.send(200, MIME_BINARY, "");
+	server.sendContent(buf, length);
 }
 
 void AmsWebServer::dayplotJson() {
@@ -671,19 +1049,26 @@ void AmsWebServer::dayplotJson() {
 	if(ds == NULL) {
 		notFound();
 	} else {
-		uint16_t pos = snprintf_P(buf, BufferSize, PSTR("{\"unit\":\"kwh\""));
-		for(uint8_t i = 0; i < 24; i++) {
-			pos += snprintf_P(buf+pos, BufferSize-pos, PSTR(",\"i%02d\":%.2f,\"e%02d\":%.2f"), i, ds->getHourImport(i) / 1000.0, i, ds->getHourExport(i) / 1000.0);
-		}
-		snprintf_P(buf+pos, BufferSize-pos, PSTR("}"));
-
 		addConditionalCloudHeaders();
-		server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
-		server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
-		server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
+		if(checkETag(ds->getRevision(), 0))
+			return;
 
-		server.setContentLength(strlen(buf));
-		server.send(200, MIME_JSON, buf);
+		JsonWriter json(&server, buf, BufferSize);
+		json.begin(200, MIME_JSON);
+		json.beginObject();
+		json.key_P(PSTR("unit"));
+		json.value("kwh");
+		char key[4];
+		for(uint8_t i = 0; i < 24; i++) {
+			snprintf_P(key, sizeof(key), PSTR("i%02d"), i);
+			json.key(key);
+			json.value(ds->getHourImport(i) / 1000.0f, 2);
+			key[0] = 'e';
+			json.key(key);
+			json.value(ds->getHourExport(i) / 1000.0f, 2);
+		}
+		json.endObject();
+		json.end();
 	}
 }
 
@@ -694,85 +1079,311 @@ void AmsWebServer::monthplotJson() {
 	if(ds == NULL) {
 		notFound();
 	} else {
-		uint16_t pos = snprintf_P(buf, BufferSize, PSTR("{\"unit\":\"kwh\""));
-		for(uint8_t i = 1; i < 32; i++) {
-			pos += snprintf_P(buf+pos, BufferSize-pos, PSTR(",\"i%02d\":%.2f,\"e%02d\":%.2f"), i, ds->getDayImport(i) / 1000.0, i, ds->getDayExport(i) / 1000.0);
-		}
-		snprintf_P(buf+pos, BufferSize-pos, PSTR("}"));
-
 		addConditionalCloudHeaders();
-		server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
-		server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
-		server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
+		if(checkETag(ds->getRevision(), 0))
+			return;
 
-		server.setContentLength(strlen(buf));
-		server.send(200, MIME_JSON, buf);
+		JsonWriter json(&server, buf, BufferSize);
+		json.begin(200, MIME_JSON);
+		json.beginObject();
+		json.key_P(PSTR("unit"));
+		json.value("kwh");
+		char key[4];
+		for(uint8_t i = 1; i < 32; i++) {
+			snprintf_P(key, sizeof(key), PSTR("i%02d"), i);
+			json.key(key);
+			json.value(ds->getDayImport(i) / 1000.0f, 2);
+			key[0] = 'e';
+			json.key(key);
+			json.value(ds->getDayExport(i) / 1000.0f, 2);
+		}
+		json.endObject();
+		json.end();
 	}
 }
 
-void AmsWebServer::energyPriceJson() {
+void AmsWebServer::archiveJson() {
 	if(!checkSecurity(2))
 		return;
 
-	float prices[36];
-	for(int i = 0; i < 36; i++) {
-		prices[i] = ps == NULL ? PRICE_NO_VALUE : ps->getValueForHour(PRICE_DIRECTION_IMPORT, i);
+	if(archive == NULL) {
+		notFound();
+		return;
 	}
 
-	uint16_t pos = snprintf_P(buf, BufferSize, PSTR("{\"currency\":\"%s\",\"source\":\"%s\""),
-		ps == NULL ? "" : ps->getCurrency(),
-		ps == NULL ? "" : ps->getSource()
-	);
+	// Range is in UTC epoch seconds, whole UTC days are read from the archive and bucketed per hour, local day or local month
+	char bucket = 'd';
+	if(server.hasArg(F("bucket")) && server.arg(F("bucket")).length() > 0) {
+		bucket = server.arg(F("bucket")).charAt(0);
+	}
+	time_t to = server.hasArg(F("to")) ? server.arg(F("to")).toInt() : time(nullptr);
+	time_t from = server.hasArg(F("from")) ? server.arg(F("from")).toInt() : to - (30 * SECS_PER_DAY);
+	from -= from % SECS_PER_DAY;
 
-    for(uint8_t i = 0;i < 36; i++) {
-        if(prices[i] == PRICE_NO_VALUE) {
-            pos += snprintf_P(buf+pos, BufferSize-pos, PSTR(",\"%02d\":null"), i);
-        } else {
-            pos += snprintf_P(buf+pos, BufferSize-pos, PSTR(",\"%02d\":%.4f"), i, prices[i]);
-        }
-    }
-	snprintf_P(buf+pos, BufferSize-pos, PSTR("}"));
+	uint16_t maxDays = bucket == 'h' ? 31 : 3660;
+	if((bucket != 'h' && bucket != 'd' && bucket != 'm') || to < from || (to - from) / SECS_PER_DAY >= maxDays) {
+		server.send_P(400, MIME_PLAIN, PSTR("400: Invalid range"));
+		return;
+	}
 
 	addConditionalCloudHeaders();
 	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
 	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
 	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
 
-	server.setContentLength(strlen(buf));
-	server.send(200, MIME_JSON, buf);
+	char bucketStr[2] = { bucket, '\0' };
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.beginObject();
+	json.key_P(PSTR("unit"));
+	json.value("wh");
+	json.key_P(PSTR("bucket"));
+	json.value(bucketStr);
+	json.key_P(PSTR("from"));
+	json.value((uint32_t) from);
+	json.key_P(PSTR("to"));
+	json.value((uint32_t) to);
+	json.key_P(PSTR("data"));
+	json.beginArray();
+
+	bool pending = false;
+	time_t key = 0;
+	uint32_t bImport = 0, bExport = 0;
+	EnergyArchiveDay day;
+	for(time_t d = from; d <= to; d += SECS_PER_DAY) {
+		if(!archive->getDay(d, day)) continue;
+
+		for(uint8_t h = 0; h < 24; h++) {
+			time_t t = d + (h * SECS_PER_HOUR);
+			time_t k = t;
+			if(bucket != 'h') {
+				tmElements_t tm;
+				breakTime(tz == NULL ? t : tz->toLocal(t), tm);
+				tm.Hour = tm.Minute = tm.Second = 0;
+				if(bucket == 'm') tm.Day = 1;
+				k = tz == NULL ? makeTime(tm) : tz->toUTC(makeTime(tm));
+			}
+			if(pending && k != key) {
+				archiveBucket(json, key, bImport, bExport);
+				pending = false;
+			}
+			if(!pending) {
+				key = k;
+				bImport = bExport = 0;
+				pending = true;
+			}
+			bImport += day.hImport[h];
+			bExport += day.hExport[h];
+		}
+
+		#if defined(ESP32)
+			esp_task_wdt_reset();
+		#elif defined(ESP8266)
+			ESP.wdtFeed();
+		#endif
+		yield();
+	}
+	if(pending) {
+		archiveBucket(json, key, bImport, bExport);
+	}
+	json.endArray();
+	json.endObject();
+	json.end();
+	archive->close();
 }
 
-void AmsWebServer::temperatureJson() {
+void AmsWebServer::archiveBucket(JsonWriter& json, time_t key, uint32_t importWh, uint32_t exportWh) {
+	json.beginObject();
+	json.key_P(PSTR("t"));
+	json.value((uint32_t) key);
+	json.key_P(PSTR("i"));
+	json.value(importWh);
+	json.key_P(PSTR("e"));
+	json.value(exportWh);
+	json.endObject();
+}
+
+void AmsWebServer::historyCsv() {
+	historyExport(false);
+}
+
+void AmsWebServer::historyNdjson() {
+	historyExport(true);
+}
+
+void AmsWebServer::historyExport(bool ndjson) {
+	if(!checkSecurity(1))
+		return;
+
+	// One row per value, written as it is read so the size of the export does not matter. The format is described in HistoryImport.h
+	String series = server.hasArg(F("series")) ? server.arg(F("series")) : String(F("hour,day,peak,cost"));
+	String fields = server.hasArg(F("fields")) ? server.arg(F("fields")) : String(F("import,export"));
+	bool withImport = fields.indexOf(F("import")) >= 0;
+	bool withExport = fields.indexOf(F("export")) >= 0;
+
+	time_t to = server.hasArg(F("to")) ? server.arg(F("to")).toInt() : time(nullptr);
+	time_t from = server.hasArg(F("from")) ? server.arg(F("from")).toInt() : to - (30 * SECS_PER_DAY);
+	if(to < from || (to - from) / SECS_PER_DAY >= 3660) {
+		server.send_P(400, MIME_PLAIN, PSTR("400: Invalid range"));
+		return;
+	}
+
+	addConditionalCloudHeaders();
+	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
+	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
+	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
+
+	JsonWriter out(&server, buf, BufferSize);
+	out.begin(200, ndjson ? MIME_NDJSON : MIME_CSV);
+	if(!ndjson) {
+		out.print_P(PSTR("series,key"));
+		if(withImport) out.print_P(PSTR(",import"));
+		if(withExport) out.print_P(PSTR(",export"));
+		out.print_P(PSTR("\n"));
+	}
+
+	char key[12];
+	if(ds != NULL && series.indexOf(F("hour")) >= 0) {
+		for(uint8_t i = 0; i < 24; i++) {
+			snprintf_P(key, sizeof(key), PSTR("%d"), i);
+			historyRow(out, ndjson, withImport, withExport, PSTR("hour"), key, ds->getHourImport(i), ds->getHourExport(i), 0);
+		}
+	}
+	if(ds != NULL && series.indexOf(F("day")) >= 0) {
+		for(uint8_t i = 1; i <= 31; i++) {
+			snprintf_P(key, sizeof(key), PSTR("%d"), i);
+			historyRow(out, ndjson, withImport, withExport, PSTR("day"), key, ds->getDayImport(i), ds->getDayExport(i), 0);
+		}
+	}
+	if(archive != NULL && series.indexOf(F("archive")) >= 0) {
+		EnergyArchiveDay day;
+		for(time_t d = from - (from % SECS_PER_DAY); d <= to; d += SECS_PER_DAY) {
+			if(!archive->getDay(d, day)) continue;
+			for(uint8_t h = 0; h < 24; h++) {
+				time_t t = d + (h * SECS_PER_HOUR);
+				if(t < from || t > to || (day.hImport[h] == 0 && day.hExport[h] == 0)) continue;
+				snprintf_P(key, sizeof(key), PSTR("%lu"), (unsigned long) t);
+				historyRow(out, ndjson, withImport, withExport, PSTR("archive"), key, day.hImport[h], day.hExport[h], 0);
+			}
+
+			#if defined(ESP32)
+				esp_task_wdt_reset();
+			#elif defined(ESP8266)
+				ESP.wdtFeed();
+			#endif
+			yield();
+		}
+		archive->close();
+	}
+	if(ea != NULL) {
+		EnergyAccountingData ead = ea->getData();
+		if(withImport && series.indexOf(F("peak")) >= 0) {
+			for(uint8_t i = 0; i < 5; i++) {
+				if(ead.peaks[i].day == 0) continue;
+				snprintf_P(key, sizeof(key), PSTR("%d"), ead.peaks[i].day);
+				historyRow(out, ndjson, withImport, withExport, PSTR("peak"), key, ead.peaks[i].value * 10, 0, 0);
+			}
+		}
+		if(series.indexOf(F("cost")) >= 0) {
+			historyRow(out, ndjson, withImport, withExport, PSTR("cost"), "yesterday", ead.costYesterday / 100.0, ead.incomeYesterday / 100.0, 2);
+			historyRow(out, ndjson, withImport, withExport, PSTR("cost"), "thismonth", ead.costThisMonth / 100.0, ead.incomeThisMonth / 100.0, 2);
+			historyRow(out, ndjson, withImport, withExport, PSTR("cost"), "lastmonth", ead.costLastMonth / 100.0, ead.incomeLastMonth / 100.0, 2);
+		}
+	}
+	out.end();
+}
+
+void AmsWebServer::historyRow(JsonWriter& out, bool ndjson, bool withImport, bool withExport, PGM_P series, const char* key, double importValue, double exportValue, uint8_t decimals) {
+	bool numericKey = isdigit(key[0]);
+	if(ndjson) {
+		out.print_P(PSTR("{\"series\":\""));
+		out.print_P(series);
+		out.printf_P(numericKey ? PSTR("\",\"key\":%s") : PSTR("\",\"key\":\"%s\""), key);
+		if(withImport) out.printf_P(PSTR(",\"import\":%.*f"), decimals, importValue);
+		if(withExport) out.printf_P(PSTR(",\"export\":%.*f"), decimals, exportValue);
+		out.print_P(PSTR("}\n"));
+	} else {
+		out.print_P(series);
+		out.printf_P(PSTR(",%s"), key);
+		if(withImport) out.printf_P(PSTR(",%.*f"), decimals, importValue);
+		if(withExport) out.printf_P(PSTR(",%.*f"), decimals, exportValue);
+		out.print_P(PSTR("\n"));
+	}
+}
+
+void AmsWebServer::energyPriceJson() {
 	if(!checkSecurity(2))
 		return;
 
-	int count = hw->getTempSensorCount();
-	snprintf_P(buf, 16, PSTR("{\"c\":%d,\"s\":["), count);
+	// Prices are relative to the current hour, so the hour is part of the tag
+	addConditionalCloudHeaders();
+	if(checkETag(ps == NULL ? 0 : ps->getRevision(), time(nullptr) / SECS_PER_HOUR))
+		return;
 
-	for(int i = 0; i < count; i++) {
-		TempSensorData* data = hw->getTempSensorData(i);
-		if(data == NULL) continue;
+	float prices[36];
+	for(int i = 0; i < 36; i++) {
+		prices[i] = ps == NULL ? PRICE_NO_VALUE : ps->getValueForHour(PRICE_DIRECTION_IMPORT, i);
+	}
 
-		char* pos = buf+strlen(buf);
-		snprintf_P(pos, 72, PSTR("{\"i\":%d,\"a\":\"%s\",\"n\":\"%s\",\"c\":%d,\"v\":%.1f},"), 
-			i,
-			toHex(data->address, 8).c_str(),
-			"",
-			1,
-			data->lastRead
-		);
-		yield();
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.beginObject();
+	json.key_P(PSTR("currency"));
+	json.value(ps == NULL ? "" : ps->getCurrency());
+	json.key_P(PSTR("source"));
+	json.value(ps == NULL ? "" : ps->getSource());
+	char key[4];
+	for(uint8_t i = 0;i < 36; i++) {
+		snprintf_P(key, sizeof(key), PSTR("%02d"), i);
+		json.key(key);
+		if(prices[i] == PRICE_NO_VALUE) {
+			json.nullValue();
+		} else {
+			json.value(prices[i], 4);
+		}
 	}
-	char* pos = buf+strlen(buf);
-	snprintf_P(count == 0 ? pos : pos-1, 8, PSTR("]}"));
+	json.endObject();
+	json.end();
+}
+
+void AmsWebServer::temperatureJson() {
+	if(!checkSecurity(2))
+		return;
 
 	addConditionalCloudHeaders();
 	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
 	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
 	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
 
-	server.setContentLength(strlen(buf));
-	server.send(200, MIME_JSON, buf);
+	int count = hw->getTempSensorCount();
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.beginObject();
+	json.key_P(PSTR("c"));
+	json.value((int32_t) count);
+	json.key_P(PSTR("s"));
+	json.beginArray();
+	for(int i = 0; i < count; i++) {
+		TempSensorData* data = hw->getTempSensorData(i);
+		if(data == NULL) continue;
+
+		json.beginObject();
+		json.key_P(PSTR("i"));
+		json.value((int32_t) i);
+		json.key_P(PSTR("a"));
+		json.value(toHex(data->address, 8).c_str());
+		json.key_P(PSTR("n"));
+		json.value("");
+		json.key_P(PSTR("c"));
+		json.value((int32_t) 1);
+		json.key_P(PSTR("v"));
+		json.value(data->lastRead, 1);
+		json.endObject();
+		yield();
+	}
+	json.endArray();
+	json.endObject();
+	json.end();
 }
 
 void AmsWebServer::indexHtml() {
@@ -830,6 +1441,11 @@ void AmsWebServer::configurationJson() {
 		return;
 		
 
+	// Certificate files are listed too, so uploads count as changes
+	addConditionalCloudHeaders();
+	if(checkETag(config->getRevision(), fileRevision))
+		return;
+
 	MeterConfig meterConfig;
 	config->getMeterConfig(meterConfig);
 	
@@ -877,23 +1493,21 @@ void AmsWebServer::configurationJson() {
 	bool qsc = false;
 	bool qsr = false;
 	bool qsk = false;
+	bool qtp = false;
 
 	if(LittleFS.begin()) {
 		qsc = LittleFS.exists(FILE_MQTT_CA);
 		qsr = LittleFS.exists(FILE_MQTT_CERT);
 		qsk = LittleFS.exists(FILE_MQTT_KEY);
+		qtp = LittleFS.exists(FILE_MQTT_TEMPLATE);
 	}
 
-	addConditionalCloudHeaders();
-	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
-	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
-	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
-
-	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-	server.send_P(200, MIME_JSON, PSTR("{\"version\":\""));
-	server.sendContent_P(FirmwareVersion::VersionString);
-	server.sendContent_P(PSTR("\","));
-	snprintf_P(buf, BufferSize, CONF_GENERAL_JSON,
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.print_P(PSTR("{\"version\":\""));
+	json.print_P(FirmwareVersion::VersionString);
+	json.print_P(PSTR("\","));
+	json.printf_P(CONF_GENERAL_JSON,
 		ntpConfig.timezone,
 		networkConfig.hostname,
 		webConfig.security,
@@ -901,8 +1515,7 @@ void AmsWebServer::configurationJson() {
 		strlen(webConfig.password) > 0 ? "***" : "",
 		webConfig.context
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_METER_JSON,
+	json.printf_P(CONF_METER_JSON,
 		meterConfig.source,
 		meterConfig.parser,
 		meterConfig.baud,
@@ -921,9 +1534,8 @@ void AmsWebServer::configurationJson() {
 		meterConfig.amperageMultiplier == 0.0 ? 1.0 : meterConfig.amperageMultiplier / 1000.0,
 		meterConfig.accumulatedMultiplier == 0.0 ? 1.0 : meterConfig.accumulatedMultiplier / 1000.0
 	);
-	server.sendContent(buf);
 
-	snprintf_P(buf, BufferSize, CONF_THRESHOLDS_JSON,
+	json.printf_P(CONF_THRESHOLDS_JSON,
 		eac->thresholds[0],
 		eac->thresholds[1],
 		eac->thresholds[2],
@@ -936,16 +1548,14 @@ void AmsWebServer::configurationJson() {
 		eac->thresholds[9],
 		eac->hours
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_WIFI_JSON,
+	json.printf_P(CONF_WIFI_JSON,
 		networkConfig.ssid,
 		strlen(networkConfig.psk) > 0 ? "***" : "",
 		networkConfig.power / 10.0,
 		networkConfig.sleep,
 		networkConfig.use11b ? "true" : "false"
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_NET_JSON,
+	json.printf_P(CONF_NET_JSON,
 		networkConfig.mode,
 		strlen(networkConfig.ip) > 0 ? "static" : "dhcp",
 		networkConfig.ip,
@@ -958,8 +1568,7 @@ void AmsWebServer::configurationJson() {
 		ntpConfig.dhcp ? "true" : "false",
 		networkConfig.ipv6 ? "true" : "false"
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_MQTT_JSON,
+	json.printf_P(CONF_MQTT_JSON,
 		mqttConfig.host,
 		mqttConfig.port,
 		mqttConfig.username,
@@ -972,24 +1581,27 @@ void AmsWebServer::configurationJson() {
 		qsr ? "true" : "false",
 		qsk ? "true" : "false",
 		mqttConfig.stateUpdate,
-		mqttConfig.stateUpdateInterval
+		mqttConfig.stateUpdateInterval,
+		mqttConfig.deadbandPower,
+		mqttConfig.deadbandVoltage / 10.0,
+		mqttConfig.deadbandCurrent / 100.0,
+		mqttConfig.deadbandPercent,
+		mqttConfig.heartbeat,
+		qtp ? "true" : "false"
 	);
-	server.sendContent(buf);
 
-	snprintf_P(buf, BufferSize, CONF_PRICE_JSON,
+	json.printf_P(CONF_PRICE_JSON,
 		price.enabled ? "true" : "false",
 		price.entsoeToken,
 		price.area,
 		price.currency
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_DEBUG_JSON,
+	json.printf_P(CONF_DEBUG_JSON,
 		debugConfig.serial ? "true" : "false",
 		debugConfig.telnet ? "true" : "false",
 		debugConfig.level
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_GPIO_JSON,
+	json.printf_P(CONF_GPIO_JSON,
 		meterConfig.rxPin == 0xff ? "null" : String(meterConfig.rxPin, 10).c_str(),
 		meterConfig.rxPinPullup ? "true" : "false",
 		meterConfig.txPin == 0xff ? "null" : String(meterConfig.txPin, 10).c_str(),
@@ -1011,8 +1623,7 @@ void AmsWebServer::configurationJson() {
 		gpioConfig->vccResistorGnd,
 		gpioConfig->vccBootLimit / 10.0
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_UI_JSON,
+	json.printf_P(CONF_UI_JSON,
 		ui.showImport,
 		ui.showExport,
 		ui.showVoltage,
@@ -1030,22 +1641,19 @@ void AmsWebServer::configurationJson() {
 		ui.darkMode,
 		ui.language
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_DOMOTICZ_JSON,
+	json.printf_P(CONF_DOMOTICZ_JSON,
 		domo.elidx,
 		domo.cl1idx,
 		domo.vl1idx,
 		domo.vl2idx,
 		domo.vl3idx
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_HA_JSON,
+	json.printf_P(CONF_HA_JSON,
 		haconf.discoveryPrefix,
 		haconf.discoveryHostname,
 		haconf.discoveryNameTag
 	);
-	server.sendContent(buf);
-	snprintf_P(buf, BufferSize, CONF_CLOUD_JSON,
+	json.printf_P(CONF_CLOUD_JSON,
 		cloud.enabled ? "true" : "false",
 		cloud.proto,
 		#if defined(ESP32) && defined(ENERGY_SPEEDOMETER_PASS)
@@ -1054,8 +1662,8 @@ void AmsWebServer::configurationJson() {
 		"null"
 		#endif
 	);
-	server.sendContent(buf);
-	server.sendContent_P(PSTR("}"));
+	json.print_P(PSTR("}"));
+	json.end();
 }
 
 void AmsWebServer::priceConfigJson() {
@@ -1063,12 +1671,12 @@ void AmsWebServer::priceConfigJson() {
 		return;
 
 	addConditionalCloudHeaders();
-	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
-	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
-	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
+	if(checkETag(ps == NULL ? 0 : ps->getRevision(), 0))
+		return;
 
-	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-	server.send_P(200, MIME_JSON, PSTR("{\"o\":["));
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.print_P(PSTR("{\"o\":["));
 	if(ps != NULL) {
 		std::vector<PriceConfig> pc = ps->getPriceConfig();
 		if(pc.size() > 0) {
@@ -1091,7 +1699,7 @@ void AmsWebServer::priceConfigJson() {
 				}
 				hours = hours.substring(0, hours.length()-1);
 
-				snprintf_P(buf, BufferSize, CONF_PRICE_ROW_JSON,
+				json.printf_P(CONF_PRICE_ROW_JSON,
 					p.type,
 					p.name,
 					p.direction,
@@ -1104,12 +1712,11 @@ void AmsWebServer::priceConfigJson() {
 					p.end_dayofmonth,
 					i == pc.size()-1 ? "" : ","
 				);
-				server.sendContent(buf);
 			}
 		}
 	}
-	snprintf_P(buf, BufferSize, PSTR("]}"));
-	server.sendContent(buf);
+	json.print_P(PSTR("]}"));
+	json.end();
 }
 
 void AmsWebServer::translationsJson() {
@@ -1174,6 +1781,9 @@ void AmsWebServer::handleSave() {
 	if(!checkSecurity(1))
 		return;
 
+	// Everything below is committed to flash once, by save()
+	config->beginBatch();
+
 	bool success = true;
 	if(server.hasArg(F("v")) && server.arg(F("v")) == F("true")) {
 		int boardType = server.arg(F("vb")).toInt();
@@ -1389,6 +1999,12 @@ void AmsWebServer::handleSave() {
 
 			mqtt.stateUpdate = server.arg(F("qt")).toInt() == 1;
 			mqtt.stateUpdateInterval = server.arg(F("qd")).toInt();
+
+			if(server.hasArg(F("qdp"))) mqtt.deadbandPower = server.arg(F("qdp")).toInt();
+			if(server.hasArg(F("qdv"))) mqtt.deadbandVoltage = lround(server.arg(F("qdv")).toFloat() * 10);
+			if(server.hasArg(F("qdc"))) mqtt.deadbandCurrent = lround(server.arg(F("qdc")).toFloat() * 100);
+			if(server.hasArg(F("qdr"))) mqtt.deadbandPercent = server.arg(F("qdr")).toInt();
+			if(server.hasArg(F("qhb"))) mqtt.heartbeat = server.arg(F("qhb")).toInt();
 		} else {
 			config->clearMqtt(mqtt);
 		}
@@ -1540,6 +2156,7 @@ void AmsWebServer::handleSave() {
 
 	if(server.hasArg(F("p")) && server.arg(F("p")) == F("true")) {
 		priceRegion = server.arg(F("pr"));
+		settingsRevision++;
 
 		PriceServiceConfig price;
 		price.enabled = server.hasArg(F("pe")) && server.arg(F("pe")) == F("true");
@@ -1749,7 +2366,12 @@ void AmsWebServer::upgrade() {
 void AmsWebServer::upgradeFromUrl(String url, String nextVersion) {
 	config->setUpgradeInformation(0xFF, 0xFF, FirmwareVersion::VersionString, nextVersion.c_str());
 
-	WiFiClient client;
+	WiFiClient* client = pool == NULL ? NULL : pool->getClient(url.c_str());
+	if(client == NULL) {
+		config->setUpgradeInformation(HTTP_UPDATE_FAILED, HTTPC_ERROR_CONNECTION_REFUSED, FirmwareVersion::VersionString, nextVersion.c_str());
+		debugger->printf_P(PSTR("Update failed\n"));
+		return;
+	}
 	#if defined(ESP8266)
 		String chipType = F("esp8266");
 	#elif defined(CONFIG_IDF_TARGET_ESP32S2)
@@ -1779,9 +2401,9 @@ void AmsWebServer::upgradeFromUrl(String url, String nextVersion) {
 	httpUpdate.rebootOnUpdate(false);
 	httpUpdate.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
 	#if defined(ESP32)
-	HTTPUpdateResult ret = httpUpdate.update(client, url, currentVersion, std::bind(&AmsWebServer::updaterRequestCallback, this, std::placeholders::_1));
+	HTTPUpdateResult ret = httpUpdate.update(*client, url, currentVersion, std::bind(&AmsWebServer::updaterRequestCallback, this, std::placeholders::_1));
 	#else
-	HTTPUpdateResult ret = httpUpdate.update(client, url, currentVersion);
+	HTTPUpdateResult ret = httpUpdate.update(*client, url, currentVersion);
 	#endif
 	int lastError = httpUpdate.getLastError();
 
@@ -1931,6 +2553,7 @@ debugger->printf_P(PSTR("An Error has occurred while writing file\n"));
         if(file) {
 			file.flush();
             file.close();
+			fileRevision++;
         } else {
 			debugger->printf_P(PSTR("File was not valid in the end... Write error: %d, \n"), file.getWriteError());
 			snprintf_P(buf, BufferSize, RESPONSE_JSON,
@@ -2087,9 +2710,44 @@ void AmsWebServer::mqttKeyDelete() {
 	}
 }
 
+void AmsWebServer::mqttTemplateUpload() {
+	if(!checkSecurity(1))
+		return;
+
+	uploadFile(FILE_MQTT_TEMPLATE);
+    HTTPUpload& upload = server.upload();
+    if(upload.status == UPLOAD_FILE_END) {
+		server.sendHeader(HEADER_LOCATION,F("/configuration"));
+		server.send(303);
+		// The handler compiles the template when it gets its config
+		MqttConfig mqttConfig;
+		if(config->getMqttConfig(mqttConfig) && mqttConfig.payloadFormat == 7) {
+			config->setMqttChanged();
+		}
+	}
+}
+
+void AmsWebServer::mqttTemplateDelete() {
+	if(!checkSecurity(1))
+		return;
+
+	if(!uploading) { // Not an upload
+		deleteFile(FILE_MQTT_TEMPLATE);
+		server.send(200);
+		MqttConfig mqttConfig;
+		if(config->getMqttConfig(mqttConfig) && mqttConfig.payloadFormat == 7) {
+			config->setMqttChanged();
+		}
+	} else {
+		uploading = false;
+		server.send(200);
+	}
+}
+
 void AmsWebServer::deleteFile(const char* path) {
 	if(LittleFS.begin()) {
 		LittleFS.remove(path);
+		fileRevision++;
 	}
 }
 
@@ -2097,6 +2755,10 @@ void AmsWebServer::tariffJson() {
 	if(!checkSecurity(2))
 		return;
 
+	addConditionalCloudHeaders();
+	if(checkETag(ea->getRevision(), config->getRevision()))
+		return;
+
 	EnergyAccountingConfig* eac = ea->getConfig();
 
 	String peaks;
@@ -2111,7 +2773,9 @@ void AmsWebServer::tariffJson() {
 		peaks += String(buf);
 	}
 
-	snprintf_P(buf, BufferSize, TARIFF_JSON,
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.printf_P(TARIFF_JSON,
 		eac->thresholds[0],
 		eac->thresholds[1],
 		eac->thresholds[2],
@@ -2126,14 +2790,7 @@ void AmsWebServer::tariffJson() {
 		ea->getCurrentThreshold(),
 		ea->getMonthMax()
 	);
-
-	addConditionalCloudHeaders();
-	server.sendHeader(HEADER_CACHE_CONTROL, CACHE_CONTROL_NO_CACHE);
-	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
-	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
-
-	server.setContentLength(strlen(buf));
-	server.send(200, MIME_JSON, buf);
+	json.end();
 }
 
 void AmsWebServer::realtimeJson() {
@@ -2156,28 +2813,81 @@ void AmsWebServer::realtimeJson() {
 	if(server.hasArg(F("size"))) {
 		size = server.arg(F("size")).toInt();
 	}
-	
-	if(size > rtp->getSize()) {
-		size = rtp->getSize();
-	}
-	if(offset > rtp->getSize()) {
-		offset = rtp->getSize();
+
+	// The UI expects one point per 10 seconds. A span and point count picks the level itself and includes min/max.
+	uint32_t interval = 10;
+	uint32_t span = 0;
+	bool minmax = false;
+	if(server.hasArg(F("span"))) {
+		span = server.arg(F("span")).toInt();
+		size = server.hasArg(F("points")) ? server.arg(F("points")).toInt() : 60;
+		if(size == 0) size = 60;
+		interval = (span + size - 1) / size;
+		minmax = true;
+	} else if(server.hasArg(F("interval"))) {
+		interval = server.arg(F("interval")).toInt();
 	}
+	if(interval == 0) interval = 1;
 
-	uint16_t pos = snprintf_P(buf, BufferSize, PSTR("{\"offset\":%d,\"size\":%d,\"total\":%d,\"data\":["), offset, size, rtp->getSize());
-	bool first = true;
-	for(uint16_t i = 0; i < size; i++) {
-		pos += snprintf_P(buf+pos, BufferSize-pos, PSTR("%s%d"), first ? "" : ",", rtp->getValue(offset+i));
-		first = false;
-		delay(1);
+	// Coarsest level that still has the requested resolution, or a coarser one if that does not reach back far enough
+	uint8_t level = 0;
+	for(uint8_t i = 1; i < rtp->getLevels(); i++) {
+		if(rtp->getLevelInterval(i) <= interval * 1000) level = i;
 	}
-	pos += snprintf_P(buf+pos, BufferSize-pos, PSTR("]}"));
-	server.send(200, MIME_JSON, buf);
+	while(span > 0 && level < rtp->getLevels() - 1 && rtp->getLevelInterval(level) / 1000 * rtp->getLevelSize(level) < span) {
+		level++;
+	}
+	uint16_t step = max((uint32_t) 1, interval * 1000 / rtp->getLevelInterval(level));
+	uint16_t total = rtp->getLevelSize(level) / step;
+	
+	if(size > total) {
+		size = total;
+	}
+	if(offset > total) {
+		offset = total;
+	}
+
+	JsonWriter json(&server, buf, BufferSize);
+	json.begin(200, MIME_JSON);
+	json.beginObject();
+	json.key_P(PSTR("offset"));
+	json.value((uint32_t) offset);
+	json.key_P(PSTR("size"));
+	json.value((uint32_t) size);
+	json.key_P(PSTR("total"));
+	json.value((uint32_t) total);
+	json.key_P(PSTR("interval"));
+	json.value((uint32_t) (step * rtp->getLevelInterval(level) / 1000));
+
+	// One pass per array, reading buckets is cheap enough that this beats buffering the points
+	for(uint8_t field = 0; field < (minmax ? 3 : 1); field++) {
+		json.key_P(field == 0 ? PSTR("data") : field == 1 ? PSTR("min") : PSTR("max"));
+		json.beginArray();
+		for(uint16_t i = 0; i < size; i++) {
+			int32_t vmin = INT32_MAX, vmax = INT32_MIN;
+			int64_t sum = 0;
+			uint16_t count = 0;
+			for(uint16_t j = 0; j < step; j++) {
+				int32_t bmin, bmax, bavg;
+				if(!rtp->getBucket(level, ((offset+i) * step) + j, bmin, bmax, bavg)) continue;
+				if(bmin < vmin) vmin = bmin;
+				if(bmax > vmax) vmax = bmax;
+				sum += bavg;
+				count++;
+			}
+			int32_t val = count == 0 ? 0 : field == 1 ? vmin : field == 2 ? vmax : (int32_t) (sum / count);
+			json.value(val);
+		}
+		json.endArray();
+	}
+	json.endObject();
+	json.end();
 }
 
 void AmsWebServer::setPriceSettings(String region, String currency) {
 	this->priceRegion = region;
 	this->priceCurrency = currency;
+	settingsRevision++;
 }
 
 void AmsWebServer::configFileDownload() {
@@ -2201,57 +2911,63 @@ void AmsWebServer::configFileDownload() {
 	server.sendHeader(HEADER_PRAGMA, PRAGMA_NO_CACHE);
 	server.sendHeader(HEADER_EXPIRES, EXPIRES_OFF);
 	server.sendHeader(F("Content-Disposition"), F("attachment; filename=configfile.cfg"));
-	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
 
-	server.send_P(200, MIME_PLAIN, PSTR("amsconfig\n"));
-	server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("version %s\n"), FirmwareVersion::VersionString));
-	server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("boardType %d\n"), sys.boardType));
+	JsonWriter writer(&server, buf, BufferSize);
+	writer.begin(200, MIME_PLAIN);
+	writer.print_P(PSTR("amsconfig\n"));
+	writer.printf_P(PSTR("version %s\n"), FirmwareVersion::VersionString);
+	configFileLine(writer, PSTR("boardType"), &sys);
 	
 	if(includeWifi) {
 		NetworkConfig network;
 		config->getNetworkConfig(network);
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("netmode %d\n"), network.mode));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("hostname %s\n"), network.hostname));
-		if(includeSecrets) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("ssid %s\n"), network.ssid));
-		if(includeSecrets) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("psk %s\n"), network.psk));
+		configFileLine(writer, PSTR("netmode"), &network);
+		configFileLine(writer, PSTR("hostname"), &network);
+		if(includeSecrets) configFileLine(writer, PSTR("ssid"), &network);
+		if(includeSecrets) configFileLine(writer, PSTR("psk"), &network);
 		if(strlen(network.ip) > 0) {
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("ip %s\n"), network.ip));
-			if(strlen(network.gateway) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gateway %s\n"), network.gateway));
-			if(strlen(network.subnet) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("subnet %s\n"), network.subnet));
-			if(strlen(network.dns1) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("dns1 %s\n"), network.dns1));
-			if(strlen(network.dns2) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("dns2 %s\n"), network.dns2));
+			configFileLine(writer, PSTR("ip"), &network);
+			if(strlen(network.gateway) > 0) configFileLine(writer, PSTR("gateway"), &network);
+			if(strlen(network.subnet) > 0) configFileLine(writer, PSTR("subnet"), &network);
+			if(strlen(network.dns1) > 0) configFileLine(writer, PSTR("dns1"), &network);
+			if(strlen(network.dns2) > 0) configFileLine(writer, PSTR("dns2"), &network);
 		}
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mdns %d\n"), network.mdns ? 1 : 0));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("use11b %d\n"), network.use11b ? 1 : 0));
+		configFileLine(writer, PSTR("mdns"), &network);
+		configFileLine(writer, PSTR("use11b"), &network);
 	}
 	
 	if(includeMqtt) {
 		MqttConfig mqtt;
 		config->getMqttConfig(mqtt);
 		if(strlen(mqtt.host) > 0) {
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttHost %s\n"), mqtt.host));
-			if(mqtt.port > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttPort %d\n"), mqtt.port));
-			if(strlen(mqtt.clientId) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttClientId %s\n"), mqtt.clientId));
-			if(strlen(mqtt.publishTopic) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttPublishTopic %s\n"), mqtt.publishTopic));
-			if(includeSecrets) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttUsername %s\n"), mqtt.username));
-			if(includeSecrets) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttPassword %s\n"), mqtt.password));
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttPayloadFormat %d\n"), mqtt.payloadFormat));
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("mqttSsl %d\n"), mqtt.ssl ? 1 : 0));
+			configFileLine(writer, PSTR("mqttHost"), &mqtt);
+			if(mqtt.port > 0) configFileLine(writer, PSTR("mqttPort"), &mqtt);
+			if(strlen(mqtt.clientId) > 0) configFileLine(writer, PSTR("mqttClientId"), &mqtt);
+			if(strlen(mqtt.publishTopic) > 0) configFileLine(writer, PSTR("mqttPublishTopic"), &mqtt);
+			if(includeSecrets) configFileLine(writer, PSTR("mqttUsername"), &mqtt);
+			if(includeSecrets) configFileLine(writer, PSTR("mqttPassword"), &mqtt);
+			configFileLine(writer, PSTR("mqttPayloadFormat"), &mqtt);
+			configFileLine(writer, PSTR("mqttSsl"), &mqtt);
+			configFileLine(writer, PSTR("mqttDeadbandPower"), &mqtt);
+			configFileLine(writer, PSTR("mqttDeadbandVoltage"), &mqtt);
+			configFileLine(writer, PSTR("mqttDeadbandCurrent"), &mqtt);
+			configFileLine(writer, PSTR("mqttDeadbandPercent"), &mqtt);
+			configFileLine(writer, PSTR("mqttHeartbeat"), &mqtt);
 
 			if(mqtt.payloadFormat == 3) {
 				DomoticzConfig domo;
 				config->getDomoticzConfig(domo);
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("domoticzElidx %d\n"), domo.elidx));
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("domoticzVl1idx %d\n"), domo.vl1idx));
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("domoticzVl2idx %d\n"), domo.vl2idx));
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("domoticzVl3idx %d\n"), domo.vl3idx));
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("domoticzCl1idx %d\n"), domo.cl1idx));
+				configFileLine(writer, PSTR("domoticzElidx"), &domo);
+				configFileLine(writer, PSTR("domoticzVl1idx"), &domo);
+				configFileLine(writer, PSTR("domoticzVl2idx"), &domo);
+				configFileLine(writer, PSTR("domoticzVl3idx"), &domo);
+				configFileLine(writer, PSTR("domoticzCl1idx"), &domo);
 			} else if(mqtt.payloadFormat == 4) {
 				HomeAssistantConfig haconf;
 				config->getHomeAssistantConfig(haconf);
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("homeAssistantDiscoveryPrefix %s\n"), haconf.discoveryPrefix));
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("homeAssistantDiscoveryHostname %s\n"), haconf.discoveryHostname));
-				server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("homeAssistantDiscoveryNameTag %s\n"), haconf.discoveryNameTag));
+				configFileLine(writer, PSTR("homeAssistantDiscoveryPrefix"), &haconf);
+				configFileLine(writer, PSTR("homeAssistantDiscoveryHostname"), &haconf);
+				configFileLine(writer, PSTR("homeAssistantDiscoveryNameTag"), &haconf);
 			}
 		}
 	}
@@ -2259,43 +2975,25 @@ void AmsWebServer::configFileDownload() {
 	if(includeWeb && includeSecrets) {
 		WebConfig web;
 		config->getWebConfig(web);
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("webSecurity %d\n"), web.security));
+		configFileLine(writer, PSTR("webSecurity"), &web);
 		if(web.security > 0) {
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("webUsername %s\n"), web.username));
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("webPassword %s\n"), web.password));
+			configFileLine(writer, PSTR("webUsername"), &web);
+			configFileLine(writer, PSTR("webPassword"), &web);
 		}
 	}
 	
 	if(includeMeter) {
 		MeterConfig meter;
 		config->getMeterConfig(meter);
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterBaud %d\n"), meter.baud));
-		char parity[4] = "";
-		switch(meter.parity) {
-			case 2:
-				strcpy_P(parity, PSTR("7N1"));
-				break;
-			case 3:
-				strcpy_P(parity, PSTR("8N1"));
-				break;
-			case 7:
-				strcpy_P(parity, PSTR("8N2"));
-				break;
-			case 10:
-				strcpy_P(parity, PSTR("7E1"));
-				break;
-			case 11:
-				strcpy_P(parity, PSTR("8E1"));
-				break;
-		}
-		if(strlen(parity) > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterParity %s\n"), parity));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterInvert %d\n"), meter.invert ? 1 : 0));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterDistributionSystem %d\n"), meter.distributionSystem));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterMainFuse %d\n"), meter.mainFuse));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterProductionCapacity %d\n"), meter.productionCapacity));
+		configFileLine(writer, PSTR("meterBaud"), &meter);
+		configFileLine(writer, PSTR("meterParity"), &meter);
+		configFileLine(writer, PSTR("meterInvert"), &meter);
+		configFileLine(writer, PSTR("meterDistributionSystem"), &meter);
+		configFileLine(writer, PSTR("meterMainFuse"), &meter);
+		configFileLine(writer, PSTR("meterProductionCapacity"), &meter);
 		if(includeSecrets) {
-			if(meter.encryptionKey[0] != 0x00) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterEncryptionKey %s\n"), toHex(meter.encryptionKey, 16).c_str()));
-			if(meter.authenticationKey[0] != 0x00) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("meterAuthenticationKey %s\n"), toHex(meter.authenticationKey, 16).c_str()));
+			if(meter.encryptionKey[0] != 0x00) configFileLine(writer, PSTR("meterEncryptionKey"), &meter);
+			if(meter.authenticationKey[0] != 0x00) configFileLine(writer, PSTR("meterAuthenticationKey"), &meter);
 		}
 	}
 	
@@ -2304,66 +3002,54 @@ void AmsWebServer::configFileDownload() {
 		config->getMeterConfig(meter);
 		GpioConfig gpio;
 		config->getGpioConfig(gpio);
-		if(meter.rxPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioHanPin %d\n"), meter.rxPin));
-		if(meter.rxPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioHanPinPullup %d\n"), meter.rxPinPullup ? 1 : 0));
-		if(gpio.apPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioApPin %d\n"), gpio.apPin));
-		if(gpio.ledPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioLedPin %d\n"), gpio.ledPin));
-		if(gpio.ledPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioLedInverted %d\n"), gpio.ledInverted ? 1 : 0));
-		if(gpio.ledPinRed != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioLedPinRed %d\n"), gpio.ledPinRed));
-		if(gpio.ledPinGreen != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioLedPinGreen %d\n"), gpio.ledPinGreen));
-		if(gpio.ledPinBlue != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioLedPinBlue %d\n"), gpio.ledPinBlue));
-		if(gpio.ledPinRed != 0xFF || gpio.ledPinGreen != 0xFF || gpio.ledPinBlue != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioLedRgbInverted %d\n"), gpio.ledRgbInverted ? 1 : 0));
-		if(gpio.tempSensorPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioTempSensorPin %d\n"), gpio.tempSensorPin));
-		if(gpio.tempAnalogSensorPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioTempAnalogSensorPin %d\n"), gpio.tempAnalogSensorPin));
-		if(gpio.vccPin != 0xFF) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioVccPin %d\n"), gpio.vccPin));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioVccOffset %.2f\n"), gpio.vccOffset / 100.0));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioVccMultiplier %.3f\n"), gpio.vccMultiplier / 1000.0));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioVccBootLimit %.1f\n"), gpio.vccBootLimit / 10.0));
-		if(gpio.vccPin != 0xFF && gpio.vccResistorGnd != 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioVccResistorGnd %d\n"), gpio.vccResistorGnd));
-		if(gpio.vccPin != 0xFF && gpio.vccResistorVcc != 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("gpioVccResistorVcc %d\n"), gpio.vccResistorVcc));
+		if(meter.rxPin != 0xFF) configFileLine(writer, PSTR("gpioHanPin"), &meter);
+		if(meter.rxPin != 0xFF) configFileLine(writer, PSTR("gpioHanPinPullup"), &meter);
+		if(gpio.apPin != 0xFF) configFileLine(writer, PSTR("gpioApPin"), &gpio);
+		if(gpio.ledPin != 0xFF) configFileLine(writer, PSTR("gpioLedPin"), &gpio);
+		if(gpio.ledPin != 0xFF) configFileLine(writer, PSTR("gpioLedInverted"), &gpio);
+		if(gpio.ledPinRed != 0xFF) configFileLine(writer, PSTR("gpioLedPinRed"), &gpio);
+		if(gpio.ledPinGreen != 0xFF) configFileLine(writer, PSTR("gpioLedPinGreen"), &gpio);
+		if(gpio.ledPinBlue != 0xFF) configFileLine(writer, PSTR("gpioLedPinBlue"), &gpio);
+		if(gpio.ledPinRed != 0xFF || gpio.ledPinGreen != 0xFF || gpio.ledPinBlue != 0xFF) configFileLine(writer, PSTR("gpioLedRgbInverted"), &gpio);
+		if(gpio.tempSensorPin != 0xFF) configFileLine(writer, PSTR("gpioTempSensorPin"), &gpio);
+		if(gpio.tempAnalogSensorPin != 0xFF) configFileLine(writer, PSTR("gpioTempAnalogSensorPin"), &gpio);
+		if(gpio.vccPin != 0xFF) configFileLine(writer, PSTR("gpioVccPin"), &gpio);
+		configFileLine(writer, PSTR("gpioVccOffset"), &gpio);
+		configFileLine(writer, PSTR("gpioVccMultiplier"), &gpio);
+		configFileLine(writer, PSTR("gpioVccBootLimit"), &gpio);
+		if(gpio.vccPin != 0xFF && gpio.vccResistorGnd != 0) configFileLine(writer, PSTR("gpioVccResistorGnd"), &gpio);
+		if(gpio.vccPin != 0xFF && gpio.vccResistorVcc != 0) configFileLine(writer, PSTR("gpioVccResistorVcc"), &gpio);
 	}
 
 	if(includeNtp) {
 		NtpConfig ntp;
 		config->getNtpConfig(ntp);
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("ntpEnable %d\n"), ntp.enable ? 1 : 0));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("ntpDhcp %d\n"), ntp.dhcp ? 1 : 0));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("ntpTimezone %s\n"), ntp.timezone));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("ntpServer %s\n"), ntp.server));
+		configFileLine(writer, PSTR("ntpEnable"), &ntp);
+		configFileLine(writer, PSTR("ntpDhcp"), &ntp);
+		configFileLine(writer, PSTR("ntpTimezone"), &ntp);
+		configFileLine(writer, PSTR("ntpServer"), &ntp);
 	}
 
 	if(includePrice) {
 		PriceServiceConfig price;
 		config->getPriceServiceConfig(price);
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("priceEnabled %d\n"), price.enabled ? 1 : 0));
-		if(strlen(price.entsoeToken) == 36 && includeSecrets) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("priceEntsoeToken %s\n"), price.entsoeToken));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("priceArea %s\n"), price.area));
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("priceCurrency %s\n"), price.currency));
+		configFileLine(writer, PSTR("priceEnabled"), &price);
+		if(strlen(price.entsoeToken) == 36 && includeSecrets) configFileLine(writer, PSTR("priceEntsoeToken"), &price);
+		configFileLine(writer, PSTR("priceArea"), &price);
+		configFileLine(writer, PSTR("priceCurrency"), &price);
 	}
 
 	if(includeThresholds) {
 		EnergyAccountingConfig eac;
 		config->getEnergyAccountingConfig(eac);
 
-		if(eac.thresholds[9] > 0) server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("thresholds %d %d %d %d %d %d %d %d %d %d %d\n"), 
-			eac.thresholds[0],
-			eac.thresholds[1],
-			eac.thresholds[2],
-			eac.thresholds[3],
-			eac.thresholds[4],
-			eac.thresholds[5],
-			eac.thresholds[6],
-			eac.thresholds[7],
-			eac.thresholds[8],
-			eac.thresholds[9],
-			eac.hours
-		));
+		if(eac.thresholds[9] > 0) configFileLine(writer, PSTR("thresholds"), &eac);
 	}
 
 
 	if(ds != NULL) {
 		DayDataPoints day = ds->getDayData();
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("dayplot %d %lu %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d"), 
+		writer.printf_P(PSTR("dayplot %d %lu %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d"), 
 			day.version,
 			(int32_t) day.lastMeterReadTime,
 			day.activeImport / 1000.0,
@@ -2392,9 +3078,9 @@ void AmsWebServer::configFileDownload() {
 			ds->getHourImport(21),
 			ds->getHourImport(22),
 			ds->getHourImport(23)
-		));
+		);
 		if(day.activeExport > 0) {
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR(" %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n"), 
+			writer.printf_P(PSTR(" %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n"), 
 				day.activeExport / 1000.0,
 				ds->getHourExport(0),
 				ds->getHourExport(1),
@@ -2420,13 +3106,13 @@ void AmsWebServer::configFileDownload() {
 				ds->getHourExport(21),
 				ds->getHourExport(22),
 				ds->getHourExport(23)
-			));
+			);
 		} else {
-			server.sendContent(F("\n"));
+			writer.print_P(PSTR("\n"));
 		}
 
 		MonthDataPoints month = ds->getMonthData();
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("monthplot %d %lu %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d"), 
+		writer.printf_P(PSTR("monthplot %d %lu %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d"), 
 			month.version,
 			(int32_t) month.lastMeterReadTime,
 			month.activeImport / 1000.0,
@@ -2462,9 +3148,9 @@ void AmsWebServer::configFileDownload() {
 			ds->getDayImport(29),
 			ds->getDayImport(30),
 			ds->getDayImport(31)
-		));
+		);
 		if(month.activeExport > 0) {
-			server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR(" %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n"), 
+			writer.printf_P(PSTR(" %.3f %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n"), 
 				month.activeExport / 1000.0,
 				ds->getDayExport(1),
 				ds->getDayExport(2),
@@ -2497,9 +3183,9 @@ void AmsWebServer::configFileDownload() {
 				ds->getDayExport(29),
 				ds->getDayExport(30),
 				ds->getDayExport(31)
-			));
+			);
 		} else {
-			server.sendContent(F("\n"));
+			writer.print_P(PSTR("\n"));
 		}
 	}
 
@@ -2507,7 +3193,7 @@ void AmsWebServer::configFileDownload() {
 		EnergyAccountingConfig eac;
 		config->getEnergyAccountingConfig(eac);
 		EnergyAccountingData ead = ea->getData();
-		server.sendContent(buf, snprintf_P(buf, BufferSize, PSTR("energyaccounting %d %d %.2f %.2f %.2f %.2f %.2f %.2f %d %.2f %d %.2f %d %.2f %d %.2f %d %.2f %.2f %.2f"), 
+		writer.printf_P(PSTR("energyaccounting %d %d %.2f %.2f %.2f %.2f %.2f %.2f %d %.2f %d %.2f %d %.2f %d %.2f %d %.2f %.2f %.2f"), 
 			ead.version,
 			ead.month,
 			ea->getCostYesterday(),
@@ -2528,9 +3214,17 @@ void AmsWebServer::configFileDownload() {
 			ead.peaks[4].value / 100.0,
 			ea->getUseLastMonth(),
 			ea->getProducedLastMonth()
-		));
-		server.sendContent_P(PSTR("\n"));
+		);
+		writer.print_P(PSTR("\n"));
 	}
+	writer.end();
+}
+
+// Formatted from the keyword table the config file is parsed with
+void AmsWebServer::configFileLine(JsonWriter& writer, PGM_P key, const void* source) {
+	char line[CONFIG_FILE_LINE_SIZE];
+	size_t length = configFileFormat(line, sizeof(line), key, (const uint8_t*) source);
+	if(length > 0) writer.write(line, length);
 }
 
 void AmsWebServer::configFilePost() {
@@ -2638,6 +3332,57 @@ void AmsWebServer::modifyMonthPlot() {
 	server.send(200, MIME_JSON, buf);
 }
 
+void AmsWebServer::historyUpload() {
+	if(!checkSecurity(1))
+		return;
+
+	// Rows are applied while the upload comes in, only the current line is kept
+	HTTPUpload& upload = server.upload();
+	if(upload.status == UPLOAD_FILE_START) {
+		if(historyImport != NULL) {
+			delete historyImport;
+		}
+		historyImport = new HistoryImport(ds, ea, archive);
+		historyImport->write(upload.buf, upload.currentSize);
+	} else if(upload.status == UPLOAD_FILE_WRITE) {
+		if(historyImport != NULL) {
+			historyImport->write(upload.buf, upload.currentSize);
+		}
+	} else if(upload.status == UPLOAD_FILE_ABORTED) {
+		if(historyImport != NULL) {
+			delete historyImport;
+			historyImport = NULL;
+		}
+	}
+}
+
+void AmsWebServer::historyPost() {
+	if(!checkSecurity(1))
+		return;
+
+	if(historyImport == NULL) {
+		server.send_P(400, MIME_PLAIN, PSTR("400: No file"));
+		return;
+	}
+
+	bool ret = historyImport->end();
+	if(archive != NULL) {
+		archive->close();
+	}
+	char message[48];
+	snprintf_P(message, sizeof(message), PSTR("%u rows, %u errors, %u hours missing"), historyImport->getRows(), historyImport->getErrors(), historyImport->getMissingHours());
+	delete historyImport;
+	historyImport = NULL;
+
+	snprintf_P(buf, BufferSize, RESPONSE_JSON,
+		ret ? "true" : "false",
+		message,
+		"false"
+	);
+	server.setContentLength(strlen(buf));
+	server.send(200, MIME_JSON, buf);
+}
+
 void AmsWebServer::addConditionalCloudHeaders() {
 	server.sendHeader(HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, ORIGIN_AMSLESER_CLOUD);
 
@@ -0,0 +1,166 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "EventStream.h"
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#endif
+
+#define EVENT_STREAM_PREFIX 6 // "data: "
+#define EVENT_STREAM_SUFFIX 2 // "\n\n"
+
+bool EventStream::subscribe(WiFiClient& client, const char* hello) {
+	if(count >= EVENT_STREAM_CLIENTS) {
+		return false;
+	}
+
+	client.setNoDelay(true);
+	client.print(F("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n\r\nretry: 5000\n"));
+	client.printf_P(PSTR("event: hello\ndata: %s\n\n"), hello);
+
+	// Newcomers get the latest event right away instead of waiting for the next frame
+	EventStreamClient& c = clients[count++];
+	c.client = client;
+	c.pos = 0;
+	c.tail = NULL;
+	c.tailLength = c.tailPos = 0;
+	return true;
+}
+
+bool EventStream::hasClients() {
+	return count > 0;
+}
+
+char* EventStream::begin(size_t& capacity) {
+	if(count == 0) {
+		return NULL;
+	}
+	if(buf == NULL) {
+		buf = (char*) malloc(EVENT_STREAM_BUFFER);
+		if(buf == NULL) return NULL;
+		length = 0;
+	}
+
+	for(uint8_t i = 0; i < count; i++) {
+		EventStreamClient& c = clients[i];
+		if(c.pos > 0 && c.pos < length) {
+			// Part of this event is already on the wire, it has to be completed before the next one
+			c.tailLength = length - c.pos;
+			c.tailPos = 0;
+			c.tail = (char*) malloc(c.tailLength);
+			if(c.tail == NULL) {
+				c.client.stop();
+			} else {
+				memcpy(c.tail, buf + c.pos, c.tailLength);
+			}
+		} else if(c.pos < length) {
+			dropped++;
+		}
+		c.pos = 0;
+	}
+	length = 0;
+
+	memcpy_P(buf, PSTR("data: "), EVENT_STREAM_PREFIX);
+	capacity = EVENT_STREAM_BUFFER - EVENT_STREAM_PREFIX - EVENT_STREAM_SUFFIX;
+	return buf + EVENT_STREAM_PREFIX;
+}
+
+void EventStream::commit(size_t size) {
+	if(buf == NULL) return;
+	if(size > EVENT_STREAM_BUFFER - EVENT_STREAM_PREFIX - EVENT_STREAM_SUFFIX) {
+		size = EVENT_STREAM_BUFFER - EVENT_STREAM_PREFIX - EVENT_STREAM_SUFFIX;
+	}
+
+	// A line break would end the data field early
+	char* data = buf + EVENT_STREAM_PREFIX;
+	for(size_t i = 0; i < size; i++) {
+		if(data[i] == '\n' || data[i] == '\r') data[i] = ' ';
+	}
+	data[size] = '\n';
+	data[size+1] = '\n';
+	length = EVENT_STREAM_PREFIX + size + EVENT_STREAM_SUFFIX;
+	events++;
+
+	loop();
+}
+
+void EventStream::loop() {
+	for(uint8_t i = count; i > 0; i--) {
+		EventStreamClient& c = clients[i-1];
+		if(!c.client.connected()) {
+			remove(i-1);
+			continue;
+		}
+		if(c.tail != NULL) {
+			int n = send(c.client, c.tail + c.tailPos, c.tailLength - c.tailPos);
+			if(n < 0) {
+				remove(i-1);
+				continue;
+			}
+			c.tailPos += n;
+			if(c.tailPos < c.tailLength) continue;
+			free(c.tail);
+			c.tail = NULL;
+		}
+		if(c.pos < length) {
+			int n = send(c.client, buf + c.pos, length - c.pos);
+			if(n < 0) {
+				remove(i-1);
+				continue;
+			}
+			c.pos += n;
+		}
+	}
+
+	if(count == 0 && buf != NULL) {
+		free(buf);
+		buf = NULL;
+		length = 0;
+	}
+}
+
+int EventStream::send(WiFiClient& client, const char* data, size_t length) {
+	// Only write what the TCP send buffer takes right now, the rest is retried from loop()
+	#if defined(ESP8266)
+		size_t available = client.availableForWrite();
+		if(available == 0) return 0;
+		return client.write((const uint8_t*) data, min(length, available));
+	#elif defined(ESP32)
+		int n = ::send(client.fd(), data, length, MSG_DONTWAIT);
+		if(n < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		return n;
+	#endif
+}
+
+void EventStream::remove(uint8_t index) {
+	EventStreamClient& c = clients[index];
+	if(c.tail != NULL) {
+		free(c.tail);
+		c.tail = NULL;
+	}
+	c.client.stop();
+	for(uint8_t i = index; i < count-1; i++) {
+		clients[i] = clients[i+1];
+	}
+	clients[count-1].client = WiFiClient();
+	clients[count-1].tail = NULL;
+	count--;
+}
+
+uint8_t EventStream::getClientCount() {
+	return count;
+}
+
+uint32_t EventStream::getEventCount() {
+	return events;
+}
+
+uint32_t EventStream::getDroppedCount() {
+	return dropped;
+}
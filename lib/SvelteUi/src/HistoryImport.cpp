@@ -0,0 +1,244 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "HistoryImport.h"
+
+static PGM_P columnName(uint8_t column) {
+	switch(column) {
+		case HISTORY_COLUMN_SERIES: return PSTR("series");
+		case HISTORY_COLUMN_KEY: return PSTR("key");
+		case HISTORY_COLUMN_IMPORT: return PSTR("import");
+		default: return PSTR("export");
+	}
+}
+
+HistoryImport::HistoryImport(AmsDataStorage* ds, EnergyAccounting* ea, EnergyArchive* archive) {
+	this->ds = ds;
+	this->ea = ea;
+	this->archive = archive;
+	if(ea != NULL) {
+		ead = ea->getData();
+	}
+}
+
+void HistoryImport::write(const uint8_t* data, size_t size) {
+	for(size_t i = 0; i < size; i++) {
+		char c = data[i];
+		if(c == '\n') {
+			if(overflow) {
+				errors++;
+			} else {
+				line[length] = '\0';
+				parseLine();
+			}
+			length = 0;
+			overflow = false;
+		} else if(c != '\r') {
+			if(length < HISTORY_LINE_SIZE - 1) {
+				line[length++] = c;
+			} else {
+				overflow = true;
+			}
+		}
+	}
+}
+
+bool HistoryImport::end() {
+	if(length > 0 && !overflow) {
+		line[length] = '\0';
+		parseLine();
+	}
+	length = 0;
+
+	bool ret = true;
+	flushDay();
+	if(dsChanged) {
+		ret &= ds->save();
+	}
+	if(eaChanged) {
+		ea->setData(ead);
+		ret &= ea->save();
+	}
+	return ret;
+}
+
+uint16_t HistoryImport::getRows() {
+	return rows;
+}
+
+uint16_t HistoryImport::getErrors() {
+	return errors;
+}
+
+uint16_t HistoryImport::getMissingHours() {
+	return missingHours;
+}
+
+void HistoryImport::parseLine() {
+	if(length == 0) return;
+
+	char* fields[HISTORY_COLUMNS] = { NULL, NULL, NULL, NULL };
+	bool ok = line[0] == '{' ? parseJson(fields) : parseCsv(fields);
+	if(!ok) return;
+
+	if(apply(fields)) {
+		rows++;
+	} else {
+		errors++;
+	}
+}
+
+bool HistoryImport::parseCsv(char** fields) {
+	char* tokens[HISTORY_MAX_COLUMNS];
+	uint8_t count = 0;
+	char* p = line;
+	while(p != NULL) {
+		// Extra columns would otherwise end up as part of the last value
+		if(count == HISTORY_MAX_COLUMNS) {
+			errors++;
+			return false;
+		}
+		tokens[count++] = p;
+		p = strchr(p, ',');
+		if(p != NULL) *p++ = '\0';
+	}
+
+	// The header tells which columns are present and in which order
+	if(strcmp_P(tokens[0], PSTR("series")) == 0) {
+		columnCount = count;
+		for(uint8_t c = 0; c < HISTORY_COLUMNS; c++) {
+			columns[c] = -1;
+			for(uint8_t i = 0; i < count; i++) {
+				if(strcmp_P(tokens[i], columnName(c)) == 0) {
+					columns[c] = i;
+				}
+			}
+		}
+		return false;
+	}
+	if(count > columnCount) {
+		errors++;
+		return false;
+	}
+
+	for(uint8_t c = 0; c < HISTORY_COLUMNS; c++) {
+		fields[c] = columns[c] >= 0 && columns[c] < count ? tokens[columns[c]] : NULL;
+	}
+	return true;
+}
+
+bool HistoryImport::parseJson(char** fields) {
+	// Flat objects with the same names as the CSV header, located first and cut out afterwards
+	char needle[12];
+	for(uint8_t c = 0; c < HISTORY_COLUMNS; c++) {
+		needle[0] = '"';
+		strcpy_P(needle + 1, columnName(c));
+		strcat(needle, "\":");
+		char* p = strstr(line, needle);
+		fields[c] = p == NULL ? NULL : p + strlen(needle);
+	}
+	for(uint8_t c = 0; c < HISTORY_COLUMNS; c++) {
+		char* p = fields[c];
+		if(p == NULL) continue;
+		while(*p == ' ') p++;
+		if(*p == '"') {
+			fields[c] = ++p;
+			p = strchr(p, '"');
+		} else {
+			fields[c] = p;
+			p = strpbrk(p, ",} ");
+		}
+		if(p != NULL) *p = '\0';
+	}
+	return true;
+}
+
+bool HistoryImport::apply(char** fields) {
+	char* series = fields[HISTORY_COLUMN_SERIES];
+	char* key = fields[HISTORY_COLUMN_KEY];
+	if(series == NULL || key == NULL || *key == '\0') return false;
+
+	bool hasImport = fields[HISTORY_COLUMN_IMPORT] != NULL && *fields[HISTORY_COLUMN_IMPORT] != '\0';
+	bool hasExport = fields[HISTORY_COLUMN_EXPORT] != NULL && *fields[HISTORY_COLUMN_EXPORT] != '\0';
+	double importValue = hasImport ? atof(fields[HISTORY_COLUMN_IMPORT]) : 0;
+	double exportValue = hasExport ? atof(fields[HISTORY_COLUMN_EXPORT]) : 0;
+
+	if(strcmp_P(series, PSTR("hour")) == 0) {
+		if(ds == NULL) return false;
+		uint32_t hour = strtoul(key, NULL, 10);
+		if(hour > 23) return false;
+		if(hasImport) ds->setHourImport(hour, importValue);
+		if(hasExport) ds->setHourExport(hour, exportValue);
+		dsChanged = true;
+	} else if(strcmp_P(series, PSTR("day")) == 0) {
+		if(ds == NULL) return false;
+		uint32_t dom = strtoul(key, NULL, 10);
+		if(dom < 1 || dom > 31) return false;
+		if(hasImport) ds->setDayImport(dom, importValue);
+		if(hasExport) ds->setDayExport(dom, exportValue);
+		dsChanged = true;
+	} else if(strcmp_P(series, PSTR("archive")) == 0) {
+		if(archive == NULL) return false;
+		time_t t = strtoul(key, NULL, 10);
+		time_t d = t - (t % SECS_PER_DAY);
+		if(d != currentDay) {
+			// Hours of one day are collected and written as one block, merged with what is already stored
+			flushDay();
+			if(archive->getDay(d, day)) {
+				dayHours = 0xFFFFFF;
+			} else {
+				memset(&day, 0, sizeof(day));
+				dayHours = 0;
+			}
+			currentDay = d;
+		}
+		uint8_t hour = (t % SECS_PER_DAY) / SECS_PER_HOUR;
+		dayHours |= 1UL << hour;
+		if(hasImport) day.hImport[hour] = importValue;
+		if(hasExport) day.hExport[hour] = exportValue;
+	} else if(strcmp_P(series, PSTR("peak")) == 0) {
+		if(ea == NULL || !hasImport || peaks >= 5) return false;
+		if(peaks == 0) {
+			memset(ead.peaks, 0, sizeof(ead.peaks));
+		}
+		ead.peaks[peaks].day = strtoul(key, NULL, 10);
+		ead.peaks[peaks].value = lround(importValue / 10);
+		peaks++;
+		eaChanged = true;
+	} else if(strcmp_P(series, PSTR("cost")) == 0) {
+		if(ea == NULL) return false;
+		int32_t* cost;
+		int32_t* income;
+		if(strcmp_P(key, PSTR("yesterday")) == 0) {
+			cost = &ead.costYesterday;
+			income = &ead.incomeYesterday;
+		} else if(strcmp_P(key, PSTR("thismonth")) == 0) {
+			cost = &ead.costThisMonth;
+			income = &ead.incomeThisMonth;
+		} else if(strcmp_P(key, PSTR("lastmonth")) == 0) {
+			cost = &ead.costLastMonth;
+			income = &ead.incomeLastMonth;
+		} else {
+			return false;
+		}
+		if(hasImport) *cost = lround(importValue * 100);
+		if(hasExport) *income = lround(exportValue * 100);
+		eaChanged = true;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void HistoryImport::flushDay() {
+	if(currentDay == 0) return;
+	// Written anyway, a partial day is still better than none. The hours left out read back as 0
+	missingHours += 24 - __builtin_popcount(dayHours);
+	if(!archive->setDay(currentDay, day)) {
+		errors++;
+	}
+	currentDay = 0;
+}
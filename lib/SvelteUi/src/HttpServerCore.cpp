@@ -0,0 +1,949 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "HttpServerCore.h"
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#endif
+
+#define HTTP_SERVER_FORM_STEP 256
+#define HTTP_SERVER_REFERENCE 256 // Shorter PROGMEM content is copied instead of referenced
+
+enum HttpArgState {
+	HttpArgNone = 0,
+	HttpArgName,
+	HttpArgValue
+};
+
+static PGM_P statusText(int code) {
+	switch(code) {
+		case 200: return PSTR("OK");
+		case 204: return PSTR("No Content");
+		case 301: return PSTR("Moved Permanently");
+		case 302: return PSTR("Found");
+		case 303: return PSTR("See Other");
+		case 304: return PSTR("Not Modified");
+		case 400: return PSTR("Bad Request");
+		case 401: return PSTR("Unauthorized");
+		case 403: return PSTR("Forbidden");
+		case 404: return PSTR("Not Found");
+		case 405: return PSTR("Method Not Allowed");
+		case 411: return PSTR("Length Required");
+		case 413: return PSTR("Payload Too Large");
+		case 414: return PSTR("URI Too Long");
+		case 431: return PSTR("Request Header Fields Too Large");
+		case 500: return PSTR("Internal Server Error");
+		case 501: return PSTR("Not Implemented");
+		case 503: return PSTR("Service Unavailable");
+	}
+	return PSTR("");
+}
+
+static uint8_t hexValue(char c) {
+	return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+static const char* findBytes(const char* data, size_t length, const char* find, size_t findLength) {
+	const char* end = data + length;
+	for(const char* p = data; p + findLength <= end; p++) {
+		if(*p == *find && memcmp(p, find, findLength) == 0) return p;
+	}
+	return NULL;
+}
+
+HttpServerCore::HttpServerCore(uint16_t port) : server(port) {
+}
+
+void HttpServerCore::begin() {
+	server.begin();
+}
+
+void HttpServerCore::setIdleCallback(std::function<void()> callback) {
+	idle = callback;
+}
+
+void HttpServerCore::collectHeader(const char* name) {
+	if(headerCount < HTTP_SERVER_HEADERS) {
+		headerNames[headerCount++] = name;
+	}
+}
+
+uint8_t HttpServerCore::getConnectionCount() {
+	uint8_t count = 0;
+	for(uint8_t i = 0; i < HTTP_SERVER_CONNECTIONS; i++) {
+		if(connections[i].state != HttpConnectionFree) count++;
+	}
+	return count;
+}
+
+void HttpServerCore::loop() {
+	if(current != NULL) {
+		// Called from a handler, which wants its response on the wire before it goes on
+		flush(*current);
+		return;
+	}
+
+	accept();
+	for(uint8_t i = 0; i < HTTP_SERVER_CONNECTIONS; i++) {
+		service(connections[i]);
+	}
+
+	// One handler per call, taking turns so one busy client cannot keep the others waiting
+	for(uint8_t i = 0; i < HTTP_SERVER_CONNECTIONS; i++) {
+		uint8_t index = (next + i) % HTTP_SERVER_CONNECTIONS;
+		if(connections[index].state == HttpConnectionReady) {
+			next = (index + 1) % HTTP_SERVER_CONNECTIONS;
+			dispatch(connections[index]);
+			break;
+		}
+	}
+}
+
+void HttpServerCore::accept() {
+	while(server.hasClient()) {
+		unsigned long now = millis();
+		HttpConnection* slot = NULL;
+		HttpConnection* idlest = NULL;
+		for(uint8_t i = 0; i < HTTP_SERVER_CONNECTIONS; i++) {
+			HttpConnection& c = connections[i];
+			if(c.state == HttpConnectionFree) {
+				slot = &c;
+				break;
+			}
+			if(c.state == HttpConnectionHead && c.uri == NULL && c.inLength == 0 && (idlest == NULL || now - c.lastActivity > now - idlest->lastActivity)) {
+				idlest = &c;
+			}
+		}
+		if(slot == NULL && idlest != NULL) {
+			// A keep-alive connection waiting for its next request makes room for a new one
+			release(*idlest, true);
+			slot = idlest;
+		}
+		if(slot == NULL) {
+			// The rest waits in the listen backlog until a connection is done
+			return;
+		}
+
+		slot->in = (char*) malloc(HTTP_SERVER_INPUT);
+		if(slot->in == NULL) return;
+		slot->client = server.accept();
+		if(!slot->client) {
+			free(slot->in);
+			slot->in = NULL;
+			return;
+		}
+		slot->client.setNoDelay(true);
+		slot->inLength = 0;
+		reset(*slot);
+	}
+}
+
+void HttpServerCore::service(HttpConnection& c) {
+	if(c.state == HttpConnectionFree || c.state == HttpConnectionReady) {
+		return;
+	}
+
+	if(c.state == HttpConnectionSending) {
+		if(sendSegment(c) < 0) {
+			release(c, true);
+			return;
+		}
+		if(c.out != NULL) {
+			if(millis() - c.lastActivity > HTTP_SERVER_SEND_TIMEOUT) {
+				release(c, true);
+			}
+			return;
+		}
+		if(!c.keepAlive) {
+			release(c, true);
+			return;
+		}
+		// Anything the client sent after the request is already in the buffer and is parsed right away
+		reset(c);
+	}
+
+	int available = c.client.available();
+	if(available > 0) {
+		if(c.inLength < HTTP_SERVER_INPUT) {
+			int n = c.client.read((uint8_t*) c.in + c.inLength, min((size_t) available, (size_t) (HTTP_SERVER_INPUT - c.inLength)));
+			if(n > 0) {
+				c.inLength += n;
+				c.lastActivity = millis();
+			}
+		}
+	} else if(!c.client.connected()) {
+		release(c, true);
+		return;
+	}
+
+	if(c.state == HttpConnectionHead) {
+		parseHead(c);
+	}
+	if(c.state == HttpConnectionBody) {
+		parseBody(c);
+	}
+	if((c.state == HttpConnectionHead || c.state == HttpConnectionBody) && millis() - c.lastActivity > HTTP_SERVER_TIMEOUT) {
+		release(c, true);
+	}
+}
+
+void HttpServerCore::dispatch(HttpConnection& c) {
+	current = &c;
+	onRequest(c);
+	current = NULL;
+
+	if(uploading == &c) {
+		uploading = NULL;
+		delete currentUpload;
+		currentUpload = NULL;
+	}
+
+	if(c.detached) {
+		// The handler kept the client, only our reference goes
+		release(c, false);
+		return;
+	}
+	if(!c.responded) {
+		c.keepAlive = false;
+	} else if(c.chunked && !c.discard) {
+		append(c, PSTR("0\r\n\r\n"), 5, true);
+	}
+	c.state = HttpConnectionSending;
+	c.lastActivity = millis();
+}
+
+void HttpServerCore::fail(HttpConnection& c, int code) {
+	if(uploading == &c) {
+		uploadAbort();
+	}
+	c.keepAlive = false;
+	c.responseHeaders = String();
+	beginResponse(c, code, PSTR("text/plain"), 0);
+	c.state = HttpConnectionSending;
+	c.lastActivity = millis();
+}
+
+void HttpServerCore::release(HttpConnection& c, bool stop) {
+	if(uploading == &c) {
+		uploadAbort();
+	}
+	if(stop) {
+		c.client.stop();
+	}
+	c.client = WiFiClient();
+	while(c.out != NULL) {
+		HttpSegment* s = c.out;
+		c.out = s->next;
+		free(s);
+	}
+	c.outTail = NULL;
+	c.outLength = 0;
+	reset(c);
+	if(c.in != NULL) {
+		free(c.in);
+		c.in = NULL;
+	}
+	c.inLength = 0;
+	c.state = HttpConnectionFree;
+}
+
+void HttpServerCore::reset(HttpConnection& c) {
+	if(c.uri != NULL) {
+		free(c.uri);
+		c.uri = NULL;
+	}
+	if(c.form != NULL) {
+		free(c.form);
+		c.form = NULL;
+	}
+	c.formLength = c.formCapacity = 0;
+	c.formOverflow = false;
+	c.argState = HttpArgNone;
+	c.argEscape = 0;
+	for(uint8_t i = 0; i < headerCount; i++) {
+		c.headers[i] = String();
+	}
+	c.contentType = String();
+	c.delimiter = String();
+	c.responseHeaders = String();
+	c.contentLength = c.bodyRead = 0;
+	c.bodyType = HttpBodyNone;
+	c.multipartState = HttpMultipartPreamble;
+	c.multipartFile = false;
+	c.handler = NULL;
+	c.method = HTTP_GET;
+	c.http11 = c.keepAlive = false;
+	c.detached = c.responded = c.chunked = c.discard = false;
+	c.outLength = 0;
+	c.state = HttpConnectionHead;
+	c.lastActivity = millis();
+}
+
+void HttpServerCore::consume(HttpConnection& c, size_t length) {
+	if(length == 0) return;
+	memmove(c.in, c.in + length, c.inLength - length);
+	c.inLength -= length;
+	c.lastActivity = millis();
+}
+
+void HttpServerCore::parseHead(HttpConnection& c) {
+	while(c.state == HttpConnectionHead) {
+		char* end = (char*) memchr(c.in, '\n', c.inLength);
+		if(end == NULL) {
+			if(c.inLength == HTTP_SERVER_INPUT) {
+				fail(c, c.uri == NULL ? 414 : 431);
+			}
+			return;
+		}
+		size_t length = end - c.in + 1;
+		*end = '\0';
+		if(end > c.in && end[-1] == '\r') end[-1] = '\0';
+
+		if(c.uri == NULL) {
+			// Empty lines ahead of the request line are allowed
+			if(c.in[0] != '\0') requestLine(c, c.in);
+		} else if(c.in[0] == '\0') {
+			headComplete(c);
+		} else {
+			headerLine(c, c.in);
+		}
+		consume(c, length);
+	}
+}
+
+void HttpServerCore::requestLine(HttpConnection& c, char* line) {
+	char* target = strchr(line, ' ');
+	char* version = target == NULL ? NULL : strchr(target + 1, ' ');
+	if(version == NULL) {
+		fail(c, 400);
+		return;
+	}
+	*target++ = '\0';
+	*version++ = '\0';
+
+	if(strcmp_P(line, PSTR("GET")) == 0) {
+		c.method = HTTP_GET;
+	} else if(strcmp_P(line, PSTR("POST")) == 0) {
+		c.method = HTTP_POST;
+	} else if(strcmp_P(line, PSTR("OPTIONS")) == 0) {
+		c.method = HTTP_OPTIONS;
+	} else if(strcmp_P(line, PSTR("HEAD")) == 0) {
+		c.method = HTTP_HEAD;
+	} else if(strcmp_P(line, PSTR("PUT")) == 0) {
+		c.method = HTTP_PUT;
+	} else if(strcmp_P(line, PSTR("PATCH")) == 0) {
+		c.method = HTTP_PATCH;
+	} else if(strcmp_P(line, PSTR("DELETE")) == 0) {
+		c.method = HTTP_DELETE;
+	} else {
+		fail(c, 501);
+		return;
+	}
+	c.http11 = strcmp_P(version, PSTR("HTTP/1.1")) == 0;
+	c.keepAlive = c.http11;
+
+	char* query = strchr(target, '?');
+	if(query != NULL) *query++ = '\0';
+
+	c.uri = (char*) malloc(strlen(target) + 1);
+	if(c.uri == NULL) {
+		fail(c, 500);
+		return;
+	}
+	char* out = c.uri;
+	for(char* p = target; *p != '\0'; p++) {
+		if(*p == '%' && isxdigit(p[1]) && isxdigit(p[2])) {
+			*out++ = (hexValue(p[1]) << 4) | hexValue(p[2]);
+			p += 2;
+		} else {
+			*out++ = *p;
+		}
+	}
+	*out = '\0';
+
+	if(query != NULL) {
+		while(*query != '\0') argPut(c, *query++);
+		argEnd(c);
+	}
+}
+
+void HttpServerCore::headerLine(HttpConnection& c, char* line) {
+	char* value = strchr(line, ':');
+	if(value == NULL) return;
+	*value++ = '\0';
+	while(*value == ' ' || *value == '\t') value++;
+	char* end = value + strlen(value);
+	while(end > value && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+
+	if(strcasecmp_P(line, PSTR("Content-Length")) == 0) {
+		c.contentLength = strtoul(value, NULL, 10);
+	} else if(strcasecmp_P(line, PSTR("Content-Type")) == 0) {
+		c.contentType = value;
+	} else if(strcasecmp_P(line, PSTR("Connection")) == 0) {
+		if(strcasecmp_P(value, PSTR("close")) == 0) {
+			c.keepAlive = false;
+		} else if(strcasecmp_P(value, PSTR("keep-alive")) == 0) {
+			c.keepAlive = true;
+		}
+	} else if(strcasecmp_P(line, PSTR("Transfer-Encoding")) == 0) {
+		// Request bodies have to come with a length
+		fail(c, 411);
+		return;
+	}
+
+	for(uint8_t i = 0; i < headerCount; i++) {
+		if(strcasecmp_P(line, headerNames[i]) == 0) {
+			c.headers[i] = value;
+		}
+	}
+}
+
+void HttpServerCore::headComplete(HttpConnection& c) {
+	onHead(c);
+	if(c.contentLength == 0) {
+		c.state = HttpConnectionReady;
+		return;
+	}
+
+	const char* type = c.contentType.c_str();
+	if(strncasecmp_P(type, PSTR("application/x-www-form-urlencoded"), 33) == 0) {
+		c.bodyType = HttpBodyForm;
+	} else if(strncasecmp_P(type, PSTR("multipart/form-data"), 19) == 0) {
+		const char* boundary = strstr_P(type, PSTR("boundary="));
+		if(boundary == NULL) {
+			fail(c, 400);
+			return;
+		}
+		boundary += 9;
+		size_t length;
+		if(*boundary == '"') {
+			boundary++;
+			length = strcspn(boundary, "\"");
+		} else {
+			length = strcspn(boundary, "; ");
+		}
+		if(length == 0 || length > 70) {
+			fail(c, 400);
+			return;
+		}
+		if(uploading != NULL) {
+			// One upload at a time, the upload handlers keep their state in the web server
+			fail(c, 503);
+			return;
+		}
+		currentUpload = new HTTPUpload();
+		uploading = &c;
+
+		char delimiter[76];
+		memcpy_P(delimiter, PSTR("\r\n--"), 4);
+		memcpy(delimiter + 4, boundary, length);
+		delimiter[length + 4] = '\0';
+		c.delimiter = delimiter;
+		c.bodyType = HttpBodyMultipart;
+		c.multipartState = HttpMultipartPreamble;
+	} else {
+		// Any other body is the "plain" argument, same as with the core's server
+		c.bodyType = HttpBodyPlain;
+		PGM_P name = PSTR("plain");
+		for(uint8_t i = 0; i < 6; i++) formPut(c, pgm_read_byte(name + i));
+	}
+	c.state = HttpConnectionBody;
+}
+
+void HttpServerCore::parseBody(HttpConnection& c) {
+	size_t length = min((uint32_t) c.inLength, c.contentLength - c.bodyRead);
+	size_t used = length;
+	if(c.bodyType == HttpBodyMultipart) {
+		used = parseMultipart(c, length);
+		if(c.state != HttpConnectionBody) return;
+	} else if(c.bodyType == HttpBodyForm) {
+		for(size_t i = 0; i < length; i++) argPut(c, c.in[i]);
+	} else {
+		for(size_t i = 0; i < length; i++) formPut(c, c.in[i]);
+	}
+	c.bodyRead += used;
+	consume(c, used);
+	if(c.bodyRead < c.contentLength) return;
+
+	if(c.bodyType == HttpBodyForm) {
+		argEnd(c);
+	} else if(c.bodyType == HttpBodyPlain) {
+		formPut(c, '\0');
+	} else if(c.multipartFile && c.multipartState == HttpMultipartData) {
+		// Body ended in the middle of a file
+		uploadEvent(c, UPLOAD_FILE_ABORTED);
+		c.multipartFile = false;
+	}
+
+	if(c.formOverflow) {
+		fail(c, 413);
+		return;
+	}
+	c.state = HttpConnectionReady;
+}
+
+size_t HttpServerCore::parseMultipart(HttpConnection& c, size_t length) {
+	const char* delimiter = c.delimiter.c_str();
+	size_t delimiterLength = c.delimiter.length();
+	size_t pos = 0;
+	while(pos < length && c.state == HttpConnectionBody) {
+		char* data = c.in + pos;
+		size_t available = length - pos;
+		switch(c.multipartState) {
+			case HttpMultipartPreamble:
+			case HttpMultipartData: {
+				// The first delimiter may start the body, without a line break in front
+				bool inPart = c.multipartState == HttpMultipartData;
+				const char* find = inPart ? delimiter : delimiter + 2;
+				size_t findLength = inPart ? delimiterLength : delimiterLength - 2;
+				const char* found = findBytes(data, available, find, findLength);
+
+				// Without a match the last bytes may be the start of a delimiter and wait for more data
+				size_t n = found != NULL ? found - data : (available >= findLength ? available - findLength + 1 : 0);
+				bool wrote = inPart && partData(c, data, n);
+				pos += n;
+				if(wrote) return pos;
+				if(found == NULL) return pos;
+
+				if(inPart) partEnd(c);
+				pos += findLength;
+				c.multipartState = HttpMultipartDelimiter;
+				break;
+			}
+			case HttpMultipartDelimiter:
+				if(available < 2) return pos;
+				if(data[0] == '-' && data[1] == '-') {
+					c.multipartState = HttpMultipartEpilogue;
+				} else if(data[0] == '\r' && data[1] == '\n') {
+					c.multipartState = HttpMultipartHeaders;
+					c.multipartFile = false;
+					currentUpload->name = String();
+					currentUpload->filename = String();
+					currentUpload->type = String();
+				} else {
+					fail(c, 400);
+					return pos;
+				}
+				pos += 2;
+				break;
+			case HttpMultipartHeaders: {
+				char* end = (char*) memchr(data, '\n', available);
+				if(end == NULL) {
+					if(pos == 0 && c.inLength == HTTP_SERVER_INPUT) fail(c, 431);
+					return pos;
+				}
+				*end = '\0';
+				if(end > data && end[-1] == '\r') end[-1] = '\0';
+				if(data[0] == '\0') {
+					partBegin(c);
+				} else {
+					partHeader(c, data);
+				}
+				pos += end - data + 1;
+				break;
+			}
+			case HttpMultipartEpilogue:
+				return length;
+		}
+	}
+	return pos;
+}
+
+void HttpServerCore::partHeader(HttpConnection& c, char* line) {
+	char* value = strchr(line, ':');
+	if(value == NULL) return;
+	*value++ = '\0';
+	while(*value == ' ') value++;
+
+	if(strcasecmp_P(line, PSTR("Content-Type")) == 0) {
+		currentUpload->type = value;
+	} else if(strcasecmp_P(line, PSTR("Content-Disposition")) == 0) {
+		// form-data; name="field"; filename="file.bin"
+		char* p = value;
+		while(p != NULL) {
+			char* next = strchr(p, ';');
+			if(next != NULL) *next++ = '\0';
+			while(*p == ' ') p++;
+			char* v = strchr(p, '=');
+			if(v != NULL) {
+				*v++ = '\0';
+				if(*v == '"') {
+					v++;
+					char* quote = strchr(v, '"');
+					if(quote != NULL) *quote = '\0';
+				}
+				if(strcmp_P(p, PSTR("name")) == 0) {
+					currentUpload->name = v;
+				} else if(strcmp_P(p, PSTR("filename")) == 0) {
+					currentUpload->filename = v;
+					c.multipartFile = true;
+				}
+			}
+			p = next;
+		}
+	}
+}
+
+void HttpServerCore::partBegin(HttpConnection& c) {
+	c.multipartState = HttpMultipartData;
+	if(c.multipartFile) {
+		currentUpload->totalSize = 0;
+		currentUpload->currentSize = 0;
+		uploadEvent(c, UPLOAD_FILE_START);
+	} else {
+		// Other fields are arguments, same as in a query
+		const char* name = currentUpload->name.c_str();
+		do {
+			formPut(c, *name);
+		} while(*name++ != '\0');
+	}
+}
+
+bool HttpServerCore::partData(HttpConnection& c, const char* data, size_t length) {
+	if(!c.multipartFile) {
+		for(size_t i = 0; i < length; i++) formPut(c, data[i]);
+		return false;
+	}
+
+	bool wrote = false;
+	while(length > 0) {
+		size_t n = min(length, (size_t) (HTTP_UPLOAD_BUFLEN - currentUpload->currentSize));
+		memcpy(currentUpload->buf + currentUpload->currentSize, data, n);
+		currentUpload->currentSize += n;
+		data += n;
+		length -= n;
+		if(currentUpload->currentSize == HTTP_UPLOAD_BUFLEN) {
+			uploadEvent(c, UPLOAD_FILE_WRITE);
+			currentUpload->totalSize += currentUpload->currentSize;
+			currentUpload->currentSize = 0;
+			wrote = true;
+		}
+	}
+	return wrote;
+}
+
+void HttpServerCore::partEnd(HttpConnection& c) {
+	if(!c.multipartFile) {
+		formPut(c, '\0');
+		return;
+	}
+	if(currentUpload->currentSize > 0) {
+		uploadEvent(c, UPLOAD_FILE_WRITE);
+		currentUpload->totalSize += currentUpload->currentSize;
+		currentUpload->currentSize = 0;
+	}
+	uploadEvent(c, UPLOAD_FILE_END);
+	c.multipartFile = false;
+}
+
+void HttpServerCore::uploadEvent(HttpConnection& c, HTTPUploadStatus status) {
+	currentUpload->status = status;
+	current = &c;
+	onUpload(c, *currentUpload);
+	current = NULL;
+}
+
+void HttpServerCore::uploadAbort() {
+	HttpConnection& c = *uploading;
+	if(c.multipartFile && c.multipartState == HttpMultipartData) {
+		uploadEvent(c, UPLOAD_FILE_ABORTED);
+		c.multipartFile = false;
+	}
+	uploading = NULL;
+	delete currentUpload;
+	currentUpload = NULL;
+}
+
+void HttpServerCore::argPut(HttpConnection& c, char ch) {
+	if(c.argEscape == 1) {
+		c.argHex = ch;
+		c.argEscape = 2;
+		return;
+	}
+	if(c.argEscape == 2) {
+		c.argEscape = 0;
+		if(isxdigit(c.argHex) && isxdigit(ch)) {
+			formPut(c, (hexValue(c.argHex) << 4) | hexValue(ch));
+		} else {
+			formPut(c, '%');
+			formPut(c, c.argHex);
+			formPut(c, ch);
+		}
+		return;
+	}
+
+	if(ch == '&') {
+		argEnd(c);
+		return;
+	}
+	if(c.argState == HttpArgNone) {
+		c.argState = HttpArgName;
+	}
+	if(ch == '=' && c.argState == HttpArgName) {
+		formPut(c, '\0');
+		c.argState = HttpArgValue;
+	} else if(ch == '%') {
+		c.argEscape = 1;
+	} else {
+		formPut(c, ch == '+' ? ' ' : ch);
+	}
+}
+
+void HttpServerCore::argEnd(HttpConnection& c) {
+	if(c.argEscape > 0) {
+		formPut(c, '%');
+		if(c.argEscape == 2) formPut(c, c.argHex);
+		c.argEscape = 0;
+	}
+	if(c.argState == HttpArgNone) return;
+	if(c.argState == HttpArgName) {
+		// Name without a value
+		formPut(c, '\0');
+	}
+	formPut(c, '\0');
+	c.argState = HttpArgNone;
+}
+
+void HttpServerCore::formPut(HttpConnection& c, char ch) {
+	if(c.formLength == c.formCapacity) {
+		if(c.formCapacity >= HTTP_SERVER_FORM) {
+			c.formOverflow = true;
+			return;
+		}
+		char* form = (char*) realloc(c.form, c.formCapacity + HTTP_SERVER_FORM_STEP);
+		if(form == NULL) {
+			c.formOverflow = true;
+			return;
+		}
+		c.form = form;
+		c.formCapacity += HTTP_SERVER_FORM_STEP;
+	}
+	c.form[c.formLength++] = ch;
+}
+
+const char* HttpServerCore::findArg(HttpConnection& c, const char* name) {
+	if(c.form == NULL) return NULL;
+	const char* p = c.form;
+	const char* end = c.form + c.formLength;
+	while(p < end) {
+		const char* nameEnd = (const char*) memchr(p, '\0', end - p);
+		if(nameEnd == NULL) break;
+		const char* value = nameEnd + 1;
+		const char* valueEnd = (const char*) memchr(value, '\0', end - value);
+		if(valueEnd == NULL) break;
+		if(strcmp(p, name) == 0) return value;
+		p = valueEnd + 1;
+	}
+	return NULL;
+}
+
+bool HttpServerCore::beginResponse(HttpConnection& c, int code, PGM_P contentType, size_t contentLength) {
+	if(c.responded) {
+		// Only the first response counts, an upload handler may already have answered
+		c.discard = true;
+		return false;
+	}
+	c.responded = true;
+	c.chunked = contentLength == CONTENT_LENGTH_UNKNOWN && c.http11;
+	if(contentLength == CONTENT_LENGTH_UNKNOWN && !c.http11) {
+		// HTTP/1.0 has no chunks, the end of the connection is the end of the body
+		c.keepAlive = false;
+	}
+
+	char line[48];
+	int n = snprintf_P(line, sizeof(line), PSTR("HTTP/1.%d %d "), c.http11 ? 1 : 0, code);
+	append(c, line, n, false);
+	PGM_P text = statusText(code);
+	append(c, text, strlen_P(text), true);
+	append(c, PSTR("\r\n"), 2, true);
+	if(contentType != NULL) {
+		append(c, PSTR("Content-Type: "), 14, true);
+		append(c, contentType, strlen_P(contentType), true);
+		append(c, PSTR("\r\n"), 2, true);
+	}
+	if(c.chunked) {
+		append(c, PSTR("Transfer-Encoding: chunked\r\n"), 28, true);
+	} else if(contentLength != CONTENT_LENGTH_UNKNOWN) {
+		n = snprintf_P(line, sizeof(line), PSTR("Content-Length: %lu\r\n"), (unsigned long) contentLength);
+		append(c, line, n, false);
+	}
+	if(c.keepAlive) {
+		append(c, PSTR("Connection: keep-alive\r\n"), 24, true);
+	} else {
+		append(c, PSTR("Connection: close\r\n"), 19, true);
+	}
+	append(c, c.responseHeaders.c_str(), c.responseHeaders.length(), false);
+	append(c, PSTR("\r\n"), 2, true);
+	c.responseHeaders = String();
+	return true;
+}
+
+void HttpServerCore::write(HttpConnection& c, const char* data, size_t length) {
+	if(c.discard || length == 0) return;
+	if(c.chunked) appendChunkHeader(c, length);
+	append(c, data, length, false);
+	if(c.chunked) append(c, PSTR("\r\n"), 2, true);
+
+	if(c.outLength > HTTP_SERVER_OUTPUT) {
+		drain(c, false);
+	}
+}
+
+void HttpServerCore::write_P(HttpConnection& c, PGM_P data, size_t length) {
+	if(c.discard || length == 0) return;
+	if(c.chunked) appendChunkHeader(c, length);
+	if(length < HTTP_SERVER_REFERENCE) {
+		append(c, data, length, true);
+	} else {
+		// Static content stays where it is and is sent from there
+		HttpSegment* s = (HttpSegment*) malloc(sizeof(HttpSegment));
+		if(s == NULL) {
+			c.discard = true;
+			c.keepAlive = false;
+			return;
+		}
+		s->next = NULL;
+		s->data = data;
+		s->length = length;
+		s->pos = 0;
+		s->progmem = true;
+		if(c.outTail == NULL) {
+			c.out = s;
+		} else {
+			c.outTail->next = s;
+		}
+		c.outTail = s;
+	}
+	if(c.chunked) append(c, PSTR("\r\n"), 2, true);
+}
+
+void HttpServerCore::flush(HttpConnection& c) {
+	drain(c, true);
+}
+
+void HttpServerCore::appendChunkHeader(HttpConnection& c, size_t length) {
+	char header[12];
+	int n = snprintf_P(header, sizeof(header), PSTR("%X\r\n"), (unsigned int) length);
+	append(c, header, n, false);
+}
+
+void HttpServerCore::append(HttpConnection& c, const char* data, size_t length, bool progmem) {
+	while(length > 0) {
+		HttpSegment* s = c.outTail;
+		if(s == NULL || s->progmem || s->length == HTTP_SERVER_SEGMENT) {
+			s = (HttpSegment*) malloc(sizeof(HttpSegment) + HTTP_SERVER_SEGMENT);
+			if(s == NULL) {
+				c.discard = true;
+				c.keepAlive = false;
+				return;
+			}
+			s->next = NULL;
+			s->data = (const char*) (s + 1);
+			s->length = 0;
+			s->pos = 0;
+			s->progmem = false;
+			if(c.outTail == NULL) {
+				c.out = s;
+			} else {
+				c.outTail->next = s;
+			}
+			c.outTail = s;
+		}
+		size_t n = min(length, (size_t) (HTTP_SERVER_SEGMENT - s->length));
+		char* to = (char*) s->data + s->length;
+		if(progmem) {
+			memcpy_P(to, data, n);
+		} else {
+			memcpy(to, data, n);
+		}
+		s->length += n;
+		c.outLength += n;
+		data += n;
+		length -= n;
+	}
+}
+
+int HttpServerCore::sendSegment(HttpConnection& c) {
+	HttpSegment* s = c.out;
+	if(s == NULL) return 0;
+
+	size_t length = min(s->length - s->pos, (size_t) HTTP_SERVER_SEGMENT);
+	const char* data = s->data + s->pos;
+	#if defined(ESP8266)
+		// The socket cannot read flash, it goes through a copy a piece at a time
+		char copy[512];
+		if(s->progmem) {
+			length = min(length, sizeof(copy));
+			memcpy_P(copy, data, length);
+			data = copy;
+		}
+	#endif
+	int n = sendBytes(c.client, data, length);
+	if(n <= 0) return n;
+
+	s->pos += n;
+	if(!s->progmem) c.outLength -= n;
+	if(s->pos == s->length) {
+		c.out = s->next;
+		if(c.out == NULL) c.outTail = NULL;
+		free(s);
+	}
+	c.lastActivity = millis();
+	return n;
+}
+
+int HttpServerCore::sendBytes(WiFiClient& client, const char* data, size_t length) {
+	// Only write what the TCP send buffer takes right now, the rest goes on the next call
+	#if defined(ESP8266)
+		size_t available = client.availableForWrite();
+		if(available == 0) return 0;
+		return client.write((const uint8_t*) data, min(length, available));
+	#elif defined(ESP32)
+		int n = ::send(client.fd(), data, length, MSG_DONTWAIT);
+		if(n < 0) {
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		return n;
+	#endif
+}
+
+void HttpServerCore::drain(HttpConnection& c, bool all) {
+	unsigned long start = millis();
+	while(c.out != NULL && (all || c.outLength > HTTP_SERVER_OUTPUT / 2)) {
+		int n = sendSegment(c);
+		if(n > 0) {
+			start = millis();
+		} else if(n < 0 || millis() - start > HTTP_SERVER_SEND_TIMEOUT) {
+			// The rest of the response is dropped and the connection closed once the handler returns
+			while(c.out != NULL) {
+				HttpSegment* s = c.out;
+				c.out = s->next;
+				free(s);
+			}
+			c.outTail = NULL;
+			c.outLength = 0;
+			c.discard = true;
+			c.keepAlive = false;
+			return;
+		}
+		pump(c);
+	}
+}
+
+void HttpServerCore::pump(HttpConnection& c) {
+	// Responses whose handlers are done keep going while this one waits for its client
+	for(uint8_t i = 0; i < HTTP_SERVER_CONNECTIONS; i++) {
+		HttpConnection& other = connections[i];
+		if(&other != &c && other.state == HttpConnectionSending && other.out != NULL) {
+			if(sendSegment(other) < 0) {
+				release(other, true);
+			}
+		}
+	}
+	if(idle) idle();
+	yield();
+}
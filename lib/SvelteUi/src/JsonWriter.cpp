@@ -0,0 +1,267 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include "JsonWriter.h"
+#include "hexutils.h"
+#include <math.h>
+
+static const uint32_t POW10[] PROGMEM = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+JsonWriter::JsonWriter(JsonWriterServer* server, char* buf, size_t size) {
+	this->server = server;
+	this->buf = buf;
+	this->size = size;
+}
+
+void JsonWriter::begin(int code, PGM_P contentType) {
+	server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server->send_P(code, contentType, PSTR(""));
+}
+
+size_t JsonWriter::end() {
+	flush(true);
+	return written;
+}
+
+void JsonWriter::setAsciiOnly(bool asciiOnly) {
+	this->asciiOnly = asciiOnly;
+}
+
+bool JsonWriter::isTruncated() {
+	return truncated;
+}
+
+size_t JsonWriter::getBytesWritten() {
+	return written + pos;
+}
+
+void JsonWriter::printf_P(PGM_P format, ...) {
+	va_list args;
+	va_start(args, format);
+	va_list retry;
+	va_copy(retry, args);
+	size_t len = vsnprintf_P(buf + pos, size - pos, format, args);
+	va_end(args);
+	if(len >= size - pos && pos > 0) {
+		// Did not fit behind what is already there, send that and format again from the start
+		flush(true);
+		len = vsnprintf_P(buf, size, format, retry);
+	}
+	va_end(retry);
+	if(len >= size - pos) {
+		truncated = true;
+		len = size - pos - 1;
+	}
+	if(asciiOnly) {
+		stripNonAscii((uint8_t*) buf + pos, len);
+	}
+	pos += len;
+	flush(false);
+}
+
+void JsonWriter::print_P(PGM_P str) {
+	size_t len = strlen_P(str);
+	for(size_t i = 0; i < len; i++) {
+		put(pgm_read_byte(str + i));
+	}
+	flush(false);
+}
+
+void JsonWriter::write(const char* data, size_t length) {
+	for(size_t i = 0; i < length; i++) {
+		put(data[i]);
+	}
+	flush(false);
+}
+
+void JsonWriter::beginObject() {
+	separator();
+	push('{');
+}
+
+void JsonWriter::endObject() {
+	if(depth > 0) depth--;
+	put('}');
+	flush(false);
+}
+
+void JsonWriter::beginArray() {
+	separator();
+	push('[');
+}
+
+void JsonWriter::endArray() {
+	if(depth > 0) depth--;
+	put(']');
+	flush(false);
+}
+
+void JsonWriter::key(const char* name) {
+	separator();
+	string(name);
+	put(':');
+	afterKey = true;
+}
+
+void JsonWriter::key_P(PGM_P name) {
+	separator();
+	put('"');
+	print_P(name);
+	put('"');
+	put(':');
+	afterKey = true;
+}
+
+void JsonWriter::value(int32_t value) {
+	separator();
+	if(value < 0) {
+		put('-');
+	}
+	char out[20];
+	uint8_t len;
+	formatUnsigned(value < 0 ? -((int64_t) value) : value, out, len);
+	write(out, len);
+}
+
+void JsonWriter::value(uint32_t value) {
+	separator();
+	char out[20];
+	uint8_t len;
+	formatUnsigned(value, out, len);
+	write(out, len);
+}
+
+void JsonWriter::value(double value, uint8_t decimals) {
+	if(isnan(value) || isinf(value)) {
+		nullValue();
+		return;
+	}
+	separator();
+	if(decimals > 6) decimals = 6;
+	uint32_t scale = pgm_read_dword(POW10 + decimals);
+	double scaled = fabs(value) * scale + 0.5;
+	if(scaled >= 18446744073709551616.0) {
+		// Does not fit 64 bits with the decimals, the integer part is all that is left anyway
+		printf_P(PSTR("%.0f"), value);
+		return;
+	}
+	uint64_t v = scaled;
+	uint64_t integer = v / scale;
+	uint32_t fraction = v % scale;
+	if(value < 0 && (integer > 0 || fraction > 0)) {
+		put('-');
+	}
+	char out[20];
+	uint8_t len;
+	formatUnsigned(integer, out, len);
+	write(out, len);
+	if(decimals > 0) {
+		put('.');
+		formatUnsigned(fraction, out, len);
+		for(uint8_t i = len; i < decimals; i++) {
+			put('0');
+		}
+		write(out, len);
+	}
+}
+
+void JsonWriter::value(bool value) {
+	separator();
+	print_P(value ? PSTR("true") : PSTR("false"));
+}
+
+void JsonWriter::value(const char* str) {
+	separator();
+	string(str);
+}
+
+void JsonWriter::nullValue() {
+	separator();
+	print_P(PSTR("null"));
+}
+
+void JsonWriter::string(const char* str) {
+	put('"');
+	for(const char* p = str; *p != '\0'; p++) {
+		uint8_t c = *p;
+		if(c == '"' || c == '\\') {
+			put('\\');
+			put(c);
+		} else if(c < 0x20) {
+			char esc[7];
+			snprintf_P(esc, sizeof(esc), PSTR("\\u%04x"), c);
+			write(esc, 6);
+		} else if(!asciiOnly || c < 0x7F) {
+			put(c);
+		}
+	}
+	put('"');
+	flush(false);
+}
+
+void JsonWriter::separator() {
+	if(afterKey) {
+		afterKey = false;
+		return;
+	}
+	if(depth == 0) return;
+	uint16_t bit = 1 << ((depth - 1) % JSON_WRITER_DEPTH);
+	if(hasValue & bit) {
+		put(',');
+	} else {
+		hasValue |= bit;
+	}
+}
+
+void JsonWriter::push(char c) {
+	put(c);
+	depth++;
+	hasValue &= ~(1 << ((depth - 1) % JSON_WRITER_DEPTH));
+	flush(false);
+}
+
+void JsonWriter::put(char c) {
+	if(pos >= size) {
+		flush(true);
+	}
+	buf[pos++] = c;
+}
+
+void JsonWriter::flush(bool all) {
+	// Send whole segments while there is at least one, keep the rest for the next write
+	size_t sent = 0;
+	while(pos - sent >= JSON_WRITER_CHUNK) {
+		server->sendContent(buf + sent, JSON_WRITER_CHUNK);
+		sent += JSON_WRITER_CHUNK;
+	}
+	if(all && pos > sent) {
+		server->sendContent(buf + sent, pos - sent);
+		sent = pos;
+	}
+	if(sent > 0) {
+		memmove(buf, buf + sent, pos - sent);
+		pos -= sent;
+		written += sent;
+	}
+}
+
+void JsonWriter::formatUnsigned(uint64_t value, char* out, uint8_t& len) {
+	char tmp[20];
+	uint8_t n = 0;
+	// 64 bit division is slow on these cores, so it is only used for the digits that need it
+	while(value > UINT32_MAX) {
+		tmp[n++] = '0' + (value % 10);
+		value /= 10;
+	}
+	uint32_t v = value;
+	do {
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while(v > 0);
+	for(len = 0; len < n; len++) {
+		out[len] = tmp[n - len - 1];
+	}
+}
@@ -0,0 +1,168 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include "WebServerAdapter.h"
+
+WebServerAdapter::WebServerAdapter(uint16_t port) : HttpServerCore(port) {
+}
+
+WebServerAdapter::~WebServerAdapter() {
+	while(routes != NULL) {
+		WebServerRoute* route = routes;
+		routes = route->next;
+		delete route;
+	}
+}
+
+void WebServerAdapter::on(const String& uri, HTTPMethod method, THandlerFunction fn) {
+	on(uri, method, fn, NULL);
+}
+
+void WebServerAdapter::on(const String& uri, HTTPMethod method, THandlerFunction fn, THandlerFunction ufn) {
+	// First match wins, same as in the core's server, so the routes keep their order
+	WebServerRoute* route = new WebServerRoute();
+	route->uri = uri;
+	route->method = method;
+	route->fn = fn;
+	route->ufn = ufn;
+	route->next = NULL;
+	if(lastRoute == NULL) {
+		routes = route;
+	} else {
+		lastRoute->next = route;
+	}
+	lastRoute = route;
+}
+
+void WebServerAdapter::onNotFound(THandlerFunction fn) {
+	notFoundHandler = fn;
+}
+
+void WebServerAdapter::collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+	for(size_t i = 0; i < headerKeysCount; i++) {
+		collectHeader(headerKeys[i]);
+	}
+}
+
+void WebServerAdapter::handleClient() {
+	loop();
+}
+
+String WebServerAdapter::uri() {
+	return current == NULL ? String() : String(current->uri);
+}
+
+String WebServerAdapter::arg(const String& name) {
+	const char* value = current == NULL ? NULL : findArg(*current, name.c_str());
+	return value == NULL ? String() : String(value);
+}
+
+bool WebServerAdapter::hasArg(const String& name) {
+	return current != NULL && findArg(*current, name.c_str()) != NULL;
+}
+
+String WebServerAdapter::header(const String& name) {
+	if(current != NULL) {
+		for(uint8_t i = 0; i < headerCount; i++) {
+			if(strcasecmp_P(name.c_str(), headerNames[i]) == 0) {
+				return current->headers[i];
+			}
+		}
+	}
+	return String();
+}
+
+bool WebServerAdapter::hasHeader(const String& name) {
+	return header(name).length() > 0;
+}
+
+void WebServerAdapter::sendHeader(const String& name, const String& value, bool first) {
+	if(current == NULL) return;
+	String line = name;
+	line += F(": ");
+	line += value;
+	line += F("\r\n");
+	if(first) {
+		current->responseHeaders = line + current->responseHeaders;
+	} else {
+		current->responseHeaders += line;
+	}
+}
+
+void WebServerAdapter::setContentLength(size_t length) {
+	contentLength = length;
+}
+
+void WebServerAdapter::send(int code, const char* contentType, const String& content) {
+	if(current == NULL) return;
+	size_t length = contentLength == CONTENT_LENGTH_NOT_SET ? content.length() : contentLength;
+	contentLength = CONTENT_LENGTH_NOT_SET;
+	if(beginResponse(*current, code, contentType, length)) {
+		write(*current, content.c_str(), content.length());
+	}
+}
+
+void WebServerAdapter::send_P(int code, PGM_P contentType, PGM_P content) {
+	send_P(code, contentType, content, strlen_P(content));
+}
+
+void WebServerAdapter::send_P(int code, PGM_P contentType, PGM_P content, size_t length) {
+	if(current == NULL) return;
+	size_t total = contentLength == CONTENT_LENGTH_NOT_SET ? length : contentLength;
+	contentLength = CONTENT_LENGTH_NOT_SET;
+	if(beginResponse(*current, code, contentType, total)) {
+		write_P(*current, content, length);
+	}
+}
+
+void WebServerAdapter::sendContent(const char* content, size_t length) {
+	if(current == NULL) return;
+	write(*current, content, length);
+}
+
+void WebServerAdapter::sendContent(const String& content) {
+	sendContent(content.c_str(), content.length());
+}
+
+HTTPUpload& WebServerAdapter::upload() {
+	return *currentUpload;
+}
+
+WiFiClient& WebServerAdapter::client() {
+	// The handler takes the connection over, for event streams and SSDP. It is not closed or reused here.
+	flush(*current);
+	current->detached = true;
+	return current->client;
+}
+
+void WebServerAdapter::onHead(HttpConnection& c) {
+	for(WebServerRoute* route = routes; route != NULL; route = route->next) {
+		if((route->method == HTTP_ANY || route->method == c.method) && route->uri == c.uri) {
+			c.handler = route;
+			return;
+		}
+	}
+}
+
+void WebServerAdapter::onUpload(HttpConnection& c, HTTPUpload& upload) {
+	WebServerRoute* route = (WebServerRoute*) c.handler;
+	contentLength = CONTENT_LENGTH_NOT_SET;
+	if(route != NULL && route->ufn) {
+		route->ufn();
+	}
+}
+
+void WebServerAdapter::onRequest(HttpConnection& c) {
+	WebServerRoute* route = (WebServerRoute*) c.handler;
+	contentLength = CONTENT_LENGTH_NOT_SET;
+	if(route != NULL) {
+		route->fn();
+	} else if(notFoundHandler) {
+		notFoundHandler();
+	} else {
+		send(404);
+	}
+}
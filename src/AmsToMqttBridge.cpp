@@ -60,8 +60,10 @@ ADC_MODE(ADC_VCC);
 
 #include "FirmwareVersion.h"
 #include "AmsStorage.h"
+#include "Calendar.h"
 #include "AmsDataStorage.h"
 #include "EnergyAccounting.h"
+#include "EnergyArchive.h"
 #include <MQTT.h>
 #include <DNSServer.h>
 #include <lwip/apps/sntp.h>
@@ -73,10 +75,12 @@ ADC_MODE(ADC_VCC);
 #include "WiFiClientConnectionHandler.h"
 #include "WiFiAccessPointConnectionHandler.h"
 #include "EthernetConnectionHandler.h"
+#include "HttpClientPool.h"
 #include "PriceService.h"
 #include "RealtimePlot.h"
 #include "AmsWebServer.h"
 #include "AmsConfiguration.h"
+#include "ConfigFile.h"
 
 #include "AmsMqttHandler.h"
 #include "JsonMqttHandler.h"
@@ -84,6 +88,7 @@ ADC_MODE(ADC_VCC);
 #include "DomoticzMqttHandler.h"
 #include "HomeAssistantMqttHandler.h"
 #include "PassthroughMqttHandler.h"
+#include "ProtobufMqttHandler.h"
 
 #include "MeterCommunicator.h"
 #include "PassiveMeterCommunicator.h"
@@ -126,6 +131,8 @@ DNSServer* dnsServer = NULL;
 
 AmsConfiguration config;
 
+HttpClientPool httpPool(&Debug);
+
 PriceService* ps = NULL;
 
 Timezone* tz = NULL;
@@ -178,7 +185,9 @@ bool ntpEnabled = false;
 
 bool mdnsEnabled = false;
 
+Calendar calendar;
 AmsDataStorage ds(&Debug);
+EnergyArchive archive(&Debug);
 #if defined(_CLOUDCONNECTOR_H)
 CloudConnector *cloud = NULL;
 __NOINIT_ATTR EnergyAccountingRealtimeData rtd;
@@ -186,6 +195,7 @@ __NOINIT_ATTR EnergyAccountingRealtimeData rtd;
 EnergyAccountingRealtimeData rtd;
 #endif
 EnergyAccounting ea(&Debug, &rtd);
+DataSnapshot snapshot(&hw, &ea);
 
 RealtimePlot rtp;
 
@@ -216,6 +226,7 @@ void handleUiLanguage();
 void handleEnergyAccountingChanged();
 bool handleVoltageCheck();
 bool readHanPort();
+void handleWebIdle();
 void errorBlink();
 
 uint8_t pulses = 0;
@@ -349,7 +360,7 @@ void setup() {
 
 	PriceServiceConfig price;
 	if(config.getPriceServiceConfig(price)) {
-		ps = new PriceService(&Debug);
+		ps = new PriceService(&Debug, &httpPool);
 		ps->setup(price);
 		ws.setPriceService(ps);
 	}
@@ -525,7 +536,10 @@ void setup() {
 	ea.setup(&ds, eac);
 	ea.load();
 	ea.setPriceService(ps);
-	ws.setup(&config, &gpioConfig, &meterState, &ds, &ea, &rtp);
+	ws.setup(&config, &gpioConfig, &meterState, &ds, &ea, &rtp, &snapshot);
+	ws.setHttpClientPool(&httpPool);
+	ws.setEnergyArchive(&archive);
+	ws.setIdleCallback(handleWebIdle);
 
 	UiConfig ui;
 	if(config.getUiConfig(ui)) {
@@ -640,6 +654,7 @@ void loop() {
 						strcpy(energySpeedometerConfig.clientId, (String("ams") + String(chipId, HEX)).c_str());
 						energySpeedometer = new JsonMqttHandler(energySpeedometerConfig, &Debug, (char*) commonBuffer, &hw);
 						energySpeedometer->setCaVerification(false);
+						energySpeedometer->setSnapshot(&snapshot);
 					}
 					if(!energySpeedometer->connected()) {
 						lwmqtt_err_t err = energySpeedometer->lastError();
@@ -667,6 +682,7 @@ void loop() {
 			} catch(const std::exception& e) {
 				debugE_P(PSTR("Exception in PriceService loop (%s)"), e.what());
 			}
+			httpPool.loop();
 			start = millis();
 			ws.loop();
 			end = millis();
@@ -689,7 +705,7 @@ void loop() {
 				CloudConfig cc;
 				if(config.getCloudConfig(cc) && cc.enabled) {
 					if(cloud == NULL) {
-						cloud = new CloudConnector(&Debug);
+						cloud = new CloudConnector(&Debug, &httpPool);
 					}
 					NtpConfig ntp;
 					config.getNtpConfig(ntp);
@@ -697,6 +713,7 @@ void loop() {
 						config.setCloudConfig(cc);
 					}
 					cloud->setConnectionHandler(ch);
+					cloud->setSnapshot(&snapshot);
 
 					PriceServiceConfig price;
 					config.getPriceServiceConfig(price);
@@ -738,6 +755,7 @@ void loop() {
 		if(WiFi.smartConfigDone()) {
 			debugI_P(PSTR("Smart config DONE!"));
 
+			config.beginBatch();
 			NetworkConfig network;
 			config.getNetworkConfig(network);
 			strcpy(network.ssid, WiFi.SSID().c_str());
@@ -894,17 +912,10 @@ void handleUiLanguage() {
 			snprintf_P((char*) commonBuffer, BUF_SIZE_COMMON, PSTR("http://hub.amsleser.no/hub/language/%s.json"),
 				strlen(ui.language) > 0 ? ui.language : "en"
 			);
-			HTTPClient http;
-
 			debugI_P(PSTR("Downloading %s"), commonBuffer);
-			#if defined(ESP8266)
-			WiFiClient client;
-			client.setTimeout(5000);
-			if(http.begin(client, (char*) commonBuffer)) {
-			#elif defined(ESP32)
-			if(http.begin((char*) commonBuffer)) {
-			#endif
-				int status = http.GET();
+			HTTPClient* http = httpPool.begin((char*) commonBuffer);
+			if(http != NULL) {
+				int status = http->GET();
 
 				#if defined(ESP32)
 					esp_task_wdt_reset();
@@ -915,7 +926,7 @@ void handleUiLanguage() {
 				if(status == HTTP_CODE_OK) {
 					snprintf_P((char*) commonBuffer, BUF_SIZE_COMMON, PSTR("/translations-%s.json"), ui.language);
 					File file = LittleFS.open((char*) commonBuffer, "w");
-					size_t written = http.writeToStream(&file);
+					size_t written = http->writeToStream(&file);
 					file.close();
 					if(written > 0) {
 						debugD_P(PSTR("Success (%lu written)"), written);
@@ -925,7 +936,7 @@ void handleUiLanguage() {
 				} else {
 					debugW_P(PSTR("Failed to download language '%s'"), ui.language);
 				}
-				http.end();
+				httpPool.end(http);
 			}
 		}
 
@@ -974,9 +985,12 @@ void handleNtpChange() {
 		sntp_servermode_dhcp(ntp.enable && ntp.dhcp ? 1 : 0); // Not implemented on ESP32?
 		ntpEnabled = ntp.enable;
 
+		calendar.setTimezone(tz);
 		ws.setTimezone(tz);
 		ds.setTimezone(tz);
+		ds.setCalendar(&calendar);
 		ea.setTimezone(tz);
+		ea.setCalendar(&calendar);
 	}
 
 	config.ackNtpChange();
@@ -1087,7 +1101,7 @@ void handlePriceService(unsigned long now) {
 		PriceServiceConfig price;
 		if(config.getPriceServiceConfig(price) && price.enabled && strlen(price.area) > 0) {
 			if(ps == NULL) {
-				ps = new PriceService(&Debug);
+				ps = new PriceService(&Debug, &httpPool);
 				ea.setPriceService(ps);
 				ws.setPriceService(ps);
 				#if defined(_CLOUDCONNECTOR_H)
@@ -1322,10 +1336,31 @@ bool readHanPort() {
 	return true;
 }
 
+bool webIdle = false;
+void handleWebIdle() {
+	// Runs while a web handler waits for its client to take more of a long response
+	if(webIdle) return;
+	webIdle = true;
+	try {
+		readHanPort();
+	} catch(const std::exception& e) {
+		debugE_P(PSTR("Exception in readHanPort (%s)"), e.what());
+		meterState.setLastError(METER_ERROR_EXCEPTION);
+	}
+	#if defined(ESP32)
+		esp_task_wdt_reset();
+	#elif defined(ESP8266)
+		ESP.wdtFeed();
+	#endif
+	webIdle = false;
+}
+
 void handleDataSuccess(AmsData* data) {
 	if(!setupMode && !hw.ledBlink(LED_GREEN, 1))
 		hw.ledBlink(LED_INTERNAL, 1);
 
+	snapshot.update();
+
 	if(mqttHandler != NULL) {
 		#if defined(ESP32)
 			esp_task_wdt_reset();
@@ -1364,8 +1399,9 @@ void handleDataSuccess(AmsData* data) {
 
 	bool saveData = false;
 	if(!ds.isHappy(now) && now > FirmwareVersion::BuildEpoch) { // Must use "isHappy()" in case day state gets reset and lastTimestamp is "now"
-		tmElements_t tm, mtm;
-		breakTime(now, tm);
+		calendar.update(now);
+		tmElements_t tm = calendar.getUtc();
+		tmElements_t mtm;
 		breakTime(meterTime, mtm);
 		if(!meterState.isCounterEstimated()) { // Assuming these type of meters report all data all the time
 			if(tm.Minute == 0) {
@@ -1393,6 +1429,7 @@ void handleDataSuccess(AmsData* data) {
 			if(!ds.save()) {
 				debugW_P(PSTR("Unable to save data storage"));
 			}
+			archive.update(&ds);
 		}
 	}
 
@@ -1508,6 +1545,7 @@ void MQTT_connect() {
 			case 0:
 			case 5:
 			case 6:
+			case 7:
 				mqttHandler = new JsonMqttHandler(mqttConfig, &Debug, (char*) commonBuffer, &hw);
 				break;
 			case 1:
@@ -1524,6 +1562,9 @@ void MQTT_connect() {
 				config.getHomeAssistantConfig(haconf);
 				mqttHandler = new HomeAssistantMqttHandler(mqttConfig, &Debug, (char*) commonBuffer, sysConfig.boardType, haconf, &hw);
 				break;
+			case 8:
+				mqttHandler = new ProtobufMqttHandler(mqttConfig, &Debug, (char*) commonBuffer, &hw);
+				break;
 			case 255:
 				mqttHandler = new PassthroughMqttHandler(mqttConfig, &Debug, (char*) commonBuffer);
 				break;
@@ -1532,6 +1573,7 @@ void MQTT_connect() {
 	ws.setMqttHandler(mqttHandler);
 
 	if(mqttHandler != NULL) {
+		mqttHandler->setSnapshot(&snapshot);
 		mqttHandler->connect();
 		mqttHandler->publishSystem(&hw, ps, &ea);
 		if(ps != NULL && ps->getValueForHour(PRICE_DIRECTION_IMPORT, 0) != PRICE_NO_VALUE) {
@@ -1540,6 +1582,200 @@ void MQTT_connect() {
 	}
 }
 
+void configFileDayPlot(char* values) {
+	int i = 0;
+	DayDataPoints day = { 0 };
+	char * pch = strtok (values," ");
+	while (pch != NULL) {
+		double val = configFileDouble(pch);
+		if(day.version < 5) {
+			if(i == 0) {
+				day.version = val;
+			} else if(i == 1) {
+				day.lastMeterReadTime = val;
+			} else if(i == 2) {
+				day.activeImport = val;
+			} else if(i > 2 && i < 27) {
+				day.hImport[i-3] = val / 10;
+			} else if(i == 27) {
+				day.activeExport = val;
+			} else if(i > 27 && i < 52) {
+				day.hExport[i-28] = val / 10;
+			}
+		} else {
+			if(i == 1) {
+				day.lastMeterReadTime = val;
+			} else if(i == 2) {
+				day.activeImport = day.version > 5 ? val * 1000 : val;
+			} else if(i == 3) {
+				day.accuracy = val;
+			} else if(i > 3 && i < 28) {
+				day.hImport[i-4] = val / pow(10, day.accuracy);
+			} else if(i == 28) {
+				day.activeExport = day.version > 5 ? val * 1000 : val;
+			} else if(i > 28 && i < 53) {
+				day.hExport[i-29] = val / pow(10, day.accuracy);
+			}
+		}
+
+		pch = strtok (NULL, " ");
+		i++;
+	}
+	ds.setDayData(day);
+}
+
+void configFileMonthPlot(char* values) {
+	int i = 0;
+	MonthDataPoints month = { 0 };
+	char * pch = strtok (values," ");
+	while (pch != NULL) {
+		double val = configFileDouble(pch);
+		if(month.version < 6) {
+			if(i == 0) {
+				month.version = val;
+			} else if(i == 1) {
+				month.lastMeterReadTime = val;
+			} else if(i == 2) {
+				month.activeImport = val;
+			} else if(i > 2 && i < 34) {
+				month.dImport[i-3] = val / 10;
+			} else if(i == 34) {
+				month.activeExport = val;
+			} else if(i > 34 && i < 66) {
+				month.dExport[i-35] = val / 10;
+			}
+		} else {
+			if(i == 1) {
+				month.lastMeterReadTime = val;
+			} else if(i == 2) {
+				month.activeImport = month.version > 6 ? val * 1000 : val;
+			} else if(i == 3) {
+				month.accuracy = val;
+			} else if(i > 3 && i < 35) {
+				month.dImport[i-4] = val / pow(10, month.accuracy);
+			} else if(i == 35) {
+				month.activeExport = month.version > 6 ? val * 1000 : val;
+			} else if(i > 35 && i < 67) {
+				month.dExport[i-36] = val / pow(10, month.accuracy);
+			}
+		}
+		pch = strtok (NULL, " ");
+		i++;
+	}
+	ds.setMonthData(month);
+}
+
+void configFileEnergyAccounting(char* values) {
+	uint8_t i = 0;
+	EnergyAccountingData ead = { 0, 0, 
+		0, 0, 0, // Cost
+		0, 0, 0, // Income
+		0, 0, 0, // Last month import, export and accuracy
+		0, 0, // Peak 1
+		0, 0, // Peak 2
+		0, 0, // Peak 3
+		0, 0, // Peak 4
+		0, 0 // Peak 5
+	};
+	uint8_t peak = 0;
+	uint64_t totalImport = 0, totalExport = 0;
+	char * pch = strtok (values," ");
+	while (pch != NULL) {
+		if(ead.version < 5) {
+			if(i == 0) {
+				long val = configFileLong(pch);
+				ead.version = val;
+			} else if(i == 1) {
+				long val = configFileLong(pch);
+				ead.month = val;
+			} else if(i == 2) {
+				float val = configFileDouble(pch);
+				if(val > 0.0) {
+					ead.peaks[0] = { 1, (uint16_t) (val*100) };
+				}
+			} else if(i == 3) {
+				float val = configFileDouble(pch);
+				ead.costYesterday = val * 100;
+			} else if(i == 4) {
+				float val = configFileDouble(pch);
+				ead.costThisMonth = val * 100;
+			} else if(i == 5) {
+				float val = configFileDouble(pch);
+				ead.costLastMonth = val * 100;
+			} else if(i >= 6 && i < 18) {
+				uint8_t hour = i-6;					
+				{			
+					long val = configFileLong(pch);
+					ead.peaks[peak].day = val;
+				} 
+				pch = strtok (NULL, " ");
+				i++;
+				{
+					float val = configFileDouble(pch);
+					ead.peaks[peak].value = val * 100;
+				}
+				peak++;
+			}
+		} else {
+			if(i == 1) {
+				long val = configFileLong(pch);
+				ead.month = val;
+			} else if(i == 2) {
+				float val = configFileDouble(pch);
+				ead.costYesterday = val * 100;
+			} else if(i == 3) {
+				float val = configFileDouble(pch);
+				ead.costThisMonth = val * 100;
+			} else if(i == 4) {
+				float val = configFileDouble(pch);
+				ead.costLastMonth = val * 100;
+			} else if(i == 5) {
+				float val = configFileDouble(pch);
+				ead.incomeYesterday= val * 100;
+			} else if(i == 6) {
+				float val = configFileDouble(pch);
+				ead.incomeThisMonth = val * 100;
+			} else if(i == 7) {
+				float val = configFileDouble(pch);
+				ead.incomeLastMonth = val * 100;
+			} else if(i >= 8 && i < 18) {
+				uint8_t hour = i-8;		
+				{			
+					long val = configFileLong(pch);
+					ead.peaks[peak].day = val;
+				} 
+				pch = strtok (NULL, " ");
+				i++;
+				{
+					float val = configFileDouble(pch);
+					ead.peaks[peak].value = val * 100;
+				}
+				peak++;
+			} else if(i == 18) {
+				float val = configFileDouble(pch);
+				totalImport = val * 1000;
+			} else if(i == 19) {
+				float val = configFileDouble(pch);
+				totalExport = val * 1000;
+			}
+		}
+		pch = strtok (NULL, " ");
+		i++;
+	}
+	uint8_t accuracy = 0;
+	uint64_t importUpdate = totalImport, exportUpdate = totalExport;
+	while(importUpdate > UINT32_MAX || exportUpdate > UINT32_MAX) {
+		accuracy++;
+		importUpdate = totalImport / pow(10, accuracy);
+		exportUpdate = totalExport / pow(10, accuracy);
+	}
+	ead.lastMonthImport = importUpdate;
+	ead.lastMonthExport = exportUpdate;
+
+	ead.version = 6;
+	ea.setData(ead);
+}
+
 void configFileParse() {
 	debugD_P(PSTR("Parsing config file"));
 
@@ -1590,423 +1826,76 @@ void configFileParse() {
 				break;
 			}
 		}
-		if(strncmp_P(buf, PSTR("boardType "), 10) == 0) {
-			if(!lSys) { config.getSystemConfig(sys); lSys = true; };
-			sys.boardType = String(buf+10).toInt();
-		} else if(strncmp_P(buf, PSTR("netmode "), 8) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			network.mode = String(buf+8).toInt();
-		} else if(strncmp_P(buf, PSTR("ssid "), 5) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.ssid, buf+5);
-		} else if(strncmp_P(buf, PSTR("psk "), 4) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.psk, buf+4);
-		} else if(strncmp_P(buf, PSTR("ip "), 3) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.ip, buf+3);
-		} else if(strncmp_P(buf, PSTR("gateway "), 8) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.gateway, buf+8);
-		} else if(strncmp_P(buf, PSTR("subnet "), 7) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.subnet, buf+7);
-		} else if(strncmp_P(buf, PSTR("dns1 "), 5) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.dns1, buf+5);
-		} else if(strncmp_P(buf, PSTR("dns2 "), 5) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.dns2, buf+5);
-		} else if(strncmp_P(buf, PSTR("hostname "), 9) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			strcpy(network.hostname, buf+9);
-		} else if(strncmp_P(buf, PSTR("use11b "), 7) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			network.use11b = String(buf+7).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("mdns "), 5) == 0) {
-			if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
-			network.mdns = String(buf+5).toInt() == 1;;
-		} else if(strncmp_P(buf, PSTR("mqttHost "), 9) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			strcpy(mqtt.host, buf+9);
-		} else if(strncmp_P(buf, PSTR("mqttPort "), 9) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			mqtt.port = String(buf+9).toInt();
-		} else if(strncmp_P(buf, PSTR("mqttClientId "), 13) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			strcpy(mqtt.clientId, buf+13);
-		} else if(strncmp_P(buf, PSTR("mqttPublishTopic "), 17) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			strcpy(mqtt.publishTopic, buf+17);
-		} else if(strncmp_P(buf, PSTR("mqttUsername "), 13) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			strcpy(mqtt.username, buf+13);
-		} else if(strncmp_P(buf, PSTR("mqttPassword "), 13) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			strcpy(mqtt.password, buf+13);
-		} else if(strncmp_P(buf, PSTR("mqttPayloadFormat "), 18) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			mqtt.payloadFormat = String(buf+18).toInt();
-		} else if(strncmp_P(buf, PSTR("mqttSsl "), 8) == 0) {
-			if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
-			mqtt.ssl = String(buf+8).toInt() == 1;;
-		} else if(strncmp_P(buf, PSTR("webSecurity "), 12) == 0) {
-			if(!lWeb) { config.getWebConfig(web); lWeb = true; };
-			web.security = String(buf+12).toInt();
-		} else if(strncmp_P(buf, PSTR("webUsername "), 12) == 0) {
-			if(!lWeb) { config.getWebConfig(web); lWeb = true; };
-			strcpy(web.username, buf+12);
-		} else if(strncmp_P(buf, PSTR("webPassword "), 12) == 0) {
-			if(!lWeb) { config.getWebConfig(web); lWeb = true; };
-			strcpy(web.password, buf+12);
-		} else if(strncmp_P(buf, PSTR("meterBaud "), 10) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.baud = String(buf+10).toInt();
-		} else if(strncmp_P(buf, PSTR("meterParity "), 12) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			if(strncmp_P(buf+12, PSTR("7N1"), 3) == 0) meter.parity = 2;
-			if(strncmp_P(buf+12, PSTR("8N1"), 3) == 0) meter.parity = 3;
-			if(strncmp_P(buf+12, PSTR("8N2"), 3) == 0) meter.parity = 7;
-			if(strncmp_P(buf+12, PSTR("7E1"), 3) == 0) meter.parity = 10;
-			if(strncmp_P(buf+12, PSTR("8E1"), 3) == 0) meter.parity = 11;
-		} else if(strncmp_P(buf, PSTR("meterInvert "), 12) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.invert = String(buf+12).toInt() == 1;;
-		} else if(strncmp_P(buf, PSTR("meterDistributionSystem "), 24) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.distributionSystem = String(buf+24).toInt();
-		} else if(strncmp_P(buf, PSTR("meterMainFuse "), 14) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.mainFuse = String(buf+14).toInt();
-		} else if(strncmp_P(buf, PSTR("meterProductionCapacity "), 24) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.productionCapacity = String(buf+24).toInt();
-		} else if(strncmp_P(buf, PSTR("meterEncryptionKey "), 19) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			fromHex(meter.encryptionKey, String(buf+19), 16);
-		} else if(strncmp_P(buf, PSTR("meterAuthenticationKey "), 23) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			fromHex(meter.authenticationKey, String(buf+23), 16);
-		} else if(strncmp_P(buf, PSTR("gpioHanPin "), 11) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.rxPin = String(buf+11).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioHanPinPullup "), 17) == 0) {
-			if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
-			meter.rxPinPullup = String(buf+17).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("gpioApPin "), 10) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.apPin = String(buf+10).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioLedPin "), 11) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.ledPin = String(buf+11).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioLedInverted "), 16) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.ledInverted = String(buf+16).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("gpioLedPinRed "), 14) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.ledPinRed = String(buf+14).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioLedPinGreen "), 16) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.ledPinGreen = String(buf+16).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioLedPinBlue "), 15) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.ledPinBlue = String(buf+15).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioLedRgbInverted "), 19) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.ledRgbInverted = String(buf+19).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("gpioTempSensorPin "), 18) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.tempSensorPin = String(buf+18).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioTempAnalogSensorPin "), 24) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.tempAnalogSensorPin = String(buf+24).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioVccPin "), 11) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.vccPin = String(buf+11).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioVccOffset "), 14) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.vccOffset = String(buf+14).toFloat() * 100;
-		} else if(strncmp_P(buf, PSTR("gpioVccMultiplier "), 18) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.vccMultiplier = String(buf+18).toFloat() * 1000;
-		} else if(strncmp_P(buf, PSTR("gpioVccBootLimit "), 17) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.vccBootLimit = String(buf+17).toFloat() * 10;
-		} else if(strncmp_P(buf, PSTR("gpioVccResistorGnd "), 19) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.vccResistorGnd = String(buf+19).toInt();
-		} else if(strncmp_P(buf, PSTR("gpioVccResistorVcc "), 19) == 0) {
-			if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
-			gpio.vccResistorVcc = String(buf+19).toInt();
-		} else if(strncmp_P(buf, PSTR("domoticzElidx "), 14) == 0) {
-			if(!lDomo) { config.getDomoticzConfig(domo); lDomo = true; };
-			domo.elidx = String(buf+14).toInt();
-		} else if(strncmp_P(buf, PSTR("domoticzVl1idx "), 15) == 0) {
-			if(!lDomo) { config.getDomoticzConfig(domo); lDomo = true; };
-			domo.vl1idx = String(buf+15).toInt();
-		} else if(strncmp_P(buf, PSTR("domoticzVl2idx "), 15) == 0) {
-			if(!lDomo) { config.getDomoticzConfig(domo); lDomo = true; };
-			domo.vl2idx = String(buf+15).toInt();
-		} else if(strncmp_P(buf, PSTR("domoticzVl3idx "), 15) == 0) {
-			if(!lDomo) { config.getDomoticzConfig(domo); lDomo = true; };
-			domo.vl3idx = String(buf+15).toInt();
-		} else if(strncmp_P(buf, PSTR("domoticzCl1idx "), 15) == 0) {
-			if(!lDomo) { config.getDomoticzConfig(domo); lDomo = true; };
-			domo.cl1idx = String(buf+15).toInt();
-		} else if(strncmp_P(buf, PSTR("homeAssistantDiscoveryPrefix "), 29) == 0) {
-			if(!lHa) { config.getHomeAssistantConfig(haconf); lHa = true; };
-			strcpy(haconf.discoveryPrefix, buf+29);
-		} else if(strncmp_P(buf, PSTR("homeAssistantDiscoveryHostname "), 31) == 0) {
-			if(!lHa) { config.getHomeAssistantConfig(haconf); lHa = true; };
-			strcpy(haconf.discoveryHostname, buf+31);
-		} else if(strncmp_P(buf, PSTR("homeAssistantDiscoveryNameTag "), 30) == 0) {
-			if(!lHa) { config.getHomeAssistantConfig(haconf); lHa = true; };
-			strcpy(haconf.discoveryNameTag, buf+30);
-		} else if(strncmp_P(buf, PSTR("ntpEnable "), 10) == 0) {
-			if(!lNtp) { config.getNtpConfig(ntp); lNtp = true; };
-			ntp.enable = String(buf+10).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("ntpDhcp "), 8) == 0) {
-			if(!lNtp) { config.getNtpConfig(ntp); lNtp = true; };
-			ntp.dhcp = String(buf+8).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("ntpServer "), 10) == 0) {
-			if(!lNtp) { config.getNtpConfig(ntp); lNtp = true; };
-			strcpy(ntp.server, buf+10);
-		} else if(strncmp_P(buf, PSTR("ntpTimezone "), 12) == 0) {
-			if(!lNtp) { config.getNtpConfig(ntp); lNtp = true; };
-			strcpy(ntp.timezone, buf+12);
-		} else if(strncmp_P(buf, PSTR("entsoeToken "), 12) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			strcpy(price.entsoeToken, buf+12);
-		} else if(strncmp_P(buf, PSTR("entsoeArea "), 11) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			strcpy(price.area, buf+11);
-		} else if(strncmp_P(buf, PSTR("entsoeCurrency "), 15) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			strcpy(price.currency, buf+15);
-		} else if(strncmp_P(buf, PSTR("entsoeMultiplier "), 17) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			price.unused1 = String(buf+17).toFloat() * 1000;
-		} else if(strncmp_P(buf, PSTR("entsoeFixedPrice "), 17) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			price.unused2 = String(buf+17).toFloat() * 1000;
-		} else if(strncmp_P(buf, PSTR("priceEnabled "), 13) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			price.enabled = String(buf+13).toInt() == 1;
-		} else if(strncmp_P(buf, PSTR("priceEntsoeToken "), 17) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			strcpy(price.entsoeToken, buf+17);
-		} else if(strncmp_P(buf, PSTR("priceArea "), 10) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			strcpy(price.area, buf+10);
-		} else if(strncmp_P(buf, PSTR("priceCurrency "), 14) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			strcpy(price.currency, buf+14);
-		} else if(strncmp_P(buf, PSTR("priceMultiplier "), 16) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			price.unused1 = String(buf+16).toFloat() * 1000;
-		} else if(strncmp_P(buf, PSTR("priceFixedPrice "), 16) == 0) {
-			if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
-			price.unused2 = String(buf+16).toFloat() * 1000;
-		} else if(strncmp_P(buf, PSTR("thresholds "), 11) == 0) {
-			if(!lEac) { config.getEnergyAccountingConfig(eac); lEac = true; };
-			int i = 0;
-			char * pch = strtok (buf+11," ");
-			while (pch != NULL && i < 10) {
-				eac.thresholds[i++] = String(pch).toInt();
-				pch = strtok (NULL, " ");
-			}
-			eac.hours = String(pch).toInt();
-		} else if(strncmp_P(buf, PSTR("dayplot "), 8) == 0) {
-			int i = 0;
-			DayDataPoints day = { 0 };
-			char * pch = strtok (buf+8," ");
-			while (pch != NULL) {
-				double val = String(pch).toDouble();
-				if(day.version < 5) {
-					if(i == 0) {
-						day.version = val;
-					} else if(i == 1) {
-						day.lastMeterReadTime = val;
-					} else if(i == 2) {
-						day.activeImport = val;
-					} else if(i > 2 && i < 27) {
-						day.hImport[i-3] = val / 10;
-					} else if(i == 27) {
-						day.activeExport = val;
-					} else if(i > 27 && i < 52) {
-						day.hExport[i-28] = val / 10;
-					}
-				} else {
-					if(i == 1) {
-						day.lastMeterReadTime = val;
-					} else if(i == 2) {
-						day.activeImport = day.version > 5 ? val * 1000 : val;
-					} else if(i == 3) {
-						day.accuracy = val;
-					} else if(i > 3 && i < 28) {
-						day.hImport[i-4] = val / pow(10, day.accuracy);
-					} else if(i == 28) {
-						day.activeExport = day.version > 5 ? val * 1000 : val;
-					} else if(i > 28 && i < 53) {
-						day.hExport[i-29] = val / pow(10, day.accuracy);
-					}
-				}
-
-				pch = strtok (NULL, " ");
-				i++;
-			}
-			ds.setDayData(day);
-			sDs = true;
-		} else if(strncmp_P(buf, PSTR("monthplot "), 10) == 0) {
-			int i = 0;
-			MonthDataPoints month = { 0 };
-			char * pch = strtok (buf+10," ");
-			while (pch != NULL) {
-				double val = String(pch).toDouble();
-				if(month.version < 6) {
-					if(i == 0) {
-						month.version = val;
-					} else if(i == 1) {
-						month.lastMeterReadTime = val;
-					} else if(i == 2) {
-						month.activeImport = val;
-					} else if(i > 2 && i < 34) {
-						month.dImport[i-3] = val / 10;
-					} else if(i == 34) {
-						month.activeExport = val;
-					} else if(i > 34 && i < 66) {
-						month.dExport[i-35] = val / 10;
-					}
-				} else {
-					if(i == 1) {
-						month.lastMeterReadTime = val;
-					} else if(i == 2) {
-						month.activeImport = month.version > 6 ? val * 1000 : val;
-					} else if(i == 3) {
-						month.accuracy = val;
-					} else if(i > 3 && i < 35) {
-						month.dImport[i-4] = val / pow(10, month.accuracy);
-					} else if(i == 35) {
-						month.activeExport = month.version > 6 ? val * 1000 : val;
-					} else if(i > 35 && i < 67) {
-						month.dExport[i-36] = val / pow(10, month.accuracy);
-					}
-				}
-				pch = strtok (NULL, " ");
-				i++;
+		char* value = strchr(buf, ' ');
+		ConfigFileKeyword keyword;
+		if(value != NULL) {
+			*value++ = '\0';
+		}
+		if(value != NULL && configFileKeyword(buf, keyword)) {
+			uint8_t* target = NULL;
+			switch(keyword.target) {
+				case ConfigFileSystem:
+					if(!lSys) { config.getSystemConfig(sys); lSys = true; };
+					target = (uint8_t*) &sys;
+					break;
+				case ConfigFileNetwork:
+					if(!lNetwork) { config.getNetworkConfig(network); lNetwork = true; };
+					target = (uint8_t*) &network;
+					break;
+				case ConfigFileMqtt:
+					if(!lMqtt) { config.getMqttConfig(mqtt); lMqtt = true; };
+					target = (uint8_t*) &mqtt;
+					break;
+				case ConfigFileWeb:
+					if(!lWeb) { config.getWebConfig(web); lWeb = true; };
+					target = (uint8_t*) &web;
+					break;
+				case ConfigFileMeter:
+					if(!lMeter) { config.getMeterConfig(meter); lMeter = true; };
+					target = (uint8_t*) &meter;
+					break;
+				case ConfigFileGpio:
+					if(!lGpio) { config.getGpioConfig(gpio); lGpio = true; };
+					target = (uint8_t*) &gpio;
+					break;
+				case ConfigFileDomoticz:
+					if(!lDomo) { config.getDomoticzConfig(domo); lDomo = true; };
+					target = (uint8_t*) &domo;
+					break;
+				case ConfigFileHomeAssistant:
+					if(!lHa) { config.getHomeAssistantConfig(haconf); lHa = true; };
+					target = (uint8_t*) &haconf;
+					break;
+				case ConfigFileNtp:
+					if(!lNtp) { config.getNtpConfig(ntp); lNtp = true; };
+					target = (uint8_t*) &ntp;
+					break;
+				case ConfigFilePrice:
+					if(!lPrice) { config.getPriceServiceConfig(price); lPrice = true; };
+					target = (uint8_t*) &price;
+					break;
+				case ConfigFileEnergyAccounting:
+					if(!lEac) { config.getEnergyAccountingConfig(eac); lEac = true; };
+					target = (uint8_t*) &eac;
+					break;
 			}
-			ds.setMonthData(month);
-			sDs = true;
-		} else if(strncmp_P(buf, PSTR("energyaccounting "), 17) == 0) {
-			uint8_t i = 0;
-			EnergyAccountingData ead = { 0, 0, 
-                0, 0, 0, // Cost
-                0, 0, 0, // Income
-                0, 0, 0, // Last month import, export and accuracy
-                0, 0, // Peak 1
-                0, 0, // Peak 2
-                0, 0, // Peak 3
-                0, 0, // Peak 4
-                0, 0 // Peak 5
-            };
-			uint8_t peak = 0;
-			uint64_t totalImport = 0, totalExport = 0;
-			char * pch = strtok (buf+17," ");
-			while (pch != NULL) {
-				if(ead.version < 5) {
-					if(i == 0) {
-						long val = String(pch).toInt();
-						ead.version = val;
-					} else if(i == 1) {
-						long val = String(pch).toInt();
-						ead.month = val;
-					} else if(i == 2) {
-						float val = String(pch).toFloat();
-						if(val > 0.0) {
-							ead.peaks[0] = { 1, (uint16_t) (val*100) };
-						}
-					} else if(i == 3) {
-						float val = String(pch).toFloat();
-						ead.costYesterday = val * 100;
-					} else if(i == 4) {
-						float val = String(pch).toFloat();
-						ead.costThisMonth = val * 100;
-					} else if(i == 5) {
-						float val = String(pch).toFloat();
-						ead.costLastMonth = val * 100;
-					} else if(i >= 6 && i < 18) {
-						uint8_t hour = i-6;					
-						{			
-							long val = String(pch).toInt();
-							ead.peaks[peak].day = val;
-						} 
-						pch = strtok (NULL, " ");
-						i++;
-						{
-							float val = String(pch).toFloat();
-							ead.peaks[peak].value = val * 100;
-						}
-						peak++;
-					}
-				} else {
-					if(i == 1) {
-						long val = String(pch).toInt();
-						ead.month = val;
-					} else if(i == 2) {
-						float val = String(pch).toFloat();
-						ead.costYesterday = val * 100;
-					} else if(i == 3) {
-						float val = String(pch).toFloat();
-						ead.costThisMonth = val * 100;
-					} else if(i == 4) {
-						float val = String(pch).toFloat();
-						ead.costLastMonth = val * 100;
-					} else if(i == 5) {
-						float val = String(pch).toFloat();
-						ead.incomeYesterday= val * 100;
-					} else if(i == 6) {
-						float val = String(pch).toFloat();
-						ead.incomeThisMonth = val * 100;
-					} else if(i == 7) {
-						float val = String(pch).toFloat();
-						ead.incomeLastMonth = val * 100;
-					} else if(i >= 8 && i < 18) {
-						uint8_t hour = i-8;		
-						{			
-							long val = String(pch).toInt();
-							ead.peaks[peak].day = val;
-						} 
-						pch = strtok (NULL, " ");
-						i++;
-						{
-							float val = String(pch).toFloat();
-							ead.peaks[peak].value = val * 100;
-						}
-						peak++;
-					} else if(i == 18) {
-						float val = String(pch).toFloat();
-						totalImport = val * 1000;
-					} else if(i == 19) {
-						float val = String(pch).toFloat();
-						totalExport = val * 1000;
-					}
+			// Plots and accounting data are not config fields and are handled here
+			if(!configFileSetValue(keyword, target, value)) {
+				switch(keyword.type) {
+					case ConfigFileDayPlot:
+						configFileDayPlot(value);
+						sDs = true;
+						break;
+					case ConfigFileMonthPlot:
+						configFileMonthPlot(value);
+						sDs = true;
+						break;
+					case ConfigFileEnergyAccountingData:
+						configFileEnergyAccounting(value);
+						sEa = true;
+						break;
 				}
-				pch = strtok (NULL, " ");
-				i++;
 			}
-            uint8_t accuracy = 0;
-            uint64_t importUpdate = totalImport, exportUpdate = totalExport;
-			while(importUpdate > UINT32_MAX || exportUpdate > UINT32_MAX) {
-                accuracy++;
-                importUpdate = totalImport / pow(10, accuracy);
-                exportUpdate = totalExport / pow(10, accuracy);
-            }
-            ead.lastMonthImport = importUpdate;
-            ead.lastMonthExport = exportUpdate;
-
-			ead.version = 6;
-			ea.setData(ead);
-			sEa = true;
 		}
 		memset(buf, 0, 1024);
 	}
@@ -2030,6 +1919,7 @@ void configFileParse() {
 
 	debugI_P(PSTR("Saving configuration now..."));
 	Serial.flush();
+	config.beginBatch();
 	if(lSys) config.setSystemConfig(sys);
 	if(lNetwork) config.setNetworkConfig(network);
 	if(lMqtt) config.setMqttConfig(mqtt);
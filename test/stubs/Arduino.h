@@ -0,0 +1,187 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// Host stand-in for the parts of the Arduino core used by the libraries under test
+
+#ifndef _ARDUINO_STUB_H
+#define _ARDUINO_STUB_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+#define vsnprintf_P vsnprintf
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strstr_P strstr
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define memcpy_P memcpy
+
+#define HEX 16
+#define PI 3.1415926535897932384626433832795
+
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+class String : public std::string {
+public:
+    String() {}
+    String(const char* str) : std::string(str) {}
+    String(const std::string& str) : std::string(str) {}
+    String(char c) : std::string(1, c) {}
+    String(unsigned char value, unsigned char base = 10) : String((unsigned long) value, base) {}
+    String(int value, unsigned char base = 10) : String((long) value, base) {}
+    String(unsigned int value, unsigned char base = 10) : String((unsigned long) value, base) {}
+    String(long value, unsigned char base = 10) {
+        char buf[34];
+        snprintf(buf, sizeof(buf), base == 16 ? "%lx" : "%ld", value);
+        assign(buf);
+    }
+    String(unsigned long value, unsigned char base = 10) {
+        char buf[34];
+        snprintf(buf, sizeof(buf), base == 16 ? "%lx" : "%lu", value);
+        assign(buf);
+    }
+    String(float value, unsigned int decimalPlaces = 2) : String((double) value, decimalPlaces) {}
+    String(double value, unsigned int decimalPlaces = 2);
+    bool isEmpty() const { return empty(); }
+    bool equals(const String& other) const { return *this == other; }
+    bool startsWith(const String& prefix) const { return compare(0, prefix.size(), prefix) == 0; }
+    String substring(size_t from, size_t to) const { return String(substr(from, to - from)); }
+    void toUpperCase() { for(char& c : *this) c = toupper(c); }
+    void replace(const String& find, const String& replace) {
+        if(find.empty()) return;
+        for(size_t pos = 0; (pos = this->find(find, pos)) != std::string::npos; pos += replace.size()) {
+            std::string::replace(pos, find.size(), replace);
+        }
+    }
+};
+
+// The core's dtostrf, which String(value, decimals) goes through. It rounds by adding half of the
+// last decimal and then peels off one digit at a time in floating point.
+inline char* dtostrf(double number, signed char width, unsigned char prec, char* s) {
+    if(isnan(number)) {
+        strcpy(s, "nan");
+        return s;
+    }
+    if(isinf(number)) {
+        strcpy(s, "inf");
+        return s;
+    }
+    char* out = s;
+    int fillme = width;
+    if(prec > 0) fillme -= (prec + 1);
+    bool negative = false;
+    if(number < 0.0) {
+        negative = true;
+        fillme--;
+        number = -number;
+    }
+    double rounding = 2.0;
+    for(uint8_t i = 0; i < prec; ++i) rounding *= 10.0;
+    rounding = 1.0 / rounding;
+    number += rounding;
+    double tenpow = 1.0;
+    int digitcount = 1;
+    while(number >= 10.0 * tenpow) {
+        tenpow *= 10.0;
+        digitcount++;
+    }
+    number /= tenpow;
+    fillme -= digitcount;
+    while(fillme-- > 0) *out++ = ' ';
+    if(negative) *out++ = '-';
+    digitcount += prec;
+    while(digitcount-- > 0) {
+        int8_t digit = (int8_t) number;
+        if(digit > 9) digit = 9;
+        *out++ = (char) ('0' | digit);
+        if(digitcount == prec && prec > 0) *out++ = '.';
+        number -= digit;
+        number *= 10.0;
+    }
+    *out = 0;
+    return s;
+}
+
+inline String::String(double value, unsigned int decimalPlaces) {
+    char buf[64];
+    assign(dtostrf(value, decimalPlaces + 2, decimalPlaces, buf));
+}
+
+#define F(s) (s)
+#define FPSTR(p) ((const char*) (p))
+
+class IPAddress {
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{ a, b, c, d } {}
+    uint8_t operator[](int index) const { return bytes[index]; }
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+        return buf;
+    }
+
+private:
+    uint8_t bytes[4] = { 0, 0, 0, 0 };
+};
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 200000; }
+};
+inline EspClass ESP;
+
+class Print;
+
+// Debug output from the libraries is dropped. Clients and files that carry data override write().
+class Stream {
+public:
+    virtual ~Stream() {}
+    virtual size_t write(const uint8_t* buf, size_t size) { return size; }
+    size_t write(const char* str) { return write((const uint8_t*) str, strlen(str)); }
+    void print(const char* str) {}
+    void print(long value, int base = 10) {}
+    void println(const char* str = "") {}
+    int printf(const char* format, ...) { return 0; }
+};
+#define printf_P printf
+
+class SerialStub : public Stream {};
+inline SerialStub Serial;
+
+// Tests move time forward by assigning stubMillis
+inline uint32_t stubMillis = 0;
+inline unsigned long millis() { return stubMillis; }
+inline unsigned long micros() { return stubMillis * 1000UL; }
+inline void yield() {}
+inline void delay(unsigned long ms) { stubMillis += ms; }
+
+#endif
@@ -0,0 +1,7 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// Host stand-in, the tests only use the config structs declared next to the EEPROM layout
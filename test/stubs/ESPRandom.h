@@ -0,0 +1,35 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _ESPRANDOM_STUB_H
+#define _ESPRANDOM_STUB_H
+
+#include "Arduino.h"
+
+class ESPRandom {
+public:
+    static void uuid4(uint8_t* buffer) {
+        for(uint8_t i = 0; i < 16; i++) buffer[i] = rand();
+        buffer[6] = (buffer[6] & 0x0F) | 0x40;
+        buffer[8] = (buffer[8] & 0x3F) | 0x80;
+    }
+
+    static bool isValidV4Uuid(const uint8_t* buffer) {
+        return (buffer[6] & 0xF0) == 0x40 && (buffer[8] & 0xC0) == 0x80;
+    }
+
+    static String uuidToString(const uint8_t* buffer) {
+        char str[37];
+        char* p = str;
+        for(uint8_t i = 0; i < 16; i++) {
+            if(i == 4 || i == 6 || i == 8 || i == 10) *p++ = '-';
+            p += sprintf(p, "%02x", buffer[i]);
+        }
+        return str;
+    }
+};
+
+#endif
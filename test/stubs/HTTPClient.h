@@ -0,0 +1,149 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// Keeps the connection handling of the ESP32 core's HTTPClient: a connected client is reused,
+// and the connection is closed after the request unless both sides agreed on keep-alive
+
+#ifndef _HTTPCLIENT_STUB_H
+#define _HTTPCLIENT_STUB_H
+
+#include "WiFi.h"
+
+typedef enum {
+    HTTPC_DISABLE_FOLLOW_REDIRECTS,
+    HTTPC_STRICT_FOLLOW_REDIRECTS,
+    HTTPC_FORCE_FOLLOW_REDIRECTS
+} followRedirects_t;
+
+typedef enum {
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_SERVICE_UNAVAILABLE = 503
+} t_http_codes;
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient {
+public:
+    void setFollowRedirects(followRedirects_t follow) {}
+    void setReuse(bool reuse) { this->reuse = reuse; }
+    void setTimeout(uint16_t timeout) {}
+    void setUserAgent(const String& userAgent) {}
+    void useHTTP10(bool http10) {
+        this->http10 = http10;
+        reuse = !http10;
+    }
+
+    bool begin(WiFiClient& client, String url) {
+        this->client = &client;
+        size_t scheme = url.find("://");
+        if(scheme == std::string::npos) return false;
+        size_t slash = url.find('/', scheme + 3);
+        std::string authority = url.substr(scheme + 3, slash == std::string::npos ? std::string::npos : slash - scheme - 3);
+        path = slash == std::string::npos ? "/" : url.substr(slash);
+        size_t colon = authority.find(':');
+        host = authority.substr(0, colon);
+        port = colon == std::string::npos ? (url.compare(0, 5, "https") == 0 ? 443 : 80) : atoi(authority.c_str() + colon + 1);
+        return true;
+    }
+
+    void addHeader(const String& name, const String& value) {
+        headers += name + ": " + value + "\r\n";
+    }
+
+    int GET() { return sendRequest("GET"); }
+    int POST(uint8_t* payload, size_t size) { return sendRequest("POST", payload, size); }
+    int POST(const String& payload) { return sendRequest("POST", (uint8_t*) payload.data(), payload.size()); }
+
+    int sendRequest(const char* type, uint8_t* payload = NULL, size_t size = 0) {
+        body.clear();
+        location.clear();
+        if(!client->connected() && !client->connect(host.c_str(), port, 5000)) {
+            headers.clear();
+            return HTTPC_ERROR_CONNECTION_REFUSED;
+        }
+        std::string request = std::string(type) + " " + path + (http10 ? " HTTP/1.0" : " HTTP/1.1") + "\r\nHost: " + host
+            + "\r\nConnection: " + (reuse ? "keep-alive" : "close") + "\r\n" + headers;
+        if(payload != NULL) request += "Content-Length: " + std::to_string(size) + "\r\n";
+        request += "\r\n";
+        headers.clear();
+        if(client->write((const uint8_t*) request.data(), request.size()) != request.size()) {
+            return HTTPC_ERROR_SEND_HEADER_FAILED;
+        }
+        if(payload != NULL && client->write(payload, size) != size) {
+            return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+        }
+
+        std::string line;
+        int code = 0;
+        size_t length = 0;
+        canReuse = reuse;
+        while(readLine(line)) {
+            if(line.empty()) {
+                if(code == 0) return HTTPC_ERROR_READ_TIMEOUT;
+                uint8_t buf[256];
+                while(body.size() < length) {
+                    int n = client->read(buf, std::min(sizeof(buf), length - body.size()));
+                    if(n < 0) return HTTPC_ERROR_READ_TIMEOUT;
+                    body.append((const char*) buf, n);
+                }
+                return code;
+            }
+            if(code == 0) {
+                if(line.compare(0, 8, "HTTP/1.0") == 0) canReuse = false;
+                code = atoi(line.c_str() + 9);
+            } else if(line.compare(0, 16, "Content-Length: ") == 0) {
+                length = atoi(line.c_str() + 16);
+            } else if(line == "Connection: close") {
+                canReuse = false;
+            } else if(line.compare(0, 10, "Location: ") == 0) {
+                location = line.substr(10);
+            }
+        }
+        return HTTPC_ERROR_READ_TIMEOUT;
+    }
+
+    String getString() { return body; }
+    static String errorToString(int error) {
+        switch(error) {
+            case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+            case HTTPC_ERROR_SEND_HEADER_FAILED: return "send header failed";
+            case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return "send payload failed";
+            case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+        }
+        return String();
+    }
+    String getLocation() { return location; }
+
+    void end() {
+        if(client != NULL && client->connected() && !(reuse && canReuse)) {
+            client->stop();
+        }
+    }
+
+private:
+    WiFiClient* client = NULL;
+    std::string host, path;
+    uint16_t port = 0;
+    bool reuse = true;
+    bool canReuse = false;
+    bool http10 = false;
+    String body, location, headers;
+
+    bool readLine(std::string& line) {
+        line.clear();
+        uint8_t c;
+        while(client->read(&c, 1) == 1) {
+            if(c == '\n') return true;
+            if(c != '\r') line += (char) c;
+        }
+        return false;
+    }
+};
+
+#endif
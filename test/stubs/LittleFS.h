@@ -0,0 +1,93 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// In-memory stand-in for LittleFS. writeBudget limits how many more bytes can be written, to
+// simulate a power cut in the middle of a write
+
+#ifndef _LITTLEFS_STUB_H
+#define _LITTLEFS_STUB_H
+
+#include "Arduino.h"
+#include <map>
+#include <string>
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+class File : public Stream {
+public:
+    File() {}
+    File(std::string* data, size_t* budget, size_t pos = 0) : data(data), budget(budget), pos(pos) {}
+
+    operator bool() const { return data != NULL; }
+
+    size_t readBytes(char* buf, size_t length) {
+        size_t n = std::min(length, data->size() - std::min(pos, data->size()));
+        memcpy(buf, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+    size_t read(uint8_t* buf, size_t length) { return readBytes((char*) buf, length); }
+    int available() { return pos < data->size() ? data->size() - pos : 0; }
+    bool seek(size_t to, SeekMode mode = SeekSet) {
+        if(mode == SeekCur) to += pos;
+        if(mode == SeekEnd) to += data->size();
+        if(to > data->size()) return false;
+        pos = to;
+        return true;
+    }
+    size_t position() { return pos; }
+    size_t size() { return data->size(); }
+    size_t write(const uint8_t* buf, size_t length) {
+        size_t n = std::min(length, *budget);
+        *budget -= n;
+        data->replace(pos, std::min(n, data->size() - pos), (const char*) buf, n);
+        pos += n;
+        return n;
+    }
+    void close() { data = NULL; }
+
+private:
+    std::string* data = NULL;
+    size_t* budget = NULL;
+    size_t pos = 0;
+};
+
+class LittleFSStub {
+public:
+    std::map<std::string, std::string> files;
+    size_t writeBudget = SIZE_MAX;
+    bool mountable = true;
+
+    bool begin() { return mountable; }
+    void end() {}
+    bool exists(const char* path) { return files.count(path) > 0; }
+    File open(const char* path, const char* mode) {
+        if(mode[0] == 'r' && !exists(path)) return File();
+        if(mode[0] == 'w') files[path].clear();
+        std::string* data = &files[path];
+        return File(data, &writeBudget, mode[0] == 'a' ? data->size() : 0);
+    }
+    bool remove(const char* path) { return files.erase(path) > 0; }
+    bool rename(const char* from, const char* to) {
+        if(!exists(from)) return false;
+        files[to] = files[from];
+        files.erase(from);
+        return true;
+    }
+    void reset() {
+        files.clear();
+        writeBudget = SIZE_MAX;
+        mountable = true;
+    }
+};
+
+inline LittleFSStub LittleFS;
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+// MQTTClient that is always connected and keeps what is published in fixed buffers, so recording
+// a message does not touch the heap
+
+#ifndef _MQTT_STUB_H
+#define _MQTT_STUB_H
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <functional>
+
+typedef enum {
+    LWMQTT_SUCCESS = 0,
+    LWMQTT_BUFFER_TOO_SHORT = -1,
+    LWMQTT_NETWORK_FAILED_CONNECT = -3
+} lwmqtt_err_t;
+
+typedef std::function<void(String &topic, String &payload)> MQTTClientCallbackSimpleFunction;
+
+#define MQTT_STUB_MESSAGES 256
+
+struct MqttStubMessage {
+    char topic[128];
+    char payload[2048];
+    bool retained;
+};
+
+// Every client writes here, tests read it back and reset mqttStubCount between cases
+inline MqttStubMessage mqttStubMessages[MQTT_STUB_MESSAGES];
+inline uint16_t mqttStubCount = 0;
+
+class MQTTClient {
+public:
+    explicit MQTTClient(int bufSize = 128) {}
+
+    void begin(const char hostname[], int port, WiFiClient& client) {}
+    void setWill(const char topic[], const char payload[], bool retained, int qos) {}
+    void dropOverflow(bool enabled) {}
+    void onMessage(MQTTClientCallbackSimpleFunction cb) {}
+
+    bool connect(const char clientId[]) { return isConnected = true; }
+    bool connect(const char clientId[], const char username[], const char password[]) { return isConnected = true; }
+    bool disconnect() {
+        isConnected = false;
+        return true;
+    }
+
+    bool publish(const String& topic, const String& payload) { return publish(topic.c_str(), payload.c_str(), false, 0); }
+    bool publish(const String& topic, const String& payload, bool retained, int qos) { return publish(topic.c_str(), payload.c_str(), retained, qos); }
+    bool publish(const char topic[], const String& payload) { return publish(topic, payload.c_str(), false, 0); }
+    bool publish(const char topic[], const String& payload, bool retained, int qos) { return publish(topic, payload.c_str(), retained, qos); }
+    bool publish(const char topic[], const char payload[]) { return publish(topic, payload, false, 0); }
+    bool publish(const char topic[], const char payload[], bool retained, int qos) {
+        if(!isConnected) return false;
+        MqttStubMessage& msg = mqttStubMessages[mqttStubCount % MQTT_STUB_MESSAGES];
+        strncpy(msg.topic, topic, sizeof(msg.topic) - 1);
+        msg.topic[sizeof(msg.topic) - 1] = '\0';
+        strncpy(msg.payload, payload, sizeof(msg.payload) - 1);
+        msg.payload[sizeof(msg.payload) - 1] = '\0';
+        msg.retained = retained;
+        mqttStubCount++;
+        return true;
+    }
+
+    bool subscribe(const char topic[]) { return isConnected; }
+    bool subscribe(const String& topic) { return isConnected; }
+    bool unsubscribe(const char topic[]) { return isConnected; }
+    bool unsubscribe(const String& topic) { return isConnected; }
+
+    bool loop() { return isConnected; }
+    bool connected() { return isConnected; }
+    lwmqtt_err_t lastError() { return LWMQTT_SUCCESS; }
+
+private:
+    bool isConnected = false;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// The parts of the Time library the firmware uses, on top of the C library's UTC conversions
+
+#ifndef _TIMELIB_STUB_H
+#define _TIMELIB_STUB_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    uint8_t Second;
+    uint8_t Minute;
+    uint8_t Hour;
+    uint8_t Wday; // Sunday is 1
+    uint8_t Day;
+    uint8_t Month;
+    uint8_t Year; // Offset from 1970
+} tmElements_t;
+
+#define SECS_PER_MIN ((time_t) 60UL)
+#define SECS_PER_HOUR ((time_t) 3600UL)
+#define SECS_PER_DAY ((time_t) 86400UL)
+#define previousMidnight(t) (((t) / SECS_PER_DAY) * SECS_PER_DAY)
+
+inline int weekday(time_t t) {
+    return ((t / SECS_PER_DAY + 4) % 7) + 1;
+}
+
+inline void breakTime(time_t t, tmElements_t& tm) {
+    struct tm g;
+    gmtime_r(&t, &g);
+    tm.Second = g.tm_sec;
+    tm.Minute = g.tm_min;
+    tm.Hour = g.tm_hour;
+    tm.Wday = g.tm_wday + 1;
+    tm.Day = g.tm_mday;
+    tm.Month = g.tm_mon + 1;
+    tm.Year = g.tm_year - 70;
+}
+
+inline time_t makeTime(const tmElements_t& tm) {
+    struct tm g = {};
+    g.tm_sec = tm.Second;
+    g.tm_min = tm.Minute;
+    g.tm_hour = tm.Hour;
+    g.tm_mday = tm.Day;
+    g.tm_mon = tm.Month - 1;
+    g.tm_year = tm.Year + 70;
+    return timegm(&g);
+}
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// Same rules and conversions as the Timezone library. The default constructor gives UTC, which is
+// what the libraries under test use unless a test sets up a zone with daylight saving
+
+#ifndef _TIMEZONE_STUB_H
+#define _TIMEZONE_STUB_H
+
+#include "TimeLib.h"
+
+enum week_t { Last, First, Second, Third, Fourth };
+enum dow_t { Sun = 1, Mon, Tue, Wed, Thu, Fri, Sat };
+enum month_t { Jan = 1, Feb, Mar, Apr, May, Jun, Jul, Aug, Sep, Oct, Nov, Dec };
+
+struct TimeChangeRule {
+    char abbrev[6];
+    uint8_t week;
+    uint8_t dow;
+    uint8_t month;
+    uint8_t hour; // Local time the change happens at
+    int offset; // Minutes from UTC
+};
+
+class Timezone {
+public:
+    Timezone() : dst({ "UTC", Last, Sun, Mar, 1, 0 }), std({ "UTC", Last, Sun, Oct, 1, 0 }) {}
+    Timezone(TimeChangeRule dst, TimeChangeRule std) : dst(dst), std(std) {}
+
+    time_t toLocal(time_t utc) {
+        calcTimeChanges(utc);
+        return utc + (utcIsDST(utc) ? dst.offset : std.offset) * SECS_PER_MIN;
+    }
+
+    time_t toUTC(time_t local) {
+        calcTimeChanges(local);
+        return local - (locIsDST(local) ? dst.offset : std.offset) * SECS_PER_MIN;
+    }
+
+    bool utcIsDST(time_t utc) {
+        if(dst.offset == std.offset) return false;
+        calcTimeChanges(utc);
+        if(stdUTC > dstUTC) return utc >= dstUTC && utc < stdUTC;
+        return !(utc >= stdUTC && utc < dstUTC);
+    }
+
+    bool locIsDST(time_t local) {
+        if(dst.offset == std.offset) return false;
+        calcTimeChanges(local);
+        if(stdLoc > dstLoc) return local >= dstLoc && local < stdLoc;
+        return !(local >= stdLoc && local < dstLoc);
+    }
+
+private:
+    TimeChangeRule dst, std;
+    int year = 0;
+    time_t dstUTC = 0, stdUTC = 0, dstLoc = 0, stdLoc = 0;
+
+    void calcTimeChanges(time_t t) {
+        tmElements_t tm;
+        breakTime(t, tm);
+        if(tm.Year + 1970 == year) return;
+        year = tm.Year + 1970;
+        dstLoc = toTime(dst, year);
+        stdLoc = toTime(std, year);
+        dstUTC = dstLoc - std.offset * SECS_PER_MIN;
+        stdUTC = stdLoc - dst.offset * SECS_PER_MIN;
+    }
+
+    // Local time of the change in year
+    static time_t toTime(const TimeChangeRule& r, int year) {
+        uint8_t month = r.month;
+        uint8_t week = r.week;
+        if(week == 0) {
+            // Last week of a month is found from the first week of the next
+            if(++month > 12) {
+                month = 1;
+                year++;
+            }
+            week = 1;
+        }
+        tmElements_t tm = { 0, 0, r.hour, 0, 1, month, (uint8_t) (year - 1970) };
+        time_t t = makeTime(tm);
+        t += ((r.dow - weekday(t) + 7) % 7 + (week - 1) * 7) * SECS_PER_DAY;
+        if(r.week == 0) t -= 7 * SECS_PER_DAY;
+        return t;
+    }
+};
+
+#endif
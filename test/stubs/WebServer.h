@@ -0,0 +1,49 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// The types the web layer takes from the core's WebServer.h, with the values the ESP32 core uses.
+// The server itself is HttpServerCore.
+
+#ifndef _WEBSERVER_STUB_H
+#define _WEBSERVER_STUB_H
+
+#include "Arduino.h"
+
+enum http_method {
+    HTTP_DELETE = 0,
+    HTTP_GET = 1,
+    HTTP_HEAD = 2,
+    HTTP_POST = 3,
+    HTTP_PUT = 4,
+    HTTP_CONNECT = 5,
+    HTTP_OPTIONS = 6,
+    HTTP_PATCH = 28
+};
+typedef enum http_method HTTPMethod;
+#define HTTP_ANY (HTTPMethod)(255)
+
+enum HTTPUploadStatus {
+    UPLOAD_FILE_START,
+    UPLOAD_FILE_WRITE,
+    UPLOAD_FILE_END,
+    UPLOAD_FILE_ABORTED
+};
+
+#define HTTP_UPLOAD_BUFLEN 1436
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+typedef struct {
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[HTTP_UPLOAD_BUFLEN];
+} HTTPUpload;
+
+#endif
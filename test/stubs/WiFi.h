@@ -0,0 +1,178 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// WiFiClient and WiFiServer on top of plain sockets, so tests can talk to each other on the loopback interface
+
+#ifndef _WIFI_STUB_H
+#define _WIFI_STUB_H
+
+#include "Arduino.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <map>
+#include <memory>
+
+// Tests send the well known ports (80, 7443) to the ports their servers got from the kernel
+inline std::map<uint16_t, uint16_t> wifiStubPorts;
+
+inline uint16_t wifiStubPort(uint16_t port) {
+    auto it = wifiStubPorts.find(port);
+    return it == wifiStubPorts.end() ? port : it->second;
+}
+
+// Copies share the socket like the core's client does, it is closed by stop() or with the last copy
+struct WiFiStubSocket {
+    int fd;
+    explicit WiFiStubSocket(int fd) : fd(fd) {}
+    ~WiFiStubSocket() {
+        if(fd >= 0) close(fd);
+    }
+};
+
+class WiFiClient : public Stream {
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd) : socket(std::make_shared<WiFiStubSocket>(fd)) {}
+
+    // Every host name resolves to the loopback interface
+    virtual int connect(const char* host, uint16_t port) {
+        stop();
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) return 0;
+        socket = std::make_shared<WiFiStubSocket>(fd);
+        setNoDelay(true);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(wifiStubPort(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(::connect(fd, (sockaddr*) &addr, sizeof(addr)) != 0) {
+            stop();
+            return 0;
+        }
+        return 1;
+    }
+    virtual int connect(const char* host, uint16_t port, int32_t timeout) {
+        return connect(host, port);
+    }
+
+    // Same as the core, a connection the peer has closed is no longer connected once its data is read
+    uint8_t connected() {
+        if(fd() < 0) return 0;
+        char c;
+        ssize_t n = recv(fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            stop();
+            return 0;
+        }
+        return 1;
+    }
+
+    void stop() {
+        if(socket != NULL && socket->fd >= 0) {
+            close(socket->fd);
+            socket->fd = -1;
+        }
+        socket = NULL;
+    }
+
+    int fd() const { return socket == NULL ? -1 : socket->fd; }
+    operator bool() { return fd() >= 0; }
+
+    void setNoDelay(bool noDelay) {
+        int one = noDelay ? 1 : 0;
+        if(fd() >= 0) setsockopt(fd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    using Stream::write;
+    size_t write(const uint8_t* buf, size_t size) override {
+        if(fd() < 0) return 0;
+        ssize_t n = send(fd(), buf, size, MSG_NOSIGNAL);
+        return n < 0 ? 0 : n;
+    }
+
+    int read(uint8_t* buf, size_t size) {
+        if(fd() < 0) return -1;
+        ssize_t n = recv(fd(), buf, size, 0);
+        return n <= 0 ? -1 : n;
+    }
+
+    int read() {
+        uint8_t c;
+        if(fd() < 0 || recv(fd(), &c, 1, MSG_DONTWAIT) != 1) return -1;
+        return c;
+    }
+
+    int available() {
+        char buf[256];
+        if(fd() < 0) return 0;
+        ssize_t n = recv(fd(), buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 ? 0 : n;
+    }
+
+    void setTimeout(unsigned long timeout) {}
+    void flush() {}
+
+private:
+    std::shared_ptr<WiFiStubSocket> socket;
+};
+
+// Listens on a port from the kernel and maps the port the firmware asked for to it
+class WiFiServer {
+public:
+    explicit WiFiServer(uint16_t port) : port(port) {}
+    ~WiFiServer() {
+        if(fd >= 0) close(fd);
+    }
+
+    void begin() {
+        fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, (sockaddr*) &addr, sizeof(addr));
+        listen(fd, 16);
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (sockaddr*) &addr, &len);
+        wifiStubPorts[port] = ntohs(addr.sin_port);
+    }
+
+    bool hasClient() {
+        pollfd p = { fd, POLLIN, 0 };
+        return fd >= 0 && poll(&p, 1, 0) > 0;
+    }
+
+    WiFiClient accept() {
+        int client = ::accept4(fd, NULL, NULL, SOCK_NONBLOCK);
+        if(client < 0) return WiFiClient();
+        // About lwIP's TCP_SND_BUF, so a client that reads slowly holds the server up as it does on the device
+        int sendBuffer = 5744;
+        setsockopt(client, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+        return WiFiClient(client);
+    }
+
+private:
+    uint16_t port;
+    int fd = -1;
+};
+
+class WiFiClass {
+public:
+    String macAddress() { return "AA:BB:CC:DD:EE:FF"; }
+    const char* getHostname() { return "ams-test"; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+    IPAddress dnsIP(uint8_t num = 0) { return num == 0 ? IPAddress(127, 0, 0, 53) : IPAddress(); }
+};
+inline WiFiClass WiFi;
+
+#endif
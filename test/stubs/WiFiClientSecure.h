@@ -0,0 +1,22 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// No TLS on the host, a secure client is a plain connection that only keeps its own type
+
+#ifndef _WIFICLIENTSECURE_STUB_H
+#define _WIFICLIENTSECURE_STUB_H
+
+#include "WiFi.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+    void setInsecure() {}
+    bool loadCACert(Stream& stream, size_t size) { return true; }
+    bool loadCertificate(Stream& stream, size_t size) { return true; }
+    bool loadPrivateKey(Stream& stream, size_t size) { return true; }
+};
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// WiFiUDP that sends one datagram per packet to the loopback interface
+
+#ifndef _WIFIUDP_STUB_H
+#define _WIFIUDP_STUB_H
+
+#include "WiFi.h"
+
+class WiFiUDP : public Stream {
+public:
+    virtual ~WiFiUDP() {
+        if(fd >= 0) close(fd);
+    }
+
+    int beginPacket(const char* host, uint16_t port) {
+        if(fd < 0) fd = socket(AF_INET, SOCK_DGRAM, 0);
+        this->port = wifiStubPort(port);
+        packet.clear();
+        return fd < 0 ? 0 : 1;
+    }
+
+    using Stream::write;
+    size_t write(const uint8_t* buf, size_t size) override {
+        packet.append((const char*) buf, size);
+        return size;
+    }
+
+    int endPacket() {
+        if(fd < 0) return 0;
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ssize_t n = sendto(fd, packet.data(), packet.size(), 0, (sockaddr*) &addr, sizeof(addr));
+        packet.clear();
+        return n < 0 ? 0 : 1;
+    }
+
+private:
+    int fd = -1;
+    uint16_t port = 0;
+    std::string packet;
+};
+
+#endif
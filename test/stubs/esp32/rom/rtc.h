@@ -0,0 +1,18 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _ESP32_ROM_RTC_STUB_H
+#define _ESP32_ROM_RTC_STUB_H
+
+typedef enum {
+    NO_MEAN = 0,
+    POWERON_RESET = 1,
+    SW_RESET = 3
+} RESET_REASON;
+
+inline RESET_REASON rtc_get_reset_reason(int cpu_no) { return POWERON_RESET; }
+
+#endif
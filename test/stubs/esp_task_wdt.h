@@ -0,0 +1,12 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _ESP_TASK_WDT_STUB_H
+#define _ESP_TASK_WDT_STUB_H
+
+inline void esp_task_wdt_reset() {}
+
+#endif
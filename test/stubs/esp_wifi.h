@@ -0,0 +1,32 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _ESP_WIFI_STUB_H
+#define _ESP_WIFI_STUB_H
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef enum {
+    ESP_IF_WIFI_STA = 0,
+    ESP_IF_WIFI_AP
+} esp_interface_t;
+
+typedef enum {
+    WIFI_IF_STA = ESP_IF_WIFI_STA,
+    WIFI_IF_AP = ESP_IF_WIFI_AP
+} wifi_interface_t;
+
+// Same addresses as WiFi.macAddress(), the access point one is the station one plus one
+inline esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6]) {
+    for(uint8_t i = 0; i < 6; i++) mac[i] = 0xAA + i * 0x11;
+    if(ifx == WIFI_IF_AP) mac[5]++;
+    return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,12 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _LWIP_DEF_STUB_H
+#define _LWIP_DEF_STUB_H
+
+#include <arpa/inet.h>
+
+#endif
@@ -0,0 +1,13 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _LWIP_SOCKETS_STUB_H
+#define _LWIP_SOCKETS_STUB_H
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#endif
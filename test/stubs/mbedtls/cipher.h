@@ -0,0 +1,16 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_CIPHER_STUB_H
+#define _MBEDTLS_CIPHER_STUB_H
+
+typedef enum {
+    MBEDTLS_CIPHER_ID_NONE = 0,
+    MBEDTLS_CIPHER_ID_NULL,
+    MBEDTLS_CIPHER_ID_AES
+} mbedtls_cipher_id_t;
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_CTR_DRBG_STUB_H
+#define _MBEDTLS_CTR_DRBG_STUB_H
+
+#include "mbedtls/entropy.h"
+
+#define MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED -0x0034
+
+// Output comes from the OpenSSL generator, seeding only checks that the entropy source answers
+struct mbedtls_ctr_drbg_context {
+    bool seeded;
+};
+
+inline void mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context* ctx) {
+    ctx->seeded = false;
+}
+
+inline int mbedtls_ctr_drbg_seed(mbedtls_ctr_drbg_context* ctx, int (*f_entropy)(void*, unsigned char*, size_t), void* p_entropy, const unsigned char* custom, size_t len) {
+    unsigned char seed[32];
+    if(f_entropy(p_entropy, seed, sizeof(seed)) != 0) return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+    ctx->seeded = true;
+    return 0;
+}
+
+inline int mbedtls_ctr_drbg_random(void* p_rng, unsigned char* output, size_t output_len) {
+    mbedtls_ctr_drbg_context* ctx = (mbedtls_ctr_drbg_context*) p_rng;
+    if(!ctx->seeded) return MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+    return RAND_bytes(output, output_len) == 1 ? 0 : MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+}
+
+#endif
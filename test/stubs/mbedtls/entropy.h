@@ -0,0 +1,25 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_ENTROPY_STUB_H
+#define _MBEDTLS_ENTROPY_STUB_H
+
+#include <stddef.h>
+#include <openssl/rand.h>
+
+struct mbedtls_entropy_context {
+    int sources;
+};
+
+inline void mbedtls_entropy_init(mbedtls_entropy_context* ctx) {
+    ctx->sources = 1;
+}
+
+inline int mbedtls_entropy_func(void* data, unsigned char* output, size_t len) {
+    return RAND_bytes(output, len) == 1 ? 0 : -0x003C;
+}
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_ERROR_STUB_H
+#define _MBEDTLS_ERROR_STUB_H
+
+#include <stdio.h>
+
+inline void mbedtls_strerror(int errnum, char* buffer, size_t buflen) {
+    snprintf(buffer, buflen, "mbedtls error -0x%04X", (unsigned int) -errnum);
+}
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_GCM_STUB_H
+#define _MBEDTLS_GCM_STUB_H
+
+#include "mbedtls/cipher.h"
+#include <string.h>
+#include <openssl/evp.h>
+
+#define MBEDTLS_GCM_ENCRYPT 1
+#define MBEDTLS_GCM_DECRYPT 0
+#define MBEDTLS_ERR_GCM_AUTH_FAILED -0x0012
+#define MBEDTLS_ERR_GCM_BAD_INPUT -0x0014
+
+struct mbedtls_gcm_context {
+    unsigned char key[32];
+    unsigned int keybits;
+};
+
+inline void mbedtls_gcm_init(mbedtls_gcm_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+inline void mbedtls_gcm_free(mbedtls_gcm_context* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+inline int mbedtls_gcm_setkey(mbedtls_gcm_context* ctx, mbedtls_cipher_id_t cipher, const unsigned char* key, unsigned int keybits) {
+    if(cipher != MBEDTLS_CIPHER_ID_AES || (keybits != 128 && keybits != 256)) return MBEDTLS_ERR_GCM_BAD_INPUT;
+    memcpy(ctx->key, key, keybits / 8);
+    ctx->keybits = keybits;
+    return 0;
+}
+
+inline int mbedtls_gcm_crypt_and_tag(mbedtls_gcm_context* ctx, int mode, size_t length, const unsigned char* iv, size_t iv_len, const unsigned char* add, size_t add_len, const unsigned char* input, unsigned char* output, size_t tag_len, unsigned char* tag) {
+    if(ctx->keybits == 0) return MBEDTLS_ERR_GCM_BAD_INPUT;
+    EVP_CIPHER_CTX* cctx = EVP_CIPHER_CTX_new();
+    int enc = mode == MBEDTLS_GCM_ENCRYPT ? 1 : 0;
+    int len;
+    bool ok = cctx != NULL
+        && EVP_CipherInit_ex(cctx, ctx->keybits == 128 ? EVP_aes_128_gcm() : EVP_aes_256_gcm(), NULL, NULL, NULL, enc) == 1
+        && EVP_CIPHER_CTX_ctrl(cctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL) == 1
+        && EVP_CipherInit_ex(cctx, NULL, NULL, ctx->key, iv, enc) == 1
+        && EVP_CipherUpdate(cctx, NULL, &len, add, add_len) == 1
+        && EVP_CipherUpdate(cctx, output, &len, input, length) == 1
+        && EVP_CipherFinal_ex(cctx, output + len, &len) == 1
+        && EVP_CIPHER_CTX_ctrl(cctx, EVP_CTRL_GCM_GET_TAG, tag_len, tag) == 1;
+    EVP_CIPHER_CTX_free(cctx);
+    return ok ? 0 : MBEDTLS_ERR_GCM_BAD_INPUT;
+}
+
+#endif
@@ -0,0 +1,10 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_NET_STUB_H
+#define _MBEDTLS_NET_STUB_H
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_PK_STUB_H
+#define _MBEDTLS_PK_STUB_H
+
+#include "mbedtls/rsa.h"
+#include <openssl/pem.h>
+
+#define MBEDTLS_ERR_PK_KEY_INVALID_FORMAT -0x3D00
+
+struct mbedtls_pk_context {
+    const void* pk_info;
+    void* pk_ctx;
+};
+
+inline void mbedtls_pk_init(mbedtls_pk_context* ctx) {
+    ctx->pk_info = NULL;
+    ctx->pk_ctx = NULL;
+}
+
+inline void mbedtls_pk_free(mbedtls_pk_context* ctx) {
+    mbedtls_rsa_context* rsa = (mbedtls_rsa_context*) ctx->pk_ctx;
+    if(rsa != NULL) {
+        EVP_PKEY_free(rsa->pkey);
+        delete rsa;
+    }
+    mbedtls_pk_init(ctx);
+}
+
+// Same as mbedtls, a PEM key has to be null terminated and the terminator counted in keylen
+inline int mbedtls_pk_parse_public_key(mbedtls_pk_context* ctx, const unsigned char* key, size_t keylen) {
+    if(keylen == 0 || key[keylen - 1] != '\0') return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+    BIO* bio = BIO_new_mem_buf(key, keylen - 1);
+    EVP_PKEY* pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    if(pkey == NULL) return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+    ctx->pk_ctx = new mbedtls_rsa_context { pkey, (size_t) EVP_PKEY_get_size(pkey) };
+    return 0;
+}
+
+inline mbedtls_rsa_context* mbedtls_pk_rsa(const mbedtls_pk_context pk) {
+    return (mbedtls_rsa_context*) pk.pk_ctx;
+}
+
+#endif
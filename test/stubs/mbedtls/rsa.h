@@ -0,0 +1,46 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// The mbedtls 2.x calls the firmware makes, carried out by OpenSSL (link with -lcrypto)
+
+#ifndef _MBEDTLS_RSA_STUB_H
+#define _MBEDTLS_RSA_STUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#define MBEDTLS_RSA_PUBLIC 0
+#define MBEDTLS_RSA_PRIVATE 1
+#define MBEDTLS_ERR_RSA_KEY_CHECK_FAILED -0x4200
+#define MBEDTLS_ERR_RSA_PUBLIC_FAILED -0x4280
+
+struct mbedtls_rsa_context {
+    EVP_PKEY* pkey;
+    size_t len;
+};
+
+// Tests read this to see how many RSA operations a run cost
+inline uint32_t mbedtlsStubRsaOperations = 0;
+
+inline int mbedtls_rsa_check_pubkey(const mbedtls_rsa_context* ctx) {
+    return ctx->pkey != NULL && EVP_PKEY_get_base_id(ctx->pkey) == EVP_PKEY_RSA ? 0 : MBEDTLS_ERR_RSA_KEY_CHECK_FAILED;
+}
+
+inline int mbedtls_rsa_pkcs1_encrypt(mbedtls_rsa_context* ctx, int (*f_rng)(void*, unsigned char*, size_t), void* p_rng, int mode, size_t ilen, const unsigned char* input, unsigned char* output) {
+    mbedtlsStubRsaOperations++;
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new(ctx->pkey, NULL);
+    size_t olen = ctx->len;
+    bool ok = pctx != NULL
+        && EVP_PKEY_encrypt_init(pctx) == 1
+        && EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) == 1
+        && EVP_PKEY_encrypt(pctx, output, &olen, input, ilen) == 1;
+    EVP_PKEY_CTX_free(pctx);
+    return ok ? 0 : MBEDTLS_ERR_RSA_PUBLIC_FAILED;
+}
+
+#endif
@@ -0,0 +1,13 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#ifndef _MBEDTLS_SSL_STUB_H
+#define _MBEDTLS_SSL_STUB_H
+
+#include "mbedtls/pk.h"
+#include "mbedtls/ctr_drbg.h"
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include <chrono>
+#include "Calendar/src/Calendar.cpp"
+
+#define MAR_30_2024 1711756800
+#define MAR_31_2024 1711843200
+#define OCT_27_2024 1729987200
+#define NOV_1_2024 1730419200
+
+static TimeChangeRule CEST = { "CEST", Last, Sun, Mar, 2, 120 };
+static TimeChangeRule CET = { "CET", Last, Sun, Oct, 3, 60 };
+static Timezone* tz;
+static Calendar* calendar;
+
+void setUp() {
+    tz = new Timezone(CEST, CET);
+    calendar = new Calendar();
+    calendar->setTimezone(tz);
+}
+
+void tearDown() {
+    delete calendar;
+    delete tz;
+}
+
+static tmElements_t local(time_t t) {
+    tmElements_t tm;
+    breakTime(tz->toLocal(t), tm);
+    return tm;
+}
+
+static bool same(const tmElements_t& a, const tmElements_t& b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Everything the calendar caches for t, checked against converting t from scratch
+static void verify(time_t t) {
+    tmElements_t expected = local(t);
+    tmElements_t utc;
+    breakTime(t, utc);
+    TEST_ASSERT_TRUE(same(expected, calendar->getLocal()));
+    TEST_ASSERT_TRUE(same(utc, calendar->getUtc()));
+    TEST_ASSERT_EQUAL_INT32(tz->toLocal(t) - t, calendar->getOffset());
+
+    tmElements_t later;
+    calendar->breakLocal(t + 5, later);
+    TEST_ASSERT_TRUE(same(local(t + 5), later));
+
+    TEST_ASSERT_TRUE(calendar->isSameHour(t));
+    TEST_ASSERT_TRUE(calendar->isSameDay(t));
+    TEST_ASSERT_TRUE(calendar->isSameMonth(t));
+
+    // The hour is a whole local hour, DST changes included
+    time_t hourStart = calendar->getHourStart();
+    TEST_ASSERT_EQUAL_INT64(0, tz->toLocal(hourStart) % SECS_PER_HOUR);
+    TEST_ASSERT_EQUAL_INT64(SECS_PER_HOUR, calendar->getNextHour() - hourStart);
+    TEST_ASSERT_FALSE(calendar->isSameHour(hourStart - 1));
+    TEST_ASSERT_FALSE(calendar->isSameHour(calendar->getNextHour()));
+
+    tmElements_t start = local(calendar->getDayStart());
+    TEST_ASSERT_EQUAL_UINT8(0, start.Hour);
+    TEST_ASSERT_EQUAL_UINT8(0, start.Minute);
+    TEST_ASSERT_EQUAL_UINT8(expected.Day, start.Day);
+    TEST_ASSERT_TRUE(local(calendar->getDayStart() - 1).Day != expected.Day);
+    tmElements_t next = local(calendar->getNextDay());
+    TEST_ASSERT_EQUAL_UINT8(0, next.Hour);
+    TEST_ASSERT_TRUE(local(calendar->getNextDay() - 1).Day == expected.Day);
+
+    start = local(calendar->getMonthStart());
+    TEST_ASSERT_EQUAL_UINT8(1, start.Day);
+    TEST_ASSERT_EQUAL_UINT8(0, start.Hour);
+    TEST_ASSERT_EQUAL_UINT8(expected.Month, start.Month);
+    next = local(calendar->getNextMonth());
+    TEST_ASSERT_EQUAL_UINT8(1, next.Day);
+    TEST_ASSERT_EQUAL_UINT8(expected.Month % 12 + 1, next.Month);
+}
+
+void test_walk_across_both_transitions() {
+    // Odd step, so every second of the hour is hit at some point
+    for(time_t t = MAR_30_2024; t < NOV_1_2024; t += 17) {
+        calendar->update(t);
+        verify(t);
+    }
+}
+
+void test_spring_day_has_23_hours() {
+    // 01:00 UTC is 03:00 CEST, local 02:00 does not exist
+    time_t t = MAR_31_2024 + SECS_PER_HOUR;
+    TEST_ASSERT_TRUE(calendar->update(t));
+    verify(t);
+    TEST_ASSERT_EQUAL_UINT8(3, calendar->getLocal().Hour);
+    TEST_ASSERT_EQUAL_INT32(7200, calendar->getOffset());
+    TEST_ASSERT_EQUAL_INT64(23 * SECS_PER_HOUR, calendar->getNextDay() - calendar->getDayStart());
+    TEST_ASSERT_EQUAL_INT64(2 * SECS_PER_HOUR, calendar->getHourStart() - calendar->getDayStart());
+
+    // The second before is 01:59:59 CET, same day but another hour
+    TEST_ASSERT_FALSE(calendar->isSameHour(t - 1));
+    TEST_ASSERT_TRUE(calendar->isSameDay(t - 1));
+    TEST_ASSERT_TRUE(calendar->update(t - 1));
+    TEST_ASSERT_EQUAL_UINT8(1, calendar->getLocal().Hour);
+    TEST_ASSERT_EQUAL_INT32(3600, calendar->getOffset());
+}
+
+void test_autumn_repeats_two_oclock() {
+    // 00:30 UTC is 02:30 CEST, 01:30 UTC is 02:30 CET
+    time_t first = OCT_27_2024 + SECS_PER_HOUR / 2;
+    time_t second = first + SECS_PER_HOUR;
+
+    calendar->update(first);
+    verify(first);
+    TEST_ASSERT_EQUAL_UINT8(2, calendar->getLocal().Hour);
+    TEST_ASSERT_EQUAL_INT32(7200, calendar->getOffset());
+    TEST_ASSERT_FALSE(calendar->isSameHour(second));
+    TEST_ASSERT_TRUE(calendar->isSameDay(second));
+    time_t firstHour = calendar->getHourStart();
+    TEST_ASSERT_EQUAL_INT64(25 * SECS_PER_HOUR, calendar->getNextDay() - calendar->getDayStart());
+
+    TEST_ASSERT_TRUE(calendar->update(second));
+    verify(second);
+    TEST_ASSERT_EQUAL_UINT8(2, calendar->getLocal().Hour);
+    TEST_ASSERT_EQUAL_INT32(3600, calendar->getOffset());
+    TEST_ASSERT_FALSE(calendar->isSameHour(first));
+    TEST_ASSERT_EQUAL_INT64(firstHour + SECS_PER_HOUR, calendar->getHourStart());
+    TEST_ASSERT_EQUAL_INT64(3 * SECS_PER_HOUR, calendar->getHourStart() - calendar->getDayStart());
+}
+
+void test_half_hour_zone() {
+    TimeChangeRule IST = { "IST", Last, Sun, Mar, 2, 330 };
+    Timezone india(IST, IST);
+    delete tz;
+    tz = &india;
+    calendar->setTimezone(tz);
+    for(time_t t = MAR_30_2024; t < MAR_30_2024 + SECS_PER_DAY; t += 7) {
+        calendar->update(t);
+        verify(t);
+    }
+    // Local and UTC hours change at different times, so the cache only lasts half an hour
+    TEST_ASSERT_EQUAL_UINT32(48, calendar->getRecomputeCount());
+    calendar->setTimezone(NULL);
+    tz = NULL;
+}
+
+void test_recompute_once_per_hour() {
+    for(time_t t = OCT_27_2024 - SECS_PER_DAY; t < OCT_27_2024 + 2 * SECS_PER_DAY; t += 2) {
+        calendar->update(t);
+    }
+    TEST_ASSERT_EQUAL_UINT32(72, calendar->getRecomputeCount());
+}
+
+// Not a pass/fail measure, the numbers are printed to compare a meter frame every 2s with and without the cache
+void test_benchmark_frame_rate() {
+    const time_t end = MAR_30_2024 + 10 * SECS_PER_DAY;
+    volatile uint32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(time_t t = MAR_30_2024; t < end; t += 2) {
+        calendar->update(t);
+        sink += calendar->getLocal().Minute + calendar->isSameDay(t);
+    }
+    double cached = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for(time_t t = MAR_30_2024; t < end; t += 2) {
+        tmElements_t tm;
+        breakTime(tz->toLocal(t), tm);
+        tmElements_t midnight = tm;
+        midnight.Hour = midnight.Minute = midnight.Second = 0;
+        sink += tm.Minute + (tz->toUTC(makeTime(midnight)) <= t);
+    }
+    double direct = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    uint32_t frames = (end - MAR_30_2024) / 2;
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Calendar %.1f ns/frame, breakTime(toLocal()) %.1f ns/frame", cached / frames, direct / frames);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_UINT32(240, calendar->getRecomputeCount());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_walk_across_both_transitions);
+    RUN_TEST(test_spring_day_has_23_hours);
+    RUN_TEST(test_autumn_repeats_two_oclock);
+    RUN_TEST(test_half_hour_zone);
+    RUN_TEST(test_recompute_once_per_hour);
+    RUN_TEST(test_benchmark_frame_rate);
+    return UNITY_END();
+}
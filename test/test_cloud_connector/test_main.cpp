@@ -0,0 +1,544 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+// Frames from CloudConnector over UDP, TCP and HTTP on the loopback interface, decrypted the way
+// the cloud does it. mbedtls is carried out by OpenSSL (test/stubs/mbedtls), the receiver below
+// uses OpenSSL directly with the private half of a key pair made for the run.
+
+#define ESP32
+#define CONFIG_IDF_TARGET_ESP32 1
+#include <unity.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <vector>
+#include <openssl/pem.h>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "WiFiClientSecure.h"
+#include "AmsConfiguration.h"
+
+// Stand-ins under the include guards of the real headers, which pull in the sensor, network and HTTP libraries
+#define _HWTOOLS_H
+class HwTools {
+public:
+    float getVcc() { return 3.287; }
+    int getWifiRssi() { return -67; }
+    float getTemperature() { return 21.5; }
+};
+
+#define _ENERGYACCOUNTING_H
+class EnergyAccounting {
+public:
+    float getUseThisHour() { return 1.234; }
+    float getProducedThisHour() { return 0.5; }
+    float getPriceForHour(uint8_t direction, uint8_t hour) { return 1.25; }
+};
+
+#define _PRICESERVICE_H
+#define PRICE_DIRECTION_IMPORT 0x01
+#define PRICE_DIRECTION_EXPORT 0x02
+#define PRICE_NO_VALUE -127
+
+struct PriceConfig {
+    char name[32];
+    uint8_t direction;
+    uint8_t days;
+    uint32_t hours;
+    uint8_t type;
+    uint32_t value;
+    uint8_t start_month;
+    uint8_t start_dayofmonth;
+    uint8_t end_month;
+    uint8_t end_dayofmonth;
+};
+
+class PriceService {
+public:
+    char* getCurrency() { return currency; }
+    float getValueForHour(uint8_t direction, int8_t hour) { return getValueForHour(direction, 0, hour); }
+    float getValueForHour(uint8_t direction, time_t ts, int8_t hour) { return direction == PRICE_DIRECTION_IMPORT ? 1.25 : PRICE_NO_VALUE; }
+    float getEnergyPriceForHour(uint8_t direction, time_t ts, int8_t hour) { return getValueForHour(direction, ts, hour); }
+    std::vector<PriceConfig> getPriceConfig() {
+        PriceConfig grid = { "Grid", PRICE_DIRECTION_IMPORT, 0x1F, 0x00FFFFC0, 0, 4500, 0, 0, 0, 0 };
+        return { grid };
+    }
+
+private:
+    char currency[4] = "NOK";
+};
+
+#define _CONNECTIONHANDLER_H
+class ConnectionHandler {
+public:
+    IPAddress getIP() { return IPAddress(10, 0, 0, 2); }
+    IPAddress getSubnetMask() { return IPAddress(255, 255, 255, 0); }
+    IPAddress getGateway() { return IPAddress(10, 0, 0, 1); }
+    IPAddress getDns(uint8_t num) { return IPAddress(10, 0, 0, 1); }
+};
+
+#include "AmsConfiguration/src/hexutils.cpp"
+#include "AmsDecoder/src/crc.cpp"
+#include "Uptime/src/Uptime.cpp"
+#include "AmsData/src/AmsData.cpp"
+#include "AmsMqttHandler/src/DecimalFormat.cpp"
+#include "AmsMqttHandler/src/TopicTable.cpp"
+#include "AmsMqttHandler/src/PublishCache.cpp"
+#include "AmsMqttHandler/src/MqttOutbox.cpp"
+#include "AmsMqttHandler/src/DataSnapshot.cpp"
+#include "AmsMqttHandler/src/AmsMqttHandler.cpp"
+#include "HttpClientPool/src/HttpClientPool.cpp"
+#include "CloudConnector/src/CloudConnector.cpp"
+
+long FirmwareVersion::BuildEpoch = 0;
+const char* FirmwareVersion::VersionString = "test";
+
+#define INTERVAL 10
+
+class TestData : public AmsData {
+public:
+    TestData() {
+        listType = 3;
+        meterType = AmsTypeAidon;
+        meterId = "7359992890";
+        meterModel = "6525";
+        activeImportPower = 4321;
+        reactiveImportPower = 120;
+        activeExportPower = 15;
+        l1voltage = 231.5;
+        l2voltage = 229.75;
+        l3voltage = 230.25;
+        l1current = 5.25;
+        l2current = 11.5;
+        l3current = 0.75;
+        activeImportCounter = 12345.678;
+        activeExportCounter = 1.5;
+        threePhase = true;
+    }
+};
+
+// Serves the public key and takes data over HTTP on a thread, UDP and TCP frames are read by the
+// test after each update. UDP and TCP listen on the same port number, like the cloud on 7443.
+class CloudServer {
+public:
+    std::string publicKey;
+    std::atomic<uint32_t> rejectPosts;
+
+    void start() {
+        rejectPosts = 0;
+        http = listener(SOCK_STREAM, 0);
+        tcp = listener(SOCK_STREAM, 0);
+        udp = listener(SOCK_DGRAM, port(tcp));
+        wifiStubPorts[80] = port(http);
+        wifiStubPorts[7443] = port(tcp);
+        running = true;
+        thread = std::thread(&CloudServer::run, this);
+    }
+
+    void stop() {
+        running = false;
+        thread.join();
+        close(http);
+        close(tcp);
+        close(udp);
+        if(stream >= 0) close(stream);
+        stream = -1;
+        wifiStubPorts.clear();
+        posted.clear();
+    }
+
+    // Sends 7443 to a port nobody listens on until accept() is called
+    void refuse() {
+        int fd = listener(SOCK_STREAM, 0);
+        wifiStubPorts[7443] = port(fd);
+        close(fd);
+    }
+
+    void accept() {
+        wifiStubPorts[7443] = port(tcp);
+    }
+
+    bool receiveUdp(std::string& frame) {
+        char buf[4096];
+        if(!wait(udp, 500)) return false;
+        ssize_t n = recv(udp, buf, sizeof(buf), 0);
+        if(n <= 0) return false;
+        frame.assign(buf, n);
+        return true;
+    }
+
+    // Everything the device wrote since the last call, the frame ends with "\r\n"
+    bool receiveTcp(std::string& frame) {
+        if(stream < 0) {
+            if(!wait(tcp, 500)) return false;
+            stream = ::accept(tcp, NULL, NULL);
+        }
+        frame.clear();
+        char buf[4096];
+        for(int timeout = 500; wait(stream, timeout); timeout = 20) {
+            ssize_t n = recv(stream, buf, sizeof(buf), 0);
+            if(n <= 0) break;
+            frame.append(buf, n);
+        }
+        if(frame.size() < 2 || frame.compare(frame.size() - 2, 2, "\r\n") != 0) return false;
+        frame.resize(frame.size() - 2);
+        return true;
+    }
+
+    bool receiveHttp(std::string& frame) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(posted.empty()) return false;
+        frame = posted.front();
+        posted.erase(posted.begin());
+        return true;
+    }
+
+private:
+    int http = -1, tcp = -1, udp = -1, stream = -1;
+    std::vector<std::string> posted;
+    std::mutex mutex;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    static int listener(int type, uint16_t port) {
+        int fd = socket(AF_INET, type, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, (sockaddr*) &addr, sizeof(addr));
+        if(type == SOCK_STREAM) listen(fd, 4);
+        return fd;
+    }
+
+    static uint16_t port(int fd) {
+        sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (sockaddr*) &addr, &len);
+        return ntohs(addr.sin_port);
+    }
+
+    static bool wait(int fd, int timeout) {
+        pollfd p = { fd, POLLIN, 0 };
+        return poll(&p, 1, timeout) > 0;
+    }
+
+    // One request per connection, the device asks for HTTP/1.0
+    void run() {
+        while(running) {
+            if(!wait(http, 20)) continue;
+            int fd = ::accept(http, NULL, NULL);
+            timeval timeout = { 1, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            std::string request;
+            char buf[4096];
+            size_t end;
+            while((end = request.find("\r\n\r\n")) == std::string::npos) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if(n <= 0) break;
+                request.append(buf, n);
+            }
+            if(end == std::string::npos) {
+                close(fd);
+                continue;
+            }
+            size_t length = 0;
+            size_t header = request.find("Content-Length: ");
+            if(header != std::string::npos && header < end) length = atoi(request.c_str() + header + 16);
+            std::string body = request.substr(end + 4);
+            while(body.size() < length) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if(n <= 0) break;
+                body.append(buf, n);
+            }
+
+            int status = 404;
+            std::string content;
+            if(request.compare(0, 26, "GET /hub/cloud/public.key ") == 0) {
+                status = 200;
+                content = publicKey;
+            } else if(request.compare(0, 21, "POST /hub/cloud/data ") == 0 && body.size() == length) {
+                if(rejectPosts > 0) {
+                    rejectPosts--;
+                    status = 503;
+                } else {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    posted.push_back(body);
+                    status = 200;
+                }
+            }
+            std::string response = "HTTP/1.1 " + std::to_string(status) + " X\r\nContent-Length: " + std::to_string(content.size())
+                + "\r\nConnection: close\r\n\r\n" + content;
+            send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+            close(fd);
+        }
+    }
+};
+
+// The cloud side: unwraps the session key with the private key and opens the frame with it
+class Receiver {
+public:
+    EVP_PKEY* privateKey = NULL;
+    std::map<uint32_t, std::string> sessionKeys;
+
+    bool open(const std::string& frame, std::string& json) {
+        const uint8_t* p = (const uint8_t*) frame.data();
+        if(frame.size() < CC_SESSION_HEADER_SIZE + CC_SESSION_TAG_SIZE || memcmp(p, "AMS", 3) != 0 || p[3] != CC_SESSION_VERSION) return false;
+        uint32_t sessionId;
+        memcpy(&sessionId, p + 4, sizeof(sessionId));
+        uint16_t keyLength = keyLengthOf(frame);
+        if(frame.size() < CC_SESSION_HEADER_SIZE + keyLength + CC_SESSION_TAG_SIZE) return false;
+
+        if(keyLength > 0) {
+            unsigned char key[512];
+            size_t len = sizeof(key);
+            EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(privateKey, NULL);
+            bool ok = EVP_PKEY_decrypt_init(ctx) == 1
+                && EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) == 1
+                && EVP_PKEY_decrypt(ctx, key, &len, p + CC_SESSION_HEADER_SIZE, keyLength) == 1;
+            EVP_PKEY_CTX_free(ctx);
+            if(!ok || len != CC_SESSION_KEY_SIZE) return false;
+            sessionKeys[sessionId] = std::string((const char*) key, len);
+        }
+        auto key = sessionKeys.find(sessionId);
+        if(key == sessionKeys.end()) return false;
+
+        size_t length = frame.size() - CC_SESSION_HEADER_SIZE - keyLength - CC_SESSION_TAG_SIZE;
+        const uint8_t* ciphertext = p + CC_SESSION_HEADER_SIZE + keyLength;
+        json.resize(length);
+        int len;
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        bool ok = EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL) == 1
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, CC_SESSION_NONCE_SIZE, NULL) == 1
+            && EVP_DecryptInit_ex(ctx, NULL, NULL, (const uint8_t*) key->second.data(), p + 4) == 1
+            && EVP_DecryptUpdate(ctx, NULL, &len, p, CC_SESSION_HEADER_SIZE) == 1
+            && EVP_DecryptUpdate(ctx, (uint8_t*) &json[0], &len, ciphertext, length) == 1
+            && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, CC_SESSION_TAG_SIZE, (void*) (ciphertext + length)) == 1
+            && EVP_DecryptFinal_ex(ctx, NULL, &len) == 1;
+        EVP_CIPHER_CTX_free(ctx);
+        return ok;
+    }
+
+    static uint16_t keyLengthOf(const std::string& frame) {
+        return ((uint8_t) frame[16] << 8) | (uint8_t) frame[17];
+    }
+
+    static uint64_t counterOf(const std::string& frame) {
+        uint64_t counter = 0;
+        for(uint8_t i = 0; i < 8; i++) counter = (counter << 8) | (uint8_t) frame[8 + i];
+        return counter;
+    }
+};
+
+static CloudServer server;
+static Receiver receiver;
+static HttpClientPool* pool;
+static CloudConnector* cloud;
+static TestData data;
+static EnergyAccounting ea;
+static PriceService ps;
+static HwTools hw;
+
+void setUp() {
+    stubMillis = 1000;
+    mbedtlsStubRsaOperations = 0;
+    receiver.sessionKeys.clear();
+    server.start();
+    pool = new HttpClientPool(&Serial);
+}
+
+void tearDown() {
+    delete cloud;
+    delete pool;
+    cloud = NULL;
+    server.stop();
+}
+
+static void createCloud(uint8_t proto) {
+    CloudConfig config = {};
+    config.enabled = true;
+    config.interval = INTERVAL;
+    config.proto = proto;
+    MeterConfig meter = {};
+    meter.distributionSystem = 2;
+    meter.mainFuse = 63;
+    SystemConfig system = {};
+    system.boardType = 7;
+    NtpConfig ntp = {};
+    strcpy(ntp.timezone, "Europe/Oslo");
+    static ResetDataContainer rdc = { 0, 0, 0 };
+
+    cloud = new CloudConnector(&Serial, pool);
+    TEST_ASSERT_TRUE(cloud->setup(config, meter, system, ntp, &hw, &rdc, &ps));
+    EnergyAccountingConfig eac = { { 5, 10, 15, 20, 25, 50, 75, 100, 150, 0 }, 5 };
+    cloud->setEnergyAccountingConfig(eac);
+}
+
+static void update() {
+    stubMillis += INTERVAL * 1000;
+    cloud->update(data, ea);
+}
+
+static bool receive(uint8_t proto, std::string& frame) {
+    switch(proto) {
+        case 0: return server.receiveUdp(frame);
+        case 1: return server.receiveTcp(frame);
+        case 2: return server.receiveHttp(frame);
+    }
+    return false;
+}
+
+static void assertJson(const std::string& json) {
+    TEST_ASSERT_EQUAL_INT(0, json.compare(0, 7, "{\"id\":\""));
+    TEST_ASSERT_TRUE(json.find(",\"crc\":\"") != std::string::npos);
+    TEST_ASSERT_EQUAL_INT('}', json.back());
+}
+
+// Every frame opens, the key comes along with the first frame and every CC_SESSION_KEY_REPEAT frames
+static void assertFramesDecrypt(uint8_t proto) {
+    createCloud(proto);
+    uint32_t sessionId = 0;
+    for(uint8_t i = 0; i < 2 * CC_SESSION_KEY_REPEAT + 1; i++) {
+        update();
+        std::string frame, json;
+        TEST_ASSERT_TRUE(receive(proto, frame));
+        TEST_ASSERT_TRUE(receiver.open(frame, json));
+        assertJson(json);
+        TEST_ASSERT_EQUAL_UINT64(i, Receiver::counterOf(frame));
+        TEST_ASSERT_EQUAL_UINT16(i % CC_SESSION_KEY_REPEAT == 0 ? 256 : 0, Receiver::keyLengthOf(frame));
+        if(i == 0) {
+            TEST_ASSERT_TRUE(json.find(",\"init\":{\"mac\":\"AA:BB:CC:DD:EE:FF\"") != std::string::npos);
+            memcpy(&sessionId, frame.data() + 4, sizeof(sessionId));
+        } else if(i == 1) {
+            TEST_ASSERT_TRUE(json.find(",\"price\":{") != std::string::npos);
+        } else {
+            TEST_ASSERT_TRUE(json.find(",\"data\":{") != std::string::npos);
+        }
+        TEST_ASSERT_EQUAL_INT(0, memcmp(&sessionId, frame.data() + 4, sizeof(sessionId)));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, mbedtlsStubRsaOperations);
+}
+
+void test_udp_frames_decrypt() {
+    assertFramesDecrypt(0);
+}
+
+void test_tcp_frames_decrypt() {
+    assertFramesDecrypt(1);
+}
+
+void test_http_frames_decrypt() {
+    assertFramesDecrypt(2);
+}
+
+void test_tampered_frame_is_rejected() {
+    createCloud(2);
+    std::string frames[2];
+    for(uint8_t i = 0; i < 2; i++) {
+        update();
+        TEST_ASSERT_TRUE(server.receiveHttp(frames[i]));
+    }
+
+    std::string json;
+    std::string tampered = frames[1];
+    tampered.back() ^= 0x01;
+    TEST_ASSERT_FALSE(receiver.open(tampered, json));
+
+    // The header is authenticated, a frame can not be replayed under another counter
+    tampered = frames[1];
+    tampered[15] ^= 0x01;
+    TEST_ASSERT_FALSE(receiver.open(tampered, json));
+
+    tampered = frames[1];
+    tampered[CC_SESSION_HEADER_SIZE + 5] ^= 0x01;
+    TEST_ASSERT_FALSE(receiver.open(tampered, json));
+
+    // The key itself is wrapped with PKCS#1 v1.5, a damaged key block does not unwrap to a usable key
+    receiver.sessionKeys.clear();
+    tampered = frames[0];
+    tampered[CC_SESSION_HEADER_SIZE + 10] ^= 0x01;
+    TEST_ASSERT_FALSE(receiver.open(tampered, json));
+
+    TEST_ASSERT_TRUE(receiver.open(frames[0], json));
+    TEST_ASSERT_TRUE(receiver.open(frames[1], json));
+    assertJson(json);
+}
+
+// UDP is not acknowledged, a receiver that lost the first frame gets the key with the repeat
+void test_udp_lost_key_frame_recovers_at_repeat() {
+    createCloud(0);
+    for(uint8_t i = 0; i < CC_SESSION_KEY_REPEAT + 2; i++) {
+        update();
+        std::string frame, json;
+        TEST_ASSERT_TRUE(server.receiveUdp(frame));
+        if(i == 0) continue;
+        TEST_ASSERT_EQUAL(i >= CC_SESSION_KEY_REPEAT, receiver.open(frame, json));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, mbedtlsStubRsaOperations);
+}
+
+// A key frame that did not get through is followed by another with the key under the next counter
+static void assertPendingKeyIsSent(uint8_t proto) {
+    std::string frame, json;
+    update();
+    TEST_ASSERT_TRUE(receive(proto, frame));
+    TEST_ASSERT_EQUAL_UINT64(1, Receiver::counterOf(frame));
+    TEST_ASSERT_EQUAL_UINT16(256, Receiver::keyLengthOf(frame));
+    TEST_ASSERT_TRUE(receiver.open(frame, json));
+    assertJson(json);
+
+    // Delivered, the key is not sent again before the repeat
+    update();
+    TEST_ASSERT_TRUE(receive(proto, frame));
+    TEST_ASSERT_EQUAL_UINT64(2, Receiver::counterOf(frame));
+    TEST_ASSERT_EQUAL_UINT16(0, Receiver::keyLengthOf(frame));
+    TEST_ASSERT_TRUE(receiver.open(frame, json));
+    TEST_ASSERT_EQUAL_UINT32(1, mbedtlsStubRsaOperations);
+}
+
+void test_tcp_refused_key_frame_is_sent_again() {
+    createCloud(1);
+    server.refuse();
+    update();
+    server.accept();
+    assertPendingKeyIsSent(1);
+}
+
+void test_http_rejected_key_frame_is_sent_again() {
+    createCloud(2);
+    server.rejectPosts = 1;
+    update();
+    std::string frame;
+    TEST_ASSERT_FALSE(server.receiveHttp(frame));
+    assertPendingKeyIsSent(2);
+}
+
+int main() {
+    receiver.privateKey = EVP_RSA_gen(2048);
+    BIO* bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_PUBKEY(bio, receiver.privateKey);
+    char* pem;
+    long len = BIO_get_mem_data(bio, &pem);
+    server.publicKey.assign(pem, len);
+    BIO_free(bio);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_udp_frames_decrypt);
+    RUN_TEST(test_tcp_frames_decrypt);
+    RUN_TEST(test_http_frames_decrypt);
+    RUN_TEST(test_tampered_frame_is_rejected);
+    RUN_TEST(test_udp_lost_key_frame_recovers_at_repeat);
+    RUN_TEST(test_tcp_refused_key_frame_is_sent_again);
+    RUN_TEST(test_http_rejected_key_frame_is_sent_again);
+    int failures = UNITY_END();
+    EVP_PKEY_free(receiver.privateKey);
+    return failures;
+}
@@ -0,0 +1,257 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include <unity.h>
+#include <string>
+#include "ConfigFile.h"
+#include "AmsConfiguration/src/ConfigFile.cpp"
+#include "AmsConfiguration/src/hexutils.cpp"
+
+#define KEYWORD_COUNT (sizeof(ConfigFileKeywords) / sizeof(ConfigFileKeywords[0]))
+
+struct Configs {
+    SystemConfig sys;
+    NetworkConfig network;
+    MqttConfig mqtt;
+    WebConfig web;
+    MeterConfig meter;
+    GpioConfig gpio;
+    DomoticzConfig domo;
+    HomeAssistantConfig haconf;
+    NtpConfig ntp;
+    PriceServiceConfig price;
+    EnergyAccountingConfig eac;
+};
+
+// Same struct per target as configFileParse() loads
+static uint8_t* targetOf(Configs& c, uint8_t target, size_t& size) {
+    switch(target) {
+        case ConfigFileSystem: size = sizeof(c.sys); return (uint8_t*) &c.sys;
+        case ConfigFileNetwork: size = sizeof(c.network); return (uint8_t*) &c.network;
+        case ConfigFileMqtt: size = sizeof(c.mqtt); return (uint8_t*) &c.mqtt;
+        case ConfigFileWeb: size = sizeof(c.web); return (uint8_t*) &c.web;
+        case ConfigFileMeter: size = sizeof(c.meter); return (uint8_t*) &c.meter;
+        case ConfigFileGpio: size = sizeof(c.gpio); return (uint8_t*) &c.gpio;
+        case ConfigFileDomoticz: size = sizeof(c.domo); return (uint8_t*) &c.domo;
+        case ConfigFileHomeAssistant: size = sizeof(c.haconf); return (uint8_t*) &c.haconf;
+        case ConfigFileNtp: size = sizeof(c.ntp); return (uint8_t*) &c.ntp;
+        case ConfigFilePrice: size = sizeof(c.price); return (uint8_t*) &c.price;
+        case ConfigFileEnergyAccounting: size = sizeof(c.eac); return (uint8_t*) &c.eac;
+    }
+    size = 0;
+    return NULL;
+}
+
+// Reads one line the way configFileParse() does: key up to the first space, value is the rest
+static bool parseLine(Configs& c, const char* text) {
+    char line[1024];
+    strncpy(line, text, sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    char* end = strchr(line, '\n');
+    if(end != NULL) *end = '\0';
+    char* value = strchr(line, ' ');
+    if(value == NULL) return false;
+    *value++ = '\0';
+    ConfigFileKeyword keyword;
+    if(!configFileKeyword(line, keyword)) return false;
+    size_t size;
+    return configFileSetValue(keyword, targetOf(c, keyword.target, size), value);
+}
+
+// A value for every field that is not zero and uses the whole range the field is written with
+static void fill(uint8_t* field, const ConfigFileKeyword& keyword) {
+    switch(keyword.type) {
+        case ConfigFileInt:
+        case ConfigFileFixed:
+        case ConfigFileSignedFixed: {
+            uint32_t value = keyword.size == 1 ? 251 : keyword.size == 2 ? 54321 : 2000000123;
+            if(keyword.type == ConfigFileSignedFixed) value = (uint32_t) -1234;
+            memcpy(field, &value, keyword.size);
+            break;
+        }
+        case ConfigFileBool:
+            *field = 1;
+            break;
+        case ConfigFileString:
+            // Full length, with spaces, the value is everything after the first space of the line
+            for(uint16_t i = 0; i < keyword.size - 1; i++) {
+                field[i] = i % 7 == 3 ? ' ' : 'a' + (i % 26);
+            }
+            field[keyword.size - 1] = '\0';
+            break;
+        case ConfigFileHex:
+            for(uint16_t i = 0; i < keyword.size; i++) {
+                field[i] = i * 17 + 5;
+            }
+            break;
+        case ConfigFileParity:
+            *field = 11;
+            break;
+    }
+}
+
+static Configs written, read;
+
+void setUp(void) {
+    memset(&written, 0, sizeof(written));
+    memset(&read, 0, sizeof(read));
+}
+
+void tearDown(void) {}
+
+void test_table_is_sorted_and_fields_fit(void) {
+    for(size_t i = 0; i < KEYWORD_COUNT; i++) {
+        const ConfigFileKeyword& keyword = ConfigFileKeywords[i];
+        if(i > 0 && strcmp(ConfigFileKeywords[i - 1].key, keyword.key) >= 0) {
+            TEST_FAIL_MESSAGE(keyword.key);
+        }
+        ConfigFileKeyword found;
+        TEST_ASSERT_TRUE(configFileKeyword(keyword.key, found));
+        TEST_ASSERT_EQUAL(keyword.offset, found.offset);
+
+        size_t size;
+        uint8_t* target = targetOf(written, keyword.target, size);
+        if(keyword.type <= ConfigFileParity) {
+            TEST_ASSERT_NOT_NULL(target);
+            TEST_ASSERT_TRUE(keyword.offset + keyword.size <= size);
+        }
+    }
+    ConfigFileKeyword keyword;
+    TEST_ASSERT_FALSE(configFileKeyword("", keyword));
+    TEST_ASSERT_FALSE(configFileKeyword("aaa", keyword));
+    TEST_ASSERT_FALSE(configFileKeyword("zzz", keyword));
+    TEST_ASSERT_FALSE(configFileKeyword("mqtthost", keyword));
+}
+
+void test_every_field_round_trips(void) {
+    uint16_t count = 0;
+    for(size_t i = 0; i < KEYWORD_COUNT; i++) {
+        const ConfigFileKeyword& keyword = ConfigFileKeywords[i];
+        if(keyword.type > ConfigFileParity) continue;
+
+        setUp();
+        size_t size;
+        uint8_t* source = targetOf(written, keyword.target, size);
+        uint8_t* target = targetOf(read, keyword.target, size);
+        fill(source + keyword.offset, keyword);
+
+        char line[CONFIG_FILE_LINE_SIZE];
+        size_t length = configFileFormat(line, sizeof(line), keyword.key, source);
+        if(length == 0) TEST_FAIL_MESSAGE(keyword.key);
+        TEST_ASSERT_EQUAL(strlen(line), length);
+        TEST_ASSERT_EQUAL('\n', line[length - 1]);
+        TEST_ASSERT_EQUAL(0, strncmp(line, keyword.key, strlen(keyword.key)));
+
+        TEST_ASSERT_TRUE(parseLine(read, line));
+        if(memcmp(source + keyword.offset, target + keyword.offset, keyword.size) != 0) {
+            TEST_FAIL_MESSAGE(line);
+        }
+        // Nothing but the field itself is touched
+        TEST_ASSERT_EQUAL(0, memcmp(&written, &read, sizeof(written)));
+        count++;
+    }
+    TEST_ASSERT_TRUE(count > 70);
+}
+
+void test_thresholds_round_trip(void) {
+    for(uint8_t i = 0; i < 10; i++) {
+        written.eac.thresholds[i] = (i + 1) * 5;
+    }
+    written.eac.thresholds[9] = 65535;
+    written.eac.hours = 3;
+
+    char line[CONFIG_FILE_LINE_SIZE];
+    TEST_ASSERT_TRUE(configFileFormat(line, sizeof(line), "thresholds", (uint8_t*) &written.eac) > 0);
+    TEST_ASSERT_EQUAL_STRING("thresholds 5 10 15 20 25 30 35 40 45 65535 3\n", line);
+    TEST_ASSERT_TRUE(parseLine(read, line));
+    TEST_ASSERT_EQUAL(0, memcmp(&written.eac, &read.eac, sizeof(written.eac)));
+}
+
+void test_lines_read_by_earlier_firmware(void) {
+    // Files already downloaded must keep loading, and new files must load on older firmware
+    char line[CONFIG_FILE_LINE_SIZE];
+    written.gpio.vccOffset = -35;
+    written.gpio.vccMultiplier = 1100;
+    written.gpio.vccBootLimit = 33;
+    written.mqtt.deadbandVoltage = 25;
+    written.mqtt.deadbandCurrent = 5;
+    written.mqtt.ssl = true;
+    written.meter.baud = 2400;
+    written.meter.parity = 3;
+    for(uint8_t i = 0; i < 16; i++) written.meter.encryptionKey[i] = 0xA0 + i;
+    strcpy(written.ntp.timezone, "Europe/Oslo");
+
+    configFileFormat(line, sizeof(line), "gpioVccOffset", (uint8_t*) &written.gpio);
+    TEST_ASSERT_EQUAL_STRING("gpioVccOffset -0.35\n", line);
+    configFileFormat(line, sizeof(line), "gpioVccMultiplier", (uint8_t*) &written.gpio);
+    TEST_ASSERT_EQUAL_STRING("gpioVccMultiplier 1.100\n", line);
+    configFileFormat(line, sizeof(line), "gpioVccBootLimit", (uint8_t*) &written.gpio);
+    TEST_ASSERT_EQUAL_STRING("gpioVccBootLimit 3.3\n", line);
+    configFileFormat(line, sizeof(line), "mqttDeadbandVoltage", (uint8_t*) &written.mqtt);
+    TEST_ASSERT_EQUAL_STRING("mqttDeadbandVoltage 2.5\n", line);
+    configFileFormat(line, sizeof(line), "mqttDeadbandCurrent", (uint8_t*) &written.mqtt);
+    TEST_ASSERT_EQUAL_STRING("mqttDeadbandCurrent 0.05\n", line);
+    configFileFormat(line, sizeof(line), "mqttSsl", (uint8_t*) &written.mqtt);
+    TEST_ASSERT_EQUAL_STRING("mqttSsl 1\n", line);
+    configFileFormat(line, sizeof(line), "meterBaud", (uint8_t*) &written.meter);
+    TEST_ASSERT_EQUAL_STRING("meterBaud 2400\n", line);
+    configFileFormat(line, sizeof(line), "meterParity", (uint8_t*) &written.meter);
+    TEST_ASSERT_EQUAL_STRING("meterParity 8N1\n", line);
+    configFileFormat(line, sizeof(line), "meterEncryptionKey", (uint8_t*) &written.meter);
+    TEST_ASSERT_EQUAL_STRING("meterEncryptionKey A0A1A2A3A4A5A6A7A8A9AAABACADAEAF\n", line);
+    configFileFormat(line, sizeof(line), "ntpTimezone", (uint8_t*) &written.ntp);
+    TEST_ASSERT_EQUAL_STRING("ntpTimezone Europe/Oslo\n", line);
+
+    // Hand written values and the old names of the price keys
+    TEST_ASSERT_TRUE(parseLine(read, "gpioVccOffset -0.35"));
+    TEST_ASSERT_EQUAL(-35, read.gpio.vccOffset);
+    TEST_ASSERT_TRUE(parseLine(read, "mqttDeadbandCurrent 2.55"));
+    TEST_ASSERT_EQUAL(255, read.mqtt.deadbandCurrent);
+    TEST_ASSERT_TRUE(parseLine(read, "meterEncryptionKey a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"));
+    TEST_ASSERT_EQUAL(0, memcmp(written.meter.encryptionKey, read.meter.encryptionKey, 16));
+    TEST_ASSERT_TRUE(parseLine(read, "entsoeToken 01234567-89ab-cdef-0123-456789abcdef"));
+    TEST_ASSERT_EQUAL_STRING("01234567-89ab-cdef-0123-456789abcdef", read.price.entsoeToken);
+}
+
+void test_nothing_written_that_would_read_back_wrong(void) {
+    char line[CONFIG_FILE_LINE_SIZE];
+    written.meter.parity = 0;
+    TEST_ASSERT_EQUAL(0, configFileFormat(line, sizeof(line), "meterParity", (uint8_t*) &written.meter));
+    TEST_ASSERT_EQUAL(0, configFileFormat(line, sizeof(line), "notAKey", (uint8_t*) &written.meter));
+    TEST_ASSERT_EQUAL(0, configFileFormat(line, sizeof(line), "dayplot", (uint8_t*) &written.meter));
+    TEST_ASSERT_EQUAL(0, configFileFormat(line, sizeof(line), "meterBaud", NULL));
+
+    // A line cut short by the buffer is left out instead
+    strcpy(written.mqtt.host, "broker.example.com");
+    TEST_ASSERT_EQUAL(0, configFileFormat(line, 20, "mqttHost", (uint8_t*) &written.mqtt));
+    TEST_ASSERT_EQUAL(28, configFileFormat(line, 29, "mqttHost", (uint8_t*) &written.mqtt));
+}
+
+void test_values_are_bounded_by_the_field(void) {
+    std::string longHost = "mqttHost " + std::string(300, 'h');
+    TEST_ASSERT_TRUE(parseLine(read, longHost.c_str()));
+    TEST_ASSERT_EQUAL(sizeof(read.mqtt.host) - 1, strlen(read.mqtt.host));
+    TEST_ASSERT_EQUAL(0, read.mqtt.port);
+
+    // Key without a value is ignored, unknown keys and plots are left to the caller
+    TEST_ASSERT_FALSE(parseLine(read, "mqttHost"));
+    TEST_ASSERT_FALSE(parseLine(read, "unknown 1"));
+    char plot[] = "1 2 3";
+    ConfigFileKeyword keyword;
+    TEST_ASSERT_TRUE(configFileKeyword("monthplot", keyword));
+    TEST_ASSERT_FALSE(configFileSetValue(keyword, (uint8_t*) &read.meter, plot));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_table_is_sorted_and_fields_fit);
+    RUN_TEST(test_every_field_round_trips);
+    RUN_TEST(test_thresholds_round_trip);
+    RUN_TEST(test_lines_read_by_earlier_firmware);
+    RUN_TEST(test_nothing_written_that_would_read_back_wrong);
+    RUN_TEST(test_values_are_bounded_by_the_field);
+    return UNITY_END();
+}
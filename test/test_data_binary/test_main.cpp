@@ -0,0 +1,419 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include "Arduino.h"
+
+// Stand-ins for accounting and hardware, defined under the include guards of the real headers so
+// AmsDataBinary.h and DataSnapshot.h pick these up instead
+#define _ENERGYACCOUNTING_H
+#define _HWTOOLS_H
+#define PRICE_NO_VALUE -127
+#define PRICE_DIRECTION_IMPORT 0x01
+#define PRICE_DIRECTION_EXPORT 0x02
+#define DEVICE_DISCONNECTED_C -127
+
+class EnergyAccounting {
+public:
+    float importPrice = PRICE_NO_VALUE, exportPrice = PRICE_NO_VALUE;
+    bool initialized = false;
+    float hour[4] = {0}, day[4] = {0}, month[4] = {0};
+    float monthMax = 0;
+    uint8_t threshold = 0;
+
+    float getPriceForHour(uint8_t d, uint8_t h) { return d == PRICE_DIRECTION_IMPORT ? importPrice : exportPrice; }
+    bool isInitialized() { return initialized; }
+    float getUseThisHour() { return hour[0]; }
+    float getCostThisHour() { return hour[1]; }
+    float getProducedThisHour() { return hour[2]; }
+    float getIncomeThisHour() { return hour[3]; }
+    float getUseToday() { return day[0]; }
+    float getCostToday() { return day[1]; }
+    float getProducedToday() { return day[2]; }
+    float getIncomeToday() { return day[3]; }
+    float getUseThisMonth() { return month[0]; }
+    float getCostThisMonth() { return month[1]; }
+    float getProducedThisMonth() { return month[2]; }
+    float getIncomeThisMonth() { return month[3]; }
+    float getMonthMax() { return monthMax; }
+    uint8_t getCurrentThreshold() { return threshold; }
+};
+
+class HwTools {
+public:
+    float vcc = 0, temperature = DEVICE_DISCONNECTED_C;
+    int rssi = 0;
+
+    float getVcc() { return vcc; }
+    int getWifiRssi() { return rssi; }
+    float getTemperature() { return temperature; }
+};
+
+#include "AmsDataBinary.h"
+#include "AmsData/src/AmsData.cpp"
+#include "AmsDataBinary/src/AmsDataBinary.cpp"
+#include "AmsMqttHandler/src/DataSnapshot.cpp"
+#include "Uptime/src/Uptime.cpp"
+
+class TestData : public AmsData {
+public:
+    void setThreePhase() {
+        listType = 3;
+        meterType = AmsTypeKaifa;
+        meterTimestamp = 1700000000;
+        activeImportPower = 4321;
+        activeExportPower = 0;
+        reactiveImportPower = 120;
+        reactiveExportPower = 7;
+        activeImportCounter = 12345.678;
+        activeExportCounter = 1.5;
+        reactiveImportCounter = 200.0004;
+        reactiveExportCounter = 3.0006;
+        powerFactor = 0.953;
+        l1voltage = 231.4;
+        l1current = -5.12;
+        l1activeImportPower = 1000;
+        l1PowerFactor = 1;
+        l2voltage = 229.96;
+        l2current = 400; // Beyond what fits i16 x100
+        l2activeImportPower = 3000;
+        l2PowerFactor = -0.5;
+        l3voltage = 230.04;
+        l3current = 1.005;
+        l3activeImportPower = 321;
+        l3activeExportPower = 17;
+        l3PowerFactor = 0.25;
+        threePhase = true;
+        l2currentMissing = true;
+        // Only reported once it repeats
+        for(int i = 0; i < 3; i++) setLastError(-3);
+    }
+
+    void setSinglePhase() {
+        listType = 1;
+        meterType = AmsTypeAidon;
+        activeImportPower = 500;
+    }
+
+    void setImportCounter(double value) {
+        activeImportCounter = value;
+    }
+};
+
+// Group sizes from the schema in AmsDataBinary.h, which is all a client has to decode with
+static const uint8_t GROUP_SIZE[] = { 16, 16, 2, 14, 14, 14, 8, 4, 4, 16, 16, 16, 5, 7, 2 };
+#define KNOWN_GROUPS (sizeof(GROUP_SIZE) / sizeof(GROUP_SIZE[0]))
+
+struct Reader {
+    const uint8_t* p;
+
+    uint8_t u8() { return *p++; }
+    int8_t i8() { return (int8_t) u8(); }
+    uint16_t u16() { uint16_t v = p[0] | (p[1] << 8); p += 2; return v; }
+    int16_t i16() { return (int16_t) u16(); }
+    uint32_t u32() { uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); p += 4; return v; }
+    int32_t i32() { return (int32_t) u32(); }
+};
+
+struct Decoded {
+    uint8_t version;
+    uint8_t headerSize;
+    uint16_t length;
+    uint32_t presence;
+    uint32_t time;
+    const uint8_t* group[32];
+};
+
+// Decodes the way the schema describes, stopping at the first group it does not know
+static bool decode(const uint8_t* buf, size_t size, Decoded& d) {
+    memset(&d, 0, sizeof(d));
+    if(size < AMS_BINARY_HEADER_SIZE) return false;
+    Reader r = { buf };
+    d.version = r.u8();
+    d.headerSize = r.u8();
+    d.length = r.u16();
+    d.presence = r.u32();
+    d.time = r.u32();
+    if(d.version != 1 || d.length > size || d.headerSize > d.length) return false;
+
+    size_t pos = d.headerSize;
+    for(uint8_t bit = 0; bit < 32; bit++) {
+        if(!(d.presence & (1UL << bit))) continue;
+        if(bit >= KNOWN_GROUPS) return true;
+        if(pos + GROUP_SIZE[bit] > d.length) return false;
+        d.group[bit] = buf + pos;
+        pos += GROUP_SIZE[bit];
+    }
+    return pos == d.length;
+}
+
+static TestData data;
+static EnergyAccounting ea;
+static HwTools hw;
+static DataSnapshot* snapshot;
+static uint8_t buf[AMS_BINARY_MAX_SIZE];
+
+void setUp() {
+    data = TestData();
+    ea = EnergyAccounting();
+    hw = HwTools();
+    snapshot = new DataSnapshot(&hw, &ea);
+    memset(buf, 0xEE, sizeof(buf));
+    stubMillis = 3723000;
+}
+
+void tearDown() {
+    delete snapshot;
+}
+
+void test_empty() {
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, NULL, NULL, 0);
+    TEST_ASSERT_EQUAL(AMS_BINARY_HEADER_SIZE, len);
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    TEST_ASSERT_EQUAL(AMS_BINARY_VERSION, d.version);
+    TEST_ASSERT_EQUAL(AMS_BINARY_HEADER_SIZE, d.headerSize);
+    TEST_ASSERT_EQUAL(len, d.length);
+    TEST_ASSERT_EQUAL_HEX32(0, d.presence);
+    TEST_ASSERT_EQUAL(0, d.time);
+}
+
+void test_buffer_too_small() {
+    AmsDataBinary bin(buf, AMS_BINARY_MAX_SIZE - 1);
+    data.setThreePhase();
+    TEST_ASSERT_EQUAL(0, bin.encode(&data, &ea, snapshot, 1700000100));
+}
+
+void test_three_phase_meter() {
+    data.setThreePhase();
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, NULL, NULL, 1700000100);
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    TEST_ASSERT_EQUAL(1700000100, d.time);
+    TEST_ASSERT_EQUAL_HEX32(0x7F, d.presence);
+
+    Reader r = { d.group[AmsBinaryPower] };
+    TEST_ASSERT_EQUAL(4321, r.u32());
+    TEST_ASSERT_EQUAL(0, r.u32());
+    TEST_ASSERT_EQUAL(120, r.u32());
+    TEST_ASSERT_EQUAL(7, r.u32());
+
+    r = { d.group[AmsBinaryCounters] };
+    TEST_ASSERT_EQUAL(12345678, r.u32());
+    TEST_ASSERT_EQUAL(1500, r.u32());
+    TEST_ASSERT_EQUAL(200000, r.u32());
+    TEST_ASSERT_EQUAL(3001, r.u32());
+
+    r = { d.group[AmsBinaryPowerFactor] };
+    TEST_ASSERT_EQUAL(953, r.i16());
+
+    r = { d.group[AmsBinaryL1] };
+    TEST_ASSERT_EQUAL(2314, r.u16());
+    TEST_ASSERT_EQUAL(-512, r.i16());
+    TEST_ASSERT_EQUAL(1000, r.u32());
+    TEST_ASSERT_EQUAL(0, r.u32());
+    TEST_ASSERT_EQUAL(1000, r.i16());
+
+    r = { d.group[AmsBinaryL2] };
+    TEST_ASSERT_EQUAL(2300, r.u16());
+    TEST_ASSERT_EQUAL(INT16_MAX, r.i16());
+    TEST_ASSERT_EQUAL(3000, r.u32());
+    TEST_ASSERT_EQUAL(0, r.u32());
+    TEST_ASSERT_EQUAL(-500, r.i16());
+
+    r = { d.group[AmsBinaryL3] };
+    TEST_ASSERT_EQUAL(2300, r.u16());
+    TEST_ASSERT_EQUAL(101, r.i16());
+    TEST_ASSERT_EQUAL(321, r.u32());
+    TEST_ASSERT_EQUAL(17, r.u32());
+    TEST_ASSERT_EQUAL(250, r.i16());
+
+    r = { d.group[AmsBinaryMeter] };
+    TEST_ASSERT_EQUAL(1700000000, r.u32());
+    TEST_ASSERT_EQUAL(3, r.u8());
+    TEST_ASSERT_EQUAL(AmsTypeKaifa, r.u8());
+    TEST_ASSERT_EQUAL_HEX8(0x09, r.u8());
+    TEST_ASSERT_EQUAL(-3, r.i8());
+}
+
+void test_single_phase_leaves_out_what_is_missing() {
+    data.setSinglePhase();
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, NULL, NULL, 0);
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    TEST_ASSERT_EQUAL_HEX32((1 << AmsBinaryPower) | (1 << AmsBinaryMeter), d.presence);
+    TEST_ASSERT_EQUAL(AMS_BINARY_HEADER_SIZE + 16 + 8, len);
+    Reader r = { d.group[AmsBinaryMeter] };
+    TEST_ASSERT_EQUAL(0, r.u32());
+    TEST_ASSERT_EQUAL(1, r.u8());
+    TEST_ASSERT_EQUAL(AmsTypeAidon, r.u8());
+    TEST_ASSERT_EQUAL_HEX8(0x00, r.u8());
+}
+
+void test_accounting_and_device() {
+    data.setThreePhase();
+    ea.importPrice = 1.2345;
+    ea.exportPrice = -0.05;
+    ea.initialized = true;
+    float hour[4] = { 0.5, 0.617, 0, 0 };
+    float day[4] = { 10.25, -1.5, 2, 0.3 };
+    float month[4] = { 300, 400.125, 20, 3 };
+    memcpy(ea.hour, hour, sizeof(hour));
+    memcpy(ea.day, day, sizeof(day));
+    memcpy(ea.month, month, sizeof(month));
+    ea.monthMax = 4.56;
+    ea.threshold = 5;
+    hw.vcc = 3.287;
+    hw.rssi = -67;
+    hw.temperature = 21.37;
+
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, &ea, snapshot, 1700000100);
+    TEST_ASSERT_LESS_OR_EQUAL(AMS_BINARY_MAX_SIZE, len);
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    TEST_ASSERT_EQUAL_HEX32(0x7FFF, d.presence);
+    // Every group present, the length is the sum of the schema sizes
+    size_t expected = AMS_BINARY_HEADER_SIZE;
+    for(uint8_t i = 0; i < KNOWN_GROUPS; i++) expected += GROUP_SIZE[i];
+    TEST_ASSERT_EQUAL(expected, len);
+
+    Reader r = { d.group[AmsBinaryPriceImport] };
+    TEST_ASSERT_EQUAL(12345, r.i32());
+    r = { d.group[AmsBinaryPriceExport] };
+    TEST_ASSERT_EQUAL(-500, r.i32());
+
+    r = { d.group[AmsBinaryHour] };
+    TEST_ASSERT_EQUAL(500, r.u32());
+    TEST_ASSERT_EQUAL(617, r.i32());
+    TEST_ASSERT_EQUAL(0, r.u32());
+    TEST_ASSERT_EQUAL(0, r.i32());
+    r = { d.group[AmsBinaryDay] };
+    TEST_ASSERT_EQUAL(10250, r.u32());
+    TEST_ASSERT_EQUAL(-1500, r.i32());
+    TEST_ASSERT_EQUAL(2000, r.u32());
+    TEST_ASSERT_EQUAL(300, r.i32());
+    r = { d.group[AmsBinaryMonth] };
+    TEST_ASSERT_EQUAL(300000, r.u32());
+    TEST_ASSERT_EQUAL(400125, r.i32());
+    TEST_ASSERT_EQUAL(20000, r.u32());
+    TEST_ASSERT_EQUAL(3000, r.i32());
+
+    r = { d.group[AmsBinaryTariff] };
+    TEST_ASSERT_EQUAL(4560, r.u32());
+    TEST_ASSERT_EQUAL(5, r.u8());
+
+    r = { d.group[AmsBinaryDevice] };
+    TEST_ASSERT_EQUAL(3723, r.u32());
+    TEST_ASSERT_EQUAL(3287, r.u16());
+    TEST_ASSERT_EQUAL(-67, r.i8());
+
+    r = { d.group[AmsBinaryTemperature] };
+    TEST_ASSERT_EQUAL(2137, r.i16());
+}
+
+void test_no_prices_until_accounting_initialized() {
+    ea.importPrice = 1;
+    hw.vcc = 3.3;
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, &ea, snapshot, 0);
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    TEST_ASSERT_EQUAL_HEX32((1 << AmsBinaryPriceImport) | (1 << AmsBinaryDevice), d.presence);
+}
+
+void test_device_values_are_those_of_the_frame() {
+    hw.vcc = 3.3;
+    hw.rssi = -50;
+    AmsDataBinary bin(buf, sizeof(buf));
+    bin.encode(&data, &ea, snapshot, 0);
+
+    // Read once per frame like data.json and MQTT, a new reading shows after the next frame
+    hw.vcc = 2.9;
+    hw.rssi = -80;
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, bin.encode(&data, &ea, snapshot, 0), d));
+    Reader r = { d.group[AmsBinaryDevice] };
+    r.u32();
+    TEST_ASSERT_EQUAL(3300, r.u16());
+    TEST_ASSERT_EQUAL(-50, r.i8());
+
+    snapshot->update();
+    TEST_ASSERT_TRUE(decode(buf, bin.encode(&data, &ea, snapshot, 0), d));
+    r = { d.group[AmsBinaryDevice] };
+    r.u32();
+    TEST_ASSERT_EQUAL(2900, r.u16());
+    TEST_ASSERT_EQUAL(-80, r.i8());
+}
+
+void test_counter_clamped() {
+    data.setSinglePhase();
+    data.setImportCounter(5000000.0); // 5 GWh does not fit u32 Wh
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, NULL, NULL, 0);
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    Reader r = { d.group[AmsBinaryCounters] };
+    TEST_ASSERT_EQUAL(UINT32_MAX, r.u32());
+}
+
+void test_decoder_stops_at_unknown_group() {
+    data.setSinglePhase();
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, NULL, NULL, 0);
+
+    // A later firmware adds group 20 with 6 bytes
+    uint32_t presence = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t) buf[7] << 24);
+    presence |= 1UL << 20;
+    memcpy(buf + 4, &presence, 4);
+    memset(buf + len, 0x55, 6);
+    len += 6;
+    buf[2] = len & 0xFF;
+    buf[3] = len >> 8;
+
+    Decoded d;
+    TEST_ASSERT_TRUE(decode(buf, len, d));
+    TEST_ASSERT_NOT_NULL(d.group[AmsBinaryPower]);
+    TEST_ASSERT_NOT_NULL(d.group[AmsBinaryMeter]);
+    Reader r = { d.group[AmsBinaryPower] };
+    TEST_ASSERT_EQUAL(500, r.u32());
+}
+
+void test_truncated_frame_rejected() {
+    data.setThreePhase();
+    AmsDataBinary bin(buf, sizeof(buf));
+    uint16_t len = bin.encode(&data, NULL, NULL, 0);
+
+    Decoded d;
+    TEST_ASSERT_FALSE(decode(buf, len - 1, d));
+    buf[2] = (len - 1) & 0xFF;
+    buf[3] = (len - 1) >> 8;
+    TEST_ASSERT_FALSE(decode(buf, len, d));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_empty);
+    RUN_TEST(test_buffer_too_small);
+    RUN_TEST(test_three_phase_meter);
+    RUN_TEST(test_single_phase_leaves_out_what_is_missing);
+    RUN_TEST(test_accounting_and_device);
+    RUN_TEST(test_no_prices_until_accounting_initialized);
+    RUN_TEST(test_device_values_are_those_of_the_frame);
+    RUN_TEST(test_counter_clamped);
+    RUN_TEST(test_decoder_stops_at_unknown_group);
+    RUN_TEST(test_truncated_frame_rejected);
+    return UNITY_END();
+}
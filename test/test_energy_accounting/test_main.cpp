@@ -0,0 +1,155 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include "EnergyIntegrator.h"
+#include "EnergyAccounting/src/EnergyIntegrator.cpp"
+
+// Deterministic pseudo random source, so a failing month can be replayed
+static uint32_t seed;
+static uint32_t next(uint32_t max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+void setUp() {
+    seed = 20231001;
+}
+
+void tearDown() {}
+
+void test_one_mwh_from_single_milliseconds() {
+    uint16_t remainder = 0;
+    uint32_t mwh = 0;
+    for(int i = 0; i < 3599; i++) {
+        mwh += EnergyIntegrator::energy(1, 1, remainder);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, mwh);
+    TEST_ASSERT_EQUAL_UINT16(3599, remainder);
+    mwh += EnergyIntegrator::energy(1, 1, remainder);
+    TEST_ASSERT_EQUAL_UINT32(1, mwh);
+    TEST_ASSERT_EQUAL_UINT16(0, remainder);
+}
+
+void test_one_kwh_from_an_hour_of_frames() {
+    uint16_t remainder = 0;
+    uint32_t mwh = 0;
+    // 2.5s frames at 1kW, 1440 of them is an hour
+    for(int i = 0; i < 1440; i++) {
+        mwh += EnergyIntegrator::energy(1000, 2500, remainder);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1000000, mwh);
+    TEST_ASSERT_EQUAL_UINT16(0, remainder);
+}
+
+void test_large_product_does_not_overflow() {
+    uint16_t remainder = 3599;
+    // 65kW over a 20 minute gap is beyond 32 bits of Watt-milliseconds
+    uint32_t mwh = EnergyIntegrator::energy(65000, 1200000, remainder);
+    TEST_ASSERT_EQUAL_UINT32(21666667, mwh);
+    TEST_ASSERT_EQUAL_UINT16(2399, remainder);
+}
+
+void test_money_keeps_fractions() {
+    int32_t remainder = 0;
+    int64_t total = 0;
+    // 1 mWh at 0.999999 per kWh is 0.999999 micro-currency, a thousand of them is 999.999
+    for(int i = 0; i < 1000; i++) {
+        total += EnergyIntegrator::money(1, 999999, remainder);
+    }
+    TEST_ASSERT_EQUAL_INT64(999, total);
+    TEST_ASSERT_EQUAL_INT32(999000, remainder);
+    total += EnergyIntegrator::money(1, 1000, remainder);
+    TEST_ASSERT_EQUAL_INT64(1000, total);
+    TEST_ASSERT_EQUAL_INT32(0, remainder);
+}
+
+void test_money_negative_price() {
+    int32_t remainder = 0;
+    int64_t total = 0;
+    for(int i = 0; i < 3; i++) {
+        total += EnergyIntegrator::money(500, -1000, remainder);
+    }
+    // -0.5 micro-currency per step, whole units are only counted once reached
+    TEST_ASSERT_EQUAL_INT64(-1, total);
+    TEST_ASSERT_EQUAL_INT32(-500000, remainder);
+}
+
+/**
+ * Replays a 31 day month of frames with varying interval, power and hourly price, both ways.
+ * Every Watt-millisecond and every fraction of micro-currency must end up either in the totals or
+ * in the remainders, so the totals are checked against sums computed without any rounding.
+ */
+void test_month_replay_is_exact() {
+    uint16_t useRemainder = 0, produceRemainder = 0;
+    int32_t costRemainder = 0, incomeRemainder = 0;
+    uint64_t use = 0, produce = 0;
+    int64_t cost = 0, income = 0;
+
+    uint64_t useWms = 0, produceWms = 0;
+    int64_t costExact = 0, incomeExact = 0; // 1/1000000 micro-currency
+
+    uint64_t now = 0;
+    uint64_t end = 31ULL * 24 * 3600 * 1000;
+    int32_t price = 0;
+    uint32_t hour = UINT32_MAX;
+    uint32_t frames = 0;
+    while(now < end) {
+        unsigned long ms = 1900 + next(1200);
+        // Every now and then the meter drops out for a while
+        if(next(5000) == 0) ms += next(600000);
+        now += ms;
+        frames++;
+
+        if(now / 3600000 != hour) {
+            hour = now / 3600000;
+            // Prices in micro-currency per kWh, sometimes negative
+            price = (int32_t) next(4000000) - 500000;
+        }
+
+        uint32_t importPower = next(3) == 0 ? 0 : next(17000);
+        uint32_t exportPower = importPower > 0 ? 0 : next(9000);
+
+        uint32_t mwhi = EnergyIntegrator::energy(importPower, ms, useRemainder);
+        use += mwhi;
+        cost += EnergyIntegrator::money(mwhi, price, costRemainder);
+        useWms += (uint64_t) importPower * ms;
+        costExact += (int64_t) price * mwhi;
+
+        uint32_t mwhe = EnergyIntegrator::energy(exportPower, ms, produceRemainder);
+        produce += mwhe;
+        income += EnergyIntegrator::money(mwhe, price, incomeRemainder);
+        produceWms += (uint64_t) exportPower * ms;
+        incomeExact += (int64_t) price * mwhe;
+    }
+
+    TEST_ASSERT_GREATER_THAN_UINT32(1000000, frames);
+
+    TEST_ASSERT_LESS_THAN_UINT16(3600, useRemainder);
+    TEST_ASSERT_TRUE(use * 3600 + useRemainder == useWms);
+    TEST_ASSERT_TRUE(use == useWms / 3600);
+
+    TEST_ASSERT_LESS_THAN_UINT16(3600, produceRemainder);
+    TEST_ASSERT_TRUE(produce * 3600 + produceRemainder == produceWms);
+    TEST_ASSERT_TRUE(produce == produceWms / 3600);
+
+    TEST_ASSERT_TRUE(costRemainder > -1000000 && costRemainder < 1000000);
+    TEST_ASSERT_TRUE(cost * 1000000 + costRemainder == costExact);
+
+    TEST_ASSERT_TRUE(incomeRemainder > -1000000 && incomeRemainder < 1000000);
+    TEST_ASSERT_TRUE(income * 1000000 + incomeRemainder == incomeExact);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_one_mwh_from_single_milliseconds);
+    RUN_TEST(test_one_kwh_from_an_hour_of_frames);
+    RUN_TEST(test_large_product_does_not_overflow);
+    RUN_TEST(test_money_keeps_fractions);
+    RUN_TEST(test_money_negative_price);
+    RUN_TEST(test_month_replay_is_exact);
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include "LittleFS.h"
+#include "TimeLib.h"
+
+// The archive only reads the day plot, the rest of the storage class stays out of the test
+#define _AMSDATASTORAGE_H
+#include "StateJournal.h"
+
+struct DayDataPoints {
+    uint8_t version;
+    uint16_t hImport[24];
+    time_t lastMeterReadTime;
+    uint64_t activeImport;
+    uint64_t activeExport;
+    uint16_t hExport[24];
+    uint8_t accuracy;
+};
+
+class AmsDataStorage {
+public:
+    DayDataPoints day;
+    DayDataPoints getDayData() { return day; }
+    uint32_t getHourImport(uint8_t hour) { return day.hImport[hour]; }
+    uint32_t getHourExport(uint8_t hour) { return day.hExport[hour]; }
+};
+
+#include "AmsDataStorage/src/EnergyArchive.cpp"
+#include "AmsDataStorage/src/StateJournal.cpp"
+#include "AmsDecoder/src/crc.cpp"
+
+long FirmwareVersion::BuildEpoch = 1672531200; // 2023-01-01
+const char* FirmwareVersion::VersionString = "test";
+
+#define JAN_1_2024 1704067200
+#define INDEX_SIZE (ENERGY_ARCHIVE_DAYS * sizeof(uint32_t))
+
+static EnergyArchive* archive;
+
+void setUp() {
+    LittleFS.reset();
+    StateJournal::mount();
+    archive = new EnergyArchive(&Serial);
+}
+
+void tearDown() {
+    delete archive;
+}
+
+static void fill(EnergyArchiveDay& day, uint32_t import, uint32_t exp) {
+    for(uint8_t i = 0; i < 24; i++) {
+        day.hImport[i] = import == 0 ? 0 : import + i * 13;
+        day.hExport[i] = exp == 0 ? 0 : exp + (i % 5) * 101;
+    }
+}
+
+void test_new_file_holds_exactly_header_and_index() {
+    EnergyArchiveDay day;
+    fill(day, 500, 0);
+    TEST_ASSERT_TRUE(archive->setDay(JAN_1_2024, day));
+    archive->close();
+
+    std::string& file = LittleFS.files["/archive2024.bin"];
+    uint32_t offset;
+    memcpy(&offset, file.data() + sizeof(EnergyArchiveHeader), sizeof(offset));
+    // The first block starts right after the index, nothing is padded in between
+    TEST_ASSERT_EQUAL_UINT32(sizeof(EnergyArchiveHeader) + INDEX_SIZE, offset);
+    for(size_t i = sizeof(EnergyArchiveHeader) + sizeof(offset); i < offset; i++) {
+        TEST_ASSERT_EQUAL_UINT8(0, (uint8_t) file[i]);
+    }
+}
+
+void test_day_round_trip() {
+    EnergyArchiveDay day, read;
+    fill(day, 1200, 300);
+    time_t t = JAN_1_2024 + 45 * SECS_PER_DAY;
+    TEST_ASSERT_TRUE(archive->setDay(t, day));
+    TEST_ASSERT_TRUE(archive->getDay(t, read));
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(day.hImport, read.hImport, 24);
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(day.hExport, read.hExport, 24);
+
+    // Other days have no index entry
+    TEST_ASSERT_FALSE(archive->getDay(t + SECS_PER_DAY, read));
+}
+
+void test_last_day_of_leap_year() {
+    EnergyArchiveDay day, read;
+    fill(day, 0, 800);
+    time_t t = JAN_1_2024 + 365 * SECS_PER_DAY;
+    TEST_ASSERT_TRUE(archive->setDay(t, day));
+    TEST_ASSERT_TRUE(archive->getDay(t, read));
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(day.hExport, read.hExport, 24);
+    TEST_ASSERT_EQUAL_UINT32(0, read.hImport[0]);
+}
+
+void test_files_without_padding_and_with_old_padding_read_alike() {
+    EnergyArchiveDay day, read;
+    fill(day, 700, 0);
+    TEST_ASSERT_TRUE(archive->setDay(JAN_1_2024, day));
+    archive->close();
+
+    // Files created before the fix carry 8 zero bytes after the index, offsets are absolute so they still resolve
+    std::string& file = LittleFS.files["/archive2024.bin"];
+    size_t start = sizeof(EnergyArchiveHeader) + INDEX_SIZE;
+    file.insert(start, 8, '\0');
+    uint32_t offset = start + 8;
+    memcpy(&file[sizeof(EnergyArchiveHeader)], &offset, sizeof(offset));
+
+    TEST_ASSERT_TRUE(archive->getDay(JAN_1_2024, read));
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(day.hImport, read.hImport, 24);
+}
+
+void test_update_archives_the_previous_day_at_midnight() {
+    AmsDataStorage ds;
+    memset(&ds.day, 0, sizeof(ds.day));
+    for(uint8_t i = 0; i < 24; i++) ds.day.hImport[i] = 100 + i;
+    ds.day.lastMeterReadTime = JAN_1_2024 + 10 * SECS_PER_DAY + SECS_PER_HOUR;
+    TEST_ASSERT_FALSE(archive->update(&ds));
+
+    ds.day.lastMeterReadTime = JAN_1_2024 + 10 * SECS_PER_DAY;
+    TEST_ASSERT_TRUE(archive->update(&ds));
+    // Once archived the day is not written again
+    TEST_ASSERT_FALSE(archive->update(&ds));
+
+    EnergyArchiveDay read;
+    TEST_ASSERT_TRUE(archive->getDay(JAN_1_2024 + 9 * SECS_PER_DAY, read));
+    TEST_ASSERT_EQUAL_UINT32(123, read.hImport[23]);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_new_file_holds_exactly_header_and_index);
+    RUN_TEST(test_day_round_trip);
+    RUN_TEST(test_last_day_of_leap_year);
+    RUN_TEST(test_files_without_padding_and_with_old_padding_read_alike);
+    RUN_TEST(test_update_archives_the_previous_day_at_midnight);
+    return UNITY_END();
+}
@@ -0,0 +1,222 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include <math.h>
+#include <map>
+#include "Arduino.h"
+#include "TimeLib.h"
+
+// Stand-ins that record what the import stores, defined under the include guards of the real headers
+#define _AMSDATASTORAGE_H
+#define _ENERGYACCOUNTING_H
+#define _ENERGYARCHIVE_H
+
+class AmsDataStorage {
+public:
+    uint32_t hImport[24] = {0}, hExport[24] = {0}, dImport[32] = {0}, dExport[32] = {0};
+    bool saved = false;
+
+    void setHourImport(uint8_t hour, uint32_t v) { hImport[hour] = v; }
+    void setHourExport(uint8_t hour, uint32_t v) { hExport[hour] = v; }
+    void setDayImport(uint8_t day, uint32_t v) { dImport[day] = v; }
+    void setDayExport(uint8_t day, uint32_t v) { dExport[day] = v; }
+    bool save() { return saved = true; }
+};
+
+struct EnergyAccountingPeak {
+    uint8_t day;
+    uint16_t value;
+};
+
+struct EnergyAccountingData {
+    uint8_t version;
+    uint8_t month;
+    int32_t costYesterday;
+    int32_t costThisMonth;
+    int32_t costLastMonth;
+    int32_t incomeYesterday;
+    int32_t incomeThisMonth;
+    int32_t incomeLastMonth;
+    uint32_t lastMonthImport;
+    uint32_t lastMonthExport;
+    uint8_t lastMonthAccuracy;
+    EnergyAccountingPeak peaks[5];
+};
+
+class EnergyAccounting {
+public:
+    EnergyAccountingData data = {};
+    EnergyAccountingData getData() { return data; }
+    void setData(EnergyAccountingData& d) { data = d; }
+    bool save() { return true; }
+};
+
+struct EnergyArchiveDay {
+    uint32_t hImport[24];
+    uint32_t hExport[24];
+};
+
+class EnergyArchive {
+public:
+    std::map<time_t, EnergyArchiveDay> days;
+
+    bool getDay(time_t day, EnergyArchiveDay& data) {
+        if(days.count(day) == 0) return false;
+        data = days[day];
+        return true;
+    }
+    bool setDay(time_t day, EnergyArchiveDay& data) {
+        days[day] = data;
+        return true;
+    }
+};
+
+#include "SvelteUi/src/HistoryImport.cpp"
+
+#define OCT_17_2023 1697500800
+
+static AmsDataStorage* ds;
+static EnergyAccounting* ea;
+static EnergyArchive* archive;
+static HistoryImport* import;
+
+void setUp() {
+    ds = new AmsDataStorage();
+    ea = new EnergyAccounting();
+    archive = new EnergyArchive();
+    import = new HistoryImport(ds, ea, archive);
+}
+
+void tearDown() {
+    delete import;
+    delete archive;
+    delete ea;
+    delete ds;
+}
+
+static bool feed(const char* text) {
+    // Split unevenly, as upload chunks are
+    size_t length = strlen(text);
+    size_t half = length / 3;
+    import->write((const uint8_t*) text, half);
+    import->write((const uint8_t*) text + half, length - half);
+    return import->end();
+}
+
+void test_csv_with_header_order() {
+    TEST_ASSERT_TRUE(feed("series,key,export,import\r\nhour,3,5,100\nday,31,,2000\npeak,12,,1234\ncost,yesterday,1.5,12.25\n"));
+    TEST_ASSERT_EQUAL_UINT16(4, import->getRows());
+    TEST_ASSERT_EQUAL_UINT16(0, import->getErrors());
+    TEST_ASSERT_EQUAL_UINT32(100, ds->hImport[3]);
+    TEST_ASSERT_EQUAL_UINT32(5, ds->hExport[3]);
+    TEST_ASSERT_EQUAL_UINT32(2000, ds->dImport[31]);
+    TEST_ASSERT_EQUAL_UINT32(0, ds->dExport[31]);
+    TEST_ASSERT_EQUAL_UINT8(12, ea->data.peaks[0].day);
+    TEST_ASSERT_EQUAL_UINT16(123, ea->data.peaks[0].value);
+    TEST_ASSERT_EQUAL_INT32(1225, ea->data.costYesterday);
+    TEST_ASSERT_EQUAL_INT32(150, ea->data.incomeYesterday);
+    TEST_ASSERT_TRUE(ds->saved);
+}
+
+void test_ndjson_rows() {
+    TEST_ASSERT_TRUE(feed("{\"series\":\"hour\",\"key\":4,\"import\":77,\"export\":8}\n{\"series\":\"cost\",\"key\":\"lastmonth\",\"import\":3.33}"));
+    TEST_ASSERT_EQUAL_UINT16(2, import->getRows());
+    TEST_ASSERT_EQUAL_UINT32(77, ds->hImport[4]);
+    TEST_ASSERT_EQUAL_UINT32(8, ds->hExport[4]);
+    TEST_ASSERT_EQUAL_INT32(333, ea->data.costLastMonth);
+}
+
+void test_extra_columns_without_header_are_rejected() {
+    feed("hour,3,100,5,junk\nhour,4,200,6\n");
+    TEST_ASSERT_EQUAL_UINT16(1, import->getRows());
+    TEST_ASSERT_EQUAL_UINT16(1, import->getErrors());
+    TEST_ASSERT_EQUAL_UINT32(0, ds->hExport[3]);
+    TEST_ASSERT_EQUAL_UINT32(6, ds->hExport[4]);
+}
+
+void test_extra_columns_beyond_header_are_rejected() {
+    // Unknown columns named in the header are allowed and skipped, one more than the header is not
+    feed("series,key,import,note,export\nhour,3,100,x,5\nhour,4,200,x,6,7\nhour,5,300\n");
+    TEST_ASSERT_EQUAL_UINT16(2, import->getRows());
+    TEST_ASSERT_EQUAL_UINT16(1, import->getErrors());
+    TEST_ASSERT_EQUAL_UINT32(5, ds->hExport[3]);
+    TEST_ASSERT_EQUAL_UINT32(0, ds->hImport[4]);
+    TEST_ASSERT_EQUAL_UINT32(300, ds->hImport[5]);
+}
+
+void test_too_many_columns_for_any_header() {
+    feed("series,key,import,export,a,b,c,d,e\nhour,3,100,5\n");
+    TEST_ASSERT_EQUAL_UINT16(1, import->getRows());
+    TEST_ASSERT_EQUAL_UINT16(1, import->getErrors());
+    feed("hour,3,1,2,3,4,5,6,7,8,9\n");
+    TEST_ASSERT_EQUAL_UINT16(2, import->getErrors());
+}
+
+void test_archive_rows_of_a_day_are_written_together() {
+    char text[2048] = "";
+    for(uint8_t h = 0; h < 24; h++) {
+        char row[64];
+        snprintf(row, sizeof(row), "archive,%ld,%u,%u\n", (long) (OCT_17_2023 + h * SECS_PER_HOUR), 100 + h, h);
+        strcat(text, row);
+    }
+    TEST_ASSERT_TRUE(feed(text));
+    TEST_ASSERT_EQUAL_UINT16(24, import->getRows());
+    TEST_ASSERT_EQUAL_UINT16(0, import->getMissingHours());
+    TEST_ASSERT_EQUAL_UINT32(1, archive->days.size());
+    TEST_ASSERT_EQUAL_UINT32(123, archive->days[OCT_17_2023].hImport[23]);
+    TEST_ASSERT_EQUAL_UINT32(23, archive->days[OCT_17_2023].hExport[23]);
+}
+
+void test_missing_archive_hours_are_counted() {
+    char text[128];
+    snprintf(text, sizeof(text), "archive,%ld,1,2\narchive,%ld,3,4\n", (long) OCT_17_2023 + 5 * SECS_PER_HOUR, (long) OCT_17_2023 + 6 * SECS_PER_HOUR);
+    TEST_ASSERT_TRUE(feed(text));
+    TEST_ASSERT_EQUAL_UINT16(22, import->getMissingHours());
+    TEST_ASSERT_EQUAL_UINT32(0, archive->days[OCT_17_2023].hImport[4]);
+    TEST_ASSERT_EQUAL_UINT32(3, archive->days[OCT_17_2023].hImport[6]);
+}
+
+void test_rows_merge_with_a_stored_day() {
+    EnergyArchiveDay stored;
+    for(uint8_t h = 0; h < 24; h++) {
+        stored.hImport[h] = 1000 + h;
+        stored.hExport[h] = 0;
+    }
+    archive->days[OCT_17_2023] = stored;
+
+    char text[64];
+    snprintf(text, sizeof(text), "archive,%ld,5\n", (long) OCT_17_2023 + 2 * SECS_PER_HOUR);
+    TEST_ASSERT_TRUE(feed(text));
+    TEST_ASSERT_EQUAL_UINT16(0, import->getMissingHours());
+    TEST_ASSERT_EQUAL_UINT32(5, archive->days[OCT_17_2023].hImport[2]);
+    TEST_ASSERT_EQUAL_UINT32(1003, archive->days[OCT_17_2023].hImport[3]);
+}
+
+void test_unknown_series_and_overlong_lines_are_errors() {
+    char text[300];
+    memset(text, '9', sizeof(text));
+    memcpy(text, "hour,1,", 7);
+    strcpy(text + 200, "\nbogus,1,2,3\nhour,24,1\nhour,2,7\n");
+    feed(text);
+    TEST_ASSERT_EQUAL_UINT16(1, import->getRows());
+    TEST_ASSERT_EQUAL_UINT16(3, import->getErrors());
+    TEST_ASSERT_EQUAL_UINT32(7, ds->hImport[2]);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_csv_with_header_order);
+    RUN_TEST(test_ndjson_rows);
+    RUN_TEST(test_extra_columns_without_header_are_rejected);
+    RUN_TEST(test_extra_columns_beyond_header_are_rejected);
+    RUN_TEST(test_too_many_columns_for_any_header);
+    RUN_TEST(test_archive_rows_of_a_day_are_written_together);
+    RUN_TEST(test_missing_archive_hours_are_counted);
+    RUN_TEST(test_rows_merge_with_a_stored_day);
+    RUN_TEST(test_unknown_series_and_overlong_lines_are_errors);
+    return UNITY_END();
+}
@@ -0,0 +1,229 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+// The pool against real sockets on the loopback interface. The stub clients have no TLS, so
+// https:// slots count handshakes like the device does but session resumption is not covered.
+
+#define ESP32
+#include <unity.h>
+#include <atomic>
+#include <poll.h>
+#include <thread>
+#include <vector>
+#include "HttpClientPool/src/HttpClientPool.cpp"
+
+const char* FirmwareVersion::VersionString = "test";
+
+#define SERVERS 3
+
+// Answers every request with "ok". /close closes the connection afterwards, /redirect sends a Location
+class LoopbackServer {
+public:
+    uint16_t port[SERVERS];
+    std::atomic<uint32_t> accepted[SERVERS];
+
+    void start() {
+        for(uint8_t i = 0; i < SERVERS; i++) {
+            accepted[i] = 0;
+            listener[i] = socket(AF_INET, SOCK_STREAM, 0);
+            int one = 1;
+            setsockopt(listener[i], SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(listener[i], (sockaddr*) &addr, sizeof(addr));
+            listen(listener[i], 8);
+            socklen_t len = sizeof(addr);
+            getsockname(listener[i], (sockaddr*) &addr, &len);
+            port[i] = ntohs(addr.sin_port);
+        }
+        running = true;
+        thread = std::thread(&LoopbackServer::run, this);
+    }
+
+    void stop() {
+        running = false;
+        thread.join();
+        for(uint8_t i = 0; i < SERVERS; i++) close(listener[i]);
+        for(Connection& c : connections) close(c.fd);
+        connections.clear();
+    }
+
+private:
+    struct Connection {
+        int fd;
+        std::string request;
+    };
+
+    int listener[SERVERS];
+    std::vector<Connection> connections;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    void run() {
+        while(running) {
+            std::vector<pollfd> fds;
+            for(uint8_t i = 0; i < SERVERS; i++) fds.push_back({ listener[i], POLLIN, 0 });
+            for(Connection& c : connections) fds.push_back({ c.fd, POLLIN, 0 });
+            if(poll(fds.data(), fds.size(), 20) <= 0) continue;
+
+            for(uint8_t i = 0; i < SERVERS; i++) {
+                if(fds[i].revents & POLLIN) {
+                    connections.push_back({ accept(listener[i], NULL, NULL), "" });
+                    accepted[i]++;
+                }
+            }
+            for(size_t i = SERVERS; i < fds.size(); i++) {
+                if(fds[i].revents == 0) continue;
+                Connection& c = connections[i - SERVERS];
+                char buf[512];
+                ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+                if(n <= 0) {
+                    close(c.fd);
+                    c.fd = -1;
+                    continue;
+                }
+                c.request.append(buf, n);
+                if(c.request.find("\r\n\r\n") != std::string::npos && !respond(c)) {
+                    close(c.fd);
+                    c.fd = -1;
+                }
+            }
+            for(size_t i = connections.size(); i > 0; i--) {
+                if(connections[i-1].fd < 0) connections.erase(connections.begin() + i - 1);
+            }
+        }
+    }
+
+    // Returns false when the connection is to be closed
+    bool respond(Connection& c) {
+        bool keep = c.request.find(" HTTP/1.1\r\n") != std::string::npos && c.request.find("Connection: close") == std::string::npos;
+        std::string headers;
+        if(c.request.compare(0, 11, "GET /close ") == 0) keep = false;
+        if(c.request.compare(0, 14, "GET /redirect ") == 0) headers = "Location: http://elsewhere/\r\n";
+        c.request.clear();
+        std::string response = std::string("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n") + headers + (keep ? "" : "Connection: close\r\n") + "\r\nok";
+        send(c.fd, response.data(), response.size(), MSG_NOSIGNAL);
+        return keep;
+    }
+};
+
+static LoopbackServer server;
+static HttpClientPool* pool;
+
+void setUp() {
+    stubMillis = 1000;
+    server.start();
+    pool = new HttpClientPool(&Serial);
+}
+
+void tearDown() {
+    delete pool;
+    server.stop();
+}
+
+static String url(uint8_t i, const char* path = "/", const char* scheme = "http") {
+    return String(scheme) + "://127.0.0.1:" + std::to_string(server.port[i]) + path;
+}
+
+// One request the way the price and cloud code make them
+static bool get(const String& url, bool http10 = false) {
+    stubMillis += 100;
+    HTTPClient* http = pool->begin(url.c_str());
+    if(http == NULL) return false;
+    if(http10) http->useHTTP10(true);
+    int code = http->GET();
+    bool ok = code == 200 && http->getString() == "ok";
+    pool->end(http);
+    return ok;
+}
+
+void test_same_host_reuses_connection() {
+    for(uint8_t i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(get(url(0)));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, server.accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(3, pool->getRequestCount());
+    TEST_ASSERT_EQUAL_UINT32(2, pool->getReuseCount());
+    TEST_ASSERT_EQUAL_UINT32(0, pool->getHandshakeCount());
+}
+
+void test_secure_slot_counts_one_handshake() {
+    TEST_ASSERT_TRUE(get(url(0, "/", "https")));
+    TEST_ASSERT_TRUE(get(url(0, "/", "https")));
+    TEST_ASSERT_EQUAL_UINT32(1, server.accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, pool->getHandshakeCount());
+
+    // Same host and port without TLS is a slot of its own
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_EQUAL_UINT32(2, server.accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, pool->getHandshakeCount());
+}
+
+void test_least_recently_used_slot_is_evicted() {
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_TRUE(get(url(1)));
+    TEST_ASSERT_TRUE(get(url(0)));
+    // Third host while both slots are in use, the slot of server 1 was used last the longest ago
+    TEST_ASSERT_TRUE(get(url(2)));
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_EQUAL_UINT32(1, server.accepted[0]);
+
+    TEST_ASSERT_TRUE(get(url(1)));
+    TEST_ASSERT_EQUAL_UINT32(2, server.accepted[1]);
+    TEST_ASSERT_EQUAL_UINT32(1, server.accepted[2]);
+}
+
+void test_http10_is_reset_for_the_next_request() {
+    // A caller that streams the body asks for HTTP/1.0, which closes the connection afterwards
+    TEST_ASSERT_TRUE(get(url(0), true));
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_EQUAL_UINT32(2, server.accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, pool->getReuseCount());
+}
+
+void test_idle_connection_is_closed() {
+    TEST_ASSERT_TRUE(get(url(0)));
+    stubMillis += HTTP_POOL_IDLE_TIMEOUT + 1;
+    pool->loop();
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_EQUAL_UINT32(2, server.accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(0, pool->getReuseCount());
+}
+
+void test_connection_closed_by_server_is_replaced() {
+    TEST_ASSERT_TRUE(get(url(0, "/close")));
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_EQUAL_UINT32(2, server.accepted[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, pool->getReuseCount());
+}
+
+void test_redirected_connection_is_not_kept() {
+    TEST_ASSERT_TRUE(get(url(0, "/redirect")));
+    TEST_ASSERT_TRUE(get(url(0)));
+    TEST_ASSERT_EQUAL_UINT32(2, server.accepted[0]);
+}
+
+void test_unsupported_url_is_rejected() {
+    TEST_ASSERT_NULL(pool->begin("ftp://127.0.0.1/"));
+    TEST_ASSERT_NULL(pool->begin("http:///path"));
+    TEST_ASSERT_EQUAL_UINT32(0, pool->getRequestCount());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_same_host_reuses_connection);
+    RUN_TEST(test_secure_slot_counts_one_handshake);
+    RUN_TEST(test_least_recently_used_slot_is_evicted);
+    RUN_TEST(test_http10_is_reset_for_the_next_request);
+    RUN_TEST(test_idle_connection_is_closed);
+    RUN_TEST(test_connection_closed_by_server_is_replaced);
+    RUN_TEST(test_redirected_connection_is_not_kept);
+    RUN_TEST(test_unsupported_url_is_rejected);
+    return UNITY_END();
+}
@@ -0,0 +1,8 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+// Own translation unit, AmsData.cpp and HomeAssistantMqttHandler.cpp both have a static fnv()
+#include "AmsData/src/AmsData.cpp"
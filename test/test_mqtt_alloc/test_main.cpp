@@ -0,0 +1,431 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+// Heap allocations made while the raw and Home Assistant handlers publish a meter frame. Every
+// malloc is counted, operator new included. The only String values left on the publish path are
+// the getters of AmsData and WiFi.macAddress(). The meter strings here are short enough for the
+// small string buffer of the host String, so they cost nothing and any count is the handler's own.
+
+#define ESP32
+#include <unity.h>
+#include <new>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "WiFiClientSecure.h"
+#include "TimeLib.h"
+#include "AmsConfiguration.h"
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+static bool counting = false;
+static uint32_t allocations = 0;
+
+extern "C" void* malloc(size_t size) {
+    if(counting) allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    if(counting) allocations++;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    if(counting) allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void* operator new(size_t size) {
+    void* ptr = malloc(size);
+    if(ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t size) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t size) noexcept { free(ptr); }
+
+// Stand-ins under the include guards of the real headers, which pull in the sensor and HTTP libraries
+#define _HWTOOLS_H
+struct TempSensorData {
+    uint8_t address[8];
+    float lastRead;
+    float lastValidRead;
+    bool changed;
+};
+
+class HwTools {
+public:
+    float getVcc() { return 3.287; }
+    int getWifiRssi() { return -67; }
+    float getTemperature() { return 21.5; }
+    uint8_t getTempSensorCount() { return 0; }
+    TempSensorData* getTempSensorData(uint8_t) { return NULL; }
+};
+
+#define _ENERGYACCOUNTING_H
+struct EnergyAccountingPeak {
+    uint8_t day;
+    uint16_t value;
+};
+
+class EnergyAccounting {
+public:
+    EnergyAccountingConfig config = { { 5, 10, 15, 20, 25, 50, 75, 100, 150, 0 }, 5 };
+
+    bool isInitialized() { return true; }
+    EnergyAccountingConfig* getConfig() { return &config; }
+    float getUseThisHour() { return 1.234; }
+    float getUseToday() { return 12.5; }
+    float getUseThisMonth() { return 301.25; }
+    float getCostThisHour() { return 0.75; }
+    float getCostToday() { return 8.5; }
+    float getCostThisMonth() { return 250.25; }
+    float getProducedThisHour() { return 0.5; }
+    float getProducedToday() { return 3.27; }
+    float getProducedThisMonth() { return 80.5; }
+    float getIncomeThisHour() { return 0.25; }
+    float getIncomeToday() { return 1.5; }
+    float getIncomeThisMonth() { return 20.75; }
+    uint8_t getCurrentThreshold() { return 10; }
+    float getMonthMax() { return 4.56; }
+    EnergyAccountingPeak getPeak(uint8_t num) { return { num, (uint16_t) (1000 + num * 111) }; }
+};
+
+#define _PRICESERVICE_H
+#define PRICE_DIRECTION_IMPORT 0x01
+#define PRICE_DIRECTION_EXPORT 0x02
+#define PRICE_NO_VALUE -127
+
+class PriceService {
+public:
+    char* getCurrency() { return currency; }
+    float getValueForHour(uint8_t direction, int8_t hour) { return getValueForHour(direction, 0, hour); }
+    float getValueForHour(uint8_t direction, time_t ts, int8_t hour) {
+        if(direction == PRICE_DIRECTION_EXPORT) return hour == 0 ? 0.4321 : PRICE_NO_VALUE;
+        return hour < 30 ? 1.0 + (hour % 7) * 0.125 : PRICE_NO_VALUE;
+    }
+    float getEnergyPriceForHour(uint8_t direction, time_t ts, int8_t hour) { return getValueForHour(direction, ts, hour); }
+
+private:
+    char currency[4] = "NOK";
+};
+
+#include "AmsConfiguration/src/hexutils.cpp"
+#include "Uptime/src/Uptime.cpp"
+#include "AmsMqttHandler/src/DecimalFormat.cpp"
+#include "AmsMqttHandler/src/TopicTable.cpp"
+#include "AmsMqttHandler/src/PublishCache.cpp"
+#include "AmsMqttHandler/src/MqttOutbox.cpp"
+#include "AmsMqttHandler/src/AmsMqttHandler.cpp"
+#include "RawMqttHandler/src/RawMqttHandler.cpp"
+#include "HomeAssistantMqttHandler/src/HomeAssistantMqttHandler.cpp"
+
+long FirmwareVersion::BuildEpoch = 0;
+const char* FirmwareVersion::VersionString = "test";
+
+class TestData : public AmsData {
+public:
+    void setList4() {
+        listType = 4;
+        packageTimestamp = 1700000000;
+        meterTimestamp = 1700000001;
+        listId = "AIDON_V0001";
+        meterId = "7359992890";
+        meterModel = "6525";
+        activeImportPower = 4321;
+        reactiveImportPower = 120;
+        activeExportPower = 15;
+        reactiveExportPower = 7;
+        l1current = 5.25;
+        l2current = 11.5;
+        l3current = 0.75;
+        l1voltage = 231.5;
+        l2voltage = 229.75;
+        l3voltage = 230.25;
+        l1activeImportPower = 1200;
+        l2activeImportPower = 2650;
+        l3activeImportPower = 471;
+        l1activeExportPower = 5;
+        l2activeExportPower = 5;
+        l3activeExportPower = 5;
+        l1activeImportCounter = 4115.226;
+        l2activeImportCounter = 4115.226;
+        l3activeImportCounter = 4115.226;
+        l1activeExportCounter = 0.5;
+        l2activeExportCounter = 0.5;
+        l3activeExportCounter = 0.5;
+        powerFactor = 0.97;
+        l1PowerFactor = 0.99;
+        l2PowerFactor = 0.95;
+        l3PowerFactor = 0.9;
+        activeImportCounter = 12345.678;
+        activeExportCounter = 1.5;
+        reactiveImportCounter = 200.25;
+        reactiveExportCounter = 3.125;
+    }
+};
+
+static TestData data;
+static TestData previous;
+static EnergyAccounting ea;
+static PriceService ps;
+static HwTools hw;
+static MqttConfig mqttConfig;
+static char buf[2048];
+
+static const MqttStubMessage* findMessage(const char* topic) {
+    for(uint16_t i = 0; i < mqttStubCount && i < MQTT_STUB_MESSAGES; i++) {
+        if(strcmp(mqttStubMessages[i].topic, topic) == 0) return &mqttStubMessages[i];
+    }
+    return NULL;
+}
+
+static RawMqttHandler* createRaw(uint8_t payloadFormat) {
+    mqttConfig.payloadFormat = payloadFormat;
+    RawMqttHandler* handler = new RawMqttHandler(mqttConfig, &Serial, buf);
+    TEST_ASSERT_TRUE(handler->connect());
+    mqttStubCount = 0;
+    return handler;
+}
+
+static HomeAssistantMqttHandler* createHomeAssistant() {
+    mqttConfig.payloadFormat = 4;
+    HomeAssistantConfig haConfig;
+    memset(&haConfig, 0, sizeof(haConfig));
+    HomeAssistantMqttHandler* handler = new HomeAssistantMqttHandler(mqttConfig, &Serial, buf, 7, haConfig, &hw);
+    TEST_ASSERT_TRUE(handler->connect());
+    mqttStubCount = 0;
+    return handler;
+}
+
+void setUp() {
+    data = TestData();
+    data.setList4();
+    previous = TestData();
+    memset(&mqttConfig, 0, sizeof(mqttConfig));
+    strcpy(mqttConfig.host, "localhost");
+    mqttConfig.port = 1883;
+    strcpy(mqttConfig.clientId, "ams-test");
+    strcpy(mqttConfig.publishTopic, "ams");
+    stubMillis = 1000;
+    mqttStubCount = 0;
+    allocations = 0;
+    // glibc loads the zone data on the first gmtime_r(), which would be counted against the handler
+    tzset();
+}
+
+void tearDown() {
+    counting = false;
+}
+
+void test_raw_full_frame_does_not_allocate() {
+    RawMqttHandler* handler = createRaw(2);
+
+    counting = true;
+    TEST_ASSERT_TRUE(handler->publish(&data, &previous, &ea, &ps));
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+    TEST_ASSERT_GREATER_THAN(50, mqttStubCount);
+    const MqttStubMessage* msg = findMessage("ams/meter/l2/voltage");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("229.75", msg->payload);
+    msg = findMessage("ams/meter/import/active/accumulated");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("12345.678", msg->payload);
+    msg = findMessage("ams/realtime/import/peak/5");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("15.5500000000", msg->payload);
+    msg = findMessage("ams/meter/id");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("7359992890", msg->payload);
+    delete handler;
+}
+
+void test_raw_cached_frames_do_not_allocate() {
+    RawMqttHandler* handler = createRaw(1);
+
+    counting = true;
+    for(uint8_t i = 0; i < 10; i++) {
+        TEST_ASSERT_TRUE(handler->publish(&data, &previous, &ea, &ps));
+        previous = data;
+    }
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+    TEST_ASSERT_GREATER_THAN(0, handler->getSuppressedCount());
+    delete handler;
+}
+
+void test_raw_prices_do_not_allocate() {
+    RawMqttHandler* handler = createRaw(1);
+
+    counting = true;
+    TEST_ASSERT_TRUE(handler->publishPrices(&ps));
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+    const MqttStubMessage* msg = findMessage("ams/price/3");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("1.3750", msg->payload);
+    msg = findMessage("ams/price/31");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("", msg->payload);
+    msg = findMessage("ams/exportprice/0");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_EQUAL_STRING("0.4321", msg->payload);
+    delete handler;
+}
+
+void test_home_assistant_frame_does_not_allocate() {
+    HomeAssistantMqttHandler* handler = createHomeAssistant();
+
+    counting = true;
+    TEST_ASSERT_TRUE(handler->publish(&data, &previous, &ea, &ps));
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+    const MqttStubMessage* msg = findMessage("ams/realtime");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_NOT_NULL(strstr(msg->payload, "\"peaks\":[11.11,12.22,13.33,14.44,15.55],"));
+    msg = findMessage("ams/power");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_NOT_NULL(strstr(msg->payload, "7359992890"));
+    TEST_ASSERT_NOT_NULL(findMessage("ams/energy"));
+    delete handler;
+}
+
+void test_home_assistant_prices_allocate_only_for_the_mac_address() {
+    HomeAssistantMqttHandler* handler = createHomeAssistant();
+
+    counting = true;
+    String mac = WiFi.macAddress();
+    counting = false;
+    uint32_t allowed = allocations;
+    allocations = 0;
+
+    counting = true;
+    TEST_ASSERT_TRUE(handler->publishPrices(&ps));
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(allowed, allocations);
+    const MqttStubMessage* msg = findMessage("ams/prices");
+    TEST_ASSERT_NOT_NULL(msg);
+    TEST_ASSERT_NOT_NULL(strstr(msg->payload, "\"3\":1.3750,"));
+    delete handler;
+}
+
+void test_home_assistant_discovery_does_not_allocate() {
+    HomeAssistantMqttHandler* handler = createHomeAssistant();
+    TEST_ASSERT_TRUE(handler->publish(&data, &previous, &ea, &ps));
+
+    // The broker has no marker, so every sensor is announced
+    String topic = "ams/discovery";
+    String payload = "00000000";
+    handler->onMessage(topic, payload);
+
+    counting = true;
+    for(uint16_t i = 0; i < 200; i++) {
+        stubMillis += HA_DISCOVERY_INTERVAL;
+        handler->loop();
+    }
+    counting = false;
+
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+    TEST_ASSERT_GREATER_THAN(30, handler->getDiscoveryPublished());
+    delete handler;
+}
+
+// Away from a half of the last decimal formatDecimal gives the text of String(value, decimals)
+void test_format_decimal_matches_string() {
+    struct { double value; unsigned int decimals; } cases[] = {
+        { 0, 2 }, { 0.05, 1 }, { 0.05, 2 }, { 0.15, 1 }, { 0.25, 1 }, { 0.125, 2 }, { 0.999, 2 },
+        { 9.9951, 2 }, { 99.95, 1 }, { 1.005, 2 }, { 2.6751, 2 }, { 229.75, 1 }, { 12345.678, 3 },
+        { 0.1 + 0.2, 1 }, { 1.2345, 4 }, { 15.55, 10 }, { 1e-9, 4 }, { 3.287f, 2 }, { 231.3f, 2 },
+        { 0.97f, 2 }, { 4115.226, 2 }, { -0.05, 1 }, { -0.05, 2 }, { -0.004, 2 }, { -0.005, 2 },
+        { -230.126, 2 }, { -12.3456, 3 }, { -0.4321f, 4 }
+    };
+    char out[DECIMAL_FORMAT_SIZE];
+    char message[64];
+    for(auto& c : cases) {
+        String expected(c.value, c.decimals);
+        uint8_t len = formatDecimal(out, c.value, c.decimals);
+        snprintf(message, sizeof(message), "%.17g with %u decimals", c.value, c.decimals);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(expected.c_str(), out, message);
+        TEST_ASSERT_EQUAL_MESSAGE(expected.size(), len, message);
+    }
+}
+
+// Meter values with up to four decimals, where the two may only part at a half of the last decimal
+void test_format_decimal_differs_from_string_only_at_a_half() {
+    uint32_t seed = 20231001;
+    uint32_t differ = 0;
+    char out[DECIMAL_FORMAT_SIZE];
+    char message[64];
+    for(uint32_t i = 0; i < 200000; i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int decimals = 1 + (seed >> 8) % 4;
+        seed = seed * 1103515245 + 12345;
+        double value = ((seed >> 4) % 2000000) / 1000.0;
+        if(i % 3 == 1) value = (float) (value / 10);
+        if(i % 3 == 2) value = -value;
+
+        String expected(value, decimals);
+        formatDecimal(out, value, decimals);
+        if(expected == out) continue;
+
+        differ++;
+        double scale = pow(10, decimals);
+        double fraction = fabs(value) * scale - floor(fabs(value) * scale);
+        snprintf(message, sizeof(message), "%.17g with %u decimals", value, decimals);
+        TEST_ASSERT_TRUE_MESSAGE(fabs(fraction - 0.5) < 1e-6, message);
+        TEST_ASSERT_TRUE_MESSAGE(fabs(atof(out) - atof(expected.c_str())) * scale < 1.5, message);
+    }
+    snprintf(message, sizeof(message), "%u of 200000 differ in the last decimal", differ);
+    TEST_MESSAGE(message);
+}
+
+// Without decimals the handlers used to send whole numbers through String(long), String(value, 0)
+// would have padded a single digit with a blank
+void test_format_decimal_without_decimals_matches_integers() {
+    long cases[] = { 0, 7, -7, 10, 4321, -67, 65535, 1700000000, -1700000000 };
+    char out[DECIMAL_FORMAT_SIZE];
+    for(long value : cases) {
+        String expected(value);
+        uint8_t len = formatDecimal(out, value, 0);
+        TEST_ASSERT_EQUAL_STRING(expected.c_str(), out);
+        TEST_ASSERT_EQUAL(expected.size(), len);
+    }
+    TEST_ASSERT_EQUAL_STRING(" 5", String(5.0, 0).c_str());
+    formatDecimal(out, 2.5, 0);
+    TEST_ASSERT_EQUAL_STRING("3", out);
+    formatDecimal(out, -0.5, 0);
+    TEST_ASSERT_EQUAL_STRING("-1", out);
+    formatDecimal(out, 0.05, 0);
+    TEST_ASSERT_EQUAL_STRING("0", out);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_raw_full_frame_does_not_allocate);
+    RUN_TEST(test_raw_cached_frames_do_not_allocate);
+    RUN_TEST(test_raw_prices_do_not_allocate);
+    RUN_TEST(test_home_assistant_frame_does_not_allocate);
+    RUN_TEST(test_home_assistant_prices_allocate_only_for_the_mac_address);
+    RUN_TEST(test_home_assistant_discovery_does_not_allocate);
+    RUN_TEST(test_format_decimal_matches_string);
+    RUN_TEST(test_format_decimal_differs_from_string_only_at_a_half);
+    RUN_TEST(test_format_decimal_without_decimals_matches_integers);
+    return UNITY_END();
+}
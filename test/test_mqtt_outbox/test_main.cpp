@@ -0,0 +1,330 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "LittleFS.h"
+#include "AmsStorage.h"
+#include "AmsMqttHandler/src/MqttOutbox.cpp"
+
+struct Message {
+    std::string topic;
+    std::string payload;
+    uint8_t qos;
+};
+
+// Accepts publishes while up, the way MQTTClient::publish() fails while disconnected
+class Broker {
+public:
+    bool up = true;
+    std::vector<Message> received;
+
+    bool publish(const char* topic, const char* payload, uint8_t qos) {
+        if(!up) return false;
+        received.push_back({ topic, payload, qos });
+        return true;
+    }
+};
+
+// Same rules as AmsMqttHandler::send() and drainOutbox()
+class Sender {
+public:
+    Sender(MqttOutbox* outbox, Broker* broker) : outbox(outbox), broker(broker) {}
+
+    bool send(const char* topic, const char* payload, bool keep) {
+        if(broker->up && outbox->isEmpty() && broker->publish(topic, payload, 0)) {
+            return true;
+        }
+        return outbox->push(topic, payload, keep ? MQTT_OUTBOX_KEEP : 0);
+    }
+
+    uint16_t drain() {
+        char topic[128];
+        char payload[512];
+        uint8_t flags;
+        uint16_t sent = 0;
+        while(broker->up && outbox->peek(topic, sizeof(topic), payload, sizeof(payload), flags)) {
+            if(!broker->publish(topic, payload, (flags & MQTT_OUTBOX_KEEP) ? 1 : 0)) break;
+            outbox->pop();
+            sent++;
+        }
+        return sent;
+    }
+
+private:
+    MqttOutbox* outbox;
+    Broker* broker;
+};
+
+static Broker broker;
+
+void setUp() {
+    LittleFS.reset();
+    broker = Broker();
+}
+
+void tearDown() {}
+
+static void counter(char* payload, size_t size, int hour) {
+    snprintf(payload, size, "{\"h\":%d,\"i\":%d.%03d}", hour, 1000 + hour, hour * 7 % 1000);
+}
+
+void test_sends_directly_while_connected() {
+    MqttOutbox outbox(1024, 4096);
+    Sender sender(&outbox, &broker);
+    TEST_ASSERT_TRUE(sender.send("ams/power", "1000", false));
+    TEST_ASSERT_EQUAL(1, broker.received.size());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+    TEST_ASSERT_EQUAL(0, outbox.getDepth());
+}
+
+void test_live_values_coalesce_while_down() {
+    MqttOutbox outbox(1024, 4096);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+
+    char payload[16];
+    for(int i = 0; i < 300; i++) {
+        snprintf(payload, sizeof(payload), "%d", i);
+        TEST_ASSERT_TRUE(sender.send("ams/power", payload, false));
+        snprintf(payload, sizeof(payload), "%d", 230 + (i % 3));
+        TEST_ASSERT_TRUE(sender.send("ams/voltage", payload, false));
+    }
+    TEST_ASSERT_TRUE(sender.send("ams/status", "ok", false));
+    TEST_ASSERT_EQUAL(3, outbox.getDepth());
+    TEST_ASSERT_EQUAL(0, outbox.getDropCount());
+    TEST_ASSERT_EQUAL(0, outbox.getSpillBytes());
+
+    broker.up = true;
+    TEST_ASSERT_EQUAL(3, sender.drain());
+    TEST_ASSERT_EQUAL(3, broker.received.size());
+    TEST_ASSERT_EQUAL_STRING("ams/power", broker.received[0].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("299", broker.received[0].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("ams/voltage", broker.received[1].topic.c_str());
+    TEST_ASSERT_EQUAL_STRING("232", broker.received[1].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("ams/status", broker.received[2].topic.c_str());
+    TEST_ASSERT_EQUAL(0, broker.received[0].qos);
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_kept_messages_are_not_coalesced() {
+    MqttOutbox outbox(1024, 4096);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+
+    char payload[64];
+    for(int h = 0; h < 5; h++) {
+        counter(payload, sizeof(payload), h);
+        TEST_ASSERT_TRUE(sender.send("ams/hour", payload, true));
+        TEST_ASSERT_TRUE(sender.send("ams/power", "1", false));
+    }
+    TEST_ASSERT_EQUAL(6, outbox.getDepth());
+
+    broker.up = true;
+    sender.drain();
+    TEST_ASSERT_EQUAL(6, broker.received.size());
+    for(int h = 0; h < 5; h++) {
+        counter(payload, sizeof(payload), h);
+        TEST_ASSERT_EQUAL_STRING(payload, broker.received[h].payload.c_str());
+        TEST_ASSERT_EQUAL(1, broker.received[h].qos);
+    }
+    TEST_ASSERT_EQUAL_STRING("ams/power", broker.received[5].topic.c_str());
+}
+
+void test_spill_keeps_order() {
+    // Room for a handful of counters in RAM, the rest goes to flash
+    MqttOutbox outbox(200, 65536);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+
+    char payload[64];
+    for(int h = 0; h < 48; h++) {
+        counter(payload, sizeof(payload), h);
+        TEST_ASSERT_TRUE(sender.send("ams/hour", payload, true));
+    }
+    TEST_ASSERT_EQUAL(48, outbox.getDepth());
+    TEST_ASSERT_GREATER_THAN(0, outbox.getSpillBytes());
+    TEST_ASSERT_TRUE(LittleFS.exists(FILE_MQTT_OUTBOX));
+    TEST_ASSERT_EQUAL(0, outbox.getDropCount());
+
+    broker.up = true;
+    TEST_ASSERT_EQUAL(48, sender.drain());
+    for(int h = 0; h < 48; h++) {
+        counter(payload, sizeof(payload), h);
+        TEST_ASSERT_EQUAL_STRING(payload, broker.received[h].payload.c_str());
+    }
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+    TEST_ASSERT_EQUAL(0, outbox.getSpillBytes());
+    TEST_ASSERT_FALSE(LittleFS.exists(FILE_MQTT_OUTBOX));
+}
+
+void test_live_values_are_dropped_not_spilled() {
+    MqttOutbox outbox(128, 65536);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+
+    char topic[32];
+    for(int i = 0; i < 20; i++) {
+        snprintf(topic, sizeof(topic), "ams/l%d/voltage", i);
+        sender.send(topic, "230.0", false);
+    }
+    TEST_ASSERT_GREATER_THAN(0, outbox.getDropCount());
+    TEST_ASSERT_EQUAL(0, outbox.getSpillBytes());
+    TEST_ASSERT_FALSE(LittleFS.exists(FILE_MQTT_OUTBOX));
+
+    // The newest survive
+    broker.up = true;
+    uint16_t sent = sender.drain();
+    TEST_ASSERT_EQUAL(20 - outbox.getDropCount(), sent);
+    TEST_ASSERT_EQUAL_STRING("ams/l19/voltage", broker.received.back().topic.c_str());
+}
+
+void test_spill_limit() {
+    MqttOutbox outbox(100, 200);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+
+    char payload[64];
+    for(int h = 0; h < 30; h++) {
+        counter(payload, sizeof(payload), h);
+        sender.send("ams/hour", payload, true);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(200, outbox.getSpillBytes());
+    TEST_ASSERT_GREATER_THAN(0, outbox.getDropCount());
+    TEST_ASSERT_EQUAL(30, outbox.getDepth() + outbox.getDropCount());
+
+    // What is delivered is still in order, with the gap where messages were dropped
+    broker.up = true;
+    sender.drain();
+    int last = -1;
+    for(Message& m : broker.received) {
+        int h = atoi(m.payload.c_str() + 5);
+        TEST_ASSERT_GREATER_THAN(last, h);
+        last = h;
+    }
+}
+
+void test_broker_drops_during_drain() {
+    MqttOutbox outbox(200, 65536);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+
+    char payload[64];
+    for(int h = 0; h < 20; h++) {
+        counter(payload, sizeof(payload), h);
+        sender.send("ams/hour", payload, true);
+    }
+
+    // Goes away again after a few, nothing is lost or sent twice
+    broker.up = true;
+    char topic[128], buf[512];
+    uint8_t flags;
+    for(int i = 0; i < 7; i++) {
+        TEST_ASSERT_TRUE(outbox.peek(topic, sizeof(topic), buf, sizeof(buf), flags));
+        TEST_ASSERT_TRUE(broker.publish(topic, buf, 1));
+        outbox.pop();
+    }
+    broker.up = false;
+    TEST_ASSERT_EQUAL(0, sender.drain());
+    counter(payload, sizeof(payload), 20);
+    sender.send("ams/hour", payload, true);
+
+    broker.up = true;
+    sender.drain();
+    TEST_ASSERT_EQUAL(21, broker.received.size());
+    for(int h = 0; h <= 20; h++) {
+        counter(payload, sizeof(payload), h);
+        TEST_ASSERT_EQUAL_STRING(payload, broker.received[h].payload.c_str());
+    }
+}
+
+void test_restart_recovers_spilled_messages() {
+    char payload[64];
+    {
+        MqttOutbox outbox(200, 65536);
+        Sender sender(&outbox, &broker);
+        broker.up = false;
+        for(int h = 0; h < 30; h++) {
+            counter(payload, sizeof(payload), h);
+            sender.send("ams/hour", payload, true);
+        }
+        TEST_ASSERT_GREATER_THAN(0, outbox.getSpillBytes());
+    }
+
+    // What was in RAM is gone with the restart, the file is read back in order
+    MqttOutbox outbox(200, 65536);
+    Sender sender(&outbox, &broker);
+    uint16_t depth = outbox.getDepth();
+    TEST_ASSERT_GREATER_THAN(0, depth);
+    TEST_ASSERT_FALSE(outbox.isEmpty());
+
+    // New messages wait behind the recovered ones even with the broker up
+    broker.up = true;
+    counter(payload, sizeof(payload), 99);
+    TEST_ASSERT_TRUE(sender.send("ams/hour", payload, true));
+    TEST_ASSERT_EQUAL(0, broker.received.size());
+
+    TEST_ASSERT_EQUAL(depth + 1, sender.drain());
+    for(int h = 0; h < depth; h++) {
+        counter(payload, sizeof(payload), h);
+        TEST_ASSERT_EQUAL_STRING(payload, broker.received[h].payload.c_str());
+    }
+    counter(payload, sizeof(payload), 99);
+    TEST_ASSERT_EQUAL_STRING(payload, broker.received.back().payload.c_str());
+    TEST_ASSERT_FALSE(LittleFS.exists(FILE_MQTT_OUTBOX));
+}
+
+void test_restart_ignores_torn_spill_record() {
+    char payload[64];
+    {
+        MqttOutbox outbox(100, 65536);
+        Sender sender(&outbox, &broker);
+        broker.up = false;
+        for(int h = 0; h < 10; h++) {
+            counter(payload, sizeof(payload), h);
+            sender.send("ams/hour", payload, true);
+        }
+    }
+    std::string& file = LittleFS.files[FILE_MQTT_OUTBOX];
+    MqttOutbox probe(100, 65536);
+    uint16_t complete = probe.getDepth();
+
+    // Power was cut in the middle of appending a record
+    file.append("\x30\x00\x01\x08" "ams/ho", 10);
+    MqttOutbox outbox(100, 65536);
+    TEST_ASSERT_EQUAL(complete, outbox.getDepth());
+
+    Sender sender(&outbox, &broker);
+    broker.up = true;
+    TEST_ASSERT_EQUAL(complete, sender.drain());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+void test_oversized_message_is_dropped() {
+    MqttOutbox outbox(64, 4096);
+    Sender sender(&outbox, &broker);
+    broker.up = false;
+    std::string big(100, 'x');
+    TEST_ASSERT_FALSE(sender.send("ams/big", big.c_str(), true));
+    TEST_ASSERT_EQUAL(1, outbox.getDropCount());
+    TEST_ASSERT_TRUE(outbox.isEmpty());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sends_directly_while_connected);
+    RUN_TEST(test_live_values_coalesce_while_down);
+    RUN_TEST(test_kept_messages_are_not_coalesced);
+    RUN_TEST(test_spill_keeps_order);
+    RUN_TEST(test_live_values_are_dropped_not_spilled);
+    RUN_TEST(test_spill_limit);
+    RUN_TEST(test_broker_drops_during_drain);
+    RUN_TEST(test_restart_recovers_spilled_messages);
+    RUN_TEST(test_restart_ignores_torn_spill_record);
+    RUN_TEST(test_oversized_message_is_dropped);
+    return UNITY_END();
+}
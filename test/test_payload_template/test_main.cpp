@@ -0,0 +1,238 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include <chrono>
+#include "Arduino.h"
+
+// Accounting stand-in under the include guard of the real header, PayloadTemplate.h picks it up instead
+#define _ENERGYACCOUNTING_H
+#define PRICE_NO_VALUE -127
+
+class EnergyAccounting {
+public:
+    float getUseThisHour() { return 1.234; }
+    float getUseToday() { return 12.5; }
+    float getUseThisMonth() { return 301.25; }
+    float getCostThisHour() { return 0.75; }
+    float getCostToday() { return 8.5; }
+    float getCostThisMonth() { return 250.25; }
+    float getProducedThisHour() { return 0.5; }
+    float getProducedToday() { return 3.27; } // printf rounds exact halves to even, the template like String(value, n) rounds them up
+    float getProducedThisMonth() { return 80.5; }
+    float getIncomeThisHour() { return 0.25; }
+    float getIncomeToday() { return 1.5; }
+    float getIncomeThisMonth() { return 20.75; }
+    uint8_t getCurrentThreshold() { return 10; }
+    float getMonthMax() { return 4.56; }
+};
+
+#include "PayloadTemplate.h"
+#include "AmsData/src/AmsData.cpp"
+#include "AmsMqttHandler/src/DecimalFormat.cpp"
+#include "AmsMqttHandler/src/PayloadTemplate.cpp"
+
+class TestData : public AmsData {
+public:
+    void setThreePhase() {
+        listType = 3;
+        packageTimestamp = 1700000000;
+        meterTimestamp = 1700000001;
+        listId = "AIDON_V0001";
+        meterId = "7359992890941742";
+        meterModel = "6525";
+        activeImportPower = 4321;
+        reactiveImportPower = 120;
+        activeExportPower = 0;
+        reactiveExportPower = 7;
+        l1current = 5.25;
+        l2current = 11.5;
+        l3current = 0.75;
+        l1voltage = 231.5;
+        l2voltage = 229.75;
+        l3voltage = 230.25;
+        activeImportCounter = 12345.678;
+        activeExportCounter = 1.5;
+        reactiveImportCounter = 200.25;
+        reactiveExportCounter = 3.125;
+    }
+};
+
+// The JSON list 3 payload, as the template a user would write for it
+static const char* LIST3_TEMPLATE = "{\"id\":\"{{id}}\",\"name\":\"{{name}}\",\"up\":{{up}},\"t\":{{t}},\"vcc\":{{vcc}},\"rssi\":{{rssi}},\"temp\":{{temp}},"
+    "\"data\":{\"lv\":\"{{lv}}\",\"meterId\":\"{{meterId}}\",\"type\":\"{{type}}\",\"P\":{{P}},\"Q\":{{Q}},\"PO\":{{PO}},\"QO\":{{QO}},"
+    "\"I1\":{{I1}},\"I2\":{{I2}},\"I3\":{{I3}},\"U1\":{{U1}},\"U2\":{{U2}},\"U3\":{{U3}},\"tPI\":{{tPI}},\"tPO\":{{tPO}},\"tQI\":{{tQI}},\"tQO\":{{tQO}},\"rtc\":{{rtc}}"
+    "},\"realtime\":{\"h\":{{useHour}},\"d\":{{useDay:1}},\"t\":{{threshold}},\"x\":{{monthMax}},\"he\":{{prodHour}},\"de\":{{prodDay:1}}}}";
+
+static TestData data;
+static EnergyAccounting ea;
+static PayloadTemplateSource src;
+static PayloadTemplate* tpl;
+static char out[PAYLOAD_TEMPLATE_MAX_SIZE];
+
+void setUp() {
+    data = TestData();
+    data.setThreePhase();
+    src = { &data, &ea, "AA:BB:CC:DD:EE:FF", "ams-1234", 3723, 3.287, -67, 21.5, 1.2345, PRICE_NO_VALUE };
+    tpl = new PayloadTemplate();
+    memset(out, 0, sizeof(out));
+}
+
+void tearDown() {
+    delete tpl;
+}
+
+static bool compile(const char* text) {
+    return tpl->compile(text, strlen(text));
+}
+
+// Same format strings and arguments as JsonMqttHandler::appendJsonHeader, publishList3 and appendJsonFooter
+static size_t renderList3(char* json, size_t size) {
+    size_t pos = snprintf_P(json, size, PSTR("{\"id\":\"%s\",\"name\":\"%s\",\"up\":%u,\"t\":%lu,\"vcc\":%.3f,\"rssi\":%d,\"temp\":%.2f,"),
+        src.id, src.name, src.uptime, (unsigned long) data.getPackageTimestamp(), src.vcc, src.rssi, src.temperature);
+    pos += snprintf_P(json+pos, size-pos, PSTR("\"data\":{"));
+    pos += snprintf_P(json+pos, size-pos, PSTR("\"lv\":\"%s\",\"meterId\":\"%s\",\"type\":\"%s\",\"P\":%d,\"Q\":%d,\"PO\":%d,\"QO\":%d,\"I1\":%.2f,\"I2\":%.2f,\"I3\":%.2f,\"U1\":%.2f,\"U2\":%.2f,\"U3\":%.2f,\"tPI\":%.3f,\"tPO\":%.3f,\"tQI\":%.3f,\"tQO\":%.3f,\"rtc\":%lu"),
+        data.getListId().c_str(), data.getMeterId().c_str(), data.getMeterModel().c_str(),
+        data.getActiveImportPower(), data.getReactiveImportPower(), data.getActiveExportPower(), data.getReactiveExportPower(),
+        data.getL1Current(), data.getL2Current(), data.getL3Current(),
+        data.getL1Voltage(), data.getL2Voltage(), data.getL3Voltage(),
+        data.getActiveImportCounter(), data.getActiveExportCounter(), data.getReactiveImportCounter(), data.getReactiveExportCounter(),
+        (unsigned long) data.getMeterTimestamp());
+    pos += snprintf_P(json+pos, size-pos, PSTR("%s\"%sh\":%.2f,\"%sd\":%.1f,\"%st\":%d,\"%sx\":%.2f,\"%she\":%.2f,\"%sde\":%.1f%s"),
+        "},\"realtime\":{", "", ea.getUseThisHour(), "", ea.getUseToday(), "", ea.getCurrentThreshold(), "", ea.getMonthMax(),
+        "", ea.getProducedThisHour(), "", ea.getProducedToday(), "}");
+    json[pos++] = '}';
+    json[pos] = '\0';
+    return pos;
+}
+
+void test_list3_template_matches_hard_coded_payload() {
+    TEST_ASSERT_TRUE(compile(LIST3_TEMPLATE));
+    char expected[PAYLOAD_TEMPLATE_MAX_SIZE];
+    size_t length = renderList3(expected, sizeof(expected));
+    TEST_ASSERT_EQUAL(length, tpl->render(out, sizeof(out), src));
+    TEST_ASSERT_EQUAL_STRING(expected, out);
+}
+
+void test_unknown_placeholder_is_rejected() {
+    TEST_ASSERT_FALSE(compile("{\"P\":{{P}},\"x\":{{nope}}}"));
+    TEST_ASSERT_TRUE(tpl->isEmpty());
+    TEST_ASSERT_FALSE(compile("{{}}"));
+    TEST_ASSERT_FALSE(compile("{{p}}"));
+}
+
+void test_unterminated_placeholder_is_rejected() {
+    TEST_ASSERT_FALSE(compile("{\"P\":{{P"));
+    TEST_ASSERT_FALSE(compile("{\"P\":{{P}"));
+    TEST_ASSERT_FALSE(compile("{{P}}{{"));
+    // A single brace is text
+    TEST_ASSERT_TRUE(compile("{\"P\":{{P}}}"));
+}
+
+void test_decimals_above_8_are_rejected() {
+    TEST_ASSERT_TRUE(compile("{{U1:8}}"));
+    TEST_ASSERT_FALSE(compile("{{U1:9}}"));
+    TEST_ASSERT_FALSE(compile("{{U1:12}}"));
+    TEST_ASSERT_FALSE(compile("{{U1:1x}}"));
+    TEST_ASSERT_FALSE(compile("{{U1:-1}}"));
+
+    TEST_ASSERT_TRUE(compile("{{U1:0}} {{U1:1}} {{U1:8}}"));
+    tpl->render(out, sizeof(out), src);
+    TEST_ASSERT_EQUAL_STRING("232 231.5 231.50000000", out);
+}
+
+void test_missing_price_is_null() {
+    TEST_ASSERT_TRUE(compile("{\"price\":{{price}},\"exportPrice\":{{exportPrice}},\"p2\":{{price:2}}}"));
+    tpl->render(out, sizeof(out), src);
+    TEST_ASSERT_EQUAL_STRING("{\"price\":1.2345,\"exportPrice\":null,\"p2\":1.23}", out);
+
+    src.price = PRICE_NO_VALUE;
+    src.exportPrice = -0.05;
+    tpl->render(out, sizeof(out), src);
+    TEST_ASSERT_EQUAL_STRING("{\"price\":null,\"exportPrice\":-0.0500,\"p2\":null}", out);
+}
+
+void test_text_fields_are_json_escaped() {
+    src.name = "a \"quoted\" \\ name";
+    TEST_ASSERT_TRUE(compile("{\"name\":\"{{name}}\"}"));
+    tpl->render(out, sizeof(out), src);
+    TEST_ASSERT_EQUAL_STRING("{\"name\":\"a \\\"quoted\\\" \\\\ name\"}", out);
+}
+
+void test_output_is_truncated_at_size() {
+    TEST_ASSERT_TRUE(compile(LIST3_TEMPLATE));
+    char full[PAYLOAD_TEMPLATE_MAX_SIZE];
+    size_t length = tpl->render(full, sizeof(full), src);
+    for(size_t size = 1; size <= length + 1; size++) {
+        memset(out, 'X', sizeof(out));
+        size_t n = tpl->render(out, size, src);
+        TEST_ASSERT_EQUAL(size - 1, n);
+        TEST_ASSERT_EQUAL('\0', out[n]);
+        TEST_ASSERT_EQUAL('X', out[size]);
+        TEST_ASSERT_TRUE(strncmp(full, out, n) == 0);
+    }
+    TEST_ASSERT_EQUAL(0, tpl->render(out, 0, src));
+}
+
+void test_escape_is_not_split_by_truncation() {
+    src.name = "\"";
+    TEST_ASSERT_TRUE(compile("{{name}}"));
+    // Room for one character only, a lone backslash would be broken JSON
+    TEST_ASSERT_EQUAL(0, tpl->render(out, 2, src));
+    TEST_ASSERT_EQUAL(2, tpl->render(out, 3, src));
+    TEST_ASSERT_EQUAL_STRING("\\\"", out);
+}
+
+void test_size_limits() {
+    TEST_ASSERT_FALSE(tpl->compile("", 0));
+    char text[PAYLOAD_TEMPLATE_MAX_SIZE + 1];
+    memset(text, 'a', sizeof(text));
+    TEST_ASSERT_TRUE(tpl->compile(text, PAYLOAD_TEMPLATE_MAX_SIZE));
+    TEST_ASSERT_FALSE(tpl->compile(text, PAYLOAD_TEMPLATE_MAX_SIZE + 1));
+
+    // Every placeholder and every span of text between them is an operation
+    std::string many;
+    for(uint8_t i = 0; i < PAYLOAD_TEMPLATE_MAX_OPS / 2; i++) many += "{{P}},";
+    TEST_ASSERT_TRUE(compile(many.c_str()));
+    many += "{{P}}";
+    TEST_ASSERT_FALSE(compile(many.c_str()));
+}
+
+// Not a pass/fail measure for time, prints the cost of the template against the hard-coded payload
+void test_benchmark_against_snprintf() {
+    TEST_ASSERT_TRUE(compile(LIST3_TEMPLATE));
+    const uint32_t rounds = 100000;
+    char json[PAYLOAD_TEMPLATE_MAX_SIZE];
+    volatile size_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < rounds; i++) sink += tpl->render(out, sizeof(out), src);
+    double rendered = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < rounds; i++) sink += renderList3(json, sizeof(json));
+    double printed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "List 3 payload: template %.0f ns, snprintf_P %.0f ns", rendered / rounds, printed / rounds);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_STRING(json, out);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_list3_template_matches_hard_coded_payload);
+    RUN_TEST(test_unknown_placeholder_is_rejected);
+    RUN_TEST(test_unterminated_placeholder_is_rejected);
+    RUN_TEST(test_decimals_above_8_are_rejected);
+    RUN_TEST(test_missing_price_is_null);
+    RUN_TEST(test_text_fields_are_json_escaped);
+    RUN_TEST(test_output_is_truncated_at_size);
+    RUN_TEST(test_escape_is_not_split_by_truncation);
+    RUN_TEST(test_size_limits);
+    RUN_TEST(test_benchmark_against_snprintf);
+    return UNITY_END();
+}
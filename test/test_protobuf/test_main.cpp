@@ -0,0 +1,411 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "ProtobufMqttHandler/src/ProtobufWriter.cpp"
+
+// Same size as AmsMqttHandler::BufferSize, the buffer every Protobuf payload is built in
+#define BUFFER_SIZE 2048
+
+struct Field {
+    uint32_t number;
+    uint8_t type;
+    uint64_t value;
+    std::string bytes;
+};
+
+// Plain wire format decoder, independent of the writer. Returns false on anything malformed.
+static bool readVarint(const uint8_t* buf, size_t length, size_t& pos, uint64_t& value) {
+    value = 0;
+    for(uint8_t shift = 0; shift < 64; shift += 7) {
+        if(pos >= length) return false;
+        uint8_t b = buf[pos++];
+        value |= (uint64_t) (b & 0x7F) << shift;
+        if((b & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static bool decode(const uint8_t* buf, size_t length, std::vector<Field>& fields) {
+    size_t pos = 0;
+    while(pos < length) {
+        uint64_t tag;
+        if(!readVarint(buf, length, pos, tag)) return false;
+        Field f = { (uint32_t) (tag >> 3), (uint8_t) (tag & 0x07), 0, "" };
+        if(f.number == 0) return false;
+        if(f.type == 0) {
+            if(!readVarint(buf, length, pos, f.value)) return false;
+        } else if(f.type == 1) {
+            if(pos + 8 > length) return false;
+            for(uint8_t i = 0; i < 8; i++) {
+                f.value |= (uint64_t) buf[pos++] << (i * 8);
+            }
+        } else if(f.type == 2) {
+            uint64_t size;
+            if(!readVarint(buf, length, pos, size) || pos + size > length) return false;
+            f.value = size;
+            f.bytes.assign((const char*) buf + pos, size);
+            pos += size;
+        } else {
+            return false;
+        }
+        fields.push_back(f);
+    }
+    return true;
+}
+
+static bool decode(const std::string& bytes, std::vector<Field>& fields) {
+    return decode((const uint8_t*) bytes.data(), bytes.size(), fields);
+}
+
+static int64_t zigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static const Field* find(const std::vector<Field>& fields, uint32_t number) {
+    for(const Field& f : fields) {
+        if(f.number == number) return &f;
+    }
+    return NULL;
+}
+
+static uint8_t buf[20000];
+
+void setUp(void) {
+    memset(buf, 0xAA, sizeof(buf));
+}
+
+void tearDown(void) {}
+
+void test_scalars_round_trip(void) {
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    writer.writeUint(1, 1);
+    writer.writeUint(2, UINT64_MAX);
+    writer.writeSint(3, -1);
+    writer.writeSint(4, INT64_MIN);
+    writer.writeSint(5, INT64_MAX);
+    writer.writeBool(6, true);
+    writer.writeFixed64(7, 0x0102030405060708ULL);
+    writer.writeString(8, "7359992890941742");
+    writer.writeUint(200, 300);
+    TEST_ASSERT_TRUE(writer.isOk());
+
+    std::vector<Field> fields;
+    TEST_ASSERT_TRUE(decode(buf, writer.getLength(), fields));
+    TEST_ASSERT_EQUAL(9, fields.size());
+    TEST_ASSERT_EQUAL_UINT64(1, fields[0].value);
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, fields[1].value);
+    TEST_ASSERT_EQUAL_INT64(-1, zigzag(fields[2].value));
+    TEST_ASSERT_EQUAL_UINT64(1, fields[2].value);
+    TEST_ASSERT_EQUAL_INT64(INT64_MIN, zigzag(fields[3].value));
+    TEST_ASSERT_EQUAL_INT64(INT64_MAX, zigzag(fields[4].value));
+    TEST_ASSERT_EQUAL_UINT64(1, fields[5].value);
+    TEST_ASSERT_EQUAL(1, fields[6].type);
+    TEST_ASSERT_EQUAL_UINT64(0x0102030405060708ULL, fields[6].value);
+    TEST_ASSERT_EQUAL(2, fields[7].type);
+    TEST_ASSERT_EQUAL_STRING("7359992890941742", fields[7].bytes.c_str());
+    TEST_ASSERT_EQUAL(200, fields[8].number);
+    TEST_ASSERT_EQUAL_UINT64(300, fields[8].value);
+
+    // Sizes from the wire format: 1 byte tag + varint, two byte tag for field 200
+    TEST_ASSERT_EQUAL(2 + 11 + 2 + 11 + 11 + 2 + 9 + 18 + 4, writer.getLength());
+}
+
+void test_zero_values_are_left_out(void) {
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    writer.writeUint(1, 0);
+    writer.writeSint(2, 0);
+    writer.writeBool(3, false);
+    writer.writeFixed64(4, 0);
+    writer.writeString(5, "");
+    writer.writeString(6, NULL);
+    writer.writePackedSint(7, NULL, 0);
+    TEST_ASSERT_TRUE(writer.isOk());
+    TEST_ASSERT_EQUAL(0, writer.getLength());
+}
+
+void test_short_message_is_moved_back(void) {
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    writer.writeUint(1, 42);
+    size_t mark = writer.beginMessage(6);
+    writer.writeUint(1, 1500);
+    writer.writeUint(2, 12000);
+    writer.endMessage(mark);
+    writer.writeUint(4, 3);
+    TEST_ASSERT_TRUE(writer.isOk());
+
+    // tag+42, tag+len+(tag+2 bytes, tag+2 bytes), tag+3, with no spare byte left behind
+    TEST_ASSERT_EQUAL(2 + 2 + 6 + 2, writer.getLength());
+    TEST_ASSERT_EQUAL_HEX8(0x32, buf[2]);
+    TEST_ASSERT_EQUAL_HEX8(6, buf[3]);
+
+    std::vector<Field> fields;
+    TEST_ASSERT_TRUE(decode(buf, writer.getLength(), fields));
+    TEST_ASSERT_EQUAL(3, fields.size());
+    TEST_ASSERT_EQUAL(6, fields[1].number);
+    TEST_ASSERT_EQUAL(4, fields[2].number);
+    TEST_ASSERT_EQUAL_UINT64(3, fields[2].value);
+
+    std::vector<Field> inner;
+    TEST_ASSERT_TRUE(decode(fields[1].bytes, inner));
+    TEST_ASSERT_EQUAL(2, inner.size());
+    TEST_ASSERT_EQUAL_UINT64(1500, inner[0].value);
+    TEST_ASSERT_EQUAL_UINT64(12000, inner[1].value);
+}
+
+void test_empty_message(void) {
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    size_t mark = writer.beginMessage(5);
+    writer.endMessage(mark);
+    TEST_ASSERT_TRUE(writer.isOk());
+    TEST_ASSERT_EQUAL(2, writer.getLength());
+    TEST_ASSERT_EQUAL_HEX8(0x2A, buf[0]);
+    TEST_ASSERT_EQUAL_HEX8(0, buf[1]);
+}
+
+static void writeMessageOfLength(ProtobufWriter& writer, uint8_t field, size_t length) {
+    // One string field of the given total length, tag and length varint included
+    std::string str(length - (length - 2 < 0x80 ? 2 : 3), 'x');
+    size_t mark = writer.beginMessage(field);
+    writer.writeString(1, str.c_str());
+    writer.endMessage(mark);
+}
+
+void test_length_boundary(void) {
+    for(size_t length : { (size_t) 126, (size_t) 127, (size_t) 128, (size_t) 129, (size_t) 1000 }) {
+        ProtobufWriter writer(buf, BUFFER_SIZE);
+        writeMessageOfLength(writer, 5, length);
+        writer.writeUint(4, 2);
+        TEST_ASSERT_TRUE(writer.isOk());
+
+        size_t header = length < 0x80 ? 2 : 3;
+        TEST_ASSERT_EQUAL(header + length + 2, writer.getLength());
+
+        std::vector<Field> fields;
+        TEST_ASSERT_TRUE(decode(buf, writer.getLength(), fields));
+        TEST_ASSERT_EQUAL(2, fields.size());
+        TEST_ASSERT_EQUAL(length, fields[0].bytes.size());
+        TEST_ASSERT_EQUAL(4, fields[1].number);
+
+        std::vector<Field> inner;
+        TEST_ASSERT_TRUE(decode(fields[0].bytes, inner));
+        TEST_ASSERT_EQUAL(1, inner.size());
+        TEST_ASSERT_TRUE(inner[0].bytes == std::string(inner[0].bytes.size(), 'x'));
+    }
+}
+
+void test_nested_messages_shrink_independently(void) {
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    size_t outer = writer.beginMessage(5);
+    size_t small = writer.beginMessage(1);
+    writer.writeUint(1, 7);
+    writer.endMessage(small);
+    writeMessageOfLength(writer, 2, 200);
+    small = writer.beginMessage(3);
+    writer.writeSint(2, -2150);
+    writer.endMessage(small);
+    writer.endMessage(outer);
+    TEST_ASSERT_TRUE(writer.isOk());
+
+    std::vector<Field> fields;
+    TEST_ASSERT_TRUE(decode(buf, writer.getLength(), fields));
+    TEST_ASSERT_EQUAL(1, fields.size());
+    TEST_ASSERT_EQUAL(writer.getLength() - 3, fields[0].bytes.size());
+
+    std::vector<Field> inner;
+    TEST_ASSERT_TRUE(decode(fields[0].bytes, inner));
+    TEST_ASSERT_EQUAL(3, inner.size());
+    TEST_ASSERT_EQUAL(2, inner[0].bytes.size());
+    TEST_ASSERT_EQUAL(200, inner[1].bytes.size());
+
+    std::vector<Field> last;
+    TEST_ASSERT_TRUE(decode(inner[2].bytes, last));
+    TEST_ASSERT_EQUAL(1, last.size());
+    TEST_ASSERT_EQUAL_INT64(-2150, zigzag(last[0].value));
+}
+
+void test_message_too_long_for_two_bytes_fails(void) {
+    ProtobufWriter writer(buf, sizeof(buf));
+    writeMessageOfLength(writer, 5, 0x3FFF);
+    TEST_ASSERT_TRUE(writer.isOk());
+
+    ProtobufWriter big(buf, sizeof(buf));
+    writeMessageOfLength(big, 5, 0x4000);
+    TEST_ASSERT_FALSE(big.isOk());
+}
+
+void test_packed_keeps_zeros(void) {
+    int32_t values[38];
+    for(uint8_t i = 0; i < 38; i++) {
+        values[i] = (i % 5 == 0) ? 0 : (i % 2 ? -1 : 1) * i * 1234;
+    }
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    size_t mark = writer.beginMessage(8);
+    writer.writeSint(1, 1700000000);
+    writer.writePackedSint(2, values, 38);
+    writer.endMessage(mark);
+    TEST_ASSERT_TRUE(writer.isOk());
+
+    std::vector<Field> fields, prices;
+    TEST_ASSERT_TRUE(decode(buf, writer.getLength(), fields));
+    TEST_ASSERT_TRUE(decode(fields[0].bytes, prices));
+    TEST_ASSERT_EQUAL(2, prices.size());
+    TEST_ASSERT_EQUAL_INT64(1700000000, zigzag(prices[0].value));
+
+    const std::string& packed = prices[1].bytes;
+    size_t pos = 0;
+    for(uint8_t i = 0; i < 38; i++) {
+        uint64_t value;
+        TEST_ASSERT_TRUE(readVarint((const uint8_t*) packed.data(), packed.size(), pos, value));
+        TEST_ASSERT_EQUAL_INT32(values[i], (int32_t) zigzag(value));
+    }
+    TEST_ASSERT_EQUAL(packed.size(), pos);
+}
+
+void test_overflow_fails_without_writing_past_end(void) {
+    for(size_t size = 0; size < 40; size++) {
+        memset(buf, 0xAA, sizeof(buf));
+        ProtobufWriter writer(buf, size);
+        writer.writeUint(1, 123456);
+        size_t mark = writer.beginMessage(5);
+        writer.writeString(1, "1234567890");
+        writer.writeFixed64(2, 0x1122334455667788ULL);
+        writer.endMessage(mark);
+        writer.writeSint(3, -99);
+
+        // Complete payload is 4 + 2 + 12 + 9 + 3 = 30 bytes, the message length needs a spare byte until it ends
+        TEST_ASSERT_EQUAL(size >= 30, writer.isOk());
+        TEST_ASSERT_TRUE(writer.getLength() <= size);
+        for(size_t i = size; i < sizeof(buf); i++) {
+            if(buf[i] != 0xAA) TEST_FAIL_MESSAGE("Wrote past the end of the buffer");
+        }
+    }
+}
+
+/*
+ * Field numbers and wire types of amsreader.proto. The tests below build payloads in the same
+ * order and with the same calls as ProtobufMqttHandler, so a field moved in one place and not in
+ * the other shows up here.
+ */
+struct ProtoField {
+    uint32_t number;
+    uint8_t type;
+};
+
+static const ProtoField PAYLOAD_FIELDS[] = { {1,0}, {2,0}, {3,0}, {4,0}, {5,2}, {6,2}, {7,2}, {8,2}, {9,2} };
+static const ProtoField METER_FIELDS[] = {
+    {1,2}, {2,2}, {3,2}, {4,0}, {5,0}, {6,0}, {7,0}, {8,0}, {9,0}, {10,0}, {11,0}, {12,0}, {13,0},
+    {14,0}, {15,0}, {16,0}, {17,0}, {18,0}, {19,0}, {20,0}, {21,0}, {22,0}, {23,0}, {24,0}, {25,0},
+    {26,0}, {27,0}, {28,0}, {29,0}, {30,0}, {31,0}, {32,0}, {33,0}, {34,0}
+};
+static const ProtoField REALTIME_FIELDS[] = { {1,0}, {2,0}, {3,0}, {4,0}, {5,0}, {6,0} };
+
+static void assertFields(const std::vector<Field>& fields, const ProtoField* proto, size_t count) {
+    TEST_ASSERT_EQUAL(count, fields.size());
+    for(size_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(proto[i].number, fields[i].number);
+        TEST_ASSERT_EQUAL(proto[i].type, fields[i].type);
+    }
+}
+
+// Largest keyframe ProtobufMqttHandler::publish() can produce: identity strings, every value at its limit
+static size_t writeWorstCaseKeyframe(ProtobufWriter& writer) {
+    std::string id(64, '9');
+    writer.writeUint(1, UINT32_MAX);
+    writer.writeSint(3, INT64_MIN);
+    writer.writeUint(4, 4);
+
+    size_t mark = writer.beginMessage(5);
+    writer.writeString(1, id.c_str());
+    writer.writeString(2, id.c_str());
+    writer.writeString(3, id.c_str());
+    writer.writeSint(4, INT64_MIN);
+    for(uint8_t i = 5; i <= 14; i++) writer.writeUint(i, UINT32_MAX);
+    for(uint8_t i = 15; i <= 17; i++) writer.writeSint(i, INT32_MIN);
+    for(uint8_t i = 18; i <= 20; i++) writer.writeUint(i, UINT32_MAX);
+    for(uint8_t i = 21; i <= 24; i++) writer.writeSint(i, INT32_MIN);
+    for(uint8_t i = 25; i <= 34; i++) writer.writeSint(i, INT64_MIN);
+    writer.endMessage(mark);
+
+    mark = writer.beginMessage(6);
+    for(uint8_t i = 1; i <= 6; i++) writer.writeUint(i, UINT32_MAX);
+    writer.endMessage(mark);
+    return writer.getLength();
+}
+
+void test_keyframe_matches_proto_and_fits(void) {
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    size_t length = writeWorstCaseKeyframe(writer);
+    TEST_ASSERT_TRUE(writer.isOk());
+    TEST_ASSERT_TRUE(length < 1024);
+
+    std::vector<Field> fields, meter, realtime;
+    TEST_ASSERT_TRUE(decode(buf, length, fields));
+    TEST_ASSERT_EQUAL(5, fields.size());
+    TEST_ASSERT_EQUAL(1, fields[0].number);
+    TEST_ASSERT_EQUAL(3, fields[1].number);
+    TEST_ASSERT_EQUAL(4, fields[2].number);
+    TEST_ASSERT_EQUAL(PAYLOAD_FIELDS[4].number, fields[3].number);
+    TEST_ASSERT_EQUAL(PAYLOAD_FIELDS[5].number, fields[4].number);
+
+    TEST_ASSERT_TRUE(decode(fields[3].bytes, meter));
+    assertFields(meter, METER_FIELDS, sizeof(METER_FIELDS) / sizeof(METER_FIELDS[0]));
+    TEST_ASSERT_EQUAL_INT64(INT64_MIN, zigzag(find(meter, 34)->value));
+    TEST_ASSERT_EQUAL_INT64(INT32_MIN, zigzag(find(meter, 24)->value));
+
+    TEST_ASSERT_TRUE(decode(fields[4].bytes, realtime));
+    assertFields(realtime, REALTIME_FIELDS, sizeof(REALTIME_FIELDS) / sizeof(REALTIME_FIELDS[0]));
+}
+
+void test_delta_frame_is_small(void) {
+    // Typical list 3 frame between keyframes: counters a few Wh on, no identity strings
+    ProtobufWriter writer(buf, BUFFER_SIZE);
+    writer.writeUint(1, 57);
+    writer.writeUint(2, 1);
+    writer.writeSint(3, 560);
+    writer.writeUint(4, 3);
+    size_t mark = writer.beginMessage(5);
+    writer.writeUint(5, 1830);
+    writer.writeUint(6, 120);
+    writer.writeSint(15, 812);
+    writer.writeSint(16, -15);
+    writer.writeSint(17, 240);
+    writer.writeUint(18, 2301);
+    writer.writeUint(19, 2298);
+    writer.writeUint(20, 2310);
+    writer.writeSint(25, 285);
+    writer.writeSint(27, 19);
+    writer.endMessage(mark);
+    TEST_ASSERT_TRUE(writer.isOk());
+    TEST_ASSERT_TRUE(writer.getLength() < 64);
+
+    std::vector<Field> fields, meter;
+    TEST_ASSERT_TRUE(decode(buf, writer.getLength(), fields));
+    TEST_ASSERT_EQUAL(1, find(fields, 2)->value);
+    TEST_ASSERT_EQUAL_INT64(560, zigzag(find(fields, 3)->value));
+    TEST_ASSERT_TRUE(decode(find(fields, 5)->bytes, meter));
+    TEST_ASSERT_EQUAL_INT64(-15, zigzag(find(meter, 16)->value));
+    TEST_ASSERT_EQUAL_INT64(285, zigzag(find(meter, 25)->value));
+    TEST_ASSERT_NULL(find(meter, 26));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_scalars_round_trip);
+    RUN_TEST(test_zero_values_are_left_out);
+    RUN_TEST(test_short_message_is_moved_back);
+    RUN_TEST(test_empty_message);
+    RUN_TEST(test_length_boundary);
+    RUN_TEST(test_nested_messages_shrink_independently);
+    RUN_TEST(test_message_too_long_for_two_bytes_fails);
+    RUN_TEST(test_packed_keeps_zeros);
+    RUN_TEST(test_overflow_fails_without_writing_past_end);
+    RUN_TEST(test_keyframe_matches_proto_and_fits);
+    RUN_TEST(test_delta_frame_is_small);
+    return UNITY_END();
+}
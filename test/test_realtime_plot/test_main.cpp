@@ -0,0 +1,154 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include <chrono>
+#include <math.h>
+#include "RealtimePlot.h"
+#include "AmsData/src/AmsData.cpp"
+#include "RealtimePlot/src/RealtimePlot.cpp"
+#include "Uptime/src/Uptime.cpp"
+
+// Largest value the codes hold, mantissa 255 on exponent 15
+#define CODE_MAX (255 << 14)
+// Mantissa is 8 bits with rounding to nearest, so at most half a step of 1/128
+#define CODE_MAX_ERROR (1.0 / 256)
+
+class TestData : public AmsData {
+public:
+    void setPower(int32_t watt) {
+        activeImportPower = watt > 0 ? watt : 0;
+        activeExportPower = watt < 0 ? -watt : 0;
+        lastUpdateMillis = millis();
+    }
+};
+
+// Samples as stored before the 12 bit codes, an int8 and a power of ten
+static int32_t oldRoundTrip(int32_t value) {
+    uint8_t scale = 0;
+    int32_t stored = value / pow(10, scale);
+    while(stored > INT8_MAX || stored < INT8_MIN) {
+        stored = value / pow(10, ++scale);
+    }
+    return (int8_t) stored * pow(10, scale);
+}
+
+static double relativeError(int32_t value, int32_t decoded) {
+    return value == 0 ? 0 : fabs((double) decoded - value) / fabs((double) value);
+}
+
+void setUp() {
+    stubMillis = 0;
+}
+
+void tearDown() {}
+
+void test_small_values_are_exact() {
+    for(int32_t v = -127; v <= 127; v++) {
+        TEST_ASSERT_EQUAL_INT32(v, RealtimePlot::decode(RealtimePlot::encode(v)));
+    }
+}
+
+void test_codes_fit_12_bits() {
+    for(int32_t v = -CODE_MAX; v <= CODE_MAX; v += 97) {
+        TEST_ASSERT_TRUE(RealtimePlot::encode(v) <= 0xFFF);
+    }
+    TEST_ASSERT_TRUE(RealtimePlot::encode(INT32_MAX) <= 0xFFF);
+    TEST_ASSERT_TRUE(RealtimePlot::encode(-INT32_MAX) <= 0xFFF);
+}
+
+void test_worst_case_relative_error() {
+    double worst = 0;
+    for(int32_t v = 128; v <= CODE_MAX; v += (v >> 12) + 1) {
+        worst = fmax(worst, relativeError(v, RealtimePlot::decode(RealtimePlot::encode(v))));
+        worst = fmax(worst, relativeError(-v, RealtimePlot::decode(RealtimePlot::encode(-v))));
+    }
+    TEST_ASSERT_TRUE(worst <= CODE_MAX_ERROR);
+}
+
+void test_exponent_carry_rounds_up() {
+    // Up to 255 the step is 1, above it halves are rounded up and the top one carries into the next exponent
+    TEST_ASSERT_EQUAL_INT32(255, RealtimePlot::decode(RealtimePlot::encode(255)));
+    TEST_ASSERT_EQUAL_INT32(258, RealtimePlot::decode(RealtimePlot::encode(257)));
+    TEST_ASSERT_EQUAL_INT32(512, RealtimePlot::decode(RealtimePlot::encode(511)));
+    TEST_ASSERT_EQUAL_INT32(-512, RealtimePlot::decode(RealtimePlot::encode(-511)));
+}
+
+void test_large_values_saturate() {
+    TEST_ASSERT_EQUAL_INT32(CODE_MAX, RealtimePlot::decode(RealtimePlot::encode(CODE_MAX)));
+    TEST_ASSERT_EQUAL_INT32(CODE_MAX, RealtimePlot::decode(RealtimePlot::encode(10000000)));
+    TEST_ASSERT_EQUAL_INT32(-CODE_MAX, RealtimePlot::decode(RealtimePlot::encode(-10000000)));
+}
+
+// Not a pass/fail measure for time, prints the cost and error of both schemes over household range
+void test_benchmark_against_int8_pow10() {
+    double worstNew = 0, worstOld = 0, sumNew = 0, sumOld = 0;
+    uint32_t n = 0;
+    for(int32_t v = -30000; v <= 30000; v++) {
+        if(v > -128 && v < 128) continue;
+        double e = relativeError(v, RealtimePlot::decode(RealtimePlot::encode(v)));
+        double o = relativeError(v, oldRoundTrip(v));
+        worstNew = fmax(worstNew, e);
+        worstOld = fmax(worstOld, o);
+        sumNew += e;
+        sumOld += o;
+        n++;
+    }
+
+    volatile int64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(uint8_t r = 0; r < 20; r++) {
+        for(int32_t v = -30000; v <= 30000; v++) sink += RealtimePlot::decode(RealtimePlot::encode(v));
+    }
+    double codes = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for(uint8_t r = 0; r < 20; r++) {
+        for(int32_t v = -30000; v <= 30000; v++) sink += oldRoundTrip(v);
+    }
+    double old = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "12 bit codes: %.2f ns, max error %.3f%%, mean %.4f%% | int8 pow10: %.2f ns, max error %.3f%%, mean %.4f%%",
+        codes / (20 * 60001.0), worstNew * 100, sumNew * 100 / n, old / (20 * 60001.0), worstOld * 100, sumOld * 100 / n);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(worstNew <= CODE_MAX_ERROR);
+    TEST_ASSERT_TRUE(worstNew < worstOld);
+    TEST_ASSERT_TRUE(sumNew < sumOld);
+}
+
+void test_samples_round_trip_through_the_ring() {
+    RealtimePlot plot;
+    TestData data;
+    uint16_t size = plot.getSize();
+    int32_t values[size];
+    stubMillis = REALTIME_SAMPLE;
+    data.setPower(0);
+    plot.update(data);
+
+    // Neighbouring samples share a byte, so both halves have to survive the other being written
+    for(uint16_t i = 0; i < size; i++) {
+        values[i] = (i % 2 ? -1 : 1) * (int32_t) (50 + i * 137);
+        stubMillis += REALTIME_SAMPLE;
+        data.setPower(values[i]);
+        plot.update(data);
+    }
+    for(uint16_t req = 0; req < size; req++) {
+        int32_t v = values[size - 1 - req];
+        TEST_ASSERT_TRUE(relativeError(v, plot.getValue(req)) <= CODE_MAX_ERROR);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_small_values_are_exact);
+    RUN_TEST(test_codes_fit_12_bits);
+    RUN_TEST(test_worst_case_relative_error);
+    RUN_TEST(test_exponent_carry_rounds_up);
+    RUN_TEST(test_large_values_saturate);
+    RUN_TEST(test_benchmark_against_int8_pow10);
+    RUN_TEST(test_samples_round_trip_through_the_ring);
+    return UNITY_END();
+}
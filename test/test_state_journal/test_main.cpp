@@ -0,0 +1,229 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ * 
+ */
+
+#include <unity.h>
+#include "LittleFS.h"
+
+// Lets a test make the shadow allocation fail
+static bool failMalloc = false;
+static void* testMalloc(size_t size) {
+    return failMalloc ? NULL : malloc(size);
+}
+
+#define malloc testMalloc
+#include "AmsDataStorage/src/StateJournal.cpp"
+#undef malloc
+#include "AmsDecoder/src/crc.cpp"
+
+#define SNAPSHOT "/state.bin"
+#define JOURNAL "/state.jnl"
+
+struct State {
+    uint8_t version;
+    uint16_t hours[24];
+    uint32_t days[31];
+    uint64_t total;
+};
+
+static State state;
+
+void setUp() {
+    LittleFS.reset();
+    StateJournal::mount();
+    failMalloc = false;
+    memset(&state, 0, sizeof(state));
+    state.version = 7;
+}
+
+void tearDown() {}
+
+// Loads the state the way the storage classes do after a restart
+static bool reboot(State& into) {
+    memset(&into, 0, sizeof(into));
+    if(!LittleFS.exists(SNAPSHOT)) return false;
+    std::string snapshot = LittleFS.files[SNAPSHOT];
+    if(snapshot.size() != sizeof(into)) return false;
+    memcpy(&into, snapshot.data(), sizeof(into));
+    StateJournal journal(SNAPSHOT, JOURNAL, &into, sizeof(into));
+    journal.setBase((const uint8_t*) snapshot.data(), snapshot.size());
+    journal.replay();
+    return true;
+}
+
+static void assertRebootEquals(const State& expected) {
+    State loaded;
+    TEST_ASSERT_TRUE(reboot(loaded));
+    TEST_ASSERT_EQUAL_MEMORY(&expected, &loaded, sizeof(State));
+}
+
+void test_first_save_writes_snapshot() {
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    state.total = 12345;
+    TEST_ASSERT_TRUE(journal.save());
+    TEST_ASSERT_FALSE(LittleFS.exists(JOURNAL));
+    assertRebootEquals(state);
+}
+
+void test_changes_are_appended_to_journal() {
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    TEST_ASSERT_TRUE(journal.save());
+    std::string snapshot = LittleFS.files[SNAPSHOT];
+
+    state.hours[3] = 1000;
+    TEST_ASSERT_TRUE(journal.save());
+    size_t first = LittleFS.files[JOURNAL].size();
+    // Header plus one record holding only the changed bytes
+    TEST_ASSERT_EQUAL(sizeof(StateJournalHeader) + sizeof(StateJournalRecord) + 2 + 2, first);
+
+    state.days[20] = 99999;
+    state.total = 1;
+    TEST_ASSERT_TRUE(journal.save());
+    TEST_ASSERT_GREATER_THAN(first, LittleFS.files[JOURNAL].size());
+
+    // Nothing changed, nothing written
+    size_t size = LittleFS.files[JOURNAL].size();
+    TEST_ASSERT_TRUE(journal.save());
+    TEST_ASSERT_EQUAL(size, LittleFS.files[JOURNAL].size());
+
+    TEST_ASSERT_TRUE(snapshot == LittleFS.files[SNAPSHOT]);
+    assertRebootEquals(state);
+}
+
+void test_replay_continues_appending() {
+    {
+        StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+        journal.save();
+        state.hours[0] = 1;
+        journal.save();
+    }
+
+    State loaded;
+    TEST_ASSERT_TRUE(reboot(loaded));
+    std::string snapshot = LittleFS.files[SNAPSHOT];
+    StateJournal journal(SNAPSHOT, JOURNAL, &loaded, sizeof(loaded));
+    journal.setBase((const uint8_t*) snapshot.data(), snapshot.size());
+    TEST_ASSERT_EQUAL(1, journal.replay());
+
+    loaded.hours[1] = 2;
+    TEST_ASSERT_TRUE(journal.save());
+    TEST_ASSERT_TRUE(snapshot == LittleFS.files[SNAPSHOT]);
+    assertRebootEquals(loaded);
+}
+
+void test_torn_record_is_ignored_and_compacted() {
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    journal.save();
+    state.hours[5] = 5;
+    TEST_ASSERT_TRUE(journal.save());
+    State good = state;
+
+    // Power is cut after a few bytes of the next record
+    state.days[10] = 10;
+    state.total = 10;
+    LittleFS.writeBudget = 3;
+    TEST_ASSERT_FALSE(journal.save());
+    LittleFS.writeBudget = SIZE_MAX;
+    assertRebootEquals(good);
+
+    // The broken tail makes the next save rewrite the snapshot instead of appending after it
+    TEST_ASSERT_TRUE(journal.save());
+    TEST_ASSERT_FALSE(LittleFS.exists(JOURNAL));
+    assertRebootEquals(state);
+}
+
+void test_corrupt_record_stops_replay() {
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    journal.save();
+    state.hours[1] = 1;
+    journal.save();
+    State good = state;
+    size_t end = LittleFS.files[JOURNAL].size();
+    state.hours[2] = 2;
+    journal.save();
+
+    // Flip a data bit in the last record, its CRC no longer matches
+    LittleFS.files[JOURNAL][end + sizeof(StateJournalRecord)] ^= 0x01;
+    assertRebootEquals(good);
+
+    // Trailing garbage after valid records
+    LittleFS.files[JOURNAL].resize(end);
+    LittleFS.files[JOURNAL].append("\xA5\x10", 2);
+    assertRebootEquals(good);
+}
+
+void test_journal_of_older_snapshot_is_discarded() {
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    journal.save();
+    state.hours[1] = 1;
+    journal.save();
+    std::string stale = LittleFS.files[JOURNAL];
+
+    state.total = 77;
+    journal.compact();
+    State good = state;
+    LittleFS.files[JOURNAL] = stale;
+
+    State loaded;
+    TEST_ASSERT_TRUE(reboot(loaded));
+    TEST_ASSERT_EQUAL_MEMORY(&good, &loaded, sizeof(State));
+    TEST_ASSERT_FALSE(LittleFS.exists(JOURNAL));
+}
+
+void test_journal_is_compacted_when_full() {
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    journal.save();
+    std::string first = LittleFS.files[SNAPSHOT];
+    for(int i = 0; i < 500; i++) {
+        state.hours[i % 24] = i;
+        state.total += i;
+        TEST_ASSERT_TRUE(journal.save());
+        if(LittleFS.exists(JOURNAL)) {
+            TEST_ASSERT_LESS_OR_EQUAL(STATE_JOURNAL_MAX_SIZE, LittleFS.files[JOURNAL].size());
+        }
+        assertRebootEquals(state);
+    }
+    TEST_ASSERT_FALSE(first == LittleFS.files[SNAPSHOT]);
+}
+
+void test_without_shadow_every_save_is_snapshot() {
+    failMalloc = true;
+    StateJournal journal(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    failMalloc = false;
+    for(int i = 0; i < 10; i++) {
+        state.days[i] = i * 1000;
+        TEST_ASSERT_TRUE(journal.save());
+        TEST_ASSERT_FALSE(LittleFS.exists(JOURNAL));
+        assertRebootEquals(state);
+    }
+
+    // Replay still works, it only needs the image
+    state.hours[0] = 1;
+    StateJournal other(SNAPSHOT, JOURNAL, &state, sizeof(state));
+    other.save();
+    state.hours[0] = 2;
+    other.save();
+    State loaded = {};
+    memcpy(&loaded, LittleFS.files[SNAPSHOT].data(), sizeof(loaded));
+    failMalloc = true;
+    StateJournal replayer(SNAPSHOT, JOURNAL, &loaded, sizeof(loaded));
+    failMalloc = false;
+    replayer.setBase((const uint8_t*) LittleFS.files[SNAPSHOT].data(), sizeof(loaded));
+    TEST_ASSERT_EQUAL(1, replayer.replay());
+    TEST_ASSERT_EQUAL_MEMORY(&state, &loaded, sizeof(State));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_save_writes_snapshot);
+    RUN_TEST(test_changes_are_appended_to_journal);
+    RUN_TEST(test_replay_continues_appending);
+    RUN_TEST(test_torn_record_is_ignored_and_compacted);
+    RUN_TEST(test_corrupt_record_stops_replay);
+    RUN_TEST(test_journal_of_older_snapshot_is_discarded);
+    RUN_TEST(test_journal_is_compacted_when_full);
+    RUN_TEST(test_without_shadow_every_save_is_snapshot);
+    return UNITY_END();
+}
@@ -0,0 +1,561 @@
+/**
+ * @copyright Utilitech AS 2023
+ * License: Fair Source
+ *
+ */
+
+// HttpServerCore and WebServerAdapter on the loopback interface, with client threads on plain
+// sockets. The test thread is the firmware loop: it replays a Kaifa list 2 frame through the
+// decoder chain on a fixed interval and calls handleClient() in between, the idle callback replays
+// frames while a handler waits for its output to drain. Latency of the requests and how late the
+// frames were handled are measured while clients load the server.
+
+#define ESP32
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <poll.h>
+#include <signal.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "AmsConfiguration.h"
+#include "AmsConfiguration/src/hexutils.cpp"
+#include "AmsDecoder/src/crc.cpp"
+#include "AmsDecoder/src/ntohll.cpp"
+#include "AmsDecoder/src/HdlcParser.cpp"
+#include "AmsDecoder/src/LlcParser.cpp"
+#include "AmsDecoder/src/DlmsParser.cpp"
+#include "AmsDecoder/src/Cosem.cpp"
+#include "Uptime/src/Uptime.cpp"
+#include "AmsData/src/AmsData.cpp"
+#include "MeterCommunicators/src/IEC6205675.cpp"
+#include "SvelteUi/src/HttpServerCore.cpp"
+#include "SvelteUi/src/WebServerAdapter.cpp"
+#include "SvelteUi/src/JsonWriter.cpp"
+
+#define FRAME_INTERVAL 10 // Compressed from the meter's 2.5s so many frames fall inside each test
+#define FRAME_LATENESS 50
+#define STATIC_SIZE (1024 * 1024)
+#define BIG_VALUES 20000
+
+// frames/Kaifa-TN-3p.raw, list 2 with 1036 W import
+static const uint8_t KAIFA_FRAME[] = {
+    0x7E, 0xA0, 0x79, 0x01, 0x02, 0x01, 0x10, 0x80, 0x93, 0xE6, 0xE7, 0x00, 0x0F, 0x40, 0x00, 0x00,
+    0x00, 0x09, 0x0C, 0x07, 0xE1, 0x09, 0x0E, 0x04, 0x15, 0x1F, 0x14, 0xFF, 0x80, 0x00, 0x00, 0x02,
+    0x0D, 0x09, 0x07, 0x4B, 0x46, 0x4D, 0x5F, 0x30, 0x30, 0x31, 0x09, 0x10, 0x36, 0x39, 0x37, 0x30,
+    0x36, 0x33, 0x31, 0x34, 0x30, 0x31, 0x37, 0x35, 0x33, 0x39, 0x38, 0x35, 0x09, 0x08, 0x4D, 0x41,
+    0x33, 0x30, 0x34, 0x48, 0x33, 0x45, 0x06, 0x00, 0x00, 0x04, 0x0C, 0x06, 0x00, 0x00, 0x00, 0x00,
+    0x06, 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x4E, 0x06, 0x00, 0x00, 0x07, 0xC1, 0x06,
+    0x00, 0x00, 0x0C, 0x9E, 0x06, 0x00, 0x00, 0x0D, 0x7E, 0x06, 0x00, 0x00, 0x09, 0x5F, 0x06, 0x00,
+    0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x09, 0x66, 0x87, 0x96, 0x7E,
+};
+
+static WebServerAdapter server;
+static uint16_t serverPort;
+static char jsonBuffer[2048];
+static char staticBody[STATIC_SIZE];
+
+static HDLCParser hdlc;
+static LLCParser llc;
+static DLMSParser dlms;
+static MeterConfig meterConfig;
+static AmsData meterState;
+
+static std::chrono::steady_clock::time_point started;
+static uint32_t frameDue;
+static uint32_t framesDecoded;
+static uint32_t frameErrors;
+static uint32_t maxFrameLateness;
+
+static std::string uploadData;
+static String uploadName;
+static String uploadFilename;
+static uint32_t uploadStarts, uploadWrites, uploadEnds;
+static size_t uploadTotal;
+
+static void syncClock() {
+    stubMillis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+// Same steps as PassiveMeterCommunicator for an unencrypted HDLC frame
+static bool decodeFrame() {
+    uint8_t buf[sizeof(KAIFA_FRAME)];
+    memcpy(buf, KAIFA_FRAME, sizeof(buf));
+    DataParserContext ctx = {};
+    ctx.length = sizeof(buf);
+
+    uint8_t* ptr = buf;
+    int8_t res = hdlc.parse(ptr, ctx);
+    if(res < 0) return false;
+    ptr += res;
+    res = llc.parse(ptr, ctx);
+    if(res < 0) return false;
+    ptr += res;
+    res = dlms.parse(ptr, ctx);
+    if(res < 0) return false;
+    ptr += res;
+
+    IEC6205675 data((const char*) ptr, AmsTypeKaifa, &meterConfig, ctx, meterState);
+    if(data.getListType() == 0) return false;
+    meterState.apply(data);
+    return true;
+}
+
+static void replayFrames() {
+    syncClock();
+    if(stubMillis < frameDue) return;
+    maxFrameLateness = std::max(maxFrameLateness, (uint32_t) (stubMillis - frameDue));
+    if(decodeFrame()) {
+        framesDecoded++;
+    } else {
+        frameErrors++;
+    }
+    frameDue += FRAME_INTERVAL;
+    if(frameDue <= stubMillis) frameDue = stubMillis + FRAME_INTERVAL;
+}
+
+static void firmwareLoop() {
+    replayFrames();
+    server.handleClient();
+    // Leaves the CPU to the client threads, the sandbox may only have one
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+// Runs the firmware loop on the test thread until the clients are done, Unity asserts only work here
+template<typename F>
+static void withClients(int count, F client) {
+    std::atomic<int> running(count);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < count; i++) {
+        threads.emplace_back([&running, &client, i]() {
+            client(i);
+            running--;
+        });
+    }
+    while(running > 0) firmwareLoop();
+    for(std::thread& t : threads) t.join();
+}
+
+// Lets the server notice closed clients so each test starts with every connection free
+static void settle() {
+    for(int i = 0; i < 2000 && server.getConnectionCount() > 0; i++) firmwareLoop();
+}
+
+struct TestResponse {
+    int status = 0;
+    std::string head;
+    std::string body;
+
+    bool hasHeader(const std::string& line) {
+        return head.find("\r\n" + line + "\r\n") != std::string::npos;
+    }
+};
+
+class TestClient {
+public:
+    size_t readSize = 16384;
+    int readDelay = 0; // ms between reads, for a slow reader
+
+    ~TestClient() {
+        if(fd >= 0) close(fd);
+    }
+
+    bool connect(int receiveBuffer = 0) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) return false;
+        if(receiveBuffer > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+        timeval timeout = { 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(serverPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return ::connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+    }
+
+    bool send(const std::string& data) {
+        return ::send(fd, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t) data.size();
+    }
+
+    // One response, a chunked body is decoded
+    bool receive(TestResponse& res) {
+        size_t end;
+        while((end = buffer.find("\r\n\r\n")) == std::string::npos) if(!fill()) return false;
+        res.head = buffer.substr(0, end + 2);
+        buffer.erase(0, end + 4);
+        res.status = atoi(res.head.c_str() + 9);
+        res.body.clear();
+
+        if(res.hasHeader("Transfer-Encoding: chunked")) {
+            while(true) {
+                while((end = buffer.find("\r\n")) == std::string::npos) if(!fill()) return false;
+                size_t size = strtoul(buffer.c_str(), NULL, 16);
+                buffer.erase(0, end + 2);
+                while(buffer.size() < size + 2) if(!fill()) return false;
+                res.body.append(buffer, 0, size);
+                buffer.erase(0, size + 2);
+                if(size == 0) return true;
+            }
+        }
+
+        size_t pos = res.head.find("Content-Length: ");
+        size_t length = pos == std::string::npos ? 0 : strtoul(res.head.c_str() + pos + 16, NULL, 10);
+        while(buffer.size() < length) if(!fill()) return false;
+        res.body = buffer.substr(0, length);
+        buffer.erase(0, length);
+        return true;
+    }
+
+    bool request(const std::string& raw, TestResponse& res) {
+        return send(raw) && receive(res);
+    }
+
+private:
+    int fd = -1;
+    std::string buffer;
+
+    bool fill() {
+        if(readDelay > 0) std::this_thread::sleep_for(std::chrono::milliseconds(readDelay));
+        char buf[16384];
+        ssize_t n = recv(fd, buf, std::min(readSize, sizeof(buf)), 0);
+        if(n <= 0) return false;
+        buffer.append(buf, n);
+        return true;
+    }
+};
+
+static std::string get(const std::string& uri) {
+    return "GET " + uri + " HTTP/1.1\r\nHost: ams\r\n\r\n";
+}
+
+static void handleArgs() {
+    server.sendHeader(F("Cache-Control"), F("no-cache"));
+    server.send(200, "text/plain", server.arg(F("a")) + "," + server.arg(F("b")));
+}
+
+static void handleSave() {
+    String res = server.arg(F("gh"));
+    res += "|";
+    res += server.arg(F("p"));
+    res += "|";
+    res += server.arg(F("empty"));
+    res += "|";
+    res += server.hasArg(F("flag")) ? "1" : "0";
+    res += server.hasArg(F("missing")) ? "1" : "0";
+    server.send(200, "text/plain", res);
+}
+
+static void handleUpload() {
+    HTTPUpload& upload = server.upload();
+    if(upload.status == UPLOAD_FILE_START) {
+        uploadStarts++;
+        uploadName = upload.name;
+        uploadFilename = upload.filename;
+        uploadData.clear();
+    } else if(upload.status == UPLOAD_FILE_WRITE) {
+        uploadWrites++;
+        uploadData.append((const char*) upload.buf, upload.currentSize);
+    } else if(upload.status == UPLOAD_FILE_END) {
+        uploadEnds++;
+        uploadTotal = upload.totalSize;
+    }
+}
+
+static void handleUploadDone() {
+    server.send(200, "text/plain", server.arg(F("note")));
+}
+
+static void handleData() {
+    JsonWriter json(&server, jsonBuffer, sizeof(jsonBuffer));
+    json.begin(200, PSTR("application/json"));
+    json.beginObject();
+    json.key_P(PSTR("t"));
+    json.value((uint32_t) meterState.getListType());
+    json.key_P(PSTR("p"));
+    json.value(meterState.getActiveImportPower());
+    json.key_P(PSTR("f"));
+    json.value(framesDecoded);
+    json.endObject();
+    json.end();
+}
+
+// Much more than HTTP_SERVER_OUTPUT, the handler has to wait for the client
+static void handleBig() {
+    JsonWriter json(&server, jsonBuffer, sizeof(jsonBuffer));
+    json.begin(200, PSTR("application/json"));
+    json.beginArray();
+    for(uint32_t i = 0; i < BIG_VALUES; i++) {
+        json.value(i);
+    }
+    json.endArray();
+    json.end();
+}
+
+// Referenced, not copied, so the handler returns at once however slowly it is read
+static void handleStatic() {
+    server.send_P(200, PSTR("application/octet-stream"), staticBody, sizeof(staticBody));
+}
+
+static void handleAuth() {
+    server.send(200, "text/plain", server.header(F("Authorization")));
+}
+
+static void handleNotFound() {
+    server.send(404, "text/plain", "Not found: " + server.uri());
+}
+
+static void startServer() {
+    for(size_t i = 0; i < sizeof(staticBody); i++) {
+        staticBody[i] = 'a' + (i % 26);
+    }
+    server.on(F("/args"), HTTP_GET, handleArgs);
+    server.on(F("/save"), HTTP_POST, handleSave);
+    server.on(F("/upload"), HTTP_POST, handleUploadDone, handleUpload);
+    server.on(F("/data.json"), HTTP_GET, handleData);
+    server.on(F("/big.json"), HTTP_GET, handleBig);
+    server.on(F("/static"), HTTP_GET, handleStatic);
+    server.on(F("/auth"), HTTP_GET, handleAuth);
+    server.onNotFound(handleNotFound);
+    const char* headers[] = { "Authorization" };
+    server.collectHeaders(headers, 1);
+    server.setIdleCallback(replayFrames);
+    server.begin();
+    serverPort = wifiStubPort(80);
+}
+
+void setUp(void) {
+    settle();
+    frameErrors = 0;
+    maxFrameLateness = 0;
+    syncClock();
+    frameDue = stubMillis;
+}
+
+void tearDown(void) {}
+
+void test_query_args_and_keep_alive() {
+    TestResponse first, second;
+    bool ok = false;
+    withClients(1, [&](int) {
+        TestClient client;
+        ok = client.connect() && client.request(get("/args?a=1%202&b=x+y"), first) && client.request(get("/args?a=%C3%A6"), second);
+    });
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_INT(200, first.status);
+    TEST_ASSERT_EQUAL_STRING("1 2,x y", first.body.c_str());
+    TEST_ASSERT_TRUE(first.hasHeader("Connection: keep-alive"));
+    TEST_ASSERT_TRUE(first.hasHeader("Cache-Control: no-cache"));
+    // Same socket, so the connection was kept and reset for the next request
+    TEST_ASSERT_EQUAL_INT(200, second.status);
+    TEST_ASSERT_EQUAL_STRING("\xC3\xA6,", second.body.c_str());
+}
+
+void test_form_body_is_decoded() {
+    std::string body = "gh=ams%2Dreader&p=a%26b&empty=&flag";
+    TestResponse res;
+    bool ok = false;
+    withClients(1, [&](int) {
+        TestClient client;
+        ok = client.connect() && client.request("POST /save HTTP/1.1\r\nHost: ams\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body, res);
+    });
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_INT(200, res.status);
+    TEST_ASSERT_EQUAL_STRING("ams-reader|a&b||10", res.body.c_str());
+}
+
+void test_multipart_upload_is_streamed() {
+    std::string boundary = "----amsreader7MA4YWxk";
+    // Parts of the delimiter in the file content have to be passed on as data
+    std::string content;
+    for(int i = 0; content.size() < 6000; i++) {
+        content += std::to_string(i) + ";1036;0.5\r\n";
+        if(i % 40 == 0) content += "\r\n--" + boundary.substr(0, i % 17) + "\r\n";
+    }
+    std::string body = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"note\"\r\n\r\nhello\r\n"
+        "--" + boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"data.csv\"\r\nContent-Type: text/csv\r\n\r\n"
+        + content + "\r\n--" + boundary + "--\r\n";
+    uploadStarts = uploadWrites = uploadEnds = 0;
+    uploadTotal = 0;
+
+    TestResponse res;
+    bool ok = false;
+    withClients(1, [&](int) {
+        TestClient client;
+        ok = client.connect() && client.send("POST /upload HTTP/1.1\r\nHost: ams\r\nContent-Type: multipart/form-data; boundary=" + boundary + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n");
+        // Odd sized pieces so delimiters and part headers are split between reads
+        for(size_t pos = 0; ok && pos < body.size(); pos += 333) {
+            ok = client.send(body.substr(pos, 333));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ok = ok && client.receive(res);
+    });
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_INT(200, res.status);
+    TEST_ASSERT_EQUAL_STRING("hello", res.body.c_str());
+    TEST_ASSERT_EQUAL_UINT32(1, uploadStarts);
+    TEST_ASSERT_EQUAL_UINT32(1, uploadEnds);
+    TEST_ASSERT_GREATER_THAN_UINT32(3, uploadWrites);
+    TEST_ASSERT_EQUAL_STRING("file", uploadName.c_str());
+    TEST_ASSERT_EQUAL_STRING("data.csv", uploadFilename.c_str());
+    TEST_ASSERT_EQUAL_UINT32(content.size(), uploadTotal);
+    TEST_ASSERT_EQUAL_UINT32(content.size(), uploadData.size());
+    TEST_ASSERT_TRUE(content == uploadData);
+}
+
+void test_json_is_chunked() {
+    TestResponse res;
+    bool ok = false;
+    withClients(1, [&](int) {
+        TestClient client;
+        ok = client.connect() && client.request(get("/data.json"), res);
+    });
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_INT(200, res.status);
+    TEST_ASSERT_TRUE(res.hasHeader("Transfer-Encoding: chunked"));
+    TEST_ASSERT_TRUE(res.hasHeader("Content-Type: application/json"));
+    TEST_ASSERT_EQUAL_INT(0, res.body.find("{\"t\":2,\"p\":1036,\"f\":"));
+    TEST_ASSERT_EQUAL_INT('}', res.body.back());
+}
+
+void test_not_found_and_collected_header() {
+    TestResponse missing, auth;
+    bool ok = false;
+    withClients(1, [&](int) {
+        TestClient client;
+        ok = client.connect() && client.request(get("/missing?x=1"), missing)
+            && client.request("GET /auth HTTP/1.1\r\nHost: ams\r\nauthorization: Basic YWRtaW4=\r\n\r\n", auth);
+    });
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_INT(404, missing.status);
+    TEST_ASSERT_EQUAL_STRING("Not found: /missing", missing.body.c_str());
+    TEST_ASSERT_EQUAL_INT(200, auth.status);
+    TEST_ASSERT_EQUAL_STRING("Basic YWRtaW4=", auth.body.c_str());
+}
+
+void test_slow_reader_does_not_block_other_clients() {
+    std::atomic<bool> othersDone(false);
+    TestResponse big;
+    bool bigOk = false;
+    int failures = 0;
+    double maxLatency = 0;
+    withClients(2, [&](int i) {
+        TestClient client;
+        if(i == 0) {
+            // Does not read until the other client is through, then reads in small steps
+            client.readSize = 4096;
+            client.readDelay = 1;
+            bigOk = client.connect(4096) && client.send(get("/static"));
+            while(!othersDone) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            bigOk = bigOk && client.receive(big);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if(!client.connect()) failures++;
+            for(int j = 0; j < 20; j++) {
+                TestResponse res;
+                auto start = std::chrono::steady_clock::now();
+                if(!client.request(get("/data.json"), res) || res.status != 200) failures++;
+                std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - start;
+                maxLatency = std::max(maxLatency, latency.count());
+            }
+            othersDone = true;
+        }
+    });
+    TEST_ASSERT_EQUAL_INT(0, failures);
+    TEST_ASSERT_LESS_THAN(250.0, maxLatency);
+    TEST_ASSERT_TRUE(bigOk);
+    TEST_ASSERT_EQUAL_INT(200, big.status);
+    TEST_ASSERT_EQUAL_UINT32(STATIC_SIZE, big.body.size());
+    TEST_ASSERT_TRUE(memcmp(staticBody, big.body.data(), STATIC_SIZE) == 0);
+    TEST_ASSERT_EQUAL_UINT32(0, frameErrors);
+    TEST_ASSERT_LESS_THAN(FRAME_LATENESS, maxFrameLateness);
+}
+
+void test_frames_are_decoded_while_a_handler_waits() {
+    TestResponse res;
+    bool ok = false;
+    uint32_t before = framesDecoded;
+    withClients(1, [&](int) {
+        TestClient client;
+        client.readSize = 1024;
+        client.readDelay = 1;
+        ok = client.connect(4096) && client.request(get("/big.json"), res);
+    });
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_INT(200, res.status);
+    TEST_ASSERT_EQUAL_INT(0, res.body.find("[0,1,2,"));
+    std::string last = "," + std::to_string(BIG_VALUES - 1) + "]";
+    TEST_ASSERT_EQUAL_INT(res.body.size() - last.size(), res.body.rfind(last));
+    TEST_ASSERT_GREATER_THAN_UINT32(before, framesDecoded);
+    TEST_ASSERT_EQUAL_UINT32(0, frameErrors);
+    TEST_ASSERT_LESS_THAN(FRAME_LATENESS, maxFrameLateness);
+}
+
+void test_latency_while_frames_are_replayed() {
+    const int clients = 4;
+    const int requests = 50;
+    std::vector<double> latencies[clients];
+    std::atomic<int> failures(0);
+    uint32_t before = framesDecoded;
+    auto start = std::chrono::steady_clock::now();
+    withClients(clients + 1, [&](int i) {
+        TestClient client;
+        if(i == clients) {
+            // A slow download alongside
+            TestResponse res;
+            client.readSize = 4096;
+            client.readDelay = 1;
+            if(!client.connect(4096) || !client.request(get("/static"), res) || res.body.size() != STATIC_SIZE) failures++;
+            return;
+        }
+        if(!client.connect()) failures++;
+        for(int j = 0; j < requests; j++) {
+            TestResponse res;
+            std::string uri = j % 2 == 0 ? "/data.json" : "/args?a=" + std::to_string(j) + "&b=" + std::to_string(i);
+            auto sent = std::chrono::steady_clock::now();
+            if(!client.request(get(uri), res) || res.status != 200) failures++;
+            std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - sent;
+            latencies[i].push_back(latency.count());
+        }
+    });
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> all;
+    for(int i = 0; i < clients; i++) all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    std::sort(all.begin(), all.end());
+    TEST_ASSERT_EQUAL_UINT32(clients * requests, all.size());
+    double p50 = all[all.size() / 2];
+    double p95 = all[all.size() * 95 / 100];
+    double max = all.back();
+    uint32_t frames = framesDecoded - before;
+    printf("%u requests in %.0f ms, p50 %.2f ms, p95 %.2f ms, max %.2f ms, %u frames at most %u ms late\n",
+        (unsigned) all.size(), elapsed.count(), p50, p95, max, frames, maxFrameLateness);
+
+    TEST_ASSERT_EQUAL_INT(0, failures.load());
+    TEST_ASSERT_LESS_THAN(250.0, p95);
+    TEST_ASSERT_LESS_THAN(2000.0, max);
+    // Every interval of the run got its frame
+    TEST_ASSERT_GREATER_THAN_UINT32(elapsed.count() / FRAME_INTERVAL / 2, frames);
+    TEST_ASSERT_EQUAL_UINT32(0, frameErrors);
+    TEST_ASSERT_LESS_THAN(FRAME_LATENESS, maxFrameLateness);
+}
+
+int main() {
+    // A client that goes away while the server writes must not end the process
+    signal(SIGPIPE, SIG_IGN);
+    started = std::chrono::steady_clock::now();
+    startServer();
+    UNITY_BEGIN();
+    RUN_TEST(test_query_args_and_keep_alive);
+    RUN_TEST(test_form_body_is_decoded);
+    RUN_TEST(test_multipart_upload_is_streamed);
+    RUN_TEST(test_json_is_chunked);
+    RUN_TEST(test_not_found_and_collected_header);
+    RUN_TEST(test_slow_reader_does_not_block_other_clients);
+    RUN_TEST(test_frames_are_decoded_while_a_handler_waits);
+    RUN_TEST(test_latency_while_frames_are_replayed);
+    return UNITY_END();
+}